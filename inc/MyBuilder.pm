@@ -22,15 +22,19 @@ my %app_deps = (
                 'pre'       => ['pre.o'],
                 'grep'      => ['grep.o'],
                 'mergeidx'  => ['invindexjoin.o'],
-                'initmat'   => ['initmat.o', 'matrix.o'],
-                'ipfp'      => ['ipfp.o', 'matrix.o'],
-                'samplea'   => ['samplea.o', 'matrix.o'],
-                'sampleb'   => ['sampleb.o', 'matrix.o'],
-                'mat2dic'   => ['mat2dic.o', 'tempdict.o', 'matrix.o'],
+                'initmat'   => ['initmat.o', 'cooccur.o', 'matrix.o'],
+                'ipfp'      => ['ipfp.o', 'ipfpem.o', 'emstats.o', 'matrix.o'],
+                'samplea'   => ['samplea.o', 'sampler.o', 'emstats.o', 'matrix.o'],
+                'sampleb'   => ['sampleb.o', 'sampler.o', 'emstats.o', 'matrix.o'],
+                'mat2dic'   => ['mat2dic.o', 'matdict.o', 'tempdict.o', 'matrix.o'],
+                'matconv'   => ['matconv.o', 'matrix.o'],
+                'dicconv'   => ['dicconv.o'],
                 'words2id'  => ['words2id.o'],
                 'css'       => ['ssentence.o'],
                 'sentalign' => ['sent_align.o'],
-                'postbin'   => ['postbin.o', 'tempdict.o'],
+                'postbin'   => ['postbin.o', 'matdict.o', 'tempdict.o', 'matrix.o'],
+                'align'     => ['align.o', 'cooccur.o', 'ipfpem.o', 'emstats.o',
+                                'matdict.o', 'tempdict.o', 'matrix.o'],
                 'mkntd'     => ['mkdict.o'],
                 'ntd-add'   => ['adddic.o'],
                 'ntd-dump'  => ['ntdump.o'],
@@ -58,8 +62,16 @@ my %lib_deps = (
 my %o_deps = (
               %lib_deps,
               'samplea.o'      => ['samplea.c'],
+              'sampler.o'      => ['sampler.c', 'sampler.h'],
+              'emstats.o'      => ['emstats.c', 'emstats.h'],
+              'cooccur.o'      => ['cooccur.c', 'cooccur.h'],
+              'ipfpem.o'       => ['ipfpem.c', 'ipfpem.h'],
+              'matdict.o'      => ['matdict.c', 'matdict.h'],
+              'align.o'        => ['align.c'],
               'sampleb.o'      => ['sampleb.c'],
               'mat2dic.o'      => ['mat2dic.c'],
+              'matconv.o'      => ['matconv.c'],
+              'dicconv.o'      => ['dicconv.c'],
               'tempdict.o'     => ['tempdict.c', 'tempdict.h'],
               'invindexjoin.o' => ['invindexjoin.c'],
               'grep.o'         => ['grep.c'],
@@ -328,8 +340,9 @@ sub ACTION_create_test_binaries {
     my $self = shift;
 
     my %tests = (
-                 'words'  => ['words_t.c'],
-                 'corpus' => ['corpus_t.c'],
+                 'words'    => ['words_t.c'],
+                 'corpus'   => ['corpus_t.c'],
+                 'invindex' => ['invindex_t.c'],
                 );
 
     my $libbuilder = $self->notes('libbuilder');
@@ -464,14 +464,15 @@ sub split_corpus_simple {
 
 
 sub run_initmat {
-    my ($self, $chunk) = @_;
+    my ($self, $chunk, $mem_limit) = @_;
     my ($crp1, $crp2) = (catfile($self->{conf}->param("homedir"),
                                  sprintf("source.%03d.crp",$chunk)),
                          catfile($self->{conf}->param("homedir"),
                                  sprintf("target.%03d.crp",$chunk)));
     my $mat = catfile($self->{conf}->param("homedir"),
                       sprintf("matrix.%03d.init",$chunk));
-    time_command("nat-initmat $crp1 $crp2 $mat");
+    my $opts = $mem_limit ? " --mem-limit=$mem_limit" : "";
+    time_command("nat-initmat$opts $crp1 $crp2 $mat");
 }
 
 
@@ -507,8 +508,30 @@ sub run_post {
 }
 
 
+sub run_align {
+    my ($self, $chunk, $iter, $conf) = @_;
+    $conf ||= {};
+    my $home = $self->{conf}->param("homedir");
+
+    my ($crp1, $crp2) = (catfile($home, sprintf("source.%03d.crp",$chunk)),
+                         catfile($home, sprintf("target.%03d.crp",$chunk)));
+    my ($lex1, $lex2) = (catfile($home, "source.lex"),
+                         catfile($home, "target.lex"));
+    my ($bin1, $bin2) = (catfile($home, sprintf("source-target.%03d.bin", $chunk)),
+                         catfile($home, sprintf("target-source.%03d.bin", $chunk)));
+
+    my $opts = " -n $iter";
+    $opts .= " -t $conf->{em_threshold}" if $conf->{em_threshold};
+    $opts .= " -r $conf->{em_change}"    if $conf->{em_change};
+    $opts .= " -l " . catfile($home, sprintf("matrix.%03d.metrics",$chunk)) if $conf->{em_metrics};
+
+    time_command("nat-align$opts $crp1 $crp2 $crp1.partials $crp2.partials $lex1 $lex2 $bin1 $bin2");
+}
+
+
 sub run_generic_EM {
-    my ($self, $alg, $iter,$chunk) = @_;
+    my ($self, $alg, $iter, $chunk, $conf) = @_;
+    $conf ||= {};
 
     my ($crp1, $crp2) = (catfile($self->{conf}->param("homedir"),
                                  sprintf("source.%03d.crp",$chunk)),
@@ -518,7 +541,15 @@ sub run_generic_EM {
     my $matIn  = catfile($self->{conf}->param("homedir"), sprintf("matrix.%03d.init",$chunk));
     my $matOut = catfile($self->{conf}->param("homedir"), sprintf("matrix.%03d.EM",$chunk));
 
-    time_command("nat-$alg $iter $crp1 $crp2 $matIn $matOut");
+    my $opts = "";
+    $opts .= " -t $conf->{em_threshold}" if $conf->{em_threshold};
+    $opts .= " -r $conf->{em_change}"    if $conf->{em_change};
+    $opts .= " -l " . catfile($self->{conf}->param("homedir"),
+                              sprintf("matrix.%03d.metrics",$chunk)) if $conf->{em_metrics};
+    $opts .= " -c $conf->{em_checkpoint}" if $conf->{em_checkpoint};
+    $opts .= " --resume"                  if $conf->{em_resume};
+
+    time_command("nat-$alg$opts $iter $crp1 $crp2 $matIn $matOut");
 
     unlink $matIn;
 }
@@ -526,9 +557,19 @@ sub run_generic_EM {
 
 sub align_all {
     my ($self, $conf) = @_;
+    $conf ||= {};
     my $id = $self->{conf}->param('nr-chunks');
-    for (1..$id) {
-        $self->align_chunk($_, 0, $conf)
+    my $jobs = $conf->{jobs} || 1;
+
+    if ($jobs <= 1) {
+        for (1..$id) {
+            $self->align_chunk($_, 0, $conf)
+        }
+    }
+    else {
+        $LOG->(" Aligning $id chunks, $jobs at a time\n");
+        $self->_run_tasks($jobs, $conf->{mem_budget},
+                          map { $self->_chunk_tasks($_, $conf, $jobs) } 1..$id);
     }
 }
 
@@ -540,7 +581,21 @@ sub align_chunk {
 
     my $id = $self->{conf}->param('nr-chunks');
 
-    die "Chunk $chunk does not exist\n" if $chunk <= 0 && $chunk > $id;
+    die "Chunk $chunk does not exist\n" if $chunk <= 0 || $chunk > $id;
+
+    $_->{run}->() for $self->_chunk_tasks($chunk, $conf || {}, 1);
+}
+
+
+## Returns the alignment pipeline of a chunk, as a list of tasks for
+## _run_tasks: a single nat-align task or, when needed, initmat, EM,
+## mat2dic and postbin, each depending on the previous one. The mem
+## function estimates, in bytes, the memory needed by the task, once
+## its dependencies are done.
+sub _chunk_tasks {
+    my ($self, $chunk, $conf, $jobs) = @_;
+    my $home = $self->{conf}->param("homedir");
+    my $file = sub { catfile($home, sprintf(shift, $chunk)) };
 
     my $algorithm = "ipfp";
     my $iters = 5;
@@ -559,19 +614,113 @@ sub align_chunk {
         $iters = $conf->{sampleb} || 10;
     }
 
-    $self->run_initmat($chunk);
-
-    if ($algorithm ne "none") {
-        $self->run_generic_EM($algorithm, $iters, $chunk);
-    } else {
-        move(catfile($self->{conf}->param("homedir"), sprintf("matrix.%03d.init",$chunk)),
-             catfile($self->{conf}->param("homedir"), sprintf("matrix.%03d.EM",$chunk)));
+    ## With a memory budget, each initmat builds its matrix in external
+    ## memory, using its share of the budget
+    my $limit = 0;
+    $limit = int($conf->{mem_budget} / $jobs) || 1 if $conf->{mem_budget};
+
+    my $corpora = sub { (-s $file->("source.%03d.crp") || 0) +
+                        (-s $file->("target.%03d.crp") || 0) };
+    my $matrix  = sub { -s $file->(shift) || 0 };
+
+    ## IPFP runs in a single process, with no intermediate files,
+    ## unless initmat must run in external memory or EM checkpoints
+    ## were asked for
+    if (($algorithm eq "ipfp" || $algorithm eq "none") && !$limit &&
+        !$conf->{em_checkpoint} && !$conf->{em_resume}) {
+        return ({ name => "align $chunk",
+                  deps => [],
+                  mem  => sub { 8 * $corpora->() },
+                  run  => sub {
+                      $self->run_align($chunk, $algorithm eq "none" ? 0 : $iters, $conf)
+                  } });
     }
-    $self->run_mat2dic($chunk);
-    $self->run_post($chunk);
+
+    return ({ name => "initmat $chunk",
+              deps => [],
+              mem  => sub { $limit ? $limit * 1024 * 1024 : 8 * $corpora->() },
+              run  => sub { $self->run_initmat($chunk, $limit) } },
+            { name => "EM $chunk",
+              deps => ["initmat $chunk"],
+              mem  => sub { 2 * $matrix->("matrix.%03d.init") + $corpora->() },
+              run  => sub {
+                  if ($algorithm ne "none") {
+                      $self->run_generic_EM($algorithm, $iters, $chunk, $conf);
+                  } else {
+                      move($file->("matrix.%03d.init"), $file->("matrix.%03d.EM"));
+                  }
+              } },
+            { name => "mat2dic $chunk",
+              deps => ["EM $chunk"],
+              mem  => sub { 2 * $matrix->("matrix.%03d.EM") },
+              run  => sub { $self->run_mat2dic($chunk) } },
+            { name => "postbin $chunk",
+              deps => ["mat2dic $chunk"],
+              mem  => sub { $corpora->() },
+              run  => sub { $self->run_post($chunk) } });
 }
 
 
+## Runs a list of tasks (see _chunk_tasks), at most $jobs at a time,
+## each in its own process. A task starts when its dependencies are
+## done and its estimated memory fits the budget (in MB) together with
+## the running ones. Tasks are started in list order.
+sub _run_tasks {
+    my ($self, $jobs, $budget, @pending) = @_;
+
+    if ($jobs <= 1) {
+        $_->{run}->() for @pending;
+        return;
+    }
+
+    $budget = $budget ? $budget * 1024 * 1024 : 0;
+
+    my (%done, %running, $failed);
+    while (@pending || %running) {
+        my $used = 0;
+        $used += $_->{size} for values %running;
+
+        my @waiting;
+        for my $task (@pending) {
+            if ($failed || keys %running >= $jobs ||
+                grep { !$done{$_} } @{$task->{deps}}) {
+                push @waiting, $task;
+                next;
+            }
+
+            my $size = $task->{mem} ? $task->{mem}->() : 0;
+            if ($budget && %running && $used + $size > $budget) {
+                push @waiting, $task;
+                next;
+            }
+
+            my $pid = fork;
+            die "ERROR: can't fork: $!\n" unless defined $pid;
+            if (!$pid) {
+                my $ok = eval { $task->{run}->(); 1 };
+                print STDERR $@ unless $ok;
+                POSIX::_exit($ok ? 0 : 1);
+            }
+            $task->{size} = $size;
+            $running{$pid} = $task;
+            $used += $size;
+        }
+        @pending = @waiting;
+        last unless %running;
+
+        my $pid = waitpid(-1, 0);
+        my $task = delete $running{$pid} or next;
+        if ($?) {
+            $failed ||= $task->{name};
+        } else {
+            $done{$task->{name}} = 1;
+        }
+    }
+
+    die "ERROR: $failed failed\n" if $failed;
+    die "ERROR: tasks with unknown dependencies\n" if @pending;
+}
+
 
 sub run_dict_add {
     my ($self, $chunk) = @_;
@@ -599,13 +748,64 @@ sub run_dict_add {
 
 
 sub make_dict {
-    my ($self, $V) = @_;
+    my ($self, $V, $conf) = @_;
+    $conf ||= {};
+    my $home = $self->{conf}->param("homedir");
+    my @files = ("source-target%s.bin", "target-source%s.bin");
 
     $LOG->("Creating dictionary");
-    for (1..$self->{conf}->param("nr-chunks")) {
-        my $bin = catfile($self->{conf}->param("homedir"), sprintf("source-target.%03d.bin", $_));
-        $LOG->(".");
-        run_dict_add($self, $_, $V) if -f $bin;
+
+    ## Chunk dictionaries are merged pairwise, in rounds, into temporary
+    ## dictionaries, until only one is left.
+    my @nodes;
+    for my $chunk (1..$self->{conf}->param("nr-chunks")) {
+        my @bins = map { catfile($home, sprintf($_, sprintf(".%03d", $chunk))) } @files;
+        push @nodes, { files => \@bins } if -f $bins[0];
+    }
+    return $LOG->("\n") unless @nodes;
+
+    my (@tasks, $round);
+    while (@nodes > 1) {
+        $round++;
+        my @merged;
+        while (my ($left, $right) = splice @nodes, 0, 2) {
+            if (!$right) {
+                push @merged, $left;
+                last;
+            }
+            my $id = "$round-" . @merged;
+            my $node = { name  => "merge $id",
+                         temp  => 1,
+                         files => [ map { catfile($home, sprintf($_, ".r$id")) } @files ] };
+            push @tasks, { name => $node->{name},
+                           deps => [ grep { $_ } $left->{name}, $right->{name} ],
+                           run  => sub {
+                               $LOG->(".");
+                               for my $i (0, 1) {
+                                   my ($dic, $bin) = ($node->{files}[$i], $right->{files}[$i]);
+                                   if ($left->{temp}) {
+                                       move $left->{files}[$i] => $dic;
+                                   } else {
+                                       copy $left->{files}[$i] => $dic;
+                                   }
+                                   time_command("nat-dict add $dic $bin");
+                                   unlink $bin if $right->{temp};
+                               }
+                           } };
+            push @merged, $node;
+        }
+        @nodes = @merged;
+    }
+
+    my @dics = map { catfile($home, sprintf($_, "")) } @files;
+    ($self->{DIC1}, $self->{DIC2}) = @dics;
+
+    ## The last merge writes the corpora dictionaries directly
+    if (@tasks) {
+        $nodes[0]{files} = \@dics;
+        $self->_run_tasks($conf->{jobs} || 1, undef, @tasks);
+    } else {
+        copy $nodes[0]{files}[$_] => $dics[$_] for (0, 1);
     }
     $LOG->("\n");
 }
@@ -626,6 +826,7 @@ sub pre_chunk {
 
     my $ignore = "";
     $ignore = "-i" if $ops->{ignore_case};
+    $ignore .= " -p" if $ops->{positional};
 
     time_command("nat-pre $ignore $cp1 $cp2 $lex1 $lex2 $crp1 $crp2");
 }
@@ -1201,6 +1402,9 @@ to C<Stdout>.
 The method B<dies> if the files does not exist or if the number of
 sentences on both files differ.
 
+With the C<positional> option the invertion indexes keep the position
+of each word, and exact phrase concordances are answered from them.
+
 Example of invocation:
 
   $pcorpus->codify({ignore_case => 1},
@@ -1280,6 +1484,23 @@ returns the time used to run the command.
 
   $pcorpus->run_initmat(3);
 
+An optional second argument is a memory limit, in MB, for building
+the matrix in external memory.
+
+  $pcorpus->run_initmat(3, 500);
+
+
+=head2 C<run_align>
+
+This method invoques the C program C<nat-align> for a specific chunk,
+that creates its dictionaries in a single process, without the
+intermediate matrix files. You must supply the chunk number and the
+number of IPFP iterations (zero for none). An optional hash reference
+takes the convergence options described for C<run_generic_EM>. It
+returns the time used to run the command.
+
+  $pcorpus->run_align(3, 5);
+
 
 =head2 C<run_mat2dic>
 
@@ -1308,9 +1529,21 @@ You should call the method with the name of the algorithm ("sampleA",
 "sampleB" or "ipfp"), the number of iterations to be done, and the
 chunk to be processed.
 
+An optional hash reference can be supplied with convergence
+options. With C<em_threshold> (mean cell difference) or C<em_change>
+(relative matrix change) the algorithm stops as soon as the change
+between two steps falls below the given value, making the number of
+iterations a maximum. With C<em_metrics> set, per-step metrics are
+written to the C<matrix.NNN.metrics> file of the chunk. With
+C<em_checkpoint> a checkpoint is saved every that number of
+iterations, and with C<em_resume> an interrupted run continues from
+its last checkpoint (saving a checkpoint at every iteration, unless
+C<em_checkpoint> is given).
+
 Returns the time used to run the command.
 
   $pcorpus->run_generic_EM("ipfp", 5, 3);
+  $pcorpus->run_generic_EM("ipfp", 10, 3, { em_change => 0.01 });
 
 =head2 C<align_all>
 
@@ -1319,6 +1552,23 @@ will not re-encode them, just re-align.
 
   $pcorpus->align_all;
 
+An optional hash reference chooses the EM algorithm (C<ipfp>,
+C<samplea> or C<sampleb>, with the number of iterations as value, or
+C<noEM>) and the convergence options described for
+C<run_generic_EM>.
+
+  $pcorpus->align_all({ ipfp => 10, em_change => 0.01 });
+
+The C<jobs> option aligns that many chunks at the same time, each
+alignment step running in its own process. Steps of the same chunk
+still run in order. The C<mem_budget> option (in MB) limits the
+estimated memory used by the steps running at the same time: a step
+waits until it fits the budget, unless nothing else is running. With
+a budget, C<nat-initmat> builds each matrix in external memory, using
+its share of the budget.
+
+  $pcorpus->align_all({ ipfp => 5, jobs => 4, mem_budget => 2000 });
+
 
 =head2 C<align_chunk>
 
@@ -1330,13 +1580,19 @@ and a optional second argument stating if you want verose output.
 
   $pcorpus->align_chunk(3,0);
 
+Chunks aligned with IPFP, or without the EM-Algorithm, are aligned by
+C<nat-align> in a single process, and no matrix files are written.
+The other algorithms, the C<mem_budget> option and EM checkpoints use
+the separate tools.
+
 
 =head2 C<run_dict_add>
 
 This method appends a chunk to both languages dictionaries (not
 NATdicts). You must supply a chunk number (and it should exist).  The
-method should not be called directly. Or, if really needed, call it
-for all chunks, one at a time, starting with the first.
+method is no longer used by C<make_dict>, and should not be called
+directly. Or, if really needed, call it for all chunks, one at a time,
+starting with the first.
 
   for (1..10) {
     $pcorpus->run_dict_add($_)
@@ -1348,10 +1604,17 @@ for all chunks, one at a time, starting with the first.
 
 This method creates the corpora dictionaries (not NATDicts). The
 method is called directly in the object with an optional argument to
-force verbose output if needed. This method will call C<run_dict_add>
-for each chunk.
+force verbose output if needed.
+
+Chunk dictionaries are merged pairwise, in rounds, until only one is
+left, instead of being added one at a time to the first one. As
+dictionaries are merged weighting each one by its number of
+occurrences, the result may differ slightly from the chunk by chunk
+addition. An optional hash reference with a C<jobs> option runs that
+many merges at the same time.
 
   $pcorpus->make_dict;
+  $pcorpus->make_dict(0, { jobs => 4 });
 
 
 =head2 C<pre_chunk>
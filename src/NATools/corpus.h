@@ -21,6 +21,7 @@
 #ifndef __CORPUS_H__
 #define __CORPUS_H__
 
+#include <stdio.h>
 #include <glib.h>
 
 #include "standard.h"
@@ -65,6 +66,29 @@ typedef struct cCorpus {
     nat_uint32_t  index_addptr;
 } Corpus;
 
+/**
+ * @brief Sequential corpus file reader
+ *
+ * Reads a corpus file one sentence at a time, for tools that can not
+ * afford to load the whole corpus in memory.
+ */
+typedef struct cCorpusReader {
+    /** the corpus file */
+    FILE         *fd;
+    /** number of cells still in the file */
+    nat_uint32_t  remaining;
+    /** cells read from the file */
+    CorpusCell   *buffer;
+    /** number of cells in the buffer */
+    nat_uint32_t  buffer_len;
+    /** position of the next cell in the buffer */
+    nat_uint32_t  buffer_pos;
+    /** the current sentence, terminated by a zero word */
+    CorpusCell   *sentence;
+    /** number of cells allocated for the sentence */
+    nat_uint32_t  sentence_size;
+} CorpusReader;
+
 Corpus*       corpus_new(void);
 void          corpus_free(Corpus *corpus);
 int           corpus_add_word(Corpus *corpus, nat_uint32_t word, nat_int_t flags);
@@ -78,4 +102,8 @@ nat_uint32_t  corpus_sentences_nr(Corpus *corpus);
 nat_uint32_t  corpus_sentences_nr_from_index(char *filename);
 nat_boolean_t corpus_strstr(const CorpusCell *haystack, const nat_uint32_t *needle);
 
+CorpusReader* corpus_reader_open(const char *filename);
+CorpusCell*   corpus_reader_next_sentence(CorpusReader *reader);
+void          corpus_reader_close(CorpusReader *reader);
+
 #endif /* __CORPUS_H__ */
@@ -35,9 +35,10 @@
 
 
 /**
- * @brief Cell in the tree of collected words
+ * @brief Cell of a collected word
  *
- * WordLstNode is each cell in the tree os collected words (Words)
+ * WordLstNode is the information kept for each word in a word list
+ * (Words)
  */
 typedef struct cWordLstNode {
     /** word identifier */
@@ -48,36 +49,65 @@ typedef struct cWordLstNode {
 
     /** the word */
     wchar_t *string;
+} WordLstNode; 
 
-    /** binary tree left branch */
-    struct cWordLstNode *left;
+/** @brief size of the blocks of the word list arena, in bytes */
+#define WORDS_BLOCK 65536
 
-    /** binary right left branch */
-    struct cWordLstNode *right;
-} WordLstNode; 
+/**
+ * @brief Block of the arena holding the cells and strings of a word
+ * list.  Its contents follow the header.
+ */
+typedef struct cWordsBlock {
+    /** the block allocated before this one */
+    struct cWordsBlock *next;
+    /** bytes used */
+    size_t used;
+    /** bytes available */
+    size_t size;
+} WordsBlock;
 
 /**
- * @brief binary search tree for words collecting.
+ * @brief hash table of words, for words collecting.
  *
- * WordNode is a binary search tree base structure, used for words
- * collecting.
+ * Words are found by string in an open addressing hash table of
+ * identifiers, and by identifier in the idx array.  Cells, and the
+ * strings of the words added, are allocated from an arena of blocks
+ * that never move.  Words of a loaded lexicon stay in the loaded
+ * file contents.
  */
 typedef struct cWords {
-    /** number of words in the tree and last identifier used */
+    /** number of words in the list and last identifier used */
     nat_uint32_t count;
 
     /** total number of occurrences (all cells count summed up) */
     nat_uint32_t occurrences;
 
-    /** the binary search tree of words */
-    WordLstNode *tree;
-
     /** direct_access to words using id */
     WordLstNode **idx;
+
+    /** allocated size of the idx array */
+    nat_uint32_t idxsize;
+
+    /** open addressing table of identifiers (0 is an empty slot) */
+    nat_uint32_t *hash;
+
+    /** size of the hash table, a power of two */
+    nat_uint32_t hashsize;
+
+    /** arena blocks, the last allocated first */
+    WordsBlock *blocks;
+
+    /** loaded lexicons: the file contents, holding the words */
+    char *file;
+
+    /** loaded lexicons: size of the file contents */
+    size_t filesize;
 } Words, Words_t;
 
 Words_t*      words_new();
 nat_uint32_t  words_add_word(Words *list, wchar_t *string);
+nat_uint32_t  words_add_word_and_index(Words *list, wchar_t *string);
 Words*        words_add_full(Words *list, nat_uint32_t id, nat_uint32_t count,
                              const wchar_t *string);
 Words*        words_load(const char *filename);
@@ -91,6 +121,8 @@ nat_uint32_t  words_occurrences(Words *list);
 nat_boolean_t words_save(Words *list, char *filename);
 nat_uint32_t  words_get_id(Words *lst, const wchar_t *string);
 nat_uint32_t  words_get_count_by_id(Words *ptr, nat_uint32_t wid);
+nat_int_t     words_set_count_by_id(Words *list, nat_uint32_t wid, nat_uint32_t count);
+nat_uint32_t  words_tokens_number(Words *list);
 Words*        words_enlarge(Words* list, nat_uint32_t extracells);
 
 #endif /* __WORDS_H__ */
@@ -0,0 +1,251 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "standard.h"
+#include <NATools/corpus.h>
+#include <NATools/words.h>
+#include "matrix.h"
+#include "cooccur.h"
+#include "ipfpem.h"
+#include "emstats.h"
+#include "tempdict.h"
+#include "dictionary.h"
+#include "matdict.h"
+#include "partials.h"
+
+/**
+ * @file
+ * @brief Aligns a pair of corpora in a single process
+ *
+ * Runs the steps of nat-initmat, nat-ipfp, nat-mat2dic and
+ * nat-postbin, passing the matrix and the temporary dictionary in
+ * memory. Intermediate files are only written on request.
+ */
+
+void show_help () {
+    printf("Usage:\n"
+           "  nat-align [-q] [-f] [-j threads] [-n steps] [-t diff] [-r change] [-l file]\n"
+           "            [-k translations]\n"
+           "            [--save-init file] [--save-em file] [--save-dict file]\n"
+           "            crpFile1 crpFile2 partials1 partials2 lexFile1 lexFile2 out1 out2\n");
+    printf("Supported options:\n"
+           "  -h shows this help message and exits\n"
+           "  -V shows "PACKAGE" version and exits\n"
+           "  -q activates quiet mode\n"
+           "  -f freezes the matrix in a compact layout (no new cells)\n"
+           "  -j uses that number of threads for the E-step and for\n"
+           "     extracting the dictionaries (default 1)\n"
+           "  -n number of IPFP steps, 0 for none (default 5)\n"
+           "  -t stops when the mean cell difference falls below diff\n"
+           "  -r stops when the relative matrix change falls below change\n"
+           "  -l writes per-step metrics to file\n"
+           "  -k number of translations kept for each word (default %d)\n"
+           "  --save-init saves the initial matrix (as nat-initmat)\n"
+           "  --save-em saves the matrix after the EM-algorithm (as nat-ipfp)\n"
+           "  --save-dict saves the temporary dictionary (as nat-mat2dic)\n"
+           "Check nat-align manpage for details.\n", MAXENTRY);
+}
+
+
+/**
+ * @brief The main function 
+ */
+int main(int argc, char **argv)
+{
+    Corpus *Corpus1, *Corpus2;
+    Matrix *Matrices;
+    struct cMat2 Dictionary;
+    Words *Words1, *Words2;
+    PartialCounts *partials1, *partials2;
+
+    int Nsteps = 5, step;
+    nat_boolean_t converged;
+    int nthreads = 1;
+    nat_uint32_t k = MAXENTRY;
+    double threshold = 0.0, relative = 0.0;
+    char *metrics = NULL;
+    char *saveInit = NULL, *saveEM = NULL, *saveDict = NULL;
+    EMStats *stats;
+
+    static struct option long_options[] = {
+        { "save-init", required_argument, NULL, 'I' },
+        { "save-em",   required_argument, NULL, 'E' },
+        { "save-dict", required_argument, NULL, 'D' },
+        { NULL, 0, NULL, 0 }
+    };
+    extern char *optarg;
+    extern int optind;
+    int c;
+
+    nat_boolean_t quiet = FALSE;
+    nat_boolean_t frozen = FALSE;
+    const char *kernels;
+
+    while ((c = getopt_long(argc, argv, "hqVfj:n:t:r:l:k:", long_options, NULL)) != EOF) {
+        switch (c) {
+        case 'h':
+            show_help();
+            return 0;
+        case 'V':
+            printf(PACKAGE " version " VERSION "\n");
+            return 0;
+        case 'q':
+            quiet = TRUE;
+            break;
+        case 'f':
+            frozen = TRUE;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > IPFP_MAXTHREADS)
+                report_error("Number of threads out of range (1-%d)", IPFP_MAXTHREADS);
+            break;
+        case 'n':
+            Nsteps = atoi(optarg);
+            if (Nsteps < 0 || Nsteps > 25) report_error("Number of steps out of range");
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'k':
+            if (atoi(optarg) < 1) report_error("Number of translations must be positive");
+            k = atoi(optarg);
+            break;
+        case 'r':
+            relative = atof(optarg);
+            break;
+        case 'l':
+            metrics = optarg;
+            break;
+        case 'I':
+            saveInit = optarg;
+            break;
+        case 'E':
+            saveEM = optarg;
+            break;
+        case 'D':
+            saveDict = optarg;
+            break;
+        default:
+            show_help();
+            return 1;
+        }
+    }
+
+    if (argc != optind + 8) {
+	printf("nat-align: wrong number of arguments\n");
+        show_help();
+        return 1;
+    }
+
+    /* Load corpora */
+    Corpus1 = corpus_new();
+    Corpus2 = corpus_new();
+    if (!Corpus1 || !Corpus2) report_error("Can't alloc Corpus structures");
+    if (!quiet) printf("Loading Corpus files\n");
+    if (corpus_load(Corpus1, argv[optind + 0])) report_error("Can't read corpus 1");
+    if (corpus_load(Corpus2, argv[optind + 1])) report_error("Can't read corpus 2");
+    if (corpus_sentences_nr(Corpus1) != corpus_sentences_nr(Corpus2))
+        report_error("Corpora lengths do not match");
+
+    /* Initial estimate (nat-initmat) */
+    Matrices = InitialEstimate(quiet,
+                               corpus_diff_words_nr(Corpus1),
+                               corpus_diff_words_nr(Corpus2),
+                               Corpus1, Corpus2, NULL, NULL);
+    if (saveInit && SaveMatrix(Matrices, saveInit))
+        report_error("Can't save matrix %s", saveInit);
+    if (frozen && FreezeMatrix(Matrices))
+        report_error("Can't freeze matrix");
+
+    /* EM-algorithm (nat-ipfp) */
+    if (Nsteps) {
+        kernels = IPFPKernels();
+        if (!quiet) {
+            printf("EM-algorithm, model A, Iterative Proportional Fitting\n\n");
+            printf("IPFP kernels: %s\n", kernels);
+            printf("Initial matrix total:%9.2f\n", MatrixTotal(Matrices, MATRIX_1));
+            printf("Initial memory used:%10.1f kb\n\n", (double) BytesInUse(Matrices) / 1024.0f);
+        }
+
+        stats = emstats_new(metrics, threshold, relative, FALSE);
+        if (!stats) report_error("Can't create metrics file %s", metrics);
+
+        step = 1;
+        while (step <= Nsteps) {
+            IPFPStep(quiet, Matrices, Corpus1, Corpus2, step, (!NULLWORD && step == Nsteps), nthreads);
+            step++;
+            converged = emstats_step(stats, Matrices, step % 2 ? MATRIX_1 : MATRIX_2, step - 1);
+            if (!quiet) {
+                printf("Matrix mean difference: %f\n", stats->mean_diff);
+                printf("Memory used:%10.1f kb\n\n", (double) stats->bytes / 1024.0f);
+            }
+            if (converged) {
+                if (!quiet) printf("Converged after %d steps\n\n", step - 1);
+                break;
+            }
+        }
+        Nsteps = step - 1;
+        emstats_free(stats);
+
+        if (Matrices->dropped)
+            fprintf(stderr, "** WARNING ** %u increments outside the frozen matrix were dropped\n",
+                    Matrices->dropped);
+
+        if (Nsteps % 2) CopyMatrix(Matrices, MATRIX_1);
+    }
+    corpus_free(Corpus1);
+    corpus_free(Corpus2);
+
+    if (saveEM && SaveMatrix(Matrices, saveEM))
+        report_error("Can't save matrix %s", saveEM);
+
+    /* Temporary dictionary (nat-mat2dic) */
+    MatrixToTempDict(quiet, Matrices, &Dictionary);
+    FreeMatrix(Matrices);
+    if (saveDict && tempdict_savematrix2(&Dictionary, saveDict))
+        report_error("Can't save dictionary %s", saveDict);
+
+    /* Dictionaries (nat-postbin) */
+    partials1 = PartialCountsLoad(argv[optind + 2]);
+    if (!partials1) report_error("Can't load partials 1");
+    partials2 = PartialCountsLoad(argv[optind + 3]);
+    if (!partials2) report_error("Can't load partials 2");
+    if (!(Words1 = words_load(argv[optind + 4]))) report_error("Can't load lexicon 1");
+    if (!(Words2 = words_load(argv[optind + 5]))) report_error("Can't load lexicon 2");
+
+    if (!quiet) printf("Writing dictionaries %s,%s...\n", argv[optind + 6], argv[optind + 7]);
+    SaveDictionaries(argv[optind + 6], argv[optind + 7], &Dictionary,
+                     Words1, Words2, partials1, partials2, nthreads, k);
+
+    tempdict_freematrix2(&Dictionary);
+    PartialCountsFree(partials1);
+    PartialCountsFree(partials2);
+    words_free(Words1);
+    words_free(Words2);
+
+    return 0;
+}
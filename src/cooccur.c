@@ -0,0 +1,199 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cooccur.h"
+
+/**
+ * @file
+ * @brief Counts word co-occurrences to build the initial alignment
+ * matrix
+ */
+
+#ifdef SAVE_DOTS
+FILE *dots_fd;
+#endif
+
+/**
+ * @brief Loads a list of word identifiers to be excluded from the
+ * co-occurrences
+ *
+ * @param nr number of words of the corpus
+ * @param buffer array of nr + 1 flags, set for the words in the list
+ * @param file file with the word identifiers
+ *
+ * @return FALSE if the file can not be read or has invalid identifiers
+ */
+nat_boolean_t LoadExcludedWords(nat_uint32_t nr, char *buffer, char* file)
+{
+    FILE *fd;
+    nat_uint32_t id;
+    fd = fopen(file, "rb");
+    if (!fd) return FALSE;
+
+    do {
+	if (fread(&id, sizeof(nat_uint32_t), 1, fd)) {
+	    if (id >= nr) return FALSE;
+	    buffer[id] = 1;
+	}
+    } while(!feof(fd));
+
+    return TRUE;
+}
+
+
+/**
+ * @brief Computes the co-occurrences of a sentence pair
+ *
+ * Each co-occurrence is given to the add callback, with its weight
+ * (one over the sentence pair length). Pairs longer than MAXLEN
+ * words are ignored.
+ */
+void SentenceCooccurrences(CorpusCell *s1, CorpusCell *s2,
+			   char *excWrds1, char *excWrds2,
+			   AddCooccurrence add, void *data)
+{
+    unsigned long r, c, l;
+    int jjdoneR, jjdoneC;
+    CorpusCell *sen2 = s2;
+
+    l = max(corpus_sentence_length(s1),
+	    corpus_sentence_length(s2));
+    if (l > MAXLEN) return;
+
+    jjdoneR = 0;
+    for(r = 1; r <= l && !jjdoneR ; r++) {
+	if (!(excWrds1 && s1->word && excWrds1[s1->word])) {
+	    jjdoneC = 0;
+	    for(c = 1; c <= l && !jjdoneC ; c++) {
+		if (excWrds2 && s2->word && excWrds2[s2->word]) {
+		    ++s2;
+		} else {
+		    if (s1->word && s2->word) {
+			if (add(data, 1.0f / (float)l, s1->word, s2->word))
+			    report_error("InitialEstimate: MatrixBatchInc failed");
+#ifdef SAVE_DOTS
+			fprintf(dots_fd, "%d %d\n", s1->word, s2->word);
+#endif
+			++s2;
+		    }
+		    else {
+			if (s1->word == 0) {
+			    if (add(data, 1.0f / (float)l, NULLWORD, s2->word))
+				report_error("InitialEstimate: MatrixBatchInc failed");
+#ifdef SAVE_DOTS
+			    fprintf(dots_fd, "0 %d\n", s2->word);
+#endif
+			    ++s2;
+			    jjdoneR=1;
+			}
+			else {
+			    if (add(data, 1.0f / (float)l, s1->word, NULLWORD))
+				report_error("InitialEstimate: MatrixBatchInc failed");
+#ifdef SAVE_DOTS
+			    fprintf(dots_fd, "%d 0\n", s1->word);
+#endif
+			    jjdoneC=1;
+			}
+		    }
+		}
+	    }
+	}
+	if (s1->word) s1++;
+	s2 = sen2;
+    }
+}
+
+static int BatchCooccurrence(void *data, float f, nat_uint32_t r, nat_uint32_t c)
+{
+    return MatrixBatchInc((MatrixBatch*)data, f, r, c);
+}
+
+/**
+ * @brief Builds the co-occurrence matrix of two corpora in memory
+ *
+ * Co-occurrences are counted in the first copy of the matrix.
+ * Exclusion lists are optional (NULL).
+ */
+Matrix* InitialEstimate(nat_boolean_t quiet,
+                        nat_uint32_t Nrow, nat_uint32_t Ncolumn, 
+			Corpus *corpus1, Corpus *corpus2,
+			char *excWrds1,	char *excWrds2)
+{ 
+    Matrix *matrix;
+    MatrixBatch *batch;
+    unsigned long cSentence, nSentences;
+    CorpusCell *s1, *s2;
+
+    if (!quiet)
+        fprintf(stderr, "\nAllocating the sparse matrix (%d x %d):      ",
+                Nrow, Ncolumn);
+
+    /* Alloc matrix */
+    matrix = AllocMatrix(Nrow, Ncolumn);
+    if (!matrix) report_error("InitialEstimate: AllocMatrix failed");
+
+    /* co-occurrences are buffered and merged into the matrix rows */
+    batch = MatrixBatchNew(matrix, MATRIX_1, MATRIX_BATCH);
+    if (!batch) report_error("InitialEstimate: MatrixBatchNew failed");
+
+    /* prepare variables for percent counting */
+    nSentences = corpus_sentences_nr(corpus1);
+    cSentence = 0;
+
+    s1 = corpus_first_sentence(corpus1);
+    s2 = corpus_first_sentence(corpus2);
+
+#ifdef SAVE_DOTS
+    dots_fd = fopen("__dots__", "w");
+    if (!dots_fd) report_error("cannot open __dots__ file");
+#endif
+
+    while (s1 != NULL && s2 != NULL) {
+	/* print percentage information */
+        if (!quiet)
+            fprintf(stderr, "\b\b\b\b\b%4.1f%%",
+                    (float) (cSentence++) * 99.9f / (float) nSentences);
+
+	SentenceCooccurrences(s1, s2, excWrds1, excWrds2, BatchCooccurrence, batch);
+
+	s1 = corpus_next_sentence(corpus1);
+	s2 = corpus_next_sentence(corpus2);
+    }
+    
+#ifdef SAVE_DOTS
+    fclose(dots_fd);
+#endif
+
+    if (s1 != NULL || s2 != NULL)
+	report_error("InitialEstimate: failed to evaluate all sentences");
+
+    if (MatrixBatchFlush(batch))
+	report_error("InitialEstimate: MatrixBatchFlush failed");
+    MatrixBatchFree(batch);
+
+    if (!quiet) fprintf(stderr, "\b\b\b\b\b\b done \n");
+
+    return matrix;
+}
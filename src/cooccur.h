@@ -0,0 +1,70 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __COOCCUR_H__
+#define __COOCCUR_H__
+
+/**
+ * @file
+ * @brief Header file for the co-occurrence counting used to build the
+ * initial alignment matrix
+ */
+
+#include <stdio.h>
+
+#include "standard.h"
+#include <NATools/corpus.h>
+#include "matrix.h"
+
+/* #define SAVE_DOTS 1 */
+
+#ifdef SAVE_DOTS
+extern FILE *dots_fd;
+#endif
+
+/**
+ * @brief Callback receiving each co-occurrence of a sentence pair
+ *
+ * @return 0 on success
+ */
+typedef int (*AddCooccurrence)(void *data, float f, nat_uint32_t r, nat_uint32_t c);
+
+nat_boolean_t LoadExcludedWords     (nat_uint32_t     nr,
+                                     char            *buffer,
+                                     char            *file);
+
+void          SentenceCooccurrences (CorpusCell      *s1,
+                                     CorpusCell      *s2,
+                                     char            *excWrds1,
+                                     char            *excWrds2,
+                                     AddCooccurrence  add,
+                                     void            *data);
+
+Matrix*       InitialEstimate       (nat_boolean_t    quiet,
+                                     nat_uint32_t     Nrow,
+                                     nat_uint32_t     Ncolumn,
+                                     Corpus          *corpus1,
+                                     Corpus          *corpus2,
+                                     char            *excWrds1,
+                                     char            *excWrds2);
+
+#endif /* __COOCCUR_H__ */
@@ -337,7 +337,8 @@ static nat_uint32_t uint32_sentence_length(const nat_uint32_t *needle) {
 /**
  * @brief searches for a sequence of words on a sentence/unit
  *
- * @todo explain the work of the placeholder.
+ * A word identifier of 1 on the needle is a placeholder, matching any
+ * word of the sentence.
  *
  * @param haystack A sentence (CorpusCell array) where to search for
  *                 a sequence of words
@@ -351,12 +352,105 @@ nat_boolean_t corpus_strstr(const CorpusCell *haystack, const nat_uint32_t *need
     nat_uint32_t needle_size = uint32_sentence_length(needle);
     nat_uint32_t haystack_size = corpus_sentence_length(haystack);
 
-    if (haystack_size > needle_size) {
-	for (i = 0; i < haystack_size - needle_size; i++) {
-	    for (j = 0; haystack[i+j].word == needle[j] || needle[j] == 1; j++);
+    if (haystack_size >= needle_size) {
+	for (i = 0; i <= haystack_size - needle_size; i++) {
+	    for (j = 0; j < needle_size && (haystack[i+j].word == needle[j] || needle[j] == 1); j++);
 	    if (j == needle_size) return TRUE;
 	}
     }
 
     return found;
 }
+
+/** @brief number of cells read at a time by a corpus reader */
+#define READER_BLOCK 65536
+
+/**
+ * @brief opens a corpus file for sequential reading
+ *
+ * @param filename a reference to the filename string
+ * @return the newly allocated reader, or NULL in error
+ */
+CorpusReader *corpus_reader_open(const char *filename)
+{
+    CorpusReader *reader;
+    FILE *fd;
+    nat_uint32_t len;
+
+    fd = fopen(filename, "rb");
+    if (fd == NULL)
+        return NULL;
+    if (fread(&len, sizeof(nat_uint32_t), 1, fd) != 1) {
+        fclose(fd);
+        return NULL;
+    }
+
+    reader = g_new(CorpusReader, 1);
+    reader->fd = fd;
+    reader->remaining = len;
+    reader->buffer = g_new(CorpusCell, READER_BLOCK);
+    reader->buffer_len = 0;
+    reader->buffer_pos = 0;
+    reader->sentence_size = MEMBLOCK;
+    reader->sentence = g_new(CorpusCell, reader->sentence_size);
+    return reader;
+}
+
+/**
+ * @brief reads the next sentence of a corpus file
+ *
+ * Sentences are returned in the same order, and with the same
+ * contents, as corpus_first_sentence and corpus_next_sentence would
+ * return them after loading the whole corpus.
+ *
+ * @param reader the corpus reader
+ * @return a pointer to the first word of the sentence (valid until
+ * the next call), or NULL at the end of the corpus
+ */
+CorpusCell *corpus_reader_next_sentence(CorpusReader *reader)
+{
+    nat_uint32_t n = 0;
+    CorpusCell cell;
+
+    while (1) {
+        if (reader->buffer_pos == reader->buffer_len) {
+            if (!reader->remaining) {
+                if (!n) return NULL;
+                /* unterminated last sentence */
+                reader->sentence[n].word = 0;
+                reader->sentence[n].flags = 0;
+                return reader->sentence;
+            }
+            reader->buffer_len = min(reader->remaining, READER_BLOCK);
+            reader->buffer_len = fread(reader->buffer, sizeof(CorpusCell),
+                                       reader->buffer_len, reader->fd);
+            if (!reader->buffer_len) {
+                reader->remaining = 0;
+                continue;
+            }
+            reader->remaining -= reader->buffer_len;
+            reader->buffer_pos = 0;
+        }
+
+        cell = reader->buffer[reader->buffer_pos++];
+        if (n + 1 >= reader->sentence_size) {
+            reader->sentence_size += MEMBLOCK;
+            reader->sentence = g_renew(CorpusCell, reader->sentence, reader->sentence_size);
+        }
+        reader->sentence[n++] = cell;
+        if (!cell.word) return reader->sentence;
+    }
+}
+
+/**
+ * @brief closes a corpus reader
+ *
+ * @param reader the corpus reader to be freed
+ */
+void corpus_reader_close(CorpusReader *reader)
+{
+    fclose(reader->fd);
+    g_free(reader->buffer);
+    g_free(reader->sentence);
+    g_free(reader);
+}
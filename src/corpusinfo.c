@@ -146,6 +146,8 @@ CorpusInfo *corpus_info_new(char *filepath) {
     self->SourceGrams = NULL;
     self->TargetGrams = NULL;
 
+    pthread_mutex_init(&self->lock, NULL);
+
     return self;
 }
 
@@ -179,6 +181,8 @@ void corpus_info_free(CorpusInfo *corpus) {
     if (corpus->TargetGrams)
         ngram_index_close(corpus->TargetGrams);
 
+    pthread_mutex_destroy(&corpus->lock);
+
     for (i = 1; i <= corpus->nrChunks; ++i) {
         fclose(corpus->chunks[i-1].source_crp);
         fclose(corpus->chunks[i-1].target_crp);
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <pthread.h>
 
 #include <NATools.h>
 #include "parseini.h"
@@ -70,6 +71,9 @@ typedef struct _CorpusInfo_ {
     char *rank_cache_filename1, *rank_cache_filename2;
     int last_rank_cache, has_rank;
 
+    /* Guards the rank caches and the n-gram indexes, loaded on
+       demand, when the corpus is shared by server threads */
+    pthread_mutex_t lock;
 
 } CorpusInfo;
 
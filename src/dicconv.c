@@ -0,0 +1,85 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "standard.h"
+#include "dictionary.h"
+#include "natdict.h"
+
+/**
+ * @file
+ * @brief Converts dictionaries between the compressed and the
+ * mappable file formats
+ */
+
+/**
+ * @brief Main function
+ *
+ * Receives two file names: the input dictionary file, with one
+ * direction (as written by nat-postbin) or a NATDict, and the output
+ * file. The output is written in the mappable format, or in the
+ * compressed one with the -c option.
+ */
+int main(int argc, char **argv)
+{
+    Dictionary *dic;
+    NATDict *natdict;
+    nat_boolean_t compressed = FALSE;
+    int ok;
+
+    extern int optind;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c")) != EOF) {
+        switch (opt) {
+        case 'c':
+            compressed = TRUE;
+            break;
+        default:
+            report_error("Usage: dicconv [-c] dicfile_in dicfile_out");
+        }
+    }
+
+    if (argc != optind + 2)
+	report_error("Usage: dicconv [-c] dicfile_in dicfile_out");
+
+    if ((natdict = natdict_open(argv[optind + 0]))) {
+	if (compressed)
+	    ok = natdict_save(natdict, argv[optind + 1]);
+	else
+	    ok = natdict_save_mapped(natdict, argv[optind + 1]);
+	natdict_free(natdict);
+    } else {
+	if (!(dic = dictionary_open(argv[optind + 0]))) report_error("Can't load dictionary");
+	if (compressed)
+	    ok = dictionary_save(dic, argv[optind + 1]);
+	else
+	    ok = dictionary_save_mapped(dic, argv[optind + 1]);
+	dictionary_free(dic);
+    }
+
+    if (!ok) report_error("Can't save dictionary");
+    return 0;
+}
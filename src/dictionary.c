@@ -25,6 +25,10 @@
 #include <zlib.h>
 #include <string.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "dictionary.h"
 
 
@@ -43,9 +47,175 @@ static int cmp(const void* pair1, const void* pair2)
     return (((DicPair*)pair1)->val > ((DicPair*)pair2)->val) ? -1 : 1;
 }
 
+/**
+ * @brief number of translations of each word in dictionary files
+ * without variable length lists
+ */
+#define OLD_ENTRIES 8
+
+/**
+ * @brief Header of a dictionary in the mappable format
+ *
+ * The header is followed by the offsets (size + 2 nat_uint32_t), the
+ * translations (npairs DicPair) and the occurrence counts (size + 1
+ * nat_uint32_t), in native byte order. Each section starts at a
+ * DICTIONARY_MAPPED_ALIGN boundary, at the position recorded here,
+ * relative to the start of the header.
+ */
+typedef struct cDictionaryMappedHeader {
+    /** DICTIONARY_MAPPED_MAGIC */
+    nat_uint32_t magic;
+    /** DICTIONARY_MAPPED_VERSION */
+    nat_uint32_t version;
+    /** number of words */
+    nat_uint32_t size;
+    /** unused, keeps the 64 bit fields aligned */
+    nat_uint32_t reserved;
+    /** number of translations */
+    uint64_t     npairs;
+    /** position of the offsets array */
+    uint64_t     offsets;
+    /** position of the translations array */
+    uint64_t     pairs;
+    /** position of the occurrence counts array */
+    uint64_t     occurs;
+    /** size of the dictionary, with the padding after the last section */
+    uint64_t     length;
+} DictionaryMappedHeader;
+
+/**
+ * @brief Pointer to a translation of a word
+ *
+ * @return the translation, or NULL if the word has no translation
+ *   on that offset
+ */
+static DicPair *dictionary_pair(Dictionary *dic, nat_uint32_t wid, int offset)
+{
+    if (wid > dic->size || offset < 0) return NULL;
+    if (dic->offsets) {
+	if ((nat_uint32_t) offset >= dic->offsets[wid+1] - dic->offsets[wid]) return NULL;
+	return dic->pairs + dic->offsets[wid] + offset;
+    }
+    if ((nat_uint32_t) offset >= dic->entries) return NULL;
+    return &DIC_POS(dic, wid, offset);
+}
+
+/**
+ * @brief Allocates a dictionary without translations
+ */
+static Dictionary *dictionary_alloc(nat_uint32_t size)
+{
+    Dictionary *new;
+
+    new = (Dictionary*)malloc(sizeof(Dictionary));
+    if (!new) return new;
+
+    new->occurs = (nat_uint32_t*)malloc(sizeof(nat_uint32_t)*(size+1));
+    if (!new->occurs) {
+	free(new);
+	return NULL;
+    }
+    memset(new->occurs, 0, sizeof(nat_uint32_t)*(size+1));
+
+    new->pairs   = NULL;
+    new->offsets = NULL;
+    new->entries = 0;
+    new->size    = size;
+    new->map     = NULL;
+    new->mapsize = 0;
+
+    return new;
+}
+
+/**
+ * @brief Copies the arrays of a mapped dictionary to memory, so they
+ * can be changed or reallocated
+ */
+static void dictionary_unmap(Dictionary *dic)
+{
+    nat_uint32_t *occurs, *offsets;
+    DicPair *pairs;
+
+    if (!dic->map) return;
+
+    occurs  = g_new(nat_uint32_t, dic->size + 1);
+    offsets = g_new(nat_uint32_t, dic->size + 2);
+    pairs   = g_new(DicPair, dic->offsets[dic->size+1] + 1);
+    memcpy(occurs, dic->occurs, sizeof(nat_uint32_t) * (dic->size + 1));
+    memcpy(offsets, dic->offsets, sizeof(nat_uint32_t) * (dic->size + 2));
+    memcpy(pairs, dic->pairs, sizeof(DicPair) * dic->offsets[dic->size+1]);
+
+    if (dic->mapsize) munmap(dic->map, dic->mapsize);
+    dic->map     = NULL;
+    dic->mapsize = 0;
+    dic->occurs  = occurs;
+    dic->offsets = offsets;
+    dic->pairs   = pairs;
+}
+
+/**
+ * @brief Gives fixed slots to a dictionary, so translations can be
+ * changed
+ *
+ * @param dic the dictionary
+ * @param entries minimum number of slots per word
+ */
+static void dictionary_expand(Dictionary *dic, nat_uint32_t entries)
+{
+    DicPair *pairs;
+    nat_uint32_t w, n;
+
+    dictionary_unmap(dic);
+
+    if (entries < MAXENTRY) entries = MAXENTRY;
+    for (w = 0; w <= dic->size; w++)
+	if ((n = dictionary_get_entries(dic, w)) > entries) entries = n;
+
+    pairs = g_new0(DicPair, (size_t) entries * (dic->size + 1));
+    for (w = 0; w <= dic->size; w++)
+	if ((n = dictionary_get_entries(dic, w)) > 0)
+	    memcpy(pairs + (size_t) w * entries, dictionary_pair(dic, w, 0), sizeof(DicPair) * n);
+
+    g_free(dic->pairs);
+    g_free(dic->offsets);
+    dic->pairs   = pairs;
+    dic->offsets = NULL;
+    dic->entries = entries;
+}
+
+/**
+ * @brief Makes a dictionary compact, keeping only the used
+ * translation slots of each word
+ *
+ * Translations are moved in place, as no word moves forward.
+ *
+ * @param dic the dictionary
+ */
+void dictionary_compact(Dictionary *dic)
+{
+    nat_uint32_t w, n, *offsets;
+
+    if (dic->offsets) return;
+
+    offsets = g_new(nat_uint32_t, dic->size + 2);
+    offsets[0] = 0;
+    for (w = 0; w <= dic->size; w++) {
+	n = dictionary_get_entries(dic, w);
+	memmove(dic->pairs + offsets[w], &DIC_POS(dic, w, 0), sizeof(DicPair) * n);
+	offsets[w+1] = offsets[w] + n;
+    }
+
+    dic->pairs   = g_realloc(dic->pairs, sizeof(DicPair) * (offsets[dic->size+1] + 1));
+    dic->offsets = offsets;
+    dic->entries = 0;
+}
+
 /**
  * @brief Saves a dictionary using a filename
  *
+ * The file is written under a temporary name, and renamed when
+ * complete, as the dictionary may be mapped from the file replaced.
+ *
  * @param dic the Dictionary object to be saved
  * @param name name of the file to be created
  *
@@ -53,17 +223,31 @@ static int cmp(const void* pair1, const void* pair2)
  */
 int dictionary_save(Dictionary *dic, const char *name)
 {
+    char *tmpname;
     FILE *gzf;
+    int ok;
+
+    tmpname = g_strdup_printf("%s.tmp", name);
+    gzf = gzopen(tmpname, "wb");
+    if (!gzf) report_error("error opening file %s for writing.\n", tmpname);
 
-    gzf = gzopen(name, "wb");
-    if (!gzf) report_error("error opening file %s for writing.\n", name);
+    ok = dictionary_save_fh(gzf, dic);
+    if (gzclose(gzf) != Z_OK) ok = 0;
+    if (ok && rename(tmpname, name)) ok = 0;
+    if (!ok) unlink(tmpname);
 
-    return dictionary_save_fh(gzf, dic);
+    g_free(tmpname);
+    return ok;
 }
 
 /**
  * @brief Saves a dictionary using a gzfile handle
  *
+ * Dictionaries are saved with variable length translation lists:
+ * the magic number, the size, the offset of the first translation of
+ * each word (plus the number of translations), the translations and
+ * the occurrence counts.
+ *
  * @param gzf zlib file handle where to save the dictioknary
  * @param dic the Dictionary to be saved
  *
@@ -71,15 +255,225 @@ int dictionary_save(Dictionary *dic, const char *name)
  */
 int dictionary_save_fh(FILE* gzf, Dictionary *dic)
 {
+    nat_uint32_t magic = DICTIONARY_MAGIC, offset = 0, w, n;
+
+    if (gzwrite(gzf, &magic, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return 0;
     if (gzwrite(gzf, &dic->size, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return 0;
-    if (gzwrite(gzf, dic->pairs, sizeof(DicPair)*MAXENTRY*(dic->size+1)) != 
-	sizeof(DicPair)*MAXENTRY*(dic->size+1)) return 0;
+
+    for (w = 0; w <= dic->size; w++) {
+	if (gzwrite(gzf, &offset, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return 0;
+	offset += dictionary_get_entries(dic, w);
+    }
+    if (gzwrite(gzf, &offset, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return 0;
+
+    for (w = 0; w <= dic->size; w++)
+	if ((n = dictionary_get_entries(dic, w)) > 0 &&
+	    gzwrite(gzf, dictionary_pair(dic, w, 0), sizeof(DicPair)*n) != sizeof(DicPair)*n)
+	    return 0;
+
     if (gzwrite(gzf, dic->occurs, sizeof(nat_uint32_t)*(dic->size+1)) != 
 	sizeof(nat_uint32_t)*(dic->size+1)) return 0;
-    gzclose(gzf);
     return 1;
 }
 
+/**
+ * @brief Pads a file with zeros up to a DICTIONARY_MAPPED_ALIGN
+ * boundary
+ *
+ * @return 0 on error
+ */
+static int dictionary_align(FILE *fd)
+{
+    static const char zeros[DICTIONARY_MAPPED_ALIGN];
+    long pos = ftell(fd);
+
+    if (pos < 0) return 0;
+    pos %= DICTIONARY_MAPPED_ALIGN;
+    if (pos && fwrite(zeros, DICTIONARY_MAPPED_ALIGN - pos, 1, fd) != 1) return 0;
+    return 1;
+}
+
+/**
+ * @brief Saves a dictionary in the mappable format, at the current
+ * position of a file
+ *
+ * The position must be at a DICTIONARY_MAPPED_ALIGN boundary, and the
+ * file is left at the next one.
+ *
+ * @param fd the file, open for writing
+ * @param dic the Dictionary to be saved
+ *
+ * @return 0 on error
+ */
+int dictionary_save_mapped_fh(FILE *fd, Dictionary *dic)
+{
+    DictionaryMappedHeader header;
+    nat_uint32_t w, n, offset = 0;
+    long base = ftell(fd);
+
+    if (base < 0 || base % DICTIONARY_MAPPED_ALIGN) return 0;
+
+    memset(&header, 0, sizeof(DictionaryMappedHeader));
+    header.magic   = DICTIONARY_MAPPED_MAGIC;
+    header.version = DICTIONARY_MAPPED_VERSION;
+    header.size    = dic->size;
+    for (w = 0; w <= dic->size; w++)
+	header.npairs += dictionary_get_entries(dic, w);
+
+#define ALIGNED(x) (((x) + DICTIONARY_MAPPED_ALIGN - 1) / DICTIONARY_MAPPED_ALIGN * DICTIONARY_MAPPED_ALIGN)
+    header.offsets = ALIGNED(sizeof(DictionaryMappedHeader));
+    header.pairs   = ALIGNED(header.offsets + sizeof(nat_uint32_t) * (dic->size + 2));
+    header.occurs  = ALIGNED(header.pairs + sizeof(DicPair) * header.npairs);
+    header.length  = ALIGNED(header.occurs + sizeof(nat_uint32_t) * (dic->size + 1));
+#undef ALIGNED
+
+    if (fwrite(&header, sizeof(DictionaryMappedHeader), 1, fd) != 1) return 0;
+    if (!dictionary_align(fd)) return 0;
+
+    for (w = 0; w <= dic->size; w++) {
+	if (fwrite(&offset, sizeof(nat_uint32_t), 1, fd) != 1) return 0;
+	offset += dictionary_get_entries(dic, w);
+    }
+    if (fwrite(&offset, sizeof(nat_uint32_t), 1, fd) != 1) return 0;
+    if (!dictionary_align(fd)) return 0;
+
+    for (w = 0; w <= dic->size; w++)
+	if ((n = dictionary_get_entries(dic, w)) > 0 &&
+	    fwrite(dictionary_pair(dic, w, 0), sizeof(DicPair), n, fd) != n)
+	    return 0;
+    if (!dictionary_align(fd)) return 0;
+
+    if (fwrite(dic->occurs, sizeof(nat_uint32_t), dic->size + 1, fd) != dic->size + 1)
+	return 0;
+    return dictionary_align(fd);
+}
+
+/**
+ * @brief Saves a dictionary in the mappable format
+ *
+ * The file is written under a temporary name, and renamed when
+ * complete.
+ *
+ * @param dic the Dictionary object to be saved
+ * @param name name of the file to be created
+ *
+ * @return 0 on error
+ */
+int dictionary_save_mapped(Dictionary *dic, const char *name)
+{
+    char *tmpname;
+    FILE *fd;
+    int ok = 0;
+
+    tmpname = g_strdup_printf("%s.tmp", name);
+    fd = fopen(tmpname, "wb");
+    if (fd) {
+	ok = dictionary_save_mapped_fh(fd, dic);
+	if (fclose(fd)) ok = 0;
+	if (ok && rename(tmpname, name)) ok = 0;
+	if (!ok) unlink(tmpname);
+    }
+
+    g_free(tmpname);
+    return ok;
+}
+
+/**
+ * @brief Builds a Dictionary over a dictionary in the mappable format
+ * already in memory
+ *
+ * The image is not copied, and must live as long as the dictionary.
+ * It is not unmapped when the dictionary is freed.
+ *
+ * @param image the start of the dictionary (its header)
+ * @param length the bytes available from image on
+ *
+ * @return the Dictionary object, or NULL if the image is not valid
+ */
+Dictionary *dictionary_map_image(char *image, size_t length)
+{
+    DictionaryMappedHeader *header = (DictionaryMappedHeader*)image;
+    Dictionary *dic;
+
+    if (length < sizeof(DictionaryMappedHeader) ||
+	header->magic != DICTIONARY_MAPPED_MAGIC ||
+	header->version != DICTIONARY_MAPPED_VERSION ||
+	header->length > length ||
+	header->offsets + sizeof(nat_uint32_t) * ((uint64_t) header->size + 2) > header->length ||
+	header->pairs + sizeof(DicPair) * header->npairs > header->length ||
+	header->occurs + sizeof(nat_uint32_t) * ((uint64_t) header->size + 1) > header->length)
+	return NULL;
+
+    dic = (Dictionary*)malloc(sizeof(Dictionary));
+    if (!dic) return NULL;
+
+    dic->size    = header->size;
+    dic->entries = 0;
+    dic->offsets = (nat_uint32_t*)(image + header->offsets);
+    dic->pairs   = (DicPair*)(image + header->pairs);
+    dic->occurs  = (nat_uint32_t*)(image + header->occurs);
+    dic->map     = image;
+    dic->mapsize = 0;
+
+    if (dic->offsets[dic->size+1] != header->npairs) {
+	free(dic);
+	return NULL;
+    }
+    return dic;
+}
+
+/**
+ * @brief Checks if a dictionary file is in the mappable format
+ */
+static nat_boolean_t dictionary_is_mapped(const char *name)
+{
+    nat_uint32_t magic;
+    nat_boolean_t mapped;
+    FILE *fd;
+
+    fd = fopen(name, "rb");
+    if (!fd) return FALSE;
+    mapped = (fread(&magic, sizeof(nat_uint32_t), 1, fd) == 1 &&
+	      (magic == DICTIONARY_MAPPED_MAGIC ||
+	       magic == GUINT32_SWAP_LE_BE(DICTIONARY_MAPPED_MAGIC)));
+    fclose(fd);
+    return mapped;
+}
+
+/**
+ * @brief Maps a dictionary file in the mappable format
+ *
+ * The mapping is private, so occurrence counts can be changed without
+ * touching the file. Translations are copied to memory when changed.
+ *
+ * @return the Dictionary object, or NULL on error
+ */
+static Dictionary *dictionary_map(const char *name)
+{
+    Dictionary *dic;
+    struct stat st;
+    char *map;
+    int fd;
+
+    fd = open(name, O_RDONLY);
+    if (fd < 0) report_error("error opening file %s for reading.\n", name);
+    if (fstat(fd, &st)) {
+	close(fd);
+	return NULL;
+    }
+    map = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    dic = dictionary_map_image(map, st.st_size);
+    if (!dic) {
+	munmap(map, st.st_size);
+	return NULL;
+    }
+    dic->mapsize = st.st_size;
+    return dic;
+}
+
 /**
  * @brief Opens a dictionary file and returns the respective Dictionary object
  *
@@ -90,6 +484,9 @@ Dictionary* dictionary_open(const char *name)
 {
     Dictionary *dic;
     FILE *gzf;
+
+    if (dictionary_is_mapped(name)) return dictionary_map(name);
+
     gzf = gzopen(name, "rb");
     if (!gzf) report_error("error opening file %s for reading.\n", name);
 
@@ -102,26 +499,53 @@ Dictionary* dictionary_open(const char *name)
 /**
  * @brief Loads a dictionary file from a zlib file handle
  *
+ * Reads both the variable length format and the older one, with
+ * OLD_ENTRIES translations for each word. The dictionary is compact.
+ *
  * @param gzf the zlib file handle to be used to read the Dictionary
  * @return the readed Dictionary object
  */
 Dictionary *dictionary_load(FILE* gzf) 
 {
     Dictionary *dic;
-    nat_uint32_t size;
+    nat_uint32_t size, total;
     if (gzread(gzf, &size, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return NULL;
-    dic = dictionary_new(size);
-    if (!dic) return NULL;
-    if (gzread(gzf, dic->pairs, sizeof(DicPair)*MAXENTRY*(dic->size+1))	!=
-	sizeof(DicPair)*MAXENTRY*(dic->size+1)) {
-	dictionary_free(dic);
-	return NULL;
+
+    if (size != DICTIONARY_MAGIC) {
+	dic = dictionary_alloc(size);
+	if (!dic) return NULL;
+
+	dic->entries = OLD_ENTRIES;
+	dic->pairs = g_new(DicPair, OLD_ENTRIES * (size + 1));
+	if (gzread(gzf, dic->pairs, sizeof(DicPair)*OLD_ENTRIES*(size+1)) !=
+	    sizeof(DicPair)*OLD_ENTRIES*(size+1)) {
+	    dictionary_free(dic);
+	    return NULL;
+	}
+    } else {
+	if (gzread(gzf, &size, sizeof(nat_uint32_t)) != sizeof(nat_uint32_t)) return NULL;
+	dic = dictionary_alloc(size);
+	if (!dic) return NULL;
+
+	dic->offsets = g_new(nat_uint32_t, size + 2);
+	if (gzread(gzf, dic->offsets, sizeof(nat_uint32_t)*(size+2)) !=
+	    sizeof(nat_uint32_t)*(size+2)) {
+	    dictionary_free(dic);
+	    return NULL;
+	}
+	total = dic->offsets[size+1];
+	dic->pairs = g_new(DicPair, total + 1);
+	if (gzread(gzf, dic->pairs, sizeof(DicPair)*total) != sizeof(DicPair)*total) {
+	    dictionary_free(dic);
+	    return NULL;
+	}
     }
     if (gzread(gzf, dic->occurs, sizeof(nat_uint32_t)*(dic->size+1)) !=
 	sizeof(nat_uint32_t)*(dic->size+1)) {
 	dictionary_free(dic);
 	return NULL;
     }
+    dictionary_compact(dic);
     return dic;
 }
     
@@ -132,14 +556,13 @@ Dictionary *dictionary_load(FILE* gzf)
  *
  * @param dic the Dictionary to be consulted
  * @param wid the source word id to be searched
- * @param offset the offset of the translation (translation number). Note that
- *   this value will be less than MAXENTRY
- * @return the translation word id
+ * @param offset the offset of the translation (translation number)
+ * @return the translation word id, 0 if there is none
  */
 nat_uint32_t dictionary_get_id(Dictionary* dic, nat_uint32_t wid, int offset)  
 {
-    if (wid > dic->size || offset >= MAXENTRY) return 0;
-    return DIC_POS(dic->pairs, wid, offset).id;
+    DicPair *pair = dictionary_pair(dic, wid, offset);
+    return pair ? pair->id : 0;
 }
 
 
@@ -149,14 +572,13 @@ nat_uint32_t dictionary_get_id(Dictionary* dic, nat_uint32_t wid, int offset)
  *
  * @param dic the Dictionary to be consulted
  * @param wid the source word id to be searched
- * @param offset the offset of the translation (translation number). Note that
- *   this value needs to be less than MAXENTRY
- * @return the translation probability
+ * @param offset the offset of the translation (translation number)
+ * @return the translation probability, 0 if there is none
  */
 float dictionary_get_val(Dictionary* dic, nat_uint32_t wid, int offset) 
 {
-    if (wid > dic->size || offset >= MAXENTRY) return 0;
-    return DIC_POS(dic->pairs, wid, offset).val;
+    DicPair *pair = dictionary_pair(dic, wid, offset);
+    return pair ? pair->val : 0;
 }
 
 
@@ -165,18 +587,22 @@ float dictionary_get_val(Dictionary* dic, nat_uint32_t wid, int offset)
  * @brief Sets a translation word id based on the source word id and
  * the translation offset
  *
- * @bug Does not check offset or wid
+ * Compact dictionaries, or offsets past the current slots, get new
+ * fixed slots for all words (at least twice as many, so that long
+ * lists are not copied for each new slot).
  *
  * @param dic the Dictionary to be changed
  * @param wid the source word id to be changed
- * @param offset the offset of the translation (translation number). Note that
- *   this value will be less than MAXENTRY
+ * @param offset the offset of the translation (translation number)
  * @param id the translation word id to be set
  * @return the changed Dictionary
  */
 Dictionary *dictionary_set_id(Dictionary* dic, nat_uint32_t wid, int offset, nat_uint32_t id) 
 {
-    DIC_POS(dic->pairs, wid, offset).id = id;
+    if (wid > dic->size || offset < 0) return dic;
+    if (dic->offsets || (nat_uint32_t) offset >= dic->entries)
+	dictionary_expand(dic, max((nat_uint32_t) offset + 1, 2 * dic->entries));
+    DIC_POS(dic, wid, offset).id = id;
     return dic;
 }
 
@@ -185,18 +611,21 @@ Dictionary *dictionary_set_id(Dictionary* dic, nat_uint32_t wid, int offset, nat
  * @brief Sets a translation probability based on the source word id and
  * the translation offset
  *
- * @bug Does not check offset or wid
+ * Compact dictionaries, or offsets past the current slots, get new
+ * fixed slots for all words (see dictionary_set_id).
  *
  * @param dic the Dictionary to be changed
  * @param wid the source word id to be changed
- * @param offset the offset of the translation (translation number). Note that
- *   this value will be less than MAXENTRY
+ * @param offset the offset of the translation (translation number)
  * @param val translation to be set
  * @return the changed Dictionary
  */
 Dictionary *dictionary_set_val(Dictionary* dic, nat_uint32_t wid, int offset, float val) 
 {
-    DIC_POS(dic->pairs, wid, offset).val = val;
+    if (wid > dic->size || offset < 0) return dic;
+    if (dic->offsets || (nat_uint32_t) offset >= dic->entries)
+	dictionary_expand(dic, max((nat_uint32_t) offset + 1, 2 * dic->entries));
+    DIC_POS(dic, wid, offset).val = val;
     return dic;
 }
 
@@ -246,6 +675,29 @@ nat_uint32_t dictionary_get_size(Dictionary* dic)
 }
 
 
+/**
+ * @brief Gets the number of translations of a word
+ *
+ * For dictionaries being built, empty slots after the last
+ * translation are not counted.
+ *
+ * @param dic the Dictionary to be consulted
+ * @param wid the source word id
+ * @return the number of translations
+ */
+nat_uint32_t dictionary_get_entries(Dictionary* dic, nat_uint32_t wid) 
+{
+    nat_uint32_t n;
+
+    if (wid > dic->size) return 0;
+    if (dic->offsets) return dic->offsets[wid+1] - dic->offsets[wid];
+
+    n = dic->entries;
+    while (n > 0 && DIC_POS(dic, wid, n-1).id == 0 && DIC_POS(dic, wid, n-1).val == 0.0f) n--;
+    return n;
+}
+
+
 /**
  * @brief Allocates a new dictionary structure
  *
@@ -257,25 +709,16 @@ Dictionary *dictionary_new(nat_uint32_t size)
 {
     Dictionary *new;
 
-    new = (Dictionary*)malloc(sizeof(Dictionary));
+    new = dictionary_alloc(size);
     if (!new) return new;
 
     new->pairs=(DicPair*)malloc(sizeof(DicPair)*MAXENTRY*(size+1));
     if (!new->pairs) {
-	free(new);
+	dictionary_free(new);
 	return NULL;
     }
     memset(new->pairs, 0, sizeof(DicPair)*MAXENTRY*(size+1));
-
-    new->occurs = (nat_uint32_t*)malloc(sizeof(nat_uint32_t)*MAXENTRY*(size+1));
-    if (!new->occurs) {
-	free(new->pairs);
-	free(new);
-	return NULL;
-    }
-
-    memset(new->occurs, 0, sizeof(nat_uint32_t)*MAXENTRY*(size+1));
-    new->size = size;
+    new->entries = MAXENTRY;
 
     return new;
 }
@@ -287,8 +730,13 @@ Dictionary *dictionary_new(nat_uint32_t size)
  */
 void dictionary_free(Dictionary *dic) 
 {
-    free(dic->occurs);
-    free(dic->pairs);
+    if (dic->map) {
+	if (dic->mapsize) munmap(dic->map, dic->mapsize);
+    } else {
+	free(dic->occurs);
+	free(dic->pairs);
+	free(dic->offsets);
+    }
     free(dic);
 }
 
@@ -296,6 +744,8 @@ void dictionary_free(Dictionary *dic)
 /**
  * @brief Adds two dictionaries
  *
+ * Each word keeps all the translations found in both dictionaries.
+ *
  * @param dic1 First dictionary
  * @param dic2 Second dictionary
  * @return the new dictionary 
@@ -303,63 +753,60 @@ void dictionary_free(Dictionary *dic)
 Dictionary* dictionary_add(Dictionary *dic1, Dictionary *dic2) 
 {
     Dictionary *new;
-    int j,k;
+    nat_uint32_t j, k, n1, n2, n;
     nat_uint32_t size1 = 0, size2 = 0;
-    nat_uint32_t i, count, id;
-    DicPair buffer1[MAXENTRY * 2], buffer2[MAXENTRY * 2];
+    nat_uint32_t i, count, id, max = 0;
+    DicPair *buffer1, *buffer2;
     nat_uint32_t new_size = dic1->size > dic2->size ? dic1->size : dic2->size;
     float factor1, factor2;
 
-    for (i = 0; i < new_size; i++) {
+    for (i = 0; i <= new_size; i++) {
 	size1 +=  dictionary_get_occ(dic1, i);
 	size2 +=  dictionary_get_occ(dic2, i);
+	n = dictionary_get_entries(dic1, i) + dictionary_get_entries(dic2, i);
+	if (n > max) max = n;
     }
 
     factor1 = (size1 <= size2) ? 1 : (1 + log10f(size1/size2));
     factor2 = (size1 >= size2) ? 1 : (1 + log10f(size2/size1));
 
     new = dictionary_new(new_size);
-    for (i = 0; i < new_size; i++) {
-	memset(buffer1, 0, sizeof(DicPair)*MAXENTRY*2);
-	memset(buffer2, 0, sizeof(DicPair)*MAXENTRY*2);
+    if (max > new->entries) dictionary_expand(new, max);
 
-	for (j = 0; j < MAXENTRY; j++) {
+    buffer1 = g_new(DicPair, max + 1);
+    buffer2 = g_new(DicPair, max + 1);
+
+    for (i = 0; i <= new_size; i++) {
+	n1 = dictionary_get_entries(dic1, i);
+	n2 = dictionary_get_entries(dic2, i);
+	memset(buffer1, 0, sizeof(DicPair)*(n1 + n2));
+	memset(buffer2, 0, sizeof(DicPair)*(n1 + n2));
+
+	for (j = 0; j < n1; j++) {
 	    buffer1[j].id  = dictionary_get_id(dic1, i, j);
 	    buffer1[j].val = dictionary_get_val(dic1, i, j);
 	}
 
-	for (j = 0; j < MAXENTRY; j++) {
+	/* translations of dic2 are aligned with the same ones of dic1,
+	   the others go after them */
+	n = n1;
+	for (j = 0; j < n2; j++) {
 	    id = dictionary_get_id(dic2, i, j);
-	    for (k = 0; k < MAXENTRY; k++) {
-		if (id == buffer1[k].id) {
-		    buffer2[k].id = id;
-		    buffer2[k].val = dictionary_get_val(dic2, i, j);
-		    break;
-		}
-	    }
-	    if (k == MAXENTRY) { /* no existe no dic1 */
-		for (; k<MAXENTRY*2; k++) {
-		    if (buffer2[k].id == 0) {
-			buffer2[k].id = id;
-			buffer2[k].val = dictionary_get_val(dic2, i, j);
-			break;
-		    }
-		}
-	    }
+	    for (k = 0; k < n1 && id != buffer1[k].id; k++)
+		;
+	    if (k == n1) k = n++; /* no existe no dic1 */
+	    buffer2[k].id = id;
+	    buffer2[k].val = dictionary_get_val(dic2, i, j);
 	}
 
 	/* OK. Neste ponto devemos ter os dois buffers prontos para
 	 * serem somados */
-	for (j = 0; j< MAXENTRY*2; j++) {
+	for (j = 0; j < n; j++) {
 	    float tmp;
-	    float v1,v2;
 
 	    float occ1 = dictionary_get_occ(dic1,i);
 	    float occ2 = dictionary_get_occ(dic2,i);
 
-	    v1 = buffer1[j].val;
-	    v2 = buffer2[j].val;
-
 	    if (occ1 + occ2 == 0.0) {
 		tmp = ((buffer1[j].val*(size1/100000)*factor1*size2 +
 			buffer2[j].val*(size2/100000)*factor2*size1) /
@@ -377,10 +824,10 @@ Dictionary* dictionary_add(Dictionary *dic1, Dictionary *dic2)
 
 	/* Buffers somados. */
 	/* Ordenar */
-	qsort(buffer1, MAXENTRY*2, sizeof(DicPair), &cmp);
+	qsort(buffer1, n, sizeof(DicPair), &cmp);
 
 	/* preencher o novo dicionrio */
-	for (j = 0; j < MAXENTRY; j++) {
+	for (j = 0; j < n; j++) {
 	    dictionary_set_id(new, i, j, buffer1[j].id);
 	    if (buffer1[j].val > 1) {
 		fprintf(stderr, "Aqui vai um (%u,%u)... %f\n", i,buffer1[j].id,buffer1[j].val);
@@ -393,6 +840,8 @@ Dictionary* dictionary_add(Dictionary *dic1, Dictionary *dic2)
 	new = dictionary_set_occ(new, i, count);
     }
 
+    g_free(buffer1);
+    g_free(buffer2);
     return new;
 }
 
@@ -420,7 +869,7 @@ double dictionary_sentence_similarity(Dictionary *dic,
     for (i = 0; i < s1size; i++) {
 	done = 0;
 	if (s1[i] < dic->size) {
-	    for (j = 0; j < MAXENTRY && !done; j++) {
+	    for (j = 0; j < (int) dictionary_get_entries(dic, s1[i]) && !done; j++) {
 		nat_uint32_t id = dictionary_get_id(dic, s1[i], j);
 		for (k = 0; k < s2size && !done; k++) {
 		    if (s2[k] == id) {
@@ -444,16 +893,19 @@ static void dictionary_remap_with_size(nat_uint32_t *Sit, nat_uint32_t *Tit, Dic
     DicPair *copy;
     nat_uint32_t i, j;
 
-    occopy = g_new(nat_uint32_t, dic->size + 1);
-    copy   = g_new(DicPair, dic->size * MAXENTRY + MAXENTRY);
+    if (dic->offsets) dictionary_expand(dic, 0);
+
+    occopy = g_new0(nat_uint32_t, dic->size + 1);
+    copy   = g_new0(DicPair, (size_t) dic->entries * (dic->size + 1));
     for (i=0; i < size; ++i) {
+	DicPair *from = &DIC_POS(dic, i, 0), *to = copy + (size_t) Sit[i] * dic->entries;
 	occopy[Sit[i]] = dic->occurs[i];
-	for (j = 0; j < MAXENTRY; ++j) {
-	    DIC_POS(copy, Sit[i], j).val = DIC_POS(dic->pairs,i,j).val;
-	    if (DIC_POS(copy, Sit[i], j).val == 0.0000000) {
-		DIC_POS(copy, Sit[i], j).id  = 0;
+	for (j = 0; j < dic->entries; ++j) {
+	    to[j].val = from[j].val;
+	    if (to[j].val == 0.0000000) {
+		to[j].id  = 0;
 	    } else {
-		DIC_POS(copy, Sit[i], j).id = Tit[DIC_POS(dic->pairs,i,j).id];
+		to[j].id = Tit[from[j].id];
 	    }
 	}
     }
@@ -481,19 +933,9 @@ void dictionary_remap(nat_uint32_t *Sit, nat_uint32_t *Tit, Dictionary *dic)
  */
 void dictionary_realloc_map(nat_uint32_t *Sit, nat_uint32_t *Tit, Dictionary *dic, nat_uint32_t nsize)
 {
-    nat_uint32_t i;
     nat_uint32_t osize;
     osize = dic->size;
     dictionary_realloc(dic, nsize);
-
-    for (i = osize; i < nsize; i++) {
-	int j;
-	dic->occurs[i] = 0;
-	for (j=0; j<MAXENTRY; ++j) {
-	    dic->pairs[i*MAXENTRY+j].id = 0;
-	    dic->pairs[i*MAXENTRY+j].val = 0;
-	}
-    }
     g_message("** Dictionary realloc done");
     dictionary_remap_with_size(Sit, Tit, dic, osize);
 }
@@ -501,13 +943,21 @@ void dictionary_realloc_map(nat_uint32_t *Sit, nat_uint32_t *Tit, Dictionary *di
 /**
  * @brief Reallocs buffers for a dictionary
  *
+ * New words have no translations and no occurrences.
+ *
  * @param dic The dictionary to be enlarged
  * @param nsize The new dictionary size
  */
 void dictionary_realloc(Dictionary *dic, nat_uint32_t nsize) {
     g_message("** old size is %u", dic->size);
     g_message("** new size is %u", nsize);
-    dic->occurs = g_realloc(dic->occurs, nsize*sizeof(nat_uint32_t));
-    dic->pairs  = g_realloc(dic->pairs,  nsize*sizeof(DicPair)*MAXENTRY);
+    if (dic->offsets) dictionary_expand(dic, 0);
+    dic->occurs = g_realloc(dic->occurs, (nsize+1)*sizeof(nat_uint32_t));
+    dic->pairs  = g_realloc(dic->pairs,  (size_t) (nsize+1)*sizeof(DicPair)*dic->entries);
+    if (nsize > dic->size) {
+	memset(dic->occurs + dic->size + 1, 0, (nsize - dic->size)*sizeof(nat_uint32_t));
+	memset(dic->pairs + (size_t) (dic->size + 1) * dic->entries, 0,
+	       (size_t) (nsize - dic->size)*sizeof(DicPair)*dic->entries);
+    }
     dic->size   = nsize;
 }
@@ -32,14 +32,39 @@
  */
 
 /**
- * @brief maximum number of entries in translation dictionary
+ * @brief default number of translations kept for each word when
+ * building a dictionary (nat-postbin and nat-align -k change it)
  */
+#ifndef MAXENTRY
 #define MAXENTRY 8
+#endif
+
+/**
+ * @brief magic number starting dictionary files with variable length
+ * translation lists (older files start with the dictionary size)
+ */
+#define DICTIONARY_MAGIC 0x4C444E21
+
+/**
+ * @brief magic number of dictionary files in the mappable format
+ */
+#define DICTIONARY_MAPPED_MAGIC 0x4D444E21
 
 /**
- * @brief macro to access directly a word translation on the buffer
+ * @brief version of the mappable dictionary format
  */
-#define DIC_POS(dic,word,j)   dic[word*MAXENTRY+j]
+#define DICTIONARY_MAPPED_VERSION 1
+
+/**
+ * @brief alignment of the sections of mappable dictionary files
+ */
+#define DICTIONARY_MAPPED_ALIGN 64
+
+/**
+ * @brief macro to access directly a word translation on a dictionary
+ * with fixed slots (see Dictionary)
+ */
+#define DIC_POS(dic,word,j)   (dic)->pairs[(word)*(dic)->entries+(j)]
 
 /**
  * @brief Per direction dictionary entries
@@ -53,14 +78,28 @@ typedef struct dpair {
 
 /**
  * @brief Per direction dictionary structure
+ *
+ * Loaded dictionaries are compact: the translations of word w are
+ * pairs[offsets[w]] up to pairs[offsets[w+1]-1]. Dictionaries being
+ * built have no offsets, and have entries slots for each word.
+ * Dictionaries in the mappable format are compact, and their arrays
+ * point into the file mapping until they are changed.
  */
 typedef struct dictionary {
     /** dictionary information */
     DicPair *pairs;
+    /** first translation of each word, NULL if not compact */
+    nat_uint32_t *offsets;
+    /** translation slots per word, if not compact */
+    nat_uint32_t  entries;
     /** buffer with occurrences counts  */
     nat_uint32_t *occurs;
     /** number of dictionary entries  */
     nat_uint32_t  size;
+    /** file mapping holding the arrays, NULL if they are allocated */
+    char         *map;
+    /** size of the mapping, 0 if it is part of a bigger one */
+    size_t        mapsize;
 } Dictionary;
 
 Dictionary*   dictionary_new(nat_uint32_t size);
@@ -74,10 +113,15 @@ nat_uint32_t  dictionary_get_occ(Dictionary *dic, nat_uint32_t wid);
 nat_uint32_t  dictionary_get_id(Dictionary *dic, nat_uint32_t wid, int offset);
 float         dictionary_get_val(Dictionary *dic, nat_uint32_t wid, int  offset);
 nat_uint32_t  dictionary_get_size(Dictionary *dic);
+nat_uint32_t  dictionary_get_entries(Dictionary *dic, nat_uint32_t wid);
+void          dictionary_compact(Dictionary *dic);
 int           dictionary_save(Dictionary *dic, const char *name);
 int           dictionary_save_fh(FILE *gzf, Dictionary *dic);
 Dictionary*   dictionary_open(const char *name);
 Dictionary*   dictionary_load(FILE *gzf);
+int           dictionary_save_mapped(Dictionary *dic, const char *name);
+int           dictionary_save_mapped_fh(FILE *fd, Dictionary *dic);
+Dictionary*   dictionary_map_image(char *image, size_t length);
 Dictionary*   dictionary_add(Dictionary *dic1, Dictionary *dic2);
 double        dictionary_sentence_similarity(Dictionary *dic, nat_uint32_t *s1,
                                              int s1size, nat_uint32_t *s2, int s2size);
@@ -0,0 +1,121 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "emstats.h"
+
+/**
+ * @file
+ * @brief EM-Algorithm convergence statistics
+ *
+ * After each EM step the matrix copies are compared and the result,
+ * together with the step wall time and memory used, optionally
+ * appended to a tab separated metrics file. The step also tells if
+ * the run converged, given the chosen thresholds.
+ */
+
+static double Seconds(struct timeval *from, struct timeval *to)
+{
+    return (double) (to->tv_sec - from->tv_sec) +
+        (double) (to->tv_usec - from->tv_usec) / 1000000.0;
+}
+
+/**
+ * @brief Starts collecting statistics for an EM-Algorithm run
+ *
+ * @param filename metrics file to create, or NULL
+ * @param threshold mean difference threshold (0 to disable)
+ * @param relative relative change threshold (0 to disable)
+ * @param append TRUE to add to an existing metrics file (when
+ * resuming a run)
+ * @return the new statistics object, or NULL if the metrics file
+ * could not be created
+ */
+EMStats *emstats_new(const char *filename, double threshold, double relative,
+                     nat_boolean_t append)
+{
+    EMStats *stats = g_new0(EMStats, 1);
+
+    if (filename) {
+        stats->fd = fopen(filename, append ? "a" : "w");
+        if (!stats->fd) {
+            g_free(stats);
+            return NULL;
+        }
+        fseek(stats->fd, 0, SEEK_END);
+        if (ftell(stats->fd) == 0)
+            fprintf(stats->fd, "# step\tseconds\ttotal_seconds\tmean_diff\trelative_change\tnonzero\tbytes\n");
+        fflush(stats->fd);
+    }
+    stats->threshold = threshold;
+    stats->relative  = relative;
+    gettimeofday(&stats->start, NULL);
+    stats->last = stats->start;
+    return stats;
+}
+
+/**
+ * @brief Collects the statistics of an EM step
+ *
+ * Must be called right after each step.
+ *
+ * @param stats the statistics object
+ * @param matrix the matrix being estimated
+ * @param Ma the matrix copy estimated in this step
+ * @param step the step number
+ * @return TRUE if the run converged
+ */
+nat_boolean_t emstats_step(EMStats *stats, Matrix *matrix, MatrixVal Ma, int step)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    stats->seconds = Seconds(&stats->last, &now);
+
+    MatrixChange(matrix, Ma, &stats->mean_diff, &stats->relative_change, &stats->nonzero);
+    stats->bytes = BytesInUse(matrix);
+
+    if (stats->fd) {
+        fprintf(stats->fd, "%d\t%.3f\t%.3f\t%g\t%g\t%llu\t%u\n", step,
+                stats->seconds, Seconds(&stats->start, &now),
+                stats->mean_diff, stats->relative_change,
+                (unsigned long long) stats->nonzero, stats->bytes);
+        fflush(stats->fd);
+    }
+
+    /* the comparison is not part of the next step */
+    gettimeofday(&stats->last, NULL);
+
+    return (stats->threshold > 0.0 && stats->mean_diff < stats->threshold) ||
+        (stats->relative > 0.0 && stats->relative_change < stats->relative);
+}
+
+/**
+ * @brief Closes the metrics file and frees the statistics object
+ */
+void emstats_free(EMStats *stats)
+{
+    if (stats->fd) fclose(stats->fd);
+    g_free(stats);
+}
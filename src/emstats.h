@@ -0,0 +1,77 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __EMSTATS_H__
+#define __EMSTATS_H__
+
+/**
+ * @file
+ * @brief Header file for the EM-Algorithm convergence statistics
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include "standard.h"
+#include "matrix.h"
+
+/**
+ * @brief Convergence statistics of an EM-Algorithm run
+ */
+typedef struct cEMStats {
+    /** metrics file, or NULL */
+    FILE           *fd;
+    /** stop when the mean difference falls below this (0 to disable) */
+    double          threshold;
+    /** stop when the relative change falls below this (0 to disable) */
+    double          relative;
+    /** time the run started */
+    struct timeval  start;
+    /** time the current step started */
+    struct timeval  last;
+
+    /** wall time of the last step, in seconds */
+    double          seconds;
+    /** mean absolute difference per cell in the last step */
+    double          mean_diff;
+    /** sum of absolute differences over the previous matrix total */
+    double          relative_change;
+    /** number of non-zero cells after the last step */
+    uint64_t        nonzero;
+    /** memory used by the matrix after the last step */
+    nat_uint32_t    bytes;
+} EMStats;
+
+EMStats*       emstats_new     (const char   *filename,
+                                double        threshold,
+                                double        relative,
+                                nat_boolean_t append);
+
+nat_boolean_t  emstats_step    (EMStats      *stats,
+                                Matrix       *matrix,
+                                MatrixVal     Ma,
+                                int           step);
+
+void           emstats_free    (EMStats      *stats);
+
+#endif /* __EMSTATS_H__ */
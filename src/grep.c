@@ -113,9 +113,10 @@ int main(int argc, char *argv[])
     Words *Source;
     Words *Target;
     CompactInvIndex *idx;
-    int xpto = 0;
     nat_uint32_t wid;
-    nat_uint32_t *occs, *occs1, *occs2;
+    nat_uint32_t *occs;
+    InvIndexIter iters[50];
+    nat_uint32_t nterms = 0;
     nat_uint32_t c = 0;
 
     init_locale();
@@ -153,21 +154,19 @@ int main(int argc, char *argv[])
     /* printf("Wid: %u\n", wid); */
     /* fprintf(stderr,"Word: %s\n", words_get_by_id(Source, wid)); */
     
-    occs = inv_index_compact_get_occurrences(idx, wid);
+    /* words without occurrences (not indexed) do not restrict the search */
+    if (inv_index_iter_init(idx, wid, &iters[nterms])) nterms++;
     if (argc > 5) {
 	argc-=5;
-	while(argc) {
+	while(argc && nterms < 50) {
 	    word = (wchar_t*)argv[4+argc];  // this should not work, I would say...
 	    wid = words_get_id(Source, word);
 	    /* fprintf(stderr,"Word: %s\n", words_get_by_id(Source, wid)); */
-	    occs1 = inv_index_compact_get_occurrences(idx, wid);
-	    occs2 = intersect(occs, occs1);
-	    if (xpto) g_free(occs);
-	    occs = occs2;
+	    if (inv_index_iter_init(idx, wid, &iters[nterms])) nterms++;
 	    argc--;
-	    xpto++;
 	}
     }
+    occs = inv_index_intersect(iters, nterms);
 
     fprintf(stderr, "Retrieving...\n");
 
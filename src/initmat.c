@@ -21,11 +21,15 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <getopt.h>
 
 #include "standard.h"
 #include <NATools/corpus.h>
 #include "matrix.h"
+#include "cooccur.h"
 
 
 /**
@@ -34,136 +38,395 @@
  */
 
 
-/* #define SAVE_DOTS 1 */
+/**
+ * @brief Maximum number of sorted runs merged at once by the
+ * external memory mode
+ */
+#define MAXRUNS 128
+
+/*
+ * External memory mode.
+ *
+ * The corpora are read one sentence pair at a time. Co-occurrences
+ * are kept in a buffer that, when full, is sorted by (row, column),
+ * with repeated cells summed up, and written to a temporary file (a
+ * run). At the end, the runs are merged and the matrix file written
+ * row by row. Weights are summed in double precision, so values may
+ * differ from the ones built in memory in the last digits.
+ */
+
+/**
+ * @brief A co-occurrence cell, as kept in runs
+ */
+typedef struct cRunItem {
+    /** matrix row */
+    nat_uint32_t row;
+    /** matrix column */
+    nat_uint32_t column;
+    /** weight */
+    double       value;
+} RunItem;
+
+/**
+ * @brief Co-occurrence buffer of the external memory mode
+ */
+typedef struct cSpillBuffer {
+    /** buffered co-occurrences */
+    RunItem      *items;
+    /** auxiliary array for sorting */
+    RunItem      *tmp;
+    /** number of buffered co-occurrences */
+    nat_uint32_t  n;
+    /** size of the buffer */
+    nat_uint32_t  size;
+    /** matrix dimensions */
+    nat_uint32_t  Nrow, Ncolumn;
+    /** runs written so far */
+    FILE        **runs;
+    /** merge level of each run (how many merges produced it) */
+    nat_uint32_t *levels;
+    /** number of runs */
+    nat_uint32_t  nruns;
+    /** temporary files are created next to this file */
+    char         *matFile;
+} SpillBuffer;
+
+/**
+ * @brief Stable counting sort of run items by row or column
+ */
+static void CountingSortRun(RunItem *from, RunItem *to, nat_uint32_t n,
+			    nat_boolean_t byrow, nat_uint32_t range)
+{
+    nat_uint32_t *count, i, k, total;
+
+    count = g_new0(nat_uint32_t, range + 2);
+    for (i = 0; i < n; i++)
+	count[byrow ? from[i].row : from[i].column]++;
+    total = 0;
+    for (k = 0; k <= range; k++) {
+	i = count[k];
+	count[k] = total;
+	total += i;
+    }
+    for (i = 0; i < n; i++)
+	to[count[byrow ? from[i].row : from[i].column]++] = from[i];
+    g_free(count);
+}
 
-static nat_boolean_t load_exc_words(nat_uint32_t nr, char *buffer, char* file)
+/**
+ * @brief K-way merge of sorted runs
+ */
+typedef struct cRunMerge {
+    /** runs being merged */
+    FILE        **runs;
+    /** heap of the current items of each run, by (row, column) */
+    RunItem      *heap;
+    /** run of each heap item */
+    nat_uint32_t *from;
+    /** number of items in the heap */
+    nat_uint32_t  n;
+} RunMerge;
+
+static nat_boolean_t RunItemLess(RunItem *a, RunItem *b)
 {
-    FILE *fd;
-    nat_uint32_t id;
-    fd = fopen(file, "rb");
-    if (!fd) return FALSE;
-
-    do {
-	if (fread(&id, sizeof(nat_uint32_t), 1, fd)) {
-	    if (id >= nr) return FALSE;
-	    buffer[id] = 1;
-	}
-    } while(!feof(fd));
+    return a->row < b->row || (a->row == b->row && a->column < b->column);
+}
+
+static void RunMergeSiftDown(RunMerge *merge, nat_uint32_t i)
+{
+    nat_uint32_t child, run;
+    RunItem item;
+
+    while ((child = 2 * i + 1) < merge->n) {
+	if (child + 1 < merge->n && RunItemLess(&merge->heap[child + 1], &merge->heap[child]))
+	    child++;
+	if (!RunItemLess(&merge->heap[child], &merge->heap[i]))
+	    break;
+	item = merge->heap[i];  merge->heap[i] = merge->heap[child];  merge->heap[child] = item;
+	run  = merge->from[i];  merge->from[i] = merge->from[child];  merge->from[child] = run;
+	i = child;
+    }
+}
 
+static void RunMergeInit(RunMerge *merge, FILE **runs, nat_uint32_t nruns)
+{
+    nat_uint32_t i;
+
+    merge->runs = runs;
+    merge->heap = g_new(RunItem, nruns);
+    merge->from = g_new(nat_uint32_t, nruns);
+    merge->n = 0;
+    for (i = 0; i < nruns; i++) {
+	if (fread(&merge->heap[merge->n], sizeof(RunItem), 1, runs[i]) == 1)
+	    merge->from[merge->n++] = i;
+    }
+    for (i = merge->n / 2; i > 0; i--)
+	RunMergeSiftDown(merge, i - 1);
+}
+
+/**
+ * @brief Gets the next cell of the merged runs, with repeated cells
+ * summed up
+ *
+ * @return FALSE when all runs are exhausted
+ */
+static nat_boolean_t RunMergeNext(RunMerge *merge, RunItem *item)
+{
+    if (!merge->n) return FALSE;
+
+    *item = merge->heap[0];
+    item->value = 0;
+    while (merge->n && merge->heap[0].row == item->row && merge->heap[0].column == item->column) {
+	item->value += merge->heap[0].value;
+	if (fread(&merge->heap[0], sizeof(RunItem), 1, merge->runs[merge->from[0]]) != 1) {
+	    merge->n--;
+	    merge->heap[0] = merge->heap[merge->n];
+	    merge->from[0] = merge->from[merge->n];
+	}
+	RunMergeSiftDown(merge, 0);
+    }
     return TRUE;
 }
 
-static Matrix* InitialEstimate(nat_boolean_t quiet,
-                               nat_uint32_t Nrow, nat_uint32_t Ncolumn, 
-			       Corpus *corpus1, Corpus *corpus2,
-			       char *excWrds1,	char *excWrds2)
-{ 
+static void RunMergeFree(RunMerge *merge, nat_uint32_t nruns)
+{
+    nat_uint32_t i;
 
-#ifdef SAVE_DOTS
-    FILE *dots_fd;
-#endif
+    for (i = 0; i < nruns; i++) fclose(merge->runs[i]);
+    g_free(merge->heap);
+    g_free(merge->from);
+}
 
-    Matrix *matrix;
-    unsigned long cSentence, nSentences;
-    unsigned long r, c, l;
-    int jjdoneR, jjdoneC;
-    CorpusCell *s1, *s2, *sen2;
+/**
+ * @brief Merges n runs, starting at the given one, into a single run
+ * that takes their place
+ */
+static void MergeRuns(SpillBuffer *spill, nat_uint32_t first, nat_uint32_t n)
+{
+    RunMerge merge;
+    RunItem item;
+    nat_uint32_t i, level = 0;
+    FILE *fd;
 
-    if (!quiet)
-        fprintf(stderr, "\nAllocating the sparse matrix (%d x %d):      ",
-                Nrow, Ncolumn);
+    fd = temp_file_near(spill->matFile);
+    if (!fd) report_error("initmat.c: cannot create temporary file");
+    RunMergeInit(&merge, spill->runs + first, n);
+    while (RunMergeNext(&merge, &item))
+	if (fwrite(&item, sizeof(RunItem), 1, fd) != 1)
+	    report_error("initmat.c: error writing temporary file");
+    RunMergeFree(&merge, n);
+    rewind(fd);
+
+    for (i = first; i < first + n; i++)
+	level = max(level, spill->levels[i] + 1);
+    spill->runs[first] = fd;
+    spill->levels[first] = level;
+    for (i = first + n; i < spill->nruns; i++) {
+	spill->runs[i - n + 1] = spill->runs[i];
+	spill->levels[i - n + 1] = spill->levels[i];
+    }
+    spill->nruns -= n - 1;
+}
+
+/**
+ * @brief Sorts the buffer, sums repeated cells and writes it as a new run
+ */
+static void SpillRun(SpillBuffer *spill)
+{
+    nat_uint32_t i, j;
+    FILE *fd;
+
+    if (!spill->n) return;
+
+    CountingSortRun(spill->items, spill->tmp, spill->n, FALSE, spill->Ncolumn);
+    CountingSortRun(spill->tmp, spill->items, spill->n, TRUE, spill->Nrow);
+    for (i = 0, j = 1; j < spill->n; j++) {
+	if (spill->items[j].row == spill->items[i].row &&
+	    spill->items[j].column == spill->items[i].column)
+	    spill->items[i].value += spill->items[j].value;
+	else
+	    spill->items[++i] = spill->items[j];
+    }
+
+    fd = temp_file_near(spill->matFile);
+    if (!fd) report_error("initmat.c: cannot create temporary file");
+    if (fwrite(spill->items, sizeof(RunItem), i + 1, fd) != i + 1)
+	report_error("initmat.c: error writing temporary file");
+    rewind(fd);
+
+    spill->runs   = g_renew(FILE*, spill->runs, spill->nruns + 1);
+    spill->levels = g_renew(nat_uint32_t, spill->levels, spill->nruns + 1);
+    spill->runs[spill->nruns] = fd;
+    spill->levels[spill->nruns++] = 0;
+    spill->n = 0;
+
+    /* keep few files open: MAXRUNS runs of the same level are merged
+       into one of the next level */
+    while (spill->nruns >= MAXRUNS &&
+	   spill->levels[spill->nruns - MAXRUNS] == spill->levels[spill->nruns - 1])
+	MergeRuns(spill, spill->nruns - MAXRUNS, MAXRUNS);
+}
+
+static int SpillCooccurrence(void *data, float f, nat_uint32_t r, nat_uint32_t c)
+{
+    SpillBuffer *spill = (SpillBuffer*)data;
+
+    if (r > spill->Nrow || c > spill->Ncolumn) return 1;
+    if (spill->n == spill->size) SpillRun(spill);
+    spill->items[spill->n].row    = r;
+    spill->items[spill->n].column = c;
+    spill->items[spill->n].value  = f;
+    spill->n++;
+    return 0;
+}
+
+/**
+ * @brief Merges the runs into the matrix file
+ */
+static void WriteMergedRuns(SpillBuffer *spill, MatrixWriter *writer)
+{
+    RunMerge merge;
+    RunItem item;
+    Cell *cells;
+    nat_uint32_t row, n;
+    nat_boolean_t more;
+
+    cells = g_new(Cell, spill->Ncolumn + 1);
+    RunMergeInit(&merge, spill->runs, spill->nruns);
+    more = RunMergeNext(&merge, &item);
+    for (row = 1; row <= spill->Nrow; row++) {
+	n = 0;
+	while (more && item.row == row) {
+	    cells[n].column = item.column;
+	    cells[n].value1 = (CellValue) item.value;
+	    cells[n].value2 = 0;
+	    n++;
+	    more = RunMergeNext(&merge, &item);
+	}
+	if (MatrixWriterAddRow(writer, cells, n))
+	    report_error("initmat.c: error writing matrix");
+    }
+    RunMergeFree(&merge, spill->nruns);
+    g_free(cells);
+}
 
-    /* Alloc matrix */
-    matrix = AllocMatrix(Nrow, Ncolumn);
-    if (!matrix) report_error("InitialEstimate: AllocMatrix failed");
+/**
+ * @brief Reads a corpus file to find its number of sentences and
+ * its biggest word identifier
+ */
+static nat_uint32_t ScanCorpus(char *filename, nat_uint32_t *maxword)
+{
+    CorpusReader *reader;
+    CorpusCell *s;
+    nat_uint32_t n = 0;
+
+    reader = corpus_reader_open(filename);
+    if (!reader) report_error("initmat.c: cannot open corpus %s", filename);
+    *maxword = 0;
+    while ((s = corpus_reader_next_sentence(reader)) != NULL) {
+	for (; s->word; s++)
+	    if (s->word > *maxword) *maxword = s->word;
+	n++;
+    }
+    corpus_reader_close(reader);
+    return n;
+}
+
+/**
+ * @brief Builds the co-occurrence matrix file without keeping the
+ * corpora or the matrix in memory
+ *
+ * @param memlimit memory to use for the co-occurrence buffer, in
+ * bytes (besides a few arrays the size of the vocabularies)
+ */
+static void StreamingEstimate(nat_boolean_t quiet,
+			      nat_uint32_t Nrow, nat_uint32_t Ncolumn,
+			      nat_uint32_t nSentences,
+			      char *file1, char *file2,
+			      char *excWrds1, char *excWrds2,
+			      char *matFile, nat_boolean_t mapped,
+			      uint64_t memlimit)
+{
+    SpillBuffer spill;
+    MatrixWriter *writer;
+    CorpusReader *reader1, *reader2;
+    CorpusCell *s1, *s2;
+    unsigned long cSentence = 0;
+
+    spill.size    = (nat_uint32_t) min(memlimit / (2 * sizeof(RunItem)), 0x7fffffff);
+    spill.size    = max(spill.size, 65536);
+    spill.items   = g_new(RunItem, spill.size);
+    spill.tmp     = g_new(RunItem, spill.size);
+    spill.n       = 0;
+    spill.Nrow    = Nrow;
+    spill.Ncolumn = Ncolumn;
+    spill.runs    = NULL;
+    spill.levels  = NULL;
+    spill.nruns   = 0;
+    spill.matFile = matFile;
 
-    /* prepare variables for percent counting */
-    nSentences = corpus_sentences_nr(corpus1);
-    cSentence = 0;
+    if (!quiet)
+        fprintf(stderr, "\nCounting co-occurrences (%d x %d):      ", Nrow, Ncolumn);
 
-    s1 = corpus_first_sentence(corpus1);
-    s2 = sen2 = corpus_first_sentence(corpus2);
+    reader1 = corpus_reader_open(file1);
+    reader2 = corpus_reader_open(file2);
+    if (!reader1 || !reader2) report_error("initmat.c: cannot open corpora");
 
 #ifdef SAVE_DOTS
     dots_fd = fopen("__dots__", "w");
     if (!dots_fd) report_error("cannot open __dots__ file");
 #endif
 
+    s1 = corpus_reader_next_sentence(reader1);
+    s2 = corpus_reader_next_sentence(reader2);
     while (s1 != NULL && s2 != NULL) {
-	/* print percentage information */
         if (!quiet)
             fprintf(stderr, "\b\b\b\b\b%4.1f%%",
                     (float) (cSentence++) * 99.9f / (float) nSentences);
 
-	l = max(corpus_sentence_length(s1),
-		corpus_sentence_length(s2));
-	if (l <= MAXLEN) {
-            jjdoneR = 0;
-	    for(r = 1; r <= l && !jjdoneR ; r++) {
-		if (!(excWrds1 && s1->word && excWrds1[s1->word])) {
-                    jjdoneC = 0;
-		    for(c = 1; c <= l && !jjdoneC ; c++) {
-			if (excWrds2 && s2->word && excWrds2[s2->word]) {
-			    ++s2;
-			} else {
-			    if (s1->word && s2->word) {
-				if (IncValue(matrix, MATRIX_1, 1.0f / (float)l, s1->word, s2->word))
-				    report_error("InitialEstimate: IncValue failed");
-#ifdef SAVE_DOTS
-				fprintf(dots_fd, "%d %d\n", s1->word, s2->word);
-#endif
-				++s2;
-			    }
-			    else {
-				if (s1->word == 0) {
-				    if (IncValue(matrix, MATRIX_1, 1.0f / (float)l, NULLWORD, s2->word))
-					report_error("InitialEstimate: IncValue failed");
-#ifdef SAVE_DOTS
-				fprintf(dots_fd, "0 %d\n", s2->word);
-#endif
-				    ++s2;
-                                    jjdoneR=1;
-				}
-				else {
-				    if (IncValue(matrix, MATRIX_1, 1.0f / (float)l, s1->word, NULLWORD))
-					report_error("InitialEstimate: IncValue failed");
-#ifdef SAVE_DOTS
-				fprintf(dots_fd, "%d 0\n", s1->word);
-#endif
-                                    jjdoneC=1;
-                                }
-			    }
-			}
-		    }
-		}
-		if (s1->word) s1++;
-		s2 = sen2;
-	    }
-	}
-	s1 = corpus_next_sentence(corpus1);
-	s2 = sen2 = corpus_next_sentence(corpus2);
+	SentenceCooccurrences(s1, s2, excWrds1, excWrds2, SpillCooccurrence, &spill);
+
+	s1 = corpus_reader_next_sentence(reader1);
+	s2 = corpus_reader_next_sentence(reader2);
     }
-    
+
 #ifdef SAVE_DOTS
     fclose(dots_fd);
 #endif
 
     if (s1 != NULL || s2 != NULL)
 	report_error("InitialEstimate: failed to evaluate all sentences");
-
-    if (!quiet) fprintf(stderr, "\b\b\b\b\b\b done \n");
-
-    return matrix;
+    corpus_reader_close(reader1);
+    corpus_reader_close(reader2);
+
+    SpillRun(&spill);
+    g_free(spill.items);
+    g_free(spill.tmp);
+
+    if (!quiet) fprintf(stderr, "\b\b\b\b\b\b done \nMerging %u runs\n", spill.nruns);
+
+    while (spill.nruns > MAXRUNS)
+	MergeRuns(&spill, 0, MAXRUNS);
+    writer = MatrixWriterNew(matFile, Nrow, Ncolumn, mapped);
+    if (!writer) report_error("initmat.c: cannot create matrix file");
+    WriteMergedRuns(&spill, writer);
+    if (MatrixWriterClose(writer))
+	report_error("initmat.c: error writing matrix");
+    g_free(spill.runs);
+    g_free(spill.levels);
 }
 
 void show_help () {
     printf("Usage:\n"
-           "  nat-initmat [-q] corpusFile1 corpusFile2 matFile\n"
-           "  nat-initmat [-q] corpusFile1 corpusFile2 excludeWrds1 excludeWrds2 matFile\n");
+           "  nat-initmat [-q] [-m] [-M mb] corpusFile1 corpusFile2 matFile\n"
+           "  nat-initmat [-q] [-m] [-M mb] corpusFile1 corpusFile2 excludeWrds1 excludeWrds2 matFile\n");
     printf("Supported options:\n"
            "  -h shows this help message and exits\n"
            "  -V shows "PACKAGE" version and exits\n"
            "  -q activates quiet mode\n"
+           "  -m saves the matrix in the mappable format\n"
+           "  -M, --mem-limit=mb builds the matrix in external memory, using\n"
+           "     about that many megabytes\n"
            "Check nat-initmat manpage for details.\n");
 }
 
@@ -182,13 +445,20 @@ int main(int argc, char **argv)
     Corpus *corpus1, *corpus2;
     Matrix *matrix;
     nat_uint32_t total1, total2;
+    nat_uint32_t nSentences;
     nat_boolean_t quiet = FALSE;
-
-    // extern char *optarg;
+    nat_boolean_t mapped = FALSE;
+    uint64_t memlimit = 0;
+
+    static struct option long_options[] = {
+        { "mem-limit", required_argument, NULL, 'M' },
+        { NULL, 0, NULL, 0 }
+    };
+    extern char *optarg;
     extern int optind;
     int c;
     
-    while ((c = getopt(argc, argv, "hqV")) != EOF) {
+    while ((c = getopt_long(argc, argv, "hqVmM:", long_options, NULL)) != EOF) {
         switch (c) {
         case 'h':
             show_help();
@@ -199,6 +469,14 @@ int main(int argc, char **argv)
         case 'q':
             quiet = TRUE;
             break;
+        case 'm':
+            mapped = TRUE;
+            break;
+        case 'M':
+            if (atoi(optarg) < 1)
+                report_error("initmat.c: invalid memory limit");
+            memlimit = (uint64_t) atoi(optarg) * 1024 * 1024;
+            break;
         default:
             show_help();
             return 1;
@@ -210,27 +488,35 @@ int main(int argc, char **argv)
         show_help();
         return 1;
     }
-    
-    corpus1 = corpus_new();
-    corpus2 = corpus_new();
 
-    corpus_load(corpus1, argv[optind + 0]);
-    corpus_load(corpus2, argv[optind + 1]);
+    if (memlimit) {
+        /* external memory: the corpora are only read sequentially */
+        corpus1 = corpus2 = NULL;
+        nSentences = ScanCorpus(argv[optind + 0], &total1);
+        if (nSentences != ScanCorpus(argv[optind + 1], &total2))
+            report_error("initmat.c: lengths do not match");
+    } else {
+        corpus1 = corpus_new();
+        corpus2 = corpus_new();
 
-    if (corpus_sentences_nr(corpus1) != corpus_sentences_nr(corpus2))
-	report_error("initmat.c: lengths do not match");
+        corpus_load(corpus1, argv[optind + 0]);
+        corpus_load(corpus2, argv[optind + 1]);
 
-    /* total1 and total2 are number of words (??) */
-    total1 = corpus_diff_words_nr(corpus1);
-    total2 = corpus_diff_words_nr(corpus2);
+        if (corpus_sentences_nr(corpus1) != corpus_sentences_nr(corpus2))
+            report_error("initmat.c: lengths do not match");
 
-    if (argc == 6) {
+        /* total1 and total2 are number of words (??) */
+        total1 = corpus_diff_words_nr(corpus1);
+        total2 = corpus_diff_words_nr(corpus2);
+    }
+
+    if (argc == optind + 5) {
 	excWrds1 = g_new0(char, total1 + 1);
-	if (!load_exc_words(total1, excWrds1, argv[optind + 2]))
+	if (!LoadExcludedWords(total1, excWrds1, argv[optind + 2]))
 	    report_error("initmat.c: error loading excludeWrds1");
 
 	excWrds2 = g_new0(char, total2 + 1);
-	if (!load_exc_words(total2, excWrds2, argv[optind + 3])) 
+	if (!LoadExcludedWords(total2, excWrds2, argv[optind + 3])) 
 	    report_error("initmat.c: error loading excludeWrds2");
 
 	matFile = argv[optind + 4];
@@ -238,6 +524,15 @@ int main(int argc, char **argv)
 	matFile = argv[optind + 2];
     }
 
+    if (memlimit) {
+        StreamingEstimate(quiet, total1, total2, nSentences,
+                          argv[optind + 0], argv[optind + 1],
+                          excWrds1, excWrds2, matFile, mapped, memlimit);
+        g_free(excWrds1);
+        g_free(excWrds2);
+        return 0;
+    }
+
     matrix = InitialEstimate(quiet, total1, total2, corpus1, corpus2, excWrds1, excWrds2);
     
     if (argc == optind + 5) {
@@ -245,7 +540,11 @@ int main(int argc, char **argv)
 	g_free(excWrds2);
     }
 
-    if (SaveMatrix(matrix, matFile)) report_error("SaveMatrix");
+    if (mapped) {
+        if (SaveMappedMatrix(matrix, matFile)) report_error("SaveMappedMatrix");
+    } else {
+        if (SaveMatrix(matrix, matFile)) report_error("SaveMatrix");
+    }
 
     /* fprintf(stderr, 
        "Matrix total after initial estimate:%9.2f\n", MatrixTotal(matrix, Matrix1)); */
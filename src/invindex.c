@@ -23,6 +23,7 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "invindex.h"
 
 /**
@@ -32,20 +33,25 @@
 
 
 
-static size_t inv_index_buffer_size(nat_uint32_t *buffer)
+static int compare(const void* a, const void* b)
 {
-    size_t s = 0;
-    if (!buffer) return 0;
-    while(*buffer) { buffer++; s++; }
-    return s;
+    nat_uint32_t ai,bi;
+    ai = *(nat_uint32_t*)a;
+    bi = *(nat_uint32_t*)b;
+    return ai>bi?1:(ai<bi?-1:0);
 }
 
+static int compare_pairs(const void* a, const void* b)
+{
+    int c = compare(a, b);
+    return c ? c : compare((nat_uint32_t*)a + 1, (nat_uint32_t*)b + 1);
+}
 
-static int compare(const void* a, const void* b)
+static int compare_iters(const void* a, const void* b)
 {
     nat_uint32_t ai,bi;
-    ai = *(nat_uint32_t*)a;
-    bi = *(nat_uint32_t*)b;
+    ai = ((InvIndexIter*)a)->count;
+    bi = ((InvIndexIter*)b)->count;
     return ai>bi?1:(ai<bi?-1:0);
 }
 
@@ -98,9 +104,11 @@ nat_uint32_t unpack(nat_uint32_t packed, nat_uchar_t *character)
  * structure.
  *
  * @param original_size the oringinal number of words
+ * @param positional if true, the index keeps the position of each
+ *                   occurrence in its sentence (see inv_index_add_position)
  * @return a new and empty invertion index.
  */
-InvIndex* inv_index_new(nat_uint32_t original_size)
+InvIndex* inv_index_new(nat_uint32_t original_size, nat_boolean_t positional)
 {
     InvIndex *index;
 
@@ -109,21 +117,25 @@ InvIndex* inv_index_new(nat_uint32_t original_size)
     index->size = original_size;
     index->lastid = 0;
     index->nrentries = 0;
+    index->positional = positional;
     index->buffer = g_new0(InvIndexEntry*, original_size);
 
     return index;
 }
 
+/* positional indexes store pairs of packed occurrence and position */
 static InvIndexEntry* inv_index_add_occurrence_(InvIndex *index,
 						InvIndexEntry *entry,
-						nat_uint32_t packed) {
+						nat_uint32_t packed,
+						nat_uint32_t position) {
     InvIndexEntry *this;
+    nat_uint32_t width = index->positional ? 2 : 1;
+    nat_boolean_t repeated = entry && entry->data[entry->ptr-width] == packed;
 
-    if (entry && entry->data[entry->ptr-1] == packed) return entry;
+    if (repeated && !index->positional) return entry;
 
-    if (entry && entry->ptr < entry->size) {
+    if (entry && entry->ptr + width <= entry->size) {
 	/* we have some free space */
-	entry->data[entry->ptr++] = packed;
 	this = entry;
     } else {
 	this = g_new(InvIndexEntry, 1);
@@ -131,10 +143,11 @@ static InvIndexEntry* inv_index_add_occurrence_(InvIndex *index,
 	this->size = CELLSIZE;
 	this->ptr = 0;
 	this->data = g_new(nat_uint32_t, this->size);
-	this->data[this->ptr++] = packed;
     }
+    this->data[this->ptr++] = packed;
+    if (index->positional) this->data[this->ptr++] = position;
 
-    index->nrentries++;
+    if (!repeated) index->nrentries++;
 
     return this;
 }
@@ -158,12 +171,38 @@ InvIndex* inv_index_add_occurrence(InvIndex *index,
 				   nat_uint32_t wid,
 				   nat_uchar_t  chunk,
 				   nat_uint32_t sentence) 
+{
+    return inv_index_add_position(index, wid, chunk, sentence, 0);
+}
+
+/**
+ * @brief Adds an word occurrence, with its position, to the
+ * invertion index
+ *
+ * The position (index of the word in the sentence) is only kept by
+ * positional indexes. Each occurrence of a word in a sentence should
+ * be added, in order.
+ *
+ * @param index the Invertion Index object
+ * @param wid the word identifier
+ * @param chunk the chunk identifier
+ * @param sentence the sentence number (for that chunk)
+ * @param position the position of the word in the sentence
+ * @return the changed Invertion Index
+ */
+InvIndex* inv_index_add_position(InvIndex *index,
+				 nat_uint32_t wid,
+				 nat_uchar_t  chunk,
+				 nat_uint32_t sentence,
+				 nat_uint32_t position)
 {
     if (wid >= index->size) {
 	nat_uint32_t newsize = index->size;
-	while(wid > newsize) newsize *=  1.3;
+	while(wid >= newsize) newsize = newsize * 1.3 + 1;
 	index->buffer = g_realloc(index->buffer, 
 				  newsize * sizeof(InvIndexEntry*));
+	memset(index->buffer + index->size, 0,
+	       (newsize - index->size) * sizeof(InvIndexEntry*));
 	index->size = newsize;
     }
 
@@ -173,26 +212,159 @@ InvIndex* inv_index_add_occurrence(InvIndex *index,
     /* Better to pack here. Less one argument in the function stack */
     index->buffer[wid] = inv_index_add_occurrence_(index,
 						   index->buffer[wid], 
-						   pack(sentence, chunk));
+						   pack(sentence, chunk),
+						   position);
     return index;
 }
 
-static nat_uint32_t inv_index_save_hash_entry(InvIndexEntry *entry, Bucket *bucket) {
-    if (entry) {
-	nat_uint32_t i;
-	for (i = 0; i<entry->ptr; i++) {
-	    bucket = bucket_add(bucket, entry->data[i]);
-	}
-	return entry->ptr + inv_index_save_hash_entry(entry->next, bucket);
-    } else {
-	return 0;
+/**
+ * @brief Copies the occurrences of a word, sorted
+ *
+ * Cells are linked from the most recent, and occurrences are normally
+ * added in order, so sorting is seldom needed. On positional indexes
+ * occurrences are pairs of packed occurrence and position.
+ *
+ * @return the number of occurrences (or pairs)
+ */
+static nat_uint32_t inv_index_entry_occurrences(InvIndexEntry *entry,
+						nat_boolean_t positional,
+						nat_uint32_t **occs,
+						nat_uint32_t *size)
+{
+    nat_uint32_t width = positional ? 2 : 1;
+    InvIndexEntry *cell;
+    nat_uint32_t n = 0, i;
+    nat_boolean_t sorted = TRUE;
+
+    for (cell = entry; cell; cell = cell->next) n += cell->ptr;
+    if (n > *size) {
+	*size = n;
+	*occs = g_renew(nat_uint32_t, *occs, *size);
+    }
+
+    i = n;
+    for (cell = entry; cell; cell = cell->next) {
+	i -= cell->ptr;
+	memcpy(*occs + i, cell->data, sizeof(nat_uint32_t) * cell->ptr);
     }
+
+    n /= width;
+    for (i = 1; sorted && i < n; i++)
+	if ((positional ? compare_pairs : compare)(*occs + (i - 1) * width, *occs + i * width) > 0)
+	    sorted = FALSE;
+    if (!sorted)
+	qsort(*occs, n, sizeof(nat_uint32_t) * width, positional ? &compare_pairs : &compare);
+
+    return n;
 }
 
+/**
+ * @brief Maximum size of the posting list of n occurrences (or pairs)
+ */
+#define INVINDEX_LIST_SIZE(n, positional) \
+    (sizeof(nat_uint32_t) * 3 * (((n) + INVINDEX_BLOCK - 1) / INVINDEX_BLOCK) + \
+     ((positional) ? 15 : 5) * (size_t) (n) + 13)
+
+static unsigned char *inv_index_put(unsigned char *ptr, nat_uint32_t value)
+{
+    while (value >= 0x80) {
+	*ptr++ = (value & 0x7F) | 0x80;
+	value >>= 7;
+    }
+    *ptr++ = value;
+    return ptr;
+}
+
+/**
+ * @brief Decodes a variable length integer of a posting list
+ */
+static nat_uint32_t inv_index_get(const unsigned char **ptr)
+{
+    nat_uint32_t value = 0;
+    int shift = 0;
+
+    while (**ptr & 0x80) {
+	value |= (nat_uint32_t) (*(*ptr)++ & 0x7F) << shift;
+	shift += 7;
+    }
+    return value | (nat_uint32_t) *(*ptr)++ << shift;
+}
+
+/**
+ * @brief Encodes a posting list (see CompactInvIndex)
+ *
+ * @param occs the sorted occurrences, or pairs of occurrence and position
+ * @param n number of occurrences or pairs (not zero)
+ * @param positional true if occs has pairs
+ * @param out where to write the list (INVINDEX_LIST_SIZE bytes)
+ * @param base offset of <i>out</i> from the start of the lists, to
+ *     align skip tables
+ * @return the size of the list
+ */
+static size_t inv_index_encode(const nat_uint32_t *occs, nat_uint32_t n,
+			       nat_boolean_t positional, unsigned char *out,
+			       uint64_t base)
+{
+    nat_uint32_t width  = positional ? 2 : 1;
+    nat_uint32_t stride = positional ? 3 : 2;
+    nat_uint32_t count, nblocks, i, j, k, last = 0;
+    nat_uint32_t *skip = NULL;
+    unsigned char *deltas, *ptr;
+
+    /* pairs of the same occurrence make a single entry */
+    for (count = 0, i = 0; i < n; i++)
+	if (!positional || !i || occs[i * 2] != occs[i * 2 - 2]) count++;
+
+    ptr = inv_index_put(out, count);
+    if (count <= INVINDEX_BLOCK) {
+	/* a single block needs no skip table, only its first occurrence */
+	ptr = inv_index_put(ptr, occs[0]);
+    } else {
+	while ((base + (ptr - out)) % 4) *ptr++ = 0;
+	nblocks = (count + INVINDEX_BLOCK - 1) / INVINDEX_BLOCK;
+	skip = (nat_uint32_t*) ptr;
+	ptr  = (unsigned char*) (skip + stride * nblocks);
+    }
+    deltas = ptr;
+
+    for (i = 0, k = 0; i < n; i += j, k++) {
+	for (j = 1; positional && i + j < n && occs[(i + j) * 2] == occs[i * 2]; j++)
+	    ;
+	if (k % INVINDEX_BLOCK == 0) {
+	    if (skip) {
+		skip[stride * (k / INVINDEX_BLOCK)]     = occs[i * width];
+		skip[stride * (k / INVINDEX_BLOCK) + 1] = ptr - deltas;
+	    }
+	} else
+	    ptr = inv_index_put(ptr, occs[i * width] - last);
+	last = occs[i * width];
+    }
+
+    /* positions of each occurrence: their number, the first, and the deltas */
+    for (i = 0, k = 0; positional && i < n; i += j, k++) {
+	for (j = 1; i + j < n && occs[(i + j) * 2] == occs[i * 2]; j++)
+	    ;
+	if (skip && k % INVINDEX_BLOCK == 0)
+	    skip[stride * (k / INVINDEX_BLOCK) + 2] = ptr - deltas;
+	ptr = inv_index_put(ptr, j);
+	ptr = inv_index_put(ptr, occs[i * 2 + 1]);
+	for (last = 1; last < j; last++)
+	    ptr = inv_index_put(ptr, occs[(i + last) * 2 + 1] - occs[(i + last) * 2 - 1]);
+    }
+
+    return ptr - out;
+}
 
 /**
  * @brief Save the invertion index in a compact format
  *
+ * The file has a header (INVINDEX_MAGIC, INVINDEX_VERSION or
+ * INVINDEX_VERSION_POSITIONAL, number of words, number of
+ * occurrences and size of the posting lists), the
+ * posting lists (see CompactInvIndex) and the offset of each list
+ * (plus the end of the last one).  Offsets take 32 bits, or 64 bits
+ * if the lists are bigger than 4GB.
+ *
  * @param index the Invertion Index to be saved
  * @param filename the filename to be used to save the buffer
  * @param quiet if not true, the function will output to <i>stderr</i> the 
@@ -202,70 +374,203 @@ static nat_uint32_t inv_index_save_hash_entry(InvIndexEntry *entry, Bucket *buck
 int inv_index_save_hash(InvIndex *index, const char *filename, nat_boolean_t quiet)
 {
     FILE *fh;
-    nat_uint32_t i;
-    nat_uint32_t *offsets;
-    nat_uint32_t offset;
-    Bucket *bucket;
+    nat_uint32_t i, n;
+    nat_uint32_t header[4];
+    uint64_t *offsets;
+    uint64_t offset;
+    nat_uint32_t *occs = NULL, occssize = 0;
+    unsigned char *list = NULL;
+    size_t listsize = 0, size;
+    int error = 0;
 
     fh = fopen(filename, "w");
     if (!fh) return 1;
 
-    offsets = g_new(nat_uint32_t, index->lastid);
+    offsets = g_new(uint64_t, index->lastid + 1);
 
     if (!quiet) fprintf(stderr, " Saving");
 
-    fwrite(&index->lastid, sizeof(nat_uint32_t), 1, fh);
-    fwrite(&index->nrentries, sizeof(nat_uint32_t), 1, fh);
+    header[0] = INVINDEX_MAGIC;
+    header[1] = index->positional ? INVINDEX_VERSION_POSITIONAL : INVINDEX_VERSION;
+    header[2] = index->lastid;
+    header[3] = index->nrentries;
+    offset = 0;
+    if (fwrite(header, sizeof(header), 1, fh) != 1 ||
+	fwrite(&offset, sizeof(uint64_t), 1, fh) != 1)
+	error = 1;
 
-    bucket = bucket_new(10000000, fh); /* 40 MBytes */
-    for (i = 0, offset = 0; i < index->lastid; i++) {
+    for (i = 0; !error && i < index->lastid; i++) {
 	offsets[i] = offset;
 
-	if (index->buffer[i])
-	    offset += inv_index_save_hash_entry(index->buffer[i],
-						bucket);
-	bucket = bucket_add(bucket, 0);
-	offset ++;
+	n = inv_index_entry_occurrences(index->buffer[i], index->positional,
+					&occs, &occssize);
+	if (n) {
+	    if (INVINDEX_LIST_SIZE(n, index->positional) > listsize) {
+		listsize = INVINDEX_LIST_SIZE(n, index->positional);
+		list = g_renew(unsigned char, list, listsize);
+	    }
+	    size = inv_index_encode(occs, n, index->positional, list, offset);
+	    if (fwrite(list, size, 1, fh) != 1) error = 1;
+	    offset += size;
+	}
 
 	if (!quiet && i % 2000 == 0) 
 	    fprintf(stderr,".");
     }
-    bucket_free(bucket);
+    offsets[index->lastid] = offset;
 
-    fwrite(offsets, sizeof(nat_uint32_t), index->lastid, fh);
+    if (offset <= UINT32_MAX) {
+	nat_uint32_t *offsets32 = g_new(nat_uint32_t, index->lastid + 1);
+	for (i = 0; i <= index->lastid; i++) offsets32[i] = offsets[i];
+	if (!error && fwrite(offsets32, sizeof(nat_uint32_t), index->lastid + 1, fh) != index->lastid + 1)
+	    error = 1;
+	g_free(offsets32);
+    } else if (!error && fwrite(offsets, sizeof(uint64_t), index->lastid + 1, fh) != index->lastid + 1)
+	error = 1;
+    if (!error && (fseek(fh, sizeof(header), SEEK_SET) ||
+		   fwrite(&offset, sizeof(uint64_t), 1, fh) != 1))
+	error = 1;
     if (!quiet) fprintf(stderr,"\n");
 
-    fclose(fh);
-    return 0;
+    g_free(offsets);
+    g_free(occs);
+    g_free(list);
+    if (fclose(fh)) error = 1;
+    return error;
+}
+
+/**
+ * @brief Loads an invertion index file in the old format
+ *
+ * The old format has no header: the number of words, the number of
+ * occurrences, the zero terminated occurrences of each word and the
+ * offset of each word occurrences.  Occurrences are compressed as
+ * they are loaded.
+ */
+static CompactInvIndex *inv_index_compact_load_old(FILE *fh, nat_uint32_t nrwords)
+{
+    nat_uint32_t nrentries, wid, n;
+    nat_uint32_t *entry, *buffer, *occs;
+    uint64_t datasize;
+    CompactInvIndex *cii;
+
+    if (!fread(&nrentries, sizeof(nat_uint32_t), 1, fh)) return NULL;
+
+    entry  = g_new(nat_uint32_t, (size_t) nrentries + nrwords);
+    buffer = g_new(nat_uint32_t, nrwords);
+    if (fread(entry,  sizeof(nat_uint32_t), (size_t) nrentries + nrwords, fh) != (size_t) nrentries + nrwords ||
+	fread(buffer, sizeof(nat_uint32_t), nrwords, fh) != nrwords) {
+	g_free(entry);
+	g_free(buffer);
+	return NULL;
+    }
+
+    datasize = 0;
+    for (wid = 0; wid < nrwords; wid++) {
+	if (buffer[wid] >= (size_t) nrentries + nrwords) buffer[wid] = nrentries + nrwords - 1;
+	for (n = 0; buffer[wid] + n < nrentries + nrwords && entry[buffer[wid] + n]; n++)
+	    ;
+	if (n) datasize += INVINDEX_LIST_SIZE(n, FALSE);
+    }
+
+    cii = inv_index_compact_new(nrwords, nrentries, datasize, FALSE);
+    datasize = 0;
+    for (wid = 0; wid < nrwords; wid++) {
+	cii->offsets[wid] = datasize;
+	occs = entry + buffer[wid];
+	for (n = 0; buffer[wid] + n < nrentries + nrwords && occs[n]; n++)
+	    ;
+	if (n) {
+	    qsort(occs, n, sizeof(nat_uint32_t), &compare);
+	    datasize += inv_index_encode(occs, n, FALSE, cii->data + datasize, datasize);
+	}
+    }
+    cii->offsets[nrwords] = datasize;
+    cii->data = g_renew(unsigned char, cii->data, datasize ? datasize : 1);
+
+    g_free(entry);
+    g_free(buffer);
+    return cii;
 }
 
 /**
  * @brief Loads a compact Invertion Index file
  *
- * This is the only way to load an Invertion Index.
+ * This is the only way to load an Invertion Index. Files in the old
+ * format (raw occurrences) are compressed while loaded.
  *
  * @param filename the name of the file to be loaded
  * @return the newly loaded Compact Invertion Index
  */
 CompactInvIndex *inv_index_compact_load(const char* filename)
 {
-    nat_uint32_t nrwords, nrentries;
+    nat_uint32_t header[4];
+    uint64_t datasize;
+    size_t width;
+    nat_uint32_t i;
     CompactInvIndex *cii;
     FILE *fh;
     fh = fopen(filename, "r");
     if (!fh) return NULL;
 
-    if (!fread(&nrwords,   sizeof(nat_uint32_t), 1, fh)) return NULL;
-    if (!fread(&nrentries, sizeof(nat_uint32_t), 1, fh)) return NULL;
+    if (!fread(header, sizeof(nat_uint32_t), 1, fh)) {
+	fclose(fh);
+	return NULL;
+    }
+
+    if (header[0] != INVINDEX_MAGIC) {
+	cii = inv_index_compact_load_old(fh, header[0]);
+	fclose(fh);
+	return cii;
+    }
 
-    cii = inv_index_compact_new(nrwords, nrentries);
+    if (fread(header + 1, sizeof(nat_uint32_t), 3, fh) != 3 ||
+	(header[1] != INVINDEX_VERSION && header[1] != INVINDEX_VERSION_POSITIONAL) ||
+	!fread(&datasize, sizeof(uint64_t), 1, fh)) {
+	fclose(fh);
+	return NULL;
+    }
+
+    cii = inv_index_compact_new(header[2], header[3], datasize,
+				header[1] == INVINDEX_VERSION_POSITIONAL);
+    width = datasize <= UINT32_MAX ? sizeof(nat_uint32_t) : sizeof(uint64_t);
+    if ((datasize && fread(cii->data, datasize, 1, fh) != 1) ||
+	fread(cii->offsets, width, cii->nrwords + 1, fh) != cii->nrwords + 1) {
+	inv_index_compact_free(cii);
+	fclose(fh);
+	return NULL;
+    }
+    fclose(fh);
 
-    if (!fread(cii->entry,  sizeof(nat_uint32_t), nrentries + nrwords, fh)) return NULL;
-    if (!fread(cii->buffer, sizeof(nat_uint32_t), nrwords, fh)) return NULL;
+    /* widen 32 bit offsets in place, from the last one */
+    if (width == sizeof(nat_uint32_t))
+	for (i = cii->nrwords + 1; i-- > 0; )
+	    cii->offsets[i] = ((nat_uint32_t*) cii->offsets)[i];
 
     return cii;
 }
 
+/**
+ * @brief Checks, from its header, if an invertion index file is
+ *     positional
+ *
+ * @param filename the name of the file
+ * @return true if the file is a positional index
+ */
+nat_boolean_t inv_index_compact_is_positional(const char* filename)
+{
+    nat_uint32_t header[2];
+    FILE *fh;
+    int n;
+
+    fh = fopen(filename, "r");
+    if (!fh) return FALSE;
+    n = fread(header, sizeof(nat_uint32_t), 2, fh);
+    fclose(fh);
+
+    return n == 2 && header[0] == INVINDEX_MAGIC && header[1] == INVINDEX_VERSION_POSITIONAL;
+}
+
 /**
  * @brief Allocates a new Compact Invertion Index object
  *
@@ -274,17 +579,22 @@ CompactInvIndex *inv_index_compact_load(const char* filename)
  *
  * @param nrwords number of words to be stored.
  * @param nrentries number of total occurrences
+ * @param datasize size of the posting lists
+ * @param positional true if the lists have the positions of the occurrences
  * @return the newly created empty Compact Invertion Index object
  */
-CompactInvIndex *inv_index_compact_new(nat_uint32_t nrwords,
-				       nat_uint32_t nrentries)
+CompactInvIndex *inv_index_compact_new(nat_uint32_t  nrwords,
+				       nat_uint32_t  nrentries,
+				       uint64_t      datasize,
+				       nat_boolean_t positional)
 {
     CompactInvIndex *cii;
     cii = g_new(CompactInvIndex, 1);
     cii->nrwords = nrwords;
     cii->nrentries = nrentries;
-    cii->buffer = g_new(nat_uint32_t, nrwords);
-    cii->entry  = g_new(nat_uint32_t, nrwords + nrentries);
+    cii->positional = positional;
+    cii->offsets = g_new(uint64_t, (size_t) nrwords + 1);
+    cii->data    = g_new(unsigned char, datasize ? datasize : 1);
     return cii;
 }
 
@@ -295,8 +605,8 @@ CompactInvIndex *inv_index_compact_new(nat_uint32_t nrwords,
  */
 void inv_index_compact_free(CompactInvIndex *cii) 
 {
-    g_free(cii->entry);
-    g_free(cii->buffer);
+    g_free(cii->data);
+    g_free(cii->offsets);
     g_free(cii);
 }
 
@@ -328,112 +638,391 @@ void inv_index_free(InvIndex *index)
  * @brief Adds a chunk Compact Invertion Index in a main Invertion Index
  *
  * Used to join chunks invertion indexes in a single invertion index.
+ * Positions are kept if both indexes are positional.  A chunk without
+ * positions can not be added to a positional index.
  *
  * @param index the Invertion Index where the information will be added;
  * @param chunk the chunk identification number;
  * @param cii the Compact Invertion Index to be added;
- * @return the Invertion Index after the addition of the Compact Inv. Index
+ * @return the Invertion Index after the addition of the Compact Inv. Index,
+ *     or NULL if the chunk has no positions for a positional index
  */
 InvIndex* inv_index_add_chunk(InvIndex *index,
 			      nat_uchar_t chunk,
 			      CompactInvIndex *cii)
 {
-    nat_uint32_t wid;
+    nat_uint32_t wid, occ, n, i;
+    nat_uint32_t *positions = NULL, size = 0;
+    InvIndexIter iter;
+
+    if (index->positional && !cii->positional) return NULL;
 
     for (wid = 0; wid < cii->nrwords; ++wid) {
-	nat_uint32_t ptr = cii->buffer[wid];
-	while(cii->entry[ptr]) {
-	    index = inv_index_add_occurrence(index, wid, chunk, cii->entry[ptr]);
-	    ptr++;
+	for (occ = inv_index_iter_init(cii, wid, &iter); occ; occ = inv_index_iter_next(&iter)) {
+	    if (index->positional) {
+		n = inv_index_iter_positions(&iter, positions, size);
+		if (n > size) {
+		    size = n;
+		    positions = g_renew(nat_uint32_t, positions, size);
+		    inv_index_iter_positions(&iter, positions, size);
+		}
+		for (i = 0; i < n; i++)
+		    index = inv_index_add_position(index, wid, chunk, occ, positions[i]);
+	    } else
+		index = inv_index_add_occurrence(index, wid, chunk, occ);
 	}
     }
+    g_free(positions);
     return index;
 }
 
+/**
+ * @brief Returns the number of occurrences of a word in a Compact
+ *     Invertion Index
+ *
+ * @param index the Compact Invertion Index
+ * @param wid the word identifier
+ * @return the number of occurrences
+ */
+nat_uint32_t inv_index_compact_count(CompactInvIndex *index, nat_uint32_t wid)
+{
+    const unsigned char *ptr;
+
+    if (wid >= index->nrwords || index->offsets[wid] == index->offsets[wid + 1])
+	return 0;
+    ptr = index->data + index->offsets[wid];
+    return inv_index_get(&ptr);
+}
+
+/**
+ * @brief Moves an iterator to the start of a block of its list
+ */
+static void inv_index_iter_block(InvIndexIter *iter, nat_uint32_t block)
+{
+    const nat_uint32_t *entry = iter->skip + iter->stride * block;
+
+    iter->pos   = block * INVINDEX_BLOCK;
+    iter->value = entry[0];
+    iter->ptr   = iter->deltas + entry[1];
+    if (iter->positions) iter->positions = iter->deltas + entry[2];
+}
+
+/**
+ * @brief Starts iterating over the occurrences of a word, in order
+ *
+ * The iterator holds no memory, and stays valid while the index is
+ * loaded.
+ *
+ * @param index the Compact Invertion Index
+ * @param wid the word identifier
+ * @param iter the iterator to initialize
+ * @return the first packed occurrence, or 0 if there is none
+ */
+nat_uint32_t inv_index_iter_init(CompactInvIndex *index, nat_uint32_t wid,
+				 InvIndexIter *iter)
+{
+    const unsigned char *ptr;
+    nat_uint32_t i;
+
+    iter->count = inv_index_compact_count(index, wid);
+    iter->pos   = 0;
+    if (!iter->count) {
+	iter->positions = NULL;
+	iter->value = 0;
+	return 0;
+    }
+
+    ptr = index->data + index->offsets[wid];
+    inv_index_get(&ptr);
+    iter->stride = index->positional ? 3 : 2;
+
+    if (iter->count <= INVINDEX_BLOCK) {
+	/* a single block, without skip table */
+	iter->skip   = NULL;
+	iter->value  = inv_index_get(&ptr);
+	iter->deltas = iter->ptr = ptr;
+	iter->positions = NULL;
+	if (index->positional) {
+	    for (i = 1; i < iter->count; i++)
+		inv_index_get(&ptr);
+	    iter->positions = ptr;
+	}
+	return iter->value;
+    }
+
+    while ((ptr - index->data) % 4) ptr++;
+    iter->skip      = (const nat_uint32_t*) ptr;
+    iter->deltas    = (const unsigned char*) (iter->skip + iter->stride *
+					      ((iter->count + INVINDEX_BLOCK - 1) / INVINDEX_BLOCK));
+    iter->positions = index->positional ? iter->deltas : NULL;
+    inv_index_iter_block(iter, 0);
+    return iter->value;
+}
+
+/**
+ * @brief Moves an iterator to the next occurrence
+ *
+ * @param iter the iterator
+ * @return the next packed occurrence, or 0 when the list ends
+ */
+nat_uint32_t inv_index_iter_next(InvIndexIter *iter)
+{
+    nat_uint32_t n;
+
+    if (!iter->value) return 0;
+
+    if (iter->pos + 1 >= iter->count)
+	iter->value = 0;
+    else if ((iter->pos + 1) % INVINDEX_BLOCK == 0)
+	inv_index_iter_block(iter, (iter->pos + 1) / INVINDEX_BLOCK);
+    else {
+	iter->pos++;
+	iter->value += inv_index_get(&iter->ptr);
+	if (iter->positions) {
+	    /* skip the positions of the previous occurrence */
+	    for (n = inv_index_get(&iter->positions); n; n--)
+		inv_index_get(&iter->positions);
+	}
+    }
+
+    return iter->value;
+}
+
+/**
+ * @brief Moves an iterator to the first occurrence not smaller than
+ *     a target
+ *
+ * The block of the target is found galloping over the skip table
+ * from the current block, so blocks before the target are not
+ * decoded, and near targets are found in few steps.
+ *
+ * @param iter the iterator
+ * @param target the packed occurrence searched
+ * @return the occurrence found, or 0 if the list ends before
+ */
+nat_uint32_t inv_index_iter_seek(InvIndexIter *iter, nat_uint32_t target)
+{
+    nat_uint32_t block, last, lo, hi, mid, step;
+
+    if (!iter->value || iter->value >= target) return iter->value;
+
+    /* last block starting before the target */
+    block = iter->pos / INVINDEX_BLOCK;
+    last  = (iter->count - 1) / INVINDEX_BLOCK;
+    lo = block; step = 1;
+    while (lo + step <= last && iter->skip[iter->stride * (lo + step)] < target) {
+	lo += step;
+	step *= 2;
+    }
+    hi = min(lo + step - 1, last);
+    while (lo < hi) {
+	mid = lo + (hi - lo + 1) / 2;
+	if (iter->skip[iter->stride * mid] < target) lo = mid;
+	else hi = mid - 1;
+    }
+    if (lo > block) inv_index_iter_block(iter, lo);
+
+    while (iter->value && iter->value < target)
+	inv_index_iter_next(iter);
+    return iter->value;
+}
+
+/**
+ * @brief Gets the positions of the current occurrence of an iterator
+ *
+ * Positions are only kept by positional indexes.
+ *
+ * @param iter the iterator
+ * @param positions where to store the positions, in order (can be NULL)
+ * @param size size of <i>positions</i>
+ * @return the number of positions of the occurrence (only the first
+ *     <i>size</i> are stored), or 0 if the index is not positional
+ */
+nat_uint32_t inv_index_iter_positions(InvIndexIter *iter,
+				      nat_uint32_t *positions, nat_uint32_t size)
+{
+    const unsigned char *ptr = iter->positions;
+    nat_uint32_t n, i, position = 0;
+
+    if (!iter->value || !ptr) return 0;
+
+    n = inv_index_get(&ptr);
+    for (i = 0; i < n && i < size; i++) {
+	position += inv_index_get(&ptr);
+	positions[i] = position;
+    }
+    return n;
+}
+
+/**
+ * @brief Checks if a phrase occurs in a sentence, using the
+ *     positions in a positional index
+ *
+ * Each word of the phrase, but wildcards, needs an iterator over its
+ * list, not past the sentence. The words must occur in consecutive
+ * positions, and wildcards must fall inside the sentence.
+ *
+ * @param iters an iterator for each word of the phrase
+ * @param phrase the zero terminated phrase word identifiers (1 for
+ *               a wildcard)
+ * @param occ the packed sentence
+ * @param length the number of words of the sentence
+ * @return true if the phrase occurs in the sentence
+ */
+nat_boolean_t inv_index_phrase_match(InvIndexIter *iters, const nat_uint32_t *phrase,
+				     nat_uint32_t occ, nat_uint32_t length)
+{
+    nat_uint32_t *starts = NULL, nstarts = 0;
+    nat_uint32_t *positions = NULL, size = 0;
+    nat_uint32_t k, n, i, j, kept;
+    nat_boolean_t first = TRUE;
+
+    for (k = 0; phrase[k] && (first || nstarts); k++) {
+	if (phrase[k] == 1)
+	    ; /* wildcard */
+	else if (inv_index_iter_seek(&iters[k], occ) != occ) {
+	    nstarts = 0;
+	    first = FALSE;
+	} else {
+	    n = inv_index_iter_positions(&iters[k], positions, size);
+	    if (n > size) {
+		size = n;
+		positions = g_renew(nat_uint32_t, positions, size);
+		inv_index_iter_positions(&iters[k], positions, size);
+	    }
+
+	    if (first) {
+		/* phrase starts given by the first word */
+		starts = g_new(nat_uint32_t, n);
+		for (i = 0; i < n; i++)
+		    if (positions[i] >= k) starts[nstarts++] = positions[i] - k;
+		first = FALSE;
+	    } else {
+		/* keep the starts where this word follows */
+		for (i = 0, j = 0, kept = 0; i < nstarts && j < n; ) {
+		    if (starts[i] + k == positions[j]) { starts[kept++] = starts[i++]; j++; }
+		    else if (starts[i] + k < positions[j]) i++;
+		    else j++;
+		}
+		nstarts = kept;
+	    }
+	}
+    }
+
+    /* wildcards must be inside the sentence */
+    while (phrase[k]) k++;
+    if (first)
+	kept = k <= length;
+    else
+	for (i = 0, kept = 0; i < nstarts; i++)
+	    if (starts[i] + k <= length) kept++;
+
+    g_free(starts);
+    g_free(positions);
+    return kept > 0;
+}
+
 /**
  * @brief gets the occurrences for a specific word identifier from a
  *     Compact Invertion Index
  *
+ * The posting list is decoded to a new buffer, to be freed by the
+ * caller. Use inv_index_iter_init to go through the occurrences
+ * without decoding them all.
+ *
  * @param index the Compact Invertion Index to be searched
  * @param wid the word identifier for the occurrences to be retrieved
- * @return a reference to a zero terminated buffer of packed occurrences.
+ * @return a new zero terminated buffer of sorted packed occurrences,
+ *     or NULL if the word is out of the index
  */
 nat_uint32_t* inv_index_compact_get_occurrences(CompactInvIndex *index,
 					   nat_uint32_t wid)
 {
+    nat_uint32_t *occs, occ, i = 0;
+    InvIndexIter iter;
+
     if (wid >= index->nrwords) return NULL;
 
-    return &(index->entry[index->buffer[wid]]);
+    occs = g_new(nat_uint32_t, inv_index_compact_count(index, wid) + 1);
+    for (occ = inv_index_iter_init(index, wid, &iter); occ; occ = inv_index_iter_next(&iter))
+	occs[i++] = occ;
+    occs[i] = 0;
+    return occs;
 }
 
 
 /**
- * @brief intersects two arrays of occurrences
+ * @brief Moves a set of iterators to their first common occurrence
  *
- * @todo Change the function name
+ * The search starts on the current occurrence of the first iterator,
+ * which should be the one with the shortest list: each other
+ * iterator seeks its candidate, and any that goes past it gives the
+ * next candidate. To get the following common occurrence, move the
+ * first iterator with inv_index_iter_next and call this again.
  *
- * @param self a reference to a zero terminated buffer of packed occurrences
- *             to be intersected with <i>other</i>. 
- * @param other a reference to a zero terminated buffer of packed occurrences
- *             to be intersected with <i>self</i>.
- * @return the intersectiong in a new zero-terminated buffer of packed occurrences
+ * @param iters the iterators
+ * @param n number of iterators
+ * @return the common packed occurrence, or 0 if there is none
  */
-nat_uint32_t* intersect(nat_uint32_t *self, nat_uint32_t *other)
+nat_uint32_t inv_index_iter_intersect(InvIndexIter *iters, nat_uint32_t n)
 {
-    nat_uint32_t self_read, new_write, other_read;
-    nat_uint32_t *new;
-    size_t size_self;
-    size_t size_other;
-
-    new = NULL;
+    nat_uint32_t target, occ, i;
 
-    size_self  = self  ? inv_index_buffer_size(self)  : 0;
-    size_other = other ? inv_index_buffer_size(other) : 0;
+    if (!n) return 0;
 
-    if (!size_self) {
-
-	new = g_new(nat_uint32_t, size_other + 1);
-	other_read = 0;
-	while(other[other_read]) {
-	    new[other_read] = other[other_read];
-	    other_read++;
+    target = iters[0].value;
+    i = 1;
+    while (target && i < n) {
+	occ = inv_index_iter_seek(&iters[i], target);
+	if (occ == target)
+	    i++;
+	else if (!occ)
+	    target = 0;
+	else {
+	    target = inv_index_iter_seek(&iters[0], occ);
+	    i = 1;
 	}
-	new[other_read] = other[other_read];
+    }
+    return target;
+}
 
-    } else if (!size_other) {
+/**
+ * @brief Sorts a set of iterators by the length of their lists
+ *
+ * The first one is then the best to drive inv_index_iter_intersect.
+ *
+ * @param iters the iterators
+ * @param n number of iterators
+ */
+void inv_index_iter_sort(InvIndexIter *iters, nat_uint32_t n)
+{
+    qsort(iters, n, sizeof(InvIndexIter), &compare_iters);
+}
 
-	new = g_new(nat_uint32_t, size_self + 1);
-	self_read = 0;
-	while(self[self_read]) {
-	    new[self_read] = self[self_read];
-	    self_read++;
-	}
-	new[self_read] = self[self_read];
+/**
+ * @brief Intersects the posting lists of a set of iterators
+ *
+ * Iterators are sorted by the length of their lists, so that the
+ * shortest one drives the search, and the intersection is written
+ * directly to the result.
+ *
+ * @param iters the iterators, just initialized (they are reordered)
+ * @param n number of iterators
+ * @return a new zero terminated buffer with the sorted common packed
+ *     occurrences
+ */
+nat_uint32_t* inv_index_intersect(InvIndexIter *iters, nat_uint32_t n)
+{
+    nat_uint32_t *occs, occ, i = 0;
 
-    } else {
+    inv_index_iter_sort(iters, n);
 
-	new = g_new(nat_uint32_t, min(size_self, size_other) + 1);
-		
-	qsort(self,  size_self,  sizeof(nat_uint32_t), &compare);
-	qsort(other, size_other, sizeof(nat_uint32_t), &compare);
-
-	self_read = 0;
-	new_write = 0;
-	other_read = 0;
-    
-	while(self[self_read] && other[other_read]) {
-	    if (self[self_read] == other[other_read]) {
-		new[new_write] = self[self_read];
-		new_write++;
-		self_read++;
-		other_read++;
-	    } else if (self[self_read] > other[other_read]) {
-		other_read++;
-	    } else {
-		self_read++;
-	    }
-	}
-	new[new_write] = 0;
+    occs = g_new(nat_uint32_t, (n ? iters[0].count : 0) + 1);
+    for (occ = inv_index_iter_intersect(iters, n); occ;
+	 occ = inv_index_iter_intersect(iters, n)) {
+	occs[i++] = occ;
+	inv_index_iter_next(&iters[0]);
     }
-    return new;
+    occs[i] = 0;
+    return occs;
 }
@@ -37,8 +37,20 @@
 /** @brief the size of the cell to be used on the linked list of occurrences */
 #define CELLSIZE 50
 
+#include <stdint.h>
 #include "standard.h"
-#include "bucket.h"
+
+/** @brief magic number of compressed invertion index files */
+#define INVINDEX_MAGIC 0x58444921
+
+/** @brief version of the compressed invertion index files */
+#define INVINDEX_VERSION 2
+
+/** @brief version of the compressed invertion index files with positions */
+#define INVINDEX_VERSION_POSITIONAL 3
+
+/** @brief number of occurrences in each block of a posting list */
+#define INVINDEX_BLOCK 128
 
 /**
  * @brief Structure for each word occurrence
@@ -70,26 +82,69 @@ typedef struct cInvIndex {
     nat_uint32_t lastid;
     /** number of entries */
     nat_uint32_t nrentries;
+    /** true if positions are kept (entries are pairs of occurrence and position) */
+    nat_boolean_t positional;
     /** array list */
     struct cInvIndexEntry **buffer;
 } InvIndex;
 
 /**
  * @brief Compact structure for the invertion index
+ *
+ * Each word has a posting list: its packed occurrences, sorted, in
+ * blocks of INVINDEX_BLOCK.  A list is the number of occurrences, a
+ * skip table with the first occurrence and the offset of the deltas
+ * of each block, and the deltas between consecutive occurrences of
+ * each block.  Numbers are variable length integers (7 bits per
+ * byte, least significant first), but the skip table, which starts
+ * at a 4 byte boundary.  Lists of a single block have, instead of
+ * the skip table, their first occurrence.
+ *
+ * On positional indexes the skip table has also the offset (from the
+ * deltas) of the positions of each block, stored after the deltas:
+ * for each occurrence, the number of positions of the word in the
+ * sentence, the first one and the deltas between them.
  */
 typedef struct cCompactInvIndex {
-    /** buffer for offsets for each word */
-    nat_uint32_t *buffer;
-    /** number of words (also, size of buffer) */
-    nat_uint32_t nrwords;
-    /** buffer for occurrences (size is nrwords + nrentries) */
-    nat_uint32_t *entry;
+    /** offset of the posting list of each word on data (nrwords + 1) */
+    uint64_t      *offsets;
+    /** number of words */
+    nat_uint32_t   nrwords;
+    /** the posting lists */
+    unsigned char *data;
     /** number of occurrences  */
-    nat_uint32_t nrentries;
+    nat_uint32_t   nrentries;
+    /** true if the lists have positions */
+    nat_boolean_t  positional;
 } CompactInvIndex;
 
+/**
+ * @brief Iterator over the posting list of a word, decoding it on
+ * demand
+ */
+typedef struct cInvIndexIter {
+    /** skip table of the list (first occurrence and offset of each block),
+	NULL for lists of a single block */
+    const nat_uint32_t  *skip;
+    /** deltas of the list */
+    const unsigned char *deltas;
+    /** next delta to decode */
+    const unsigned char *ptr;
+    /** positions of the current occurrence, NULL if the index is not positional */
+    const unsigned char *positions;
+    /** number of integers of each skip table entry */
+    nat_uint32_t         stride;
+    /** number of occurrences on the list */
+    nat_uint32_t         count;
+    /** position of the current occurrence */
+    nat_uint32_t         pos;
+    /** the current occurrence, 0 when the list ended */
+    nat_uint32_t         value;
+} InvIndexIter;
+
 InvIndex*        inv_index_new(
-                         nat_uint32_t original_size);
+                         nat_uint32_t original_size,
+			 nat_boolean_t positional);
 
 InvIndex*        inv_index_add_occurrence(
                          InvIndex *index,
@@ -97,6 +152,13 @@ InvIndex*        inv_index_add_occurrence(
 			 nat_uchar_t  chunk,
 			 nat_uint32_t sentence);
 
+InvIndex*        inv_index_add_position(
+                         InvIndex *index,
+			 nat_uint32_t wid,
+			 nat_uchar_t  chunk,
+			 nat_uint32_t sentence,
+			 nat_uint32_t position);
+
 int inv_index_save_hash(InvIndex *index, const char *filename, nat_boolean_t quiet);
 
 void             inv_index_free(
@@ -104,16 +166,26 @@ void             inv_index_free(
 
 CompactInvIndex *inv_index_compact_new(
                          nat_uint32_t nrwords,
-			 nat_uint32_t nrentries);
+			 nat_uint32_t nrentries,
+			 uint64_t     datasize,
+			 nat_boolean_t positional);
 
 CompactInvIndex *inv_index_compact_load(const char* filename);
+nat_boolean_t   inv_index_compact_is_positional(const char* filename);
 InvIndex*       inv_index_add_chunk(InvIndex *index, nat_uchar_t chunk, CompactInvIndex *cii);
 void            inv_index_compact_free(CompactInvIndex *cii);
 nat_uint32_t*   inv_index_compact_get_occurrences(CompactInvIndex *index, nat_uint32_t wid);
+nat_uint32_t    inv_index_compact_count(CompactInvIndex *index, nat_uint32_t wid);
+nat_uint32_t    inv_index_iter_init(CompactInvIndex *index, nat_uint32_t wid, InvIndexIter *iter);
+nat_uint32_t    inv_index_iter_next(InvIndexIter *iter);
+nat_uint32_t    inv_index_iter_seek(InvIndexIter *iter, nat_uint32_t target);
+nat_uint32_t    inv_index_iter_positions(InvIndexIter *iter, nat_uint32_t *positions, nat_uint32_t size);
+nat_boolean_t   inv_index_phrase_match(InvIndexIter *iters, const nat_uint32_t *phrase,
+                                       nat_uint32_t occ, nat_uint32_t length);
+void            inv_index_iter_sort(InvIndexIter *iters, nat_uint32_t n);
+nat_uint32_t    inv_index_iter_intersect(InvIndexIter *iters, nat_uint32_t n);
+nat_uint32_t*   inv_index_intersect(InvIndexIter *iters, nat_uint32_t n);
 nat_uint32_t    unpack( nat_uint32_t packed, nat_uchar_t *character);
 nat_uint32_t    pack(nat_uint32_t integer, nat_uchar_t character);
-nat_uint32_t*   intersect(nat_uint32_t *self, nat_uint32_t *other);
-
-/* size_t inv_index_buffer_size(nat_uint32_t *buffer); */
 
 #endif /* __INVINDEX_H__ */
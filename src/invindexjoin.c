@@ -38,9 +38,13 @@ int main(int argc, char *argv[]) {
     } else {
 	InvIndex *full_index;
 	nat_uchar_t chunk;
+	nat_boolean_t positional = TRUE;
 	int i;
 
-	full_index = inv_index_new(150000);
+	/* the index is positional if all the chunk indexes are */
+	for (i=2; i<argc; i++)
+	    if (!inv_index_compact_is_positional(argv[i])) positional = FALSE;
+	full_index = inv_index_new(150000, positional);
 
 	fprintf(stderr, " Creating index");
 	for (i=2, chunk = 1; i<argc; i++, chunk++) {
@@ -48,6 +52,8 @@ int main(int argc, char *argv[]) {
 	    fprintf(stderr, ".");
 
 	    cii = inv_index_compact_load(argv[i]);
+	    if (!cii) report_error("Can't load index %s", argv[i]);
+
 	    full_index = inv_index_add_chunk(full_index, chunk, cii);
 	    inv_index_compact_free(cii);
 	}
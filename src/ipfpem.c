@@ -0,0 +1,784 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ipfpem.h"
+
+/**
+ * @file
+ * @brief Implementation of the IPFP EM-Algorithm variant
+ */
+
+/**
+ * @brief Number of steps for IPFP algorithm
+ */
+#define NSTEPS 500
+
+/**
+ * @brief Number of sentence pairs given to each thread in each round
+ * of the parallel E-step
+ */
+#define ROUNDSIZE 2048
+
+#if 0
+/* not being used */
+static void printEntropy(struct cMatrix *M, int M1, int empty)
+{ 
+    double h, hx, hy, hygx, hxgy, uygx, uxgy, uxy;
+    if (empty) {
+	h = log(GetNRow(M) * GetNColumn(M));
+	hx = log(GetNRow(M));
+	hy = log(GetNColumn(M));
+	hygx = h - hx;
+	hxgy = h - hy;
+	uygx = (hy - hygx) / hy;
+	uxgy = (hx - hxgy) / hx;
+	uxy = 2.0f * (hx + hy - h) / (hx + hy);
+    }
+    else
+	MatrixEntropy(M, M1, &h, &hx, &hy, &hygx, &hxgy, &uygx, &uxgy, &uxy);
+    fprintf(stderr, "  Entropy of x variable:   H(x)   = %f\n", hx);
+    fprintf(stderr, "  Entropy of y variable:   H(y)   = %f\n", hy);
+    fprintf(stderr, "  Entropy of y given x:    H(y|x) = %f\n", hygx);
+    fprintf(stderr, "  Entropy of x given y:    H(x|y) = %f\n", hxgy);
+    fprintf(stderr, "  Table entropy:           H(x,y) = %f\n\n", h);
+
+    fprintf(stderr, "  Dependency of y given x: U(y|x) = %f\n", uygx);
+    fprintf(stderr, "  Dependency of x given y: U(x|y) = %f\n", uxgy);
+    fprintf(stderr, "  Symmetrical dependency:  U(x,y) = %f\n", uxy);
+}
+#endif
+
+
+
+/* EM algorithm */
+
+static nat_uint32_t MarginalCounts(CorpusCell *s, nat_uint32_t *st,
+			      nat_uint32_t *n, nat_uint32_t l,
+			      nat_uint32_t nullwrd)
+{
+    nat_uint32_t i, j, lt;
+    i = 0;
+    lt = 0;
+    while (s[i].word) {
+	j = 0;
+	while (j < lt && st[j] < s[i].word) j++;
+	if (j == lt) {
+	    n[lt] = 1;
+	    st[lt++] = s[i].word;
+	}
+	else {
+	    if (st[j] == s[i].word)
+		n[j] += 1;
+	    else {
+		memmove(st + j + 1, st + j, sizeof(nat_uint32_t) * (lt - j));
+		memmove( n + j + 1,  n + j, sizeof(nat_uint32_t) * (lt - j));
+		n[j] = 1;
+		st[j] = s[i].word;
+		lt++;
+	    }
+	}
+	i++;
+    }
+    if (i < l) {
+	memmove(st + 1, st, sizeof(nat_uint32_t) * lt);
+	memmove( n + 1, n,  sizeof(nat_uint32_t) * lt);
+	st[0] = nullwrd;
+	n[0] = l - i;
+	lt++;
+    }
+    st[lt] = 0;
+    n[lt] = 0;
+    return lt;
+}
+
+static double MarginalProbs(double *p, double *pi, double *pj, nat_uint32_t lr, nat_uint32_t lc)
+{
+    double total, f;
+    nat_uint32_t r, c;
+    total = 0.0f;
+    for (c = 0; c < lc; c++) pj[c] = 0;
+    for (r = 0; r < lr; r++) {
+	pi[r] = 0;
+	for (c = 0; c < lc; c++) {
+	    f = p[r*lc + c];
+	    pj[c] += f;
+	    pi[r] += f;
+	}
+	total += pi[r];
+    }
+    return total;
+}
+
+/*
+ * IPFP kernels.
+ *
+ * The contingency table is a compact lr x lc tile (row stride lc).
+ * Each IPFP step scales the rows to their marginals, summing the
+ * column marginals, and then scales the columns, summing the row
+ * marginals. The vectorized versions add the same values in the same
+ * order as the scalar one (each vector lane holds a different column
+ * or row), so all kernels give the very same results.
+ */
+
+/**
+ * @brief Scales each row r of the tile by fi[r], summing the columns in pj
+ */
+typedef void (*ScaleRowsFunc)(double *p, const double *fi, double *pj,
+                              nat_uint32_t lr, nat_uint32_t lc);
+
+/**
+ * @brief Scales each column c of the tile by fj[c], summing the rows in pi
+ */
+typedef void (*ScaleColumnsFunc)(double *p, const double *fj, double *pi,
+                                 nat_uint32_t lr, nat_uint32_t lc);
+
+static void ScaleRowsScalar(double *p, const double *fi, double *pj,
+                            nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c;
+    double *row;
+
+    for (c = 0; c < lc; c++) pj[c] = 0;
+    for (r = 0; r < lr; r++) {
+	row = p + r * lc;
+	for (c = 0; c < lc; c++) {
+	    row[c] *= fi[r];
+	    pj[c] += row[c];
+	}
+    }
+}
+
+static void ScaleColumnsScalar(double *p, const double *fj, double *pi,
+                               nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c;
+    double *row, sum;
+
+    for (r = 0; r < lr; r++) {
+	row = p + r * lc;
+	sum = 0;
+	for (c = 0; c < lc; c++) {
+	    row[c] *= fj[c];
+	    sum += row[c];
+	}
+	pi[r] = sum;
+    }
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+/**
+ * @brief Vectorized kernels are available for this platform
+ */
+#define IPFP_SIMD 1
+
+__attribute__((target("sse2")))
+static void ScaleRowsSSE2(double *p, const double *fi, double *pj,
+                          nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c;
+    __m128d f, x;
+    double *row;
+
+    for (c = 0; c < lc; c++) pj[c] = 0;
+    for (r = 0; r < lr; r++) {
+	row = p + r * lc;
+	f = _mm_set1_pd(fi[r]);
+	for (c = 0; c + 2 <= lc; c += 2) {
+	    x = _mm_mul_pd(_mm_loadu_pd(row + c), f);
+	    _mm_storeu_pd(row + c, x);
+	    _mm_storeu_pd(pj + c, _mm_add_pd(_mm_loadu_pd(pj + c), x));
+	}
+	for (; c < lc; c++) {
+	    row[c] *= fi[r];
+	    pj[c] += row[c];
+	}
+    }
+}
+
+/* rows are handled in pairs: after a 2x2 transpose, each lane of the
+   accumulator sums one of the rows, column after column */
+__attribute__((target("sse2")))
+static void ScaleColumnsSSE2(double *p, const double *fj, double *pi,
+                             nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c;
+    __m128d g, a, b, acc;
+    double *r0, *r1, sum[2];
+
+    for (r = 0; r + 2 <= lr; r += 2) {
+	r0 = p + r * lc;
+	r1 = r0 + lc;
+	acc = _mm_setzero_pd();
+	for (c = 0; c + 2 <= lc; c += 2) {
+	    g = _mm_loadu_pd(fj + c);
+	    a = _mm_mul_pd(_mm_loadu_pd(r0 + c), g);
+	    b = _mm_mul_pd(_mm_loadu_pd(r1 + c), g);
+	    _mm_storeu_pd(r0 + c, a);
+	    _mm_storeu_pd(r1 + c, b);
+	    acc = _mm_add_pd(acc, _mm_unpacklo_pd(a, b));
+	    acc = _mm_add_pd(acc, _mm_unpackhi_pd(a, b));
+	}
+	_mm_storeu_pd(sum, acc);
+	for (; c < lc; c++) {
+	    r0[c] *= fj[c];
+	    sum[0] += r0[c];
+	    r1[c] *= fj[c];
+	    sum[1] += r1[c];
+	}
+	pi[r]     = sum[0];
+	pi[r + 1] = sum[1];
+    }
+    if (r < lr)
+	ScaleColumnsScalar(p + r * lc, fj, pi + r, lr - r, lc);
+}
+
+__attribute__((target("avx2")))
+static void ScaleRowsAVX2(double *p, const double *fi, double *pj,
+                          nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c;
+    __m256d f, x;
+    double *row;
+
+    for (c = 0; c < lc; c++) pj[c] = 0;
+    for (r = 0; r < lr; r++) {
+	row = p + r * lc;
+	f = _mm256_set1_pd(fi[r]);
+	for (c = 0; c + 4 <= lc; c += 4) {
+	    x = _mm256_mul_pd(_mm256_loadu_pd(row + c), f);
+	    _mm256_storeu_pd(row + c, x);
+	    _mm256_storeu_pd(pj + c, _mm256_add_pd(_mm256_loadu_pd(pj + c), x));
+	}
+	for (; c < lc; c++) {
+	    row[c] *= fi[r];
+	    pj[c] += row[c];
+	}
+    }
+}
+
+/* same as the SSE2 version, with blocks of four rows and a 4x4
+   transpose */
+__attribute__((target("avx2")))
+static void ScaleColumnsAVX2(double *p, const double *fj, double *pi,
+                             nat_uint32_t lr, nat_uint32_t lc)
+{
+    nat_uint32_t r, c, k;
+    __m256d g, a0, a1, a2, a3, t0, t1, t2, t3, acc;
+    double *row[4], sum[4];
+
+    for (r = 0; r + 4 <= lr; r += 4) {
+	for (k = 0; k < 4; k++) row[k] = p + (r + k) * lc;
+	acc = _mm256_setzero_pd();
+	for (c = 0; c + 4 <= lc; c += 4) {
+	    g  = _mm256_loadu_pd(fj + c);
+	    a0 = _mm256_mul_pd(_mm256_loadu_pd(row[0] + c), g);
+	    a1 = _mm256_mul_pd(_mm256_loadu_pd(row[1] + c), g);
+	    a2 = _mm256_mul_pd(_mm256_loadu_pd(row[2] + c), g);
+	    a3 = _mm256_mul_pd(_mm256_loadu_pd(row[3] + c), g);
+	    _mm256_storeu_pd(row[0] + c, a0);
+	    _mm256_storeu_pd(row[1] + c, a1);
+	    _mm256_storeu_pd(row[2] + c, a2);
+	    _mm256_storeu_pd(row[3] + c, a3);
+	    t0 = _mm256_unpacklo_pd(a0, a1);
+	    t1 = _mm256_unpackhi_pd(a0, a1);
+	    t2 = _mm256_unpacklo_pd(a2, a3);
+	    t3 = _mm256_unpackhi_pd(a2, a3);
+	    acc = _mm256_add_pd(acc, _mm256_permute2f128_pd(t0, t2, 0x20));
+	    acc = _mm256_add_pd(acc, _mm256_permute2f128_pd(t1, t3, 0x20));
+	    acc = _mm256_add_pd(acc, _mm256_permute2f128_pd(t0, t2, 0x31));
+	    acc = _mm256_add_pd(acc, _mm256_permute2f128_pd(t1, t3, 0x31));
+	}
+	_mm256_storeu_pd(sum, acc);
+	for (; c < lc; c++) {
+	    for (k = 0; k < 4; k++) {
+		row[k][c] *= fj[c];
+		sum[k] += row[k][c];
+	    }
+	}
+	for (k = 0; k < 4; k++) pi[r + k] = sum[k];
+    }
+    if (r < lr)
+	ScaleColumnsSSE2(p + r * lc, fj, pi + r, lr - r, lc);
+}
+
+#endif /* x86 */
+
+/**
+ * @brief Row scaling kernel in use (see SelectKernels)
+ */
+static ScaleRowsFunc ScaleRows = ScaleRowsScalar;
+
+/**
+ * @brief Column scaling kernel in use (see SelectKernels)
+ */
+static ScaleColumnsFunc ScaleColumns = ScaleColumnsScalar;
+
+/**
+ * @brief Chooses the fastest IPFP kernels supported by the processor
+ *
+ * Must be called before the E-step threads are started.
+ *
+ * @return the name of the kernels chosen
+ */
+const char *IPFPKernels(void)
+{
+#ifdef IPFP_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+	ScaleRows = ScaleRowsAVX2;
+	ScaleColumns = ScaleColumnsAVX2;
+	return "avx2";
+    }
+    if (__builtin_cpu_supports("sse2")) {
+	ScaleRows = ScaleRowsSSE2;
+	ScaleColumns = ScaleColumnsSSE2;
+	return "sse2";
+    }
+#endif
+    return "scalar";
+}
+
+/**
+ * @brief Iterative proportional fitting of a lr x lc tile
+ *
+ * Scales p until its row marginals (pi) match the word counts ni and
+ * its column marginals (pj) match nj, or for NSTEPS steps.
+ *
+ * @param f scratch array for the scaling factors (MAXLEN entries)
+ */
+static void IPFP(double  *p, double  *pi, double  *pj, double *f,
+		 nat_uint32_t *ni, nat_uint32_t *nj, nat_uint32_t  lr, nat_uint32_t  lc)
+{
+    nat_boolean_t ready;
+    nat_uint32_t r, c;
+    nat_uint32_t steps = NSTEPS;
+
+    ready = FALSE;
+
+    while (!ready && steps) {
+	steps --;
+
+	for (r = 0; r < lr; r++) f[r] = (double) ni[r] / pi[r];
+	ScaleRows(p, f, pj, lr, lc);
+
+	for (c = 0; c < lc; c++) f[c] = (double) nj[c] / pj[c];
+	ScaleColumns(p, f, pi, lr, lc);
+
+	ready = TRUE;
+	r = 0;
+	while (ready && r < lr) {
+	    double x;
+	    if ((x = fabs((double)(pi[r] - ni[r]))) > 0.01f) {
+		ready = FALSE;
+	    }
+	    r++;
+	}
+    }
+}
+
+static double OddsRatio(double pij, double pi, double pj, double p)
+{
+    double pr;
+
+    pr = (pi-pij)*(pj-pij);
+    if (pr == 0.0f)
+	return (double) 1.0E17f;
+    else {
+	pr = (pij*(p-pi-pj+pij)) / pr;
+	return pr;  
+    }
+}
+
+/**
+ * @brief Work buffers used to estimate the counts of one sentence pair
+ */
+typedef struct cEMWorkspace {
+    /** partial matrix probabilities and their marginals */
+    double       *p, *pi, *pj;
+    /** scaling factors used by IPFP */
+    double       *f;
+    /** estimated counts and their marginals */
+    double       *e, *ei, *ej;
+    /** sorted word identifiers of both sentences */
+    nat_uint32_t *st1, *st2;
+    /** word counts of both sentences */
+    nat_uint32_t *ni, *nj;
+    /** number of different words (rows and columns) in the estimate */
+    nat_uint32_t  lr, lc;
+} EMWorkspace;
+
+/**
+ * @brief Cell of the thread-local accumulator of the parallel E-step
+ */
+typedef struct cEMCount {
+    /** matrix row (source word identifier) */
+    nat_uint32_t row;
+    /** matrix column (target word identifier) */
+    nat_uint32_t column;
+    /** accumulated count */
+    double       value;
+} EMCount;
+
+/**
+ * @brief State of an E-step worker thread
+ */
+typedef struct cEMWorker {
+    /** the thread running this worker */
+    pthread_t     thread;
+    /** per-sentence buffers, private to the worker */
+    EMWorkspace  *ws;
+    /** the matrix being estimated (read only while workers run) */
+    Matrix       *M;
+    /** the matrix copy to read probabilities from */
+    MatrixVal     M1;
+    /** last step flag (see EMalgorithm) */
+    int           last;
+    /** slice of the source sentences assigned to this worker */
+    CorpusCell  **s1;
+    /** slice of the target sentences assigned to this worker */
+    CorpusCell  **s2;
+    /** number of sentence pairs in the slice */
+    nat_uint32_t  n;
+    /** sparse accumulator, sorted and without duplicates after a round */
+    EMCount      *counts;
+    /** number of cells used in the accumulator */
+    nat_uint32_t  ncounts;
+    /** number of cells allocated for the accumulator */
+    nat_uint32_t  size;
+} EMWorker;
+
+static EMWorkspace *EMWorkspaceNew(void)
+{
+    EMWorkspace *ws = g_new(EMWorkspace, 1);
+
+    ws->p   = g_new(double, MAXLEN * MAXLEN);
+    ws->pi  = g_new(double, MAXLEN);
+    ws->pj  = g_new(double, MAXLEN);
+    ws->f   = g_new(double, MAXLEN);
+    ws->e   = g_new(double, MAXLEN * MAXLEN);
+    ws->ei  = g_new(double, MAXLEN);
+    ws->ej  = g_new(double, MAXLEN);
+    ws->st1 = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->st2 = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->ni  = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->nj  = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->lr  = ws->lc = 0;
+
+    return ws;
+}
+
+static void EMWorkspaceFree(EMWorkspace *ws)
+{
+    g_free(ws->p);
+    g_free(ws->pi);
+    g_free(ws->pj);
+    g_free(ws->f);
+    g_free(ws->e);
+    g_free(ws->ei);
+    g_free(ws->ej);
+    g_free(ws->st1);
+    g_free(ws->st2);
+    g_free(ws->ni);
+    g_free(ws->nj);
+    g_free(ws);
+}
+
+/**
+ * @brief Estimates the counts for a sentence pair
+ *
+ * Only reads the M1 copy of the matrix, so it can be called from
+ * several threads at the same time. The estimate is left in the
+ * workspace: ws->e is a ws->lr x ws->lc table (stride ws->lc) for
+ * the words in ws->st1 and ws->st2.
+ *
+ * @return FALSE if the sentence pair is too long to be estimated
+ */
+static nat_boolean_t EstimateSentence(EMWorkspace *ws, Matrix *M, MatrixVal M1,
+                                      CorpusCell *s1, CorpusCell *s2, int last)
+{
+    double *p = ws->p, *pi = ws->pi, *pj = ws->pj;
+    double *e = ws->e, *ei = ws->ei, *ej = ws->ej;
+    double pN, nij;
+    nat_uint32_t r, c, lr, lc, l;
+
+    l = max(corpus_sentence_length(s1),
+            corpus_sentence_length(s2));
+    if (l > MAXLEN) return FALSE;
+
+    lr = MarginalCounts(s1, ws->st1, ws->ni, l, 1);
+    lc = MarginalCounts(s2, ws->st2, ws->nj, l, 1);
+    if (GetPartialMatrix(M, M1, ws->st1, ws->st2, p, lc))
+        report_error("EMalgorithm: GetPartialMatrix");
+    pN = MarginalProbs(p, pi, pj, lr, lc);
+    for (c = 0; c < lc; c++)
+        ej[c] = 0;
+    for (r = 0; r < lr; r++) {
+        ei[r] = 0;
+        for (c = 0; c < lc; c++) {
+            nij = OddsRatio(p[r*lc + c], pi[r], pj[c], pN);
+            e[r * lc + c] = nij;
+            ei[r] += nij;
+            ej[c] += nij;
+        }
+    }
+    IPFP(e, ei, ej, ws->f, ws->ni, ws->nj, lr, lc);
+    if (last) {
+        if (ws->st1[0] == 1) {
+            for (c = 0; c < lc; c++) {
+                for (r = 1; r < lr; r++)
+                    e[r * lc + c] += e[0*lc + c] / (lr - 1);
+                e[0 * lc + c] = 0.0f;
+            }
+        }
+        if (ws->st2[0] == 1) {
+            for (r = 0; r < lr; r++) {
+                for (c = 1; c < lc; c++)
+                    e[r * lc + c] += e[r*lc + 0] / (lc - 1);
+                e[r*lc + 0] = 0.0f;
+            }
+        }
+    }
+    ws->lr = lr;
+    ws->lc = lc;
+    return TRUE;
+}
+
+static int CompareCounts(const void *a, const void *b)
+{
+    const EMCount *x = (const EMCount*)a;
+    const EMCount *y = (const EMCount*)b;
+
+    if (x->row != y->row) return x->row < y->row ? -1 : 1;
+    if (x->column != y->column) return x->column < y->column ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Body of an E-step worker thread
+ *
+ * Estimates every sentence pair of its slice, appending the counts to
+ * the worker accumulator, that is then sorted by (row, column) with
+ * repeated cells summed up.
+ */
+static void *EMWorkerRun(void *data)
+{
+    EMWorker *w = (EMWorker*)data;
+    EMWorkspace *ws = w->ws;
+    nat_uint32_t i, j, r, c;
+
+    w->ncounts = 0;
+    for (i = 0; i < w->n; i++) {
+        if (!EstimateSentence(ws, w->M, w->M1, w->s1[i], w->s2[i], w->last))
+            continue;
+        if (w->ncounts + ws->lr * ws->lc > w->size) {
+            w->size = max(2 * w->size, w->ncounts + ws->lr * ws->lc);
+            w->counts = g_renew(EMCount, w->counts, w->size);
+        }
+        for (r = 0; r < ws->lr; r++) {
+            for (c = 0; c < ws->lc; c++) {
+                w->counts[w->ncounts].row    = ws->st1[r];
+                w->counts[w->ncounts].column = ws->st2[c];
+                w->counts[w->ncounts].value  = ws->e[r * ws->lc + c];
+                w->ncounts++;
+            }
+        }
+    }
+
+    if (w->ncounts) {
+        qsort(w->counts, w->ncounts, sizeof(EMCount), CompareCounts);
+        for (i = 0, j = 1; j < w->ncounts; j++) {
+            if (w->counts[j].row == w->counts[i].row &&
+                w->counts[j].column == w->counts[i].column)
+                w->counts[i].value += w->counts[j].value;
+            else
+                w->counts[++i] = w->counts[j];
+        }
+        w->ncounts = i + 1;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Serial E-step: estimates each sentence pair in turn
+ *
+ * The counts are buffered and merged into M2 in batches. This is
+ * safe, as estimates only read the M1 copy of the matrix.
+ */
+static void SerialEStep(nat_boolean_t quiet, Matrix *M, MatrixVal M1, MatrixVal M2,
+                        Corpus *C1, Corpus *C2, int last)
+{
+    EMWorkspace *ws = EMWorkspaceNew();
+    MatrixBatch *batch;
+    nat_uint32_t k, length, r, c;
+    CorpusCell *s1, *s2;
+
+    batch = MatrixBatchNew(M, M2, MATRIX_BATCH);
+    if (!batch) report_error("EMalgorithm: MatrixBatchNew failed");
+
+    k = 0;
+    length = corpus_sentences_nr(C1);
+    s1 = corpus_first_sentence(C1);
+    s2 = corpus_first_sentence(C2);
+    while (s1 != NULL && s2 != NULL) {
+	if (!quiet) fprintf(stderr, "\b\b\b\b\b%4.1f%%", (double) (k++) * 99.9f / (double) length);
+	if (EstimateSentence(ws, M, M1, s1, s2, last)) {
+	    for (r = 0; r < ws->lr; r++) {
+		for (c = 0; c < ws->lc; c++) {
+		    if (MatrixBatchInc(batch, ws->e[r * ws->lc + c], ws->st1[r], ws->st2[c]))
+			report_error("EMalgorithm: MatrixBatchInc failed");
+		}
+	    }
+	}
+	s1 = corpus_next_sentence(C1);
+	s2 = corpus_next_sentence(C2);
+    }
+
+    if (MatrixBatchFlush(batch))
+	report_error("EMalgorithm: MatrixBatchFlush failed");
+    MatrixBatchFree(batch);
+    EMWorkspaceFree(ws);
+}
+
+/**
+ * @brief Parallel E-step
+ *
+ * The sentence pairs are read in rounds of nthreads * ROUNDSIZE
+ * pairs, and each round is split in nthreads contiguous slices, one
+ * per worker. Workers only read the M1 copy of the matrix and keep
+ * their counts in private accumulators, that are merged into M2, in
+ * worker order, when all workers finished the round. Thus, the
+ * resulting matrix only depends on the number of threads used.
+ */
+static void ParallelEStep(nat_boolean_t quiet, Matrix *M, MatrixVal M1, MatrixVal M2,
+                          Corpus *C1, Corpus *C2, int last, int nthreads)
+{
+    EMWorker *workers = g_new0(EMWorker, nthreads);
+    MatrixBatch *batch;
+    CorpusCell **pairs1 = g_new(CorpusCell*, nthreads * ROUNDSIZE);
+    CorpusCell **pairs2 = g_new(CorpusCell*, nthreads * ROUNDSIZE);
+    nat_uint32_t k, n, i, length, from, to;
+    CorpusCell *s1, *s2;
+    int t;
+
+    batch = MatrixBatchNew(M, M2, MATRIX_BATCH);
+    if (!batch) report_error("EMalgorithm: MatrixBatchNew failed");
+
+    for (t = 0; t < nthreads; t++) {
+        workers[t].ws   = EMWorkspaceNew();
+        workers[t].M    = M;
+        workers[t].M1   = M1;
+        workers[t].last = last;
+    }
+
+    k = 0;
+    length = corpus_sentences_nr(C1);
+    s1 = corpus_first_sentence(C1);
+    s2 = corpus_first_sentence(C2);
+    while (s1 != NULL && s2 != NULL) {
+        if (!quiet) fprintf(stderr, "\b\b\b\b\b%4.1f%%", (double) k * 99.9f / (double) length);
+
+        n = 0;
+        while (n < nthreads * ROUNDSIZE && s1 != NULL && s2 != NULL) {
+            pairs1[n] = s1;
+            pairs2[n] = s2;
+            n++;
+            s1 = corpus_next_sentence(C1);
+            s2 = corpus_next_sentence(C2);
+        }
+
+        for (t = 0; t < nthreads; t++) {
+            from = (nat_uint32_t) (((double) n * t) / nthreads);
+            to   = (nat_uint32_t) (((double) n * (t + 1)) / nthreads);
+            workers[t].s1 = pairs1 + from;
+            workers[t].s2 = pairs2 + from;
+            workers[t].n  = to - from;
+            if (pthread_create(&workers[t].thread, NULL, EMWorkerRun, workers + t))
+                report_error("EMalgorithm: cannot create worker thread");
+        }
+        for (t = 0; t < nthreads; t++)
+            pthread_join(workers[t].thread, NULL);
+
+        for (t = 0; t < nthreads; t++) {
+            for (i = 0; i < workers[t].ncounts; i++) {
+                if (MatrixBatchInc(batch, workers[t].counts[i].value,
+                                   workers[t].counts[i].row, workers[t].counts[i].column))
+                    report_error("EMalgorithm: MatrixBatchInc failed");
+            }
+        }
+        k += n;
+    }
+
+    if (MatrixBatchFlush(batch))
+        report_error("EMalgorithm: MatrixBatchFlush failed");
+    MatrixBatchFree(batch);
+
+    for (t = 0; t < nthreads; t++) {
+        EMWorkspaceFree(workers[t].ws);
+        g_free(workers[t].counts);
+    }
+    g_free(workers);
+    g_free(pairs1);
+    g_free(pairs2);
+}
+
+/**
+ * @brief One step of the IPFP EM-Algorithm
+ *
+ * Estimates the counts from the matrix copy of the previous step (the
+ * second copy on even steps), into the other copy.
+ *
+ * @param last true on the last step, when null word counts are spread
+ * over the other words
+ * @param nthreads number of threads of the E-step
+ */
+void IPFPStep(nat_boolean_t quiet, Matrix *M, Corpus *C1, Corpus *C2,
+              int step, int last, int nthreads)
+{
+    MatrixVal M1, M2;
+
+    if (step % 2) {
+        M1 = MATRIX_1;
+        M2 = MATRIX_2; 
+    } else {
+        M1 = MATRIX_2;
+        M2 = MATRIX_1;
+    }
+
+    if (!quiet) fprintf(stderr, "Step %d of the EM-algorithm:      ", step);
+
+    ClearMatrix(M, M2);
+    if (nthreads > 1)
+        ParallelEStep(quiet, M, M1, M2, C1, C2, last, nthreads);
+    else
+        SerialEStep(quiet, M, M1, M2, C1, C2, last);
+
+    if (!quiet) printf("\b\b\b\b\bdone \n");
+}
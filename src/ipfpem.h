@@ -0,0 +1,50 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __IPFPEM_H__
+#define __IPFPEM_H__
+
+/**
+ * @file
+ * @brief Header file for the IPFP EM-Algorithm variant
+ */
+
+#include "standard.h"
+#include <NATools/corpus.h>
+#include "matrix.h"
+
+/**
+ * @brief Maximum number of threads for the parallel E-step
+ */
+#define IPFP_MAXTHREADS 64
+
+const char *IPFPKernels  (void);
+
+void        IPFPStep     (nat_boolean_t  quiet,
+                          Matrix        *M,
+                          Corpus        *C1,
+                          Corpus        *C2,
+                          int            step,
+                          int            last,
+                          int            nthreads);
+
+#endif /* __IPFPEM_H__ */
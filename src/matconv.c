@@ -0,0 +1,75 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "matrix.h"
+#include "standard.h"
+
+/**
+ * @file
+ * @brief Converts sparse matrices between the classic and the
+ * mappable file formats
+ */
+
+/**
+ * @brief Main function
+ *
+ * Receives two file names: the input matrix file (in any format) and
+ * the output matrix file. The output is written in the mappable
+ * format, or in the classic one with the -c option.
+ */
+int main(int argc, char **argv)
+{
+    Matrix *matrix;
+    nat_boolean_t classic = FALSE;
+
+    extern int optind;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c")) != EOF) {
+        switch (opt) {
+        case 'c':
+            classic = TRUE;
+            break;
+        default:
+            report_error("Usage: matconv [-c] matrixfile_in matrixfile_out");
+        }
+    }
+
+    if (argc != optind + 2)
+	report_error("Usage: matconv [-c] matrixfile_in matrixfile_out");
+
+    if (!(matrix = LoadFrozenMatrix(argv[optind + 0]))) report_error("LoadMatrix");
+
+    if (classic) {
+	if (SaveMatrix(matrix, argv[optind + 1])) report_error("SaveMatrix");
+    } else {
+	if (SaveMappedMatrix(matrix, argv[optind + 1])) report_error("SaveMappedMatrix");
+    }
+
+    FreeMatrix(matrix);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dictionary.h"
+#include "matdict.h"
+
+#include <glib.h>
+
+/**
+ * @file
+ * @brief Conversion of alignment matrices into dictionaries
+ */
+
+/**
+ * @brief Threshold for adding or not in the dictionary (was 0.1f)
+ */
+#define FMIN 0.005f
+
+/**
+ * @brief Lower threshold to add in the dictionary
+ *
+ * @todo Fix-me. I think I'm wrong.
+ */
+#define MINTOT 0.0f
+
+/**
+ * @brief Builds a temporary dictionary from the first copy of an
+ * alignment matrix
+ *
+ * Cells are kept if they are bigger than FMIN times their row or
+ * column total.
+ *
+ * @param dict temporary dictionary, allocated by this function
+ */
+void MatrixToTempDict(nat_boolean_t quiet, Matrix *matrix, struct cMat2 *dict)
+{
+    nat_uint32_t length, k;
+    float rftot, *cftot, *cf;
+    nat_uint32_t r, c, Nrow, Ncolumn;
+    nat_uint32_t *pc;
+
+    Nrow = GetNRow(matrix);
+    Ncolumn = GetNColumn(matrix);
+
+    if (tempdict_allocmatrix2(dict, Nrow, Ncolumn))
+	report_error("Error allocing matrix");
+
+    cftot = g_new0(float, Ncolumn + 1);
+    cf    = g_new(float, Ncolumn + 1);
+    pc    = g_new0(nat_uint32_t, Ncolumn + 1);
+
+    if (!quiet) {
+	fprintf(stderr, "\n");
+	fprintf(stderr, "Converting matrix to dictionary:      ");
+    }
+    k = 1;
+    length = Nrow + 1;
+
+    /* Calcular somatrio das colunas da matrix -> cftot[1..]*/
+    ColumnTotals(matrix, MATRIX_1, cftot);
+
+    if (!quiet) fprintf(stderr, "\b\b\b\b\b%4.1f%%", (float) (k++) * 99.9f / (float) length);
+    for (r = 1; r <= Nrow; r++) {
+
+	/* Calcular total da linha */
+	/* pc -> indices de colunas */
+	/* cf -> valores das celulas por coluna */
+	rftot = GetRow(matrix, MATRIX_1, r, pc, cf);
+	c = 0; 
+	while (pc[c] > 0) {
+	    if (cf[c] > rftot*FMIN || cf[c] > cftot[c] * FMIN)
+		tempdict_dirtyputvalue2(dict, cf[c], r, pc[c]);
+	    c++;
+	}
+	if (!quiet) fprintf(stderr, "\b\b\b\b\b%4.1f%%", (float) (k++) * 99.9f / (float) length);
+    }
+    if (!quiet) fprintf(stderr, "\b\b\b\b\bdone \n\n");
+
+    g_free(cftot);
+    g_free(cf);
+    g_free(pc);
+}
+
+static void setEntry(Dictionary* dic, nat_uint32_t word, 
+		     Words *WL,
+		     nat_uint32_t *c, float *f, nat_uint32_t max, float total)
+{
+    nat_uint32_t j;
+    float v;
+
+    for(j = 0; j < max; j++) {
+	v = f[j]/total;
+	if (c[j] && v > 0.005f) {
+	    dic = dictionary_set_id(dic, word, j, c[j]);
+	    dic = dictionary_set_val(dic, word, j, v);
+	}
+    }
+}
+
+/**
+ * @brief Saves the dictionary of one language from the best
+ * translations of its words
+ */
+static void saveDictionary(char *filename, TempDictTop *top,
+			   Words *WL, Words *tWL, PartialCounts *partials)
+{
+    nat_uint32_t index;
+    Dictionary* dic;
+    
+    dic = dictionary_new(words_size(WL));
+
+    for (index = 2; index <= partials->last; index++) {   
+	if (index <= top->n && top->totals[index] > (float) MINTOT)
+	    setEntry(dic, index, tWL, top->ids + index * top->k,
+		     top->vals + index * top->k, top->k, top->totals[index]);
+
+	/* TO CHANGE */
+	/* node = words_get_full_by_id(W1, index); */
+	dic = dictionary_set_occ(dic, index, partials->buffer[index]);
+    }
+    if (top->n >= 1)
+	setEntry(dic, 1, tWL, top->ids + top->k, top->vals + top->k,
+		 top->k, top->totals[1]);
+
+    if (!dictionary_save(dic, filename))
+	report_error("Cannot save dictionary %s", filename);
+
+    dictionary_free(dic);
+}
+
+/**
+ * @brief Saves the dictionaries of both languages from a temporary
+ * dictionary
+ *
+ * Each word keeps its k best translations, with probabilities
+ * relative to the word total, and its number of occurrences. Both
+ * directions are extracted in a single pass by tempdict_topk.
+ *
+ * @param nthreads number of threads used to extract the translations
+ * @param k number of translations kept for each word (MAXENTRY by
+ *     default)
+ */
+void SaveDictionaries(char *f1, char* f2, struct cMat2 *M, 
+		      Words *WL1, Words *WL2,
+		      PartialCounts *partials1, 
+		      PartialCounts *partials2,
+		      int nthreads, nat_uint32_t k)
+{
+    TempDictTop rows, columns;
+
+    if (tempdict_topk(M, k, nthreads, &rows, &columns))
+	report_error("Cannot extract translations");
+
+    saveDictionary(f1, &rows, WL1, WL2, partials1);
+    saveDictionary(f2, &columns, WL2, WL1, partials2);
+
+    tempdict_freetop(&rows);
+    tempdict_freetop(&columns);
+}
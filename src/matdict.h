@@ -0,0 +1,52 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __MATDICT_H__
+#define __MATDICT_H__
+
+/**
+ * @file
+ * @brief Header file for the conversion of alignment matrices into
+ * dictionaries
+ */
+
+#include "standard.h"
+#include <NATools/words.h>
+#include "matrix.h"
+#include "tempdict.h"
+#include "partials.h"
+
+void MatrixToTempDict  (nat_boolean_t   quiet,
+                        Matrix         *matrix,
+                        struct cMat2   *dict);
+
+void SaveDictionaries  (char           *f1,
+                        char           *f2,
+                        struct cMat2   *M,
+                        Words          *WL1,
+                        Words          *WL2,
+                        PartialCounts  *partials1,
+                        PartialCounts  *partials2,
+                        int             nthreads,
+                        nat_uint32_t    k);
+
+#endif /* __MATDICT_H__ */
@@ -24,6 +24,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "matrix.h"
 
 #include <glib.h>
@@ -38,6 +42,170 @@
  */
 #define DEBUG 0
 
+/**
+ * @brief alignment of the sections of a mappable matrix file
+ */
+#define MAPPED_ALIGN 4096
+
+/**
+ * @brief Header of a matrix file in the mappable format
+ *
+ * The header is followed by the offsets (Nrows + 2 uint64_t), the
+ * columns (Ncells nat_uint32_t) and the two values arrays (Ncells
+ * CellValues each), stored in native byte order. Each section starts at a
+ * MAPPED_ALIGN boundary, at the file position recorded here.
+ */
+typedef struct cMappedHeader {
+    /** MATRIX_MAGIC */
+    nat_uint32_t magic;
+    /** MATRIX_MAPPED_VERSION */
+    nat_uint32_t version;
+    /** number of rows */
+    nat_uint32_t Nrows;
+    /** number of columns */
+    nat_uint32_t Ncolumns;
+    /** size of each value, in bytes */
+    nat_uint32_t valuesize;
+    /** unused, keeps the 64 bit fields aligned */
+    nat_uint32_t reserved;
+    /** number of cells */
+    uint64_t     Ncells;
+    /** file position of the offsets array */
+    uint64_t     offsets;
+    /** file position of the columns array */
+    uint64_t     columns;
+    /** file positions of the values arrays, indexed by MatrixVal */
+    uint64_t     values[2];
+} MappedHeader;
+
+static void InitFrozenFields(Matrix *matrix)
+{
+    matrix->frozen  = FALSE;
+    matrix->Ncells  = 0;
+    matrix->offsets = NULL;
+    matrix->columns = NULL;
+    matrix->values[0] = matrix->values[1] = NULL;
+    matrix->dropped = 0;
+    matrix->map = NULL;
+    matrix->mapsize = 0;
+}
+
+/**
+ * @brief value size recorded for classic matrix files written before
+ * native cell values
+ */
+#define FIXED_POINT 0
+
+/**
+ * @brief Cell of a classic matrix file written before native cell
+ * values
+ *
+ * Values are in fixed point (MAXDEC), and values over MAXVAL take a
+ * second (double precision) cell with the same column, holding the
+ * value divided by MAXVAL.
+ */
+typedef struct cFixedCell {
+    /** number of the column */
+    nat_uint32_t column;
+    /** value1, in fixed point */
+    nat_uint32_t value1;
+    /** value2, in fixed point */
+    nat_uint32_t value2;
+} __attribute__((packed)) FixedCell;
+
+/**
+ * @brief Converts a row of fixed point cells to native cells
+ *
+ * @return the number of cells used (double precision cells are merged)
+ */
+static nat_uint32_t DecodeFixedRow(FixedCell *p, nat_uint32_t l, Cell *cells)
+{
+    nat_uint32_t i, n;
+
+    i = n = 0;
+    while (i < l && p[i].column > 0) {
+        cells[n].column = p[i].column;
+        cells[n].value1 = (CellValue) p[i].value1 / (CellValue) MAXDEC;
+        cells[n].value2 = (CellValue) p[i].value2 / (CellValue) MAXDEC;
+        if (i+1 < l && p[i+1].column == p[i].column) {
+            cells[n].value1 += (CellValue) p[i+1].value1 * (CellValue) MAXVAL;
+            cells[n].value2 += (CellValue) p[i+1].value2 * (CellValue) MAXVAL;
+            i++;
+        }
+        i++;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * @brief Reads a cell value stored with a given size (float or double)
+ */
+static CellValue DecodeNativeValue(const char *p, nat_uint32_t valuesize)
+{
+    float f;
+    double d;
+
+    if (valuesize == sizeof(float)) {
+        memcpy(&f, p, sizeof(float));
+        return (CellValue) f;
+    }
+    memcpy(&d, p, sizeof(double));
+    return (CellValue) d;
+}
+
+/**
+ * @brief Searches a column in a range of cells of a frozen matrix
+ *
+ * @return the position of the first cell, between from and to, with a
+ * column not smaller than the one searched (to if there is none)
+ */
+static uint64_t FrozenLowerBound(Matrix *matrix, uint64_t from, uint64_t to,
+                                 nat_uint32_t column)
+{
+    uint64_t m;
+    while (from < to) {
+        m = from + (to - from) / 2;
+        if (matrix->columns[m] < column)
+            from = m + 1;
+        else
+            to = m;
+    }
+    return from;
+}
+
+/**
+ * @brief Searches a cell in a frozen matrix
+ *
+ * @return true if the cell exists. Its position is stored in k.
+ */
+static nat_boolean_t FrozenSearch(Matrix *matrix, nat_uint32_t row, nat_uint32_t column,
+                                  uint64_t *k)
+{
+    uint64_t end = matrix->offsets[row + 1];
+    *k = FrozenLowerBound(matrix, matrix->offsets[row], end, column);
+    return (*k < end && matrix->columns[*k] == column);
+}
+
+static int AllocFrozenArrays(Matrix *matrix, uint64_t ncells)
+{
+    if (!ncells) ncells = 1;
+    matrix->offsets   = (uint64_t*)malloc(sizeof(uint64_t) * (matrix->Nrows + 2));
+    matrix->columns   = (nat_uint32_t*)malloc(sizeof(nat_uint32_t) * ncells);
+    matrix->values[0] = (CellValue*)malloc(sizeof(CellValue) * ncells);
+    matrix->values[1] = (CellValue*)malloc(sizeof(CellValue) * ncells);
+    if (!matrix->offsets || !matrix->columns || !matrix->values[0] || !matrix->values[1]) {
+        free(matrix->offsets);
+        free(matrix->columns);
+        free(matrix->values[0]);
+        free(matrix->values[1]);
+        InitFrozenFields(matrix);
+        return 1;
+    }
+    matrix->offsets[0] = matrix->offsets[1] = 0;
+    return 0;
+}
+
 /**
  * @brief Allocates a new Matrix object
  * 
@@ -59,6 +227,7 @@ Matrix* AllocMatrix(nat_uint32_t nrow, nat_uint32_t ncolumn)
 
     matrix->Nrows = nrow;
     matrix->Ncolumns = ncolumn;
+    InitFrozenFields(matrix);
 
     /* Alloc structure pointers for rows */
     //matrix->rows = g_new(Row, 1+nrow);
@@ -94,6 +263,19 @@ void FreeMatrix(Matrix *matrix)
 {
     nat_uint32_t r;
 
+    if (matrix->frozen) {
+        if (matrix->map) {
+            munmap(matrix->map, matrix->mapsize);
+        } else {
+            free(matrix->offsets);
+            free(matrix->columns);
+            free(matrix->values[0]);
+            free(matrix->values[1]);
+        }
+        free(matrix);
+        return;
+    }
+
     for (r = 1; r <= matrix->Nrows; ++r) {
 	free(matrix->rows[r].cells);
     }
@@ -193,12 +375,12 @@ static int EnlargeRow(Matrix *matrix, nat_uint32_t r)
  *
  * @return Cell value
  */
-nat_uint32_t Get(Cell *p, MatrixVal Ma)
+CellValue Get(Cell *p, MatrixVal Ma)
 {
     return Ma?p->value1:p->value2;
 }
 
-static void Inc(Cell *p, MatrixVal Ma, nat_uint32_t inc)
+static void Inc(Cell *p, MatrixVal Ma, CellValue inc)
 {
     if (Ma)
         p->value1 += inc;
@@ -206,65 +388,6 @@ static void Inc(Cell *p, MatrixVal Ma, nat_uint32_t inc)
         p->value2 += inc;
 }
 
-static int Put(Matrix *matrix, MatrixVal Ma, float f, nat_uint32_t i, nat_uint32_t row)
-{
-    Cell *pointer;
-    nat_uint32_t v;
-    nat_uint32_t length;
-
-    pointer = matrix->rows[row].cells;
-    length = matrix->rows[row].length;
-
-    if (f < MAXVAL) {
-	v = (nat_uint32_t) (f * MAXDEC + 0.5f);
-	if (Ma)
-            pointer[i].value1 = v;
-	else
-            pointer[i].value2 = v;
-	++i;
-	if (i < length && pointer[i].column == pointer[i-1].column) {
-	    if (Get(pointer + i, !Ma) == 0) {
-		memmove(pointer + i, pointer + i + 1,(length-i)*sizeof(Cell));
-		pointer[length].column = 0;
-		pointer[length].value1 = 0;
-		pointer[length].value2 = 0;
-	    }
-	    else
-		if (Ma) pointer[i].value1 = 0;
-		else pointer[i].value2 = 0;
-	}
-    }
-    else {
-	v = (nat_uint32_t) (((int) (f* (float) MAXDEC + 0.5f)) % ((nat_uint32_t) MAXVAL * (nat_uint32_t) MAXDEC));
-#if DEBUG
-	printf("Matrix: double precision\n");
-#endif
-	if (Ma)
-            pointer[i].value1 = v;
-	else
-            pointer[i].value2 = v;
-	i++;
-	if ((i <length && pointer[i].column != pointer[i-1].column) || (i>=length)) {
-	    /* if ((i < length && pointer[length].column != 0) || (i>length)) { */
-	    if (i>=length) {
-		if (EnlargeRow(matrix, row)) {
-		    printf("Error Enlarging row...\n");
-		    return 1;
-		}
-		pointer = matrix->rows[row].cells;
-		length = matrix->rows[row].length;
-	    }
-	    memmove(pointer+i,pointer+i-1,(length-i)*sizeof(Cell));
-	    if (Ma) pointer[i].value2 = 0;
-	    else pointer[i].value1 = 0;
-	}
-	v = (nat_uint32_t) (f / (float) MAXVAL);
-	if (Ma) pointer[i].value1 = v;
-	else pointer[i].value2 = v;
-    }
-    return 0;
-}
-
 static int PutValue(Matrix *matrix, MatrixVal Ma, float f, 
 		    nat_uint32_t row, nat_uint32_t column)
 {
@@ -280,7 +403,8 @@ static int PutValue(Matrix *matrix, MatrixVal Ma, float f,
 
 	} else {
 
-	    if (i >= length) { /*  || pointer[i].column != 0) { */
+	    /* the row must have a free cell at the end, or it is lost */
+	    if (i >= length || pointer[length-1].column != 0) {
 		/* printf("Enlarging 2\n"); */
 		// printf("ROW: %d\n", row);
 		if (EnlargeRow(matrix, row)) {
@@ -296,7 +420,11 @@ static int PutValue(Matrix *matrix, MatrixVal Ma, float f,
 	    pointer[i].value1 = 0;
 	    pointer[i].value2 = 0;
 	}
-	return Put(matrix, Ma, f, i, row);
+	if (Ma)
+	    pointer[i].value1 = f;
+	else
+	    pointer[i].value2 = f;
+	return 0;
     }
 }
 
@@ -312,31 +440,319 @@ int IncValue(Matrix *matrix,
 {
     Cell *p;
     nat_uint32_t i, l;
-    nat_uint32_t inc;
-    float f;
+
+    if (matrix->frozen) {
+        uint64_t k;
+        if (row > matrix->Nrows || column > matrix->Ncolumns) {
+            fprintf(stderr, "** WARNING ** IncValue: Failed on Search Item (%d,%d)\n",row,column);
+            return 1;
+        }
+        /* the pattern is fixed: increments to new cells are dropped */
+        if (FrozenSearch(matrix, row, column, &k))
+            matrix->values[Ma][k] += incfactor;
+        else if (incfactor != 0.0f)
+            matrix->dropped++;
+        return 0;
+    }
 
     if (SearchItem(matrix, row, column, &p, &i, &l)) {
         fprintf(stderr, "** WARNING ** IncValue: Failed on Search Item (%d,%d)\n",row,column);
 	return 1;
     } else {
 	if (i < l && (p[i].column == 0 || p[i].column == column)) {
-	    inc = (nat_uint32_t) (incfactor * MAXDEC + 0.5f);
 	    p[i].column = column;
-	    if (Get(p+i, Ma) + inc < MAXVAL * MAXDEC) {
-		Inc(p+i, Ma, inc);
-		return 0;
-	    } else {
-		f = (float) Get(p+i, Ma) / (float) MAXDEC;
-		if (i+1 <= l && p[i+1].column == column)
-		    f += (float) (Get(p+i+1, Ma) * MAXVAL);
-		return Put(matrix, Ma, f+incfactor, i, row);
-	    }
+	    Inc(p+i, Ma, incfactor);
+	    return 0;
 	} else {
 	    return PutValue(matrix, Ma, incfactor, row, column);
 	}
     }
 }
 
+/**
+ * @brief Pending increment, as sorted by MatrixAccumulateBatch
+ */
+typedef struct cBatchItem {
+    /** matrix row */
+    nat_uint32_t row;
+    /** matrix column */
+    nat_uint32_t column;
+    /** position in the batch, to keep the order of repeated cells */
+    nat_uint32_t index;
+    /** increment */
+    float        value;
+} BatchItem;
+
+static int CompareBatchItems(const void *a, const void *b)
+{
+    const BatchItem *x = (const BatchItem*)a;
+    const BatchItem *y = (const BatchItem*)b;
+
+    if (x->row != y->row) return x->row < y->row ? -1 : 1;
+    if (x->column != y->column) return x->column < y->column ? -1 : 1;
+    if (x->index != y->index) return x->index < y->index ? -1 : 1;
+    return 0;
+}
+
+/**
+ * @brief Stable counting sort of batch items by one of their keys
+ *
+ * @param key offset of the key (row or column) in BatchItem
+ * @param range maximum value of the key
+ */
+static int CountingSortBatch(BatchItem *from, BatchItem *to, nat_uint32_t n,
+                             size_t key, nat_uint32_t range)
+{
+    nat_uint32_t *count, i, k, total;
+
+    count = (nat_uint32_t*)calloc(range + 2, sizeof(nat_uint32_t));
+    if (!count) return 1;
+    for (i = 0; i < n; i++)
+	count[*(nat_uint32_t*)((char*)(from + i) + key)]++;
+    total = 0;
+    for (k = 0; k <= range; k++) {
+	i = count[k];
+	count[k] = total;
+	total += i;
+    }
+    for (i = 0; i < n; i++)
+	to[count[*(nat_uint32_t*)((char*)(from + i) + key)]++] = from[i];
+    free(count);
+    return 0;
+}
+
+/**
+ * @brief Sorts batch items by row and column, keeping the batch order
+ * for repeated cells
+ *
+ * Big batches use two counting sort passes (column, then row). Small
+ * ones, compared to the matrix size, are quicker to sort with qsort.
+ */
+static int SortBatch(Matrix *matrix, BatchItem *items, nat_uint32_t n)
+{
+    BatchItem *tmp;
+    int error;
+
+    if (n < (matrix->Nrows + matrix->Ncolumns) / 4) {
+	qsort(items, n, sizeof(BatchItem), CompareBatchItems);
+	return 0;
+    }
+
+    tmp = (BatchItem*)malloc(sizeof(BatchItem) * n);
+    if (!tmp) return 1;
+    error = CountingSortBatch(items, tmp, n, offsetof(BatchItem, column), matrix->Ncolumns) ||
+	CountingSortBatch(tmp, items, n, offsetof(BatchItem, row), matrix->Nrows);
+    free(tmp);
+    return error;
+}
+
+/**
+ * @brief Merges the sorted increments of one row into a dynamic row
+ *
+ * The new row is built in the scratch buffer, in one pass over the
+ * old row and the increments, and then copied back.
+ */
+static int MergeBatchRow(Matrix *matrix, MatrixVal Ma, BatchItem *items, nat_uint32_t n,
+                         Cell **scratch, nat_uint32_t *scratchsize)
+{
+    nat_uint32_t row = items[0].row;
+    nat_uint32_t i, j, k, used, l, column;
+    Cell *p, *out;
+
+    p = matrix->rows[row].cells;
+    l = matrix->rows[row].length;
+    used = 0;
+    while (used < l && p[used].column > 0) used++;
+
+    if (used + n + 1 > *scratchsize) {
+	*scratchsize = used + n + 1;
+	*scratch = (Cell*)realloc(*scratch, sizeof(Cell) * *scratchsize);
+	if (!*scratch) return 1;
+    }
+    out = *scratch;
+
+    i = j = k = 0;
+    while (i < used || j < n) {
+	if (j == n || (i < used && p[i].column < items[j].column)) {
+	    /* untouched cells are copied as they are */
+	    out[k++] = p[i++];
+	    continue;
+	}
+	column = items[j].column;
+	if (i < used && p[i].column == column) {
+	    out[k] = p[i++];
+	} else {
+	    out[k].column = column;
+	    out[k].value1 = out[k].value2 = 0;
+	}
+	for (; j < n && items[j].column == column; j++)
+	    Inc(out + k, Ma, items[j].value);
+	k++;
+    }
+
+    /* grow the row as EnlargeRow does, keeping a free cell at the end */
+    if (k >= l) {
+	while (l <= k) {
+	    if (2 * l <= matrix->Ncolumns) l = 2 * l;
+	    else l = max(l * 1.2, l + MEMBLOCK);
+	}
+	p = (Cell*)realloc(p, sizeof(Cell) * l);
+	if (!p) return 1;
+	matrix->rows[row].cells = p;
+	matrix->rows[row].length = l;
+    }
+    memcpy(p, out, sizeof(Cell) * k);
+    memset(p + k, 0, sizeof(Cell) * (l - k));
+    return 0;
+}
+
+/**
+ * @brief Increments a set of matrix cells
+ *
+ * The increments are sorted by row and column, and merged into each
+ * row in a single pass, instead of searching (and possibly moving)
+ * the row cells once per increment. Increments to the same cell are
+ * applied in the order they are given, so the result is the same as
+ * calling IncValue for each increment in turn.
+ *
+ * @param matrix the matrix to increment
+ * @param Ma the matrix copy to increment
+ * @param rows the rows of the increments
+ * @param columns the columns of the increments
+ * @param values the increments
+ * @param n the number of increments
+ *
+ * @return 0 on success
+ */
+int MatrixAccumulateBatch(Matrix *matrix, MatrixVal Ma,
+			  nat_uint32_t *rows, nat_uint32_t *columns,
+			  float *values, nat_uint32_t n)
+{
+    BatchItem *items;
+    Cell *scratch = NULL;
+    nat_uint32_t a, b, i, scratchsize = 0;
+    uint64_t k, end;
+    int error = 0;
+
+    for (i = 0; i < n; i++) {
+	if (rows[i] == 0 || rows[i] > matrix->Nrows ||
+	    columns[i] == 0 || columns[i] > matrix->Ncolumns) {
+	    fprintf(stderr, "** WARNING ** MatrixAccumulateBatch: Failed on Search Item (%d,%d)\n",
+		    rows[i], columns[i]);
+	    return 1;
+	}
+    }
+
+    items = (BatchItem*)malloc(sizeof(BatchItem) * (n ? n : 1));
+    if (!items) return 1;
+    for (i = 0; i < n; i++) {
+	items[i].row    = rows[i];
+	items[i].column = columns[i];
+	items[i].index  = i;
+	items[i].value  = values[i];
+    }
+    if (SortBatch(matrix, items, n)) {
+	free(items);
+	return 1;
+    }
+
+    for (a = 0; a < n && !error; a = b) {
+	b = a + 1;
+	while (b < n && items[b].row == items[a].row) b++;
+
+	if (matrix->frozen) {
+	    /* the pattern is fixed: increments to new cells are dropped */
+	    k = matrix->offsets[items[a].row];
+	    end = matrix->offsets[items[a].row + 1];
+	    for (i = a; i < b; i++) {
+		k = FrozenLowerBound(matrix, k, end, items[i].column);
+		if (k < end && matrix->columns[k] == items[i].column)
+		    matrix->values[Ma][k] += items[i].value;
+		else if (items[i].value != 0.0f)
+		    matrix->dropped++;
+	    }
+	} else {
+	    error = MergeBatchRow(matrix, Ma, items + a, b - a, &scratch, &scratchsize);
+	}
+    }
+
+    free(scratch);
+    free(items);
+    return error;
+}
+
+/**
+ * @brief Allocates a buffer for increments to a matrix
+ *
+ * @param matrix the matrix to increment
+ * @param Ma the matrix copy to increment
+ * @param size maximum number of pending increments (MATRIX_BATCH is a
+ * good default)
+ *
+ * @return the new MatrixBatch object
+ */
+MatrixBatch *MatrixBatchNew(Matrix *matrix, MatrixVal Ma, nat_uint32_t size)
+{
+    MatrixBatch *batch;
+
+    batch = (MatrixBatch*)malloc(sizeof(MatrixBatch));
+    if (!batch) return NULL;
+    batch->matrix  = matrix;
+    batch->Ma      = Ma;
+    batch->n       = 0;
+    batch->size    = size ? size : 1;
+    batch->rows    = (nat_uint32_t*)malloc(sizeof(nat_uint32_t) * batch->size);
+    batch->columns = (nat_uint32_t*)malloc(sizeof(nat_uint32_t) * batch->size);
+    batch->values  = (float*)malloc(sizeof(float) * batch->size);
+    if (!batch->rows || !batch->columns || !batch->values) {
+	MatrixBatchFree(batch);
+	return NULL;
+    }
+    return batch;
+}
+
+/**
+ * @brief Adds an increment to a batch, flushing it when full
+ *
+ * @return 0 on success
+ */
+int MatrixBatchInc(MatrixBatch *batch, float incf, nat_uint32_t r, nat_uint32_t c)
+{
+    if (batch->n == batch->size && MatrixBatchFlush(batch))
+	return 1;
+    batch->rows[batch->n]    = r;
+    batch->columns[batch->n] = c;
+    batch->values[batch->n]  = incf;
+    batch->n++;
+    return 0;
+}
+
+/**
+ * @brief Applies the pending increments of a batch to its matrix
+ *
+ * @return 0 on success
+ */
+int MatrixBatchFlush(MatrixBatch *batch)
+{
+    int error;
+
+    error = MatrixAccumulateBatch(batch->matrix, batch->Ma, batch->rows,
+				  batch->columns, batch->values, batch->n);
+    batch->n = 0;
+    return error;
+}
+
+/**
+ * @brief Frees a batch. Pending increments are discarded.
+ */
+void MatrixBatchFree(MatrixBatch *batch)
+{
+    free(batch->rows);
+    free(batch->columns);
+    free(batch->values);
+    free(batch);
+}
+
 /**
  * @brief Don't know
  * 
@@ -347,16 +763,17 @@ float GetValue(Matrix *matrix, MatrixVal Ma,
 {
     Cell *p;
     nat_uint32_t i, l;
-    float f;
+    if (matrix->frozen) {
+        uint64_t k;
+        if (r < 1 || r > matrix->Nrows || c > matrix->Ncolumns)
+            return 0.0f;
+        return FrozenSearch(matrix, r, c, &k) ? matrix->values[Ma][k] : 0.0f;
+    }
     if (SearchItem(matrix, r, c, &p, &i, &l))
 	return 0.0f;
     else {
-	if (i<=l && p[i].column == c) {
-	    f = (float) Get(p+i, Ma) / (float) MAXDEC;
-	    if (i+1 <= l && p[i+1].column == c)
-		f += (float) Get(p+i+1, Ma) * MAXVAL;
-	    return f;
-	}
+	if (i < l && p[i].column == c)
+	    return Get(p+i, Ma);
 	else return 0.0f;
     }
 }
@@ -378,6 +795,19 @@ float GetRow(Matrix *matrix, MatrixVal Ma, nat_uint32_t r, nat_uint32_t *c, floa
     float fm, total;
     if (r < 1 || r > matrix->Nrows)
 	return 0.0f;
+    else if (matrix->frozen) {
+        uint64_t k;
+        total = 0.0f;
+        j = 0;
+        for (k = matrix->offsets[r]; k < matrix->offsets[r+1]; k++) {
+            total += matrix->values[Ma][k];
+            c[j] = matrix->columns[k];
+            f[j] = matrix->values[Ma][k];
+            j++;
+        }
+        c[j] = 0;
+        f[j] = 0.0f;
+    }
     else {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
@@ -385,11 +815,7 @@ float GetRow(Matrix *matrix, MatrixVal Ma, nat_uint32_t r, nat_uint32_t *c, floa
 	j = 0;
 	total = 0.0f;
 	while (i < l && p[i].column > 0) {
-	    fm = (float) Get(p+i, Ma) / (float) MAXDEC;
-	    if (i+1 < l && p[i].column == p[i+1].column) {
-		fm += (float) (Get(p+i+1, Ma)*MAXVAL);
-		i++;
-	    }
+	    fm = Get(p+i, Ma);
 	    total += fm;
 	    c[j] = p[i].column;
 	    f[j] = fm;
@@ -422,11 +848,7 @@ static float GetRowMax(Matrix *matrix, MatrixVal Ma, nat_uint32_t r,
 	i = 0;
 	total = 0.0f;
 	while (i < l && p[i].column > 0) {
-	    fm = (float) Get(p+i, Ma) / (float) MAXDEC;
-	    if (i+1 < l && p[i].column == p[i+1].column) {
-		fm += (float) (Get(p+i+1, Ma)*MAXVAL);
-		i++;
-	    }
+	    fm = Get(p+i, Ma);
 	    total += fm;
 	    j = 0;
 	    while (j < max && c[j] > 0 && f[j] >= fm) j++;
@@ -468,9 +890,7 @@ static float GetColumnMax(Matrix *matrix, MatrixVal Ma, nat_uint32_t c,
 	    j = 0;
 	    while (j < l && p[j].column > 0 && p[j].column < c) j++;
 	    if (j < l && p[j].column == c) {
-		fm = (float) Get(p+j, Ma) / (float) MAXDEC;
-		if (j+1 < l && p[j+1].column == c)
-		    fm += (float) (Get(p+j+1, Ma)*MAXVAL);
+		fm = Get(p+j, Ma);
 		total += fm;
 		j = 0;
 		while (j < max && r[j] > 0 && f[j] >= fm) j++;
@@ -508,6 +928,26 @@ int GetPartialMatrix(Matrix *matrix, MatrixVal Ma, nat_uint32_t *r,
     c = tmp;
     m = 0;
     n = 0;
+    if (matrix->frozen) {
+        uint64_t k, end;
+        /* columns are sorted, so each search starts at the last cell found */
+        while (*r > 0) {
+            if (*r > matrix->Nrows)
+                return 1;
+            k = matrix->offsets[*r];
+            end = matrix->offsets[*r + 1];
+            for (c = tmp, n = 0; *c > 0; c++, n++) {
+                k = FrozenLowerBound(matrix, k, end, *c);
+                if (k < end && matrix->columns[k] == *c)
+                    M[m*max + n] = (double) matrix->values[Ma][k];
+                else
+                    M[m*max + n] = 0.0f;
+            }
+            r++;
+            m++;
+        }
+        return 0;
+    }
     while (*r > 0) {
 	if (*r > matrix->Nrows)
 	    return 1;
@@ -524,11 +964,8 @@ int GetPartialMatrix(Matrix *matrix, MatrixVal Ma, nat_uint32_t *r,
 #else
 		while (i < l && p[i].column > 0 && p[i].column < *c) i++;
 #endif
-		if (i < l && p[i].column == *c) {
-		    M[m*max + n] = (double) Get(p+i, Ma) / (double) MAXDEC ;
-		    if (i+1 < l && p[i+1].column == *c)
-			M[m*max + n] += (double) Get(p +i+1, Ma) * MAXVAL;
-		}
+		if (i < l && p[i].column == *c)
+		    M[m*max + n] = (double) Get(p+i, Ma);
 		else M[m*max + n] = 0.0f;
 		c++;
 		n++;
@@ -566,9 +1003,7 @@ static int GetConditionalMatrix(Matrix *matrix, MatrixVal Ma, nat_uint32_t *r,
 	    i = 0;
 	    pm = 0.0f;
 	    while (i < l && p[i].column > 0) {
-		f = (float) Get(p+ (i++), Ma) / (float) MAXDEC ;
-		if (i < l && p[i].column == p[i-1].column)
-		    f += (float) Get(p + (i++), Ma) * (float) MAXVAL;	
+		f = Get(p+ (i++), Ma);
 		pm += f;
 		while (*c > 0 && p[i-1].column >= *c) {
 		    if (p[i-1].column == *c) M[m*max + n] = f;
@@ -601,6 +1036,10 @@ void ClearMatrix(Matrix *matrix, MatrixVal Ma)
 {
     Cell *p;
     nat_uint32_t r, i, l;
+    if (matrix->frozen) {
+        memset(matrix->values[Ma], 0, sizeof(CellValue) * matrix->Ncells);
+        return;
+    }
     for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
@@ -611,14 +1050,6 @@ void ClearMatrix(Matrix *matrix, MatrixVal Ma)
 	    else
                 p[i].value2 = 0;
             ++i;
-	    if (i < l && p[i].column == p[i-1].column)
-		if ((Ma && p[i].value2 == 0) || (!Ma && p[i].value1 == 0)) {
-		    if (i+1 < l)
-			memmove(p+i, p+i+1, sizeof(Cell)*(l-i-1)); // was ...*(l-i)
-		    p[l-1].column = 0;  // was p[l]
-		    p[l-1].value1 = 0;  // was p[l]
-		    p[l-1].value2 = 0;  // was p[l]
-		}
 	}
     }
 }
@@ -633,6 +1064,10 @@ void CopyMatrix(Matrix *matrix,  MatrixVal Mdest)
 {
     Cell *p;
     nat_uint32_t r, i, l;
+    if (matrix->frozen) {
+        memcpy(matrix->values[Mdest], matrix->values[!Mdest], sizeof(CellValue) * matrix->Ncells);
+        return;
+    }
     for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
@@ -670,20 +1105,22 @@ float CompareMatrices(Matrix *matrix)
     total = 0;
     diff = 0.0f;
 
+    if (matrix->frozen) {
+        uint64_t k;
+        for (k = 0; k < matrix->Ncells; k++)
+            diff += fabs(matrix->values[0][k] - matrix->values[1][k]);
+        return (diff / matrix->Ncells);
+    }
+
     /* Go by all the matrix rows */
     for (r = 1; r <= matrix->Nrows; ++r) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
 	i = 0;
 	while (i < l && p[i].column > 0) {
-	    f1 = (float) Get(p+i, 0) / (float) MAXDEC ;
-	    f2 = (float) Get(p+i, 1) / (float) MAXDEC ;
+	    f1 = Get(p+i, 0);
+	    f2 = Get(p+i, 1);
             ++i;
-	    if (i < l && p[i].column == p[i-1].column) {
-		f1 += (float) Get(p + i, 0) * MAXVAL;
-		f2 += (float) Get(p + i, 1) * MAXVAL;
-                ++i;
-	    }
 	    diff += fabs(f1 - f2);
 	    ++total;
 	}
@@ -691,6 +1128,59 @@ float CompareMatrices(Matrix *matrix)
     return (diff / total);
 }
 
+/**
+ * @brief Measures the change between the two matrix copies
+ *
+ * Used to check EM convergence, with Ma being the copy just
+ * estimated and the other copy holding the values of the previous
+ * step.
+ *
+ * @param matrix   the matrix pair to be used
+ * @param Ma       the newest matrix copy
+ * @param mean     where to store the mean absolute difference per cell
+ * @param relative where to store the sum of absolute differences
+ *                 divided by the sum of the previous values
+ * @param nonzero  where to store the number of non-zero cells in Ma
+ */
+void MatrixChange(Matrix *matrix, MatrixVal Ma, double *mean,
+                  double *relative, uint64_t *nonzero)
+{
+    Cell *p;
+    nat_uint32_t r, i, l;
+    MatrixVal Mb = Ma == MATRIX_1 ? MATRIX_2 : MATRIX_1;
+    double diff = 0.0, before = 0.0, f1, f2;
+    uint64_t cells = 0, nz = 0;
+
+    if (matrix->frozen) {
+        uint64_t k;
+        for (k = 0; k < matrix->Ncells; k++) {
+            f1 = matrix->values[Ma][k];
+            f2 = matrix->values[Mb][k];
+            diff += fabs(f1 - f2);
+            before += fabs(f2);
+            if (f1 != 0.0) nz++;
+        }
+        cells = matrix->Ncells;
+    } else {
+        for (r = 1; r <= matrix->Nrows; r++) {
+            p = matrix->rows[r].cells;
+            l = matrix->rows[r].length;
+            for (i = 0; i < l && p[i].column > 0; i++) {
+                f1 = Get(p+i, Ma);
+                f2 = Get(p+i, Mb);
+                diff += fabs(f1 - f2);
+                before += fabs(f2);
+                if (f1 != 0.0) nz++;
+                cells++;
+            }
+        }
+    }
+
+    *mean     = cells ? diff / cells : 0.0;
+    *relative = before > 0.0 ? diff / before : (diff > 0.0 ? 1.0 : 0.0);
+    *nonzero  = nz;
+}
+
 /**
  * @brief Sums the values in a matrix
  *
@@ -707,17 +1197,19 @@ float MatrixTotal(Matrix *matrix, MatrixVal Ma)
     float total, f;
     nat_uint32_t r, i, l;
     total = 0;
+    if (matrix->frozen) {
+        uint64_t k;
+        for (k = 0; k < matrix->Ncells; k++)
+            total += matrix->values[Ma][k];
+        return total;
+    }
     for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
 	i = 1;
 	while (i < l && p[i].column > 0) {
-	    f = (float) Get(p+i, Ma) / (float) MAXDEC ;
+	    f = Get(p+i, Ma);
             ++i;
-	    if (i < l && p[i].column == p[i-1].column) {
-		f += (float) Get(p + i, Ma) * MAXVAL;
-                ++i;
-            }
 	    total += f;
 	}
     }
@@ -754,15 +1246,25 @@ void MatrixEntropy(Matrix *matrix, MatrixVal Ma, double *h,
     sumj = (double*)malloc(sizeof(double)*matrix->Ncolumns);
     for (i = 0; i <= matrix->Ncolumns; i++)
 	sumj[i] = 0.0f;
-    for (r = 1; r <= matrix->Nrows; r++) {
+    if (matrix->frozen) {
+        uint64_t k;
+        for (r = 1; r <= matrix->Nrows; r++) {
+            sumi[r-1] = 0.0f;
+            for (k = matrix->offsets[r]; k < matrix->offsets[r+1]; k++) {
+                f = matrix->values[Ma][k];
+                sum += f;
+                sumi[r-1] += f;
+                sumj[matrix->columns[k] - 1] += f;
+            }
+        }
+    }
+    else for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
 	i = 0;
 	sumi[r-1] = 0.0f;
 	while (i <= l && p[i].column > 0) {
-	    f = (double) Get(p+(i++), Ma) / (double) MAXDEC ;
-	    if (i <= l && p[i].column == p[i-1].column)
-		f += (double) Get(p + (i++), Ma) * MAXVAL;
+	    f = (double) Get(p+(i++), Ma);
 	    sum += f;
 	    sumi[r-1] += f;
 	    sumj[p[i-1].column - 1] += f;
@@ -779,14 +1281,22 @@ void MatrixEntropy(Matrix *matrix, MatrixVal Ma, double *h,
 	f = sumj[i] / sum;
 	if (f) *hy -= f*log(f);
     }
-    for (r = 1; r <= matrix->Nrows; r++) {
+    if (matrix->frozen) {
+        uint64_t k;
+        for (k = 0; k < matrix->Ncells; k++) {
+            f = matrix->values[Ma][k];
+            if (f) {
+                f /= sum;
+                *h -= f*log(f);
+            }
+        }
+    }
+    else for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r-1].cells;
 	l = matrix->rows[r-1].length;
 	i = 0;
 	while (i <= l && p[i].column > 0) {
-	    f = (double) Get(p+(i++), Ma) / (double) MAXDEC ;
-	    if (i <= l && p[i].column == p[i-1].column)
-		f += (double) Get(p + (i++), Ma) * MAXVAL;
+	    f = (double) Get(p+(i++), Ma);
 	    if (f) {
 		f /= sum;
 		*h -= f*log(f);
@@ -818,14 +1328,18 @@ void ColumnTotals(Matrix *matrix, MatrixVal Ma, float *cf)
     nat_uint32_t r, i, l;
     for (i = 1; i <= matrix->Ncolumns; i++)
 	cf[i] = 0.0f;
+    if (matrix->frozen) {
+        uint64_t k;
+        for (k = 0; k < matrix->Ncells; k++)
+            cf[matrix->columns[k]] += matrix->values[Ma][k];
+        return;
+    }
     for (r = 1; r <= matrix->Nrows; r++) {
 	p = matrix->rows[r].cells;
 	l = matrix->rows[r].length;
 	i = 0;
 	while (i < l && p[i].column > 0) {
-	    f = (float) Get(p+i, Ma) / (float) MAXDEC ;
-	    if (i+1 < l && p[i+1].column == p[i].column)
-		f += (float) Get(p + (++i), Ma) * MAXVAL;
+	    f = Get(p+i, Ma);
 	    cf[p[i].column] += f;
 	    i++;
 	}
@@ -844,6 +1358,10 @@ nat_uint32_t BytesInUse(Matrix *matrix)
     nat_uint32_t size = 0;
     nat_uint32_t i = 0;
 
+    if (matrix->frozen)
+        return sizeof(Matrix) + sizeof(uint64_t) * (matrix->Nrows + 2) +
+            (sizeof(nat_uint32_t) + 2 * sizeof(CellValue)) * matrix->Ncells;
+
     size = sizeof(Matrix) + sizeof(Row)*matrix->Nrows;
     for (i = 1; i <= matrix->Nrows; ++i) {
 	size += sizeof(Cell)*matrix->rows[i].length;
@@ -852,58 +1370,638 @@ nat_uint32_t BytesInUse(Matrix *matrix)
 }
 
 /**
- * @brief Save the matrix to disk
+ * @brief Converts a row of a frozen matrix to dynamic matrix cells
  *
- * @param matrix the matrix to be saved
- * @param filename the filename of the file to be created
+ * The row ends with an empty cell, as dynamic rows are expected to
+ * have free space. The cells array must have room for the row cells
+ * plus one.
  *
- * @return 0 on success
+ * @return the number of cells used
  */
-int SaveMatrix(Matrix *matrix, char *filename)
+static nat_uint32_t EncodeFrozenRow(Matrix *matrix, nat_uint32_t r, Cell *cells)
 {
-    FILE *fd;
-    nat_uint32_t r, i;
-    
-    fd = fopen(filename, "wb");
-    if (!fd) return 1;
+    nat_uint32_t i;
+    uint64_t k;
 
-    /*  
-     * FILE IS:
-     *
-     * nrows
-     * ncolumns
-     * row1ncols col val1 val2 col val1 val2
-     * row2ncols col val1 val2 col val1 val2
-     */
+    i = 0;
+    for (k = matrix->offsets[r]; k < matrix->offsets[r+1]; k++) {
+        cells[i].column = matrix->columns[k];
+        cells[i].value1 = matrix->values[MATRIX_1][k];
+        cells[i].value2 = matrix->values[MATRIX_2][k];
+        i++;
+    }
+    cells[i].column = 0;
+    cells[i].value1 = cells[i].value2 = 0;
+    return i + 1;
+}
 
-    i = matrix->Nrows;
-    if (fwrite(&i, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
-    i = matrix->Ncolumns;
-    if (fwrite(&i, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
+/**
+ * @brief Writes the rows of a frozen matrix in the dynamic matrix format
+ */
+static int SaveFrozenRows(Matrix *matrix, FILE *fd)
+{
+    Cell *cells = NULL;
+    nat_uint32_t r, i, size = 0;
 
     for (r = 1; r <= matrix->Nrows; ++r) {
-	i = matrix->rows[r].length;
-	if (fwrite(&i, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
-	if (fwrite(matrix->rows[r].cells, sizeof(Cell), i, fd) != i) return 1;
+        if (matrix->offsets[r+1] - matrix->offsets[r] + 1 > size) {
+            size = matrix->offsets[r+1] - matrix->offsets[r] + 1;
+            cells = (Cell*)realloc(cells, sizeof(Cell) * size);
+            if (!cells) return 1;
+        }
+        i = EncodeFrozenRow(matrix, r, cells);
+
+        if (fwrite(&i, sizeof(nat_uint32_t), 1, fd) != 1 ||
+            fwrite(cells, sizeof(Cell), i, fd) != i) {
+            free(cells);
+            return 1;
+        }
     }
-
-    fclose(fd);
+    free(cells);
     return 0;
 }
 
 /**
- * @brief Load a matrix from disk
- *
- * @param filename the filename of the file containing the matrix
- * information
+ * @brief Writes the header of a classic matrix file
  *
- * @return the newly created Matrix structure
+ * @return 0 on success
  */
-Matrix *LoadMatrix(char *filename)
+static int WriteMatrixHeader(FILE *fd, nat_uint32_t nrow, nat_uint32_t ncolumn)
 {
-    Matrix *matrix;
-    FILE *fd;
-    nat_uint32_t r, i;
+    nat_uint32_t header[4];
+
+    header[0] = MATRIX_NATIVE_MAGIC;
+    header[1] = sizeof(CellValue);
+    header[2] = nrow;
+    header[3] = ncolumn;
+    return fwrite(header, sizeof(nat_uint32_t), 4, fd) != 4;
+}
+
+/**
+ * @brief Reads the header of a classic matrix file
+ *
+ * @param fd the matrix file, at its start
+ * @param matrix where to store the matrix dimensions
+ * @param valuesize where to store the size of the cell values in the
+ * file (FIXED_POINT for files written before native values)
+ *
+ * @return 0 on success
+ */
+static int ReadMatrixHeader(FILE *fd, Matrix *matrix, nat_uint32_t *valuesize)
+{
+    nat_uint32_t word;
+
+    if (fread(&word, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
+    if (word == MATRIX_NATIVE_MAGIC) {
+	if (fread(valuesize, sizeof(nat_uint32_t), 1, fd) != 1 ||
+	    fread(&matrix->Nrows, sizeof(nat_uint32_t), 1, fd) != 1)
+	    return 1;
+	if (*valuesize != sizeof(float) && *valuesize != sizeof(double))
+	    return 1;
+    } else {
+	*valuesize = FIXED_POINT;
+	matrix->Nrows = word;
+    }
+    return fread(&matrix->Ncolumns, sizeof(nat_uint32_t), 1, fd) != 1;
+}
+
+/**
+ * @brief Size of each cell in a classic matrix file
+ */
+static size_t FileCellSize(nat_uint32_t valuesize)
+{
+    return valuesize == FIXED_POINT ? sizeof(FixedCell) : sizeof(nat_uint32_t) + 2 * valuesize;
+}
+
+/**
+ * @brief Reads the cells of a row of a classic matrix file
+ *
+ * Cells of files written with other value formats (fixed point, or
+ * a different CellValue type) are converted to native cells, and
+ * free cells are left at the end.
+ *
+ * @param fd the matrix file
+ * @param valuesize the value size, as given by ReadMatrixHeader
+ * @param l the number of cells of the row in the file
+ * @param cells where to store the cells (room for l cells)
+ * @param raw buffer for the file cells, reallocated as needed
+ * @param rawsize size of the raw buffer
+ *
+ * @return 0 on success
+ */
+static int ReadMatrixRow(FILE *fd, nat_uint32_t valuesize, nat_uint32_t l,
+                         Cell *cells, char **raw, size_t *rawsize)
+{
+    size_t cellsize = FileCellSize(valuesize);
+    nat_uint32_t i, n;
+    char *p;
+
+    if (valuesize == sizeof(CellValue))
+	return fread(cells, sizeof(Cell), l, fd) != l;
+
+    if (cellsize * l > *rawsize) {
+	*rawsize = cellsize * l;
+	*raw = (char*)realloc(*raw, *rawsize);
+	if (!*raw) return 1;
+    }
+    if (fread(*raw, cellsize, l, fd) != l) return 1;
+
+    if (valuesize == FIXED_POINT) {
+	n = DecodeFixedRow((FixedCell*)*raw, l, cells);
+    } else {
+	for (n = 0, p = *raw; n < l; n++, p += cellsize) {
+	    memcpy(&cells[n].column, p, sizeof(nat_uint32_t));
+	    if (!cells[n].column) break;
+	    cells[n].value1 = DecodeNativeValue(p + sizeof(nat_uint32_t), valuesize);
+	    cells[n].value2 = DecodeNativeValue(p + sizeof(nat_uint32_t) + valuesize, valuesize);
+	}
+    }
+    for (i = n; i < l; i++) {
+	cells[i].column = 0;
+	cells[i].value1 = cells[i].value2 = 0;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks if an open matrix file is in the mappable format
+ *
+ * Leaves the file position at the start of the file.
+ */
+static nat_boolean_t IsMappedMatrix(FILE *fd)
+{
+    nat_uint32_t magic;
+    nat_boolean_t mapped;
+
+    mapped = (fread(&magic, sizeof(nat_uint32_t), 1, fd) == 1 &&
+              (magic == MATRIX_MAGIC || magic == GUINT32_SWAP_LE_BE(MATRIX_MAGIC)));
+    rewind(fd);
+    return mapped;
+}
+
+/**
+ * @brief Checks if an array of a mappable matrix file is inside the
+ * file
+ *
+ * @param pos file position of the array
+ * @param count number of elements of the array
+ * @param size size of each element
+ * @param length size of the file
+ * @return true if the array ends before the end of the file
+ */
+static nat_boolean_t MappedArrayFits(uint64_t pos, uint64_t count, size_t size, uint64_t length)
+{
+    return pos <= length && count <= (length - pos) / size;
+}
+
+/**
+ * @brief Maps a matrix file in the mappable format
+ *
+ * The mapping is private: value pages are copied on the first write,
+ * so the matrix can be used as the EM working matrix without touching
+ * the file. Offsets and columns are kept read only.
+ *
+ * @return a frozen matrix, or NULL on error
+ */
+static Matrix *MapMatrix(char *filename)
+{
+    Matrix *matrix;
+    MappedHeader header;
+    struct stat st;
+    uint64_t pos, r, *offsets;
+    char *map;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+	report_error("matrix.c: error opening file");
+	return NULL;
+    }
+    if (fstat(fd, &st) || read(fd, &header, sizeof(MappedHeader)) != sizeof(MappedHeader)) {
+	close(fd);
+	report_error("matrix.c: error reading mapped matrix header");
+	return NULL;
+    }
+    if (header.magic != MATRIX_MAGIC) {
+	close(fd);
+	report_error("matrix.c: mapped matrix has a different byte order");
+	return NULL;
+    }
+    if (header.version != MATRIX_MAPPED_VERSION) {
+	close(fd);
+	report_error("matrix.c: unsupported mapped matrix version");
+	return NULL;
+    }
+    if (header.valuesize != sizeof(CellValue)) {
+	close(fd);
+	report_error("matrix.c: mapped matrix has a different cell value type");
+	return NULL;
+    }
+    if (!MappedArrayFits(header.offsets, (uint64_t)header.Nrows + 2, sizeof(uint64_t), st.st_size) ||
+        !MappedArrayFits(header.columns, header.Ncells, sizeof(nat_uint32_t), st.st_size) ||
+        !MappedArrayFits(header.values[MATRIX_1], header.Ncells, sizeof(CellValue), st.st_size) ||
+        !MappedArrayFits(header.values[MATRIX_2], header.Ncells, sizeof(CellValue), st.st_size)) {
+	close(fd);
+	report_error("matrix.c: mapped matrix file is truncated");
+	return NULL;
+    }
+
+    map = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+	report_error("matrix.c: error mapping matrix file");
+	return NULL;
+    }
+    /* rows must lie inside the cells */
+    offsets = (uint64_t*)(map + header.offsets);
+    for (r = 0; r <= header.Nrows && offsets[r] <= offsets[r + 1]; r++)
+	;
+    if (r <= header.Nrows || offsets[header.Nrows + 1] != header.Ncells) {
+	munmap(map, st.st_size);
+	report_error("matrix.c: mapped matrix file is corrupt");
+	return NULL;
+    }
+
+    /* structure pages are never written */
+    pos = header.values[0] < header.values[1] ? header.values[0] : header.values[1];
+    if (pos % sysconf(_SC_PAGESIZE) == 0)
+	mprotect(map, pos, PROT_READ);
+
+    matrix = (Matrix*)malloc(sizeof(Matrix));
+    if (!matrix) {
+	munmap(map, st.st_size);
+	report_error("matrix.c: error allocating matrix structure");
+	return NULL;
+    }
+    InitFrozenFields(matrix);
+    matrix->rows     = NULL;
+    matrix->Nrows    = header.Nrows;
+    matrix->Ncolumns = header.Ncolumns;
+    matrix->Ncells   = header.Ncells;
+    matrix->offsets  = offsets;
+    matrix->columns  = (nat_uint32_t*)(map + header.columns);
+    matrix->values[MATRIX_1] = (CellValue*)(map + header.values[MATRIX_1]);
+    matrix->values[MATRIX_2] = (CellValue*)(map + header.values[MATRIX_2]);
+    matrix->map      = map;
+    matrix->mapsize  = st.st_size;
+    matrix->frozen   = TRUE;
+    return matrix;
+}
+
+/**
+ * @brief Converts a mapped matrix to the dynamic layout
+ *
+ * Used by LoadMatrix, as its users expect to add new cells. The
+ * mapped matrix is freed.
+ */
+static Matrix *ThawMatrix(Matrix *mapped)
+{
+    Matrix *matrix;
+    nat_uint32_t r, l;
+
+    if (!mapped) return NULL;
+
+    matrix = (Matrix*)malloc(sizeof(Matrix));
+    if (!matrix) {
+	report_error("matrix.c: error allocating matrix structure");
+	return NULL;
+    }
+    InitFrozenFields(matrix);
+    matrix->Nrows    = mapped->Nrows;
+    matrix->Ncolumns = mapped->Ncolumns;
+    matrix->rows = (Row*)malloc(sizeof(Row) * (matrix->Nrows + 1));
+    if (!matrix->rows) {
+	report_error("matrix.c: error allocating row pointers");
+	return NULL;
+    }
+
+    for (r = 1; r <= matrix->Nrows; ++r) {
+	/* leave free cells at the end, as AllocMatrix does */
+	l = (mapped->offsets[r+1] - mapped->offsets[r] + MEMBLOCK) / MEMBLOCK * MEMBLOCK;
+	matrix->rows[r].cells = (Cell*)calloc(l, sizeof(Cell));
+	if (!matrix->rows[r].cells) {
+	    report_error("matrix.c: error allocating cells memory");
+	    return NULL;
+	}
+	EncodeFrozenRow(mapped, r, matrix->rows[r].cells);
+	matrix->rows[r].length = l;
+    }
+
+    FreeMatrix(mapped);
+    return matrix;
+}
+
+/**
+ * @brief Writes zeros up to the next MAPPED_ALIGN boundary
+ *
+ * @return the new file position, or 0 on error
+ */
+static uint64_t AlignMappedFile(FILE *fd, uint64_t pos)
+{
+    static const char zeros[MAPPED_ALIGN] = { 0 };
+    uint64_t pad = (MAPPED_ALIGN - pos % MAPPED_ALIGN) % MAPPED_ALIGN;
+
+    if (pad && fwrite(zeros, 1, pad, fd) != pad) return 0;
+    return pos + pad;
+}
+
+/**
+ * @brief Writes one values array of a dynamic matrix, in the frozen
+ * layout order
+ */
+static int SaveDynamicValues(Matrix *matrix, MatrixVal Ma, FILE *fd)
+{
+    nat_uint32_t r, i, l;
+    CellValue f;
+    Cell *p;
+
+    for (r = 1; r <= matrix->Nrows; ++r) {
+	p = matrix->rows[r].cells;
+	l = matrix->rows[r].length;
+	for (i = 0; i < l && p[i].column > 0; i++) {
+	    f = Get(p+i, Ma);
+	    if (fwrite(&f, sizeof(CellValue), 1, fd) != 1) return 1;
+	}
+    }
+    return 0;
+}
+
+/**
+ * @brief Writes the sections of a mappable matrix file
+ *
+ * @return 0 on success
+ */
+static int WriteMappedSections(Matrix *matrix, MappedHeader *header,
+                               uint64_t *offsets, FILE *fd)
+{
+    nat_uint32_t r, i, l;
+    Cell *p;
+
+    if (fwrite(header, sizeof(MappedHeader), 1, fd) != 1) return 1;
+    if (AlignMappedFile(fd, sizeof(MappedHeader)) != header->offsets) return 1;
+    if (fwrite(offsets, sizeof(uint64_t), matrix->Nrows + 2, fd) != matrix->Nrows + 2) return 1;
+    if (AlignMappedFile(fd, header->offsets + sizeof(uint64_t) * (matrix->Nrows + 2)) != header->columns)
+	return 1;
+
+    if (matrix->frozen) {
+	if (fwrite(matrix->columns, sizeof(nat_uint32_t), header->Ncells, fd) != header->Ncells) return 1;
+    } else {
+	for (r = 1; r <= matrix->Nrows; ++r) {
+	    p = matrix->rows[r].cells;
+	    l = matrix->rows[r].length;
+	    for (i = 0; i < l && p[i].column > 0; i++)
+		if (fwrite(&p[i].column, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
+	}
+    }
+    if (AlignMappedFile(fd, header->columns + sizeof(nat_uint32_t) * header->Ncells) != header->values[MATRIX_1])
+	return 1;
+
+    if (matrix->frozen) {
+	if (fwrite(matrix->values[MATRIX_1], sizeof(CellValue), header->Ncells, fd) != header->Ncells) return 1;
+    } else {
+	if (SaveDynamicValues(matrix, MATRIX_1, fd)) return 1;
+    }
+    if (AlignMappedFile(fd, header->values[MATRIX_1] + sizeof(CellValue) * header->Ncells) != header->values[MATRIX_2])
+	return 1;
+
+    if (matrix->frozen) {
+	if (fwrite(matrix->values[MATRIX_2], sizeof(CellValue), header->Ncells, fd) != header->Ncells) return 1;
+    } else {
+	if (SaveDynamicValues(matrix, MATRIX_2, fd)) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Save the matrix to disk, in the mappable format
+ *
+ * The matrix can be in any layout. Loading the file with
+ * LoadFrozenMatrix maps it in memory without copying or decoding.
+ * The file is written under a temporary name and renamed when
+ * complete, so readers never see a partial matrix.
+ *
+ * @param matrix the matrix to be saved
+ * @param filename the filename of the file to be created
+ *
+ * @return 0 on success
+ */
+int SaveMappedMatrix(Matrix *matrix, char *filename)
+{
+    MappedHeader header;
+    FILE *fd;
+    char *tmpname;
+    uint64_t pos, k, *offsets;
+    nat_uint32_t r, i, l;
+    int error;
+    Cell *p;
+
+    /* offsets of a dynamic matrix are computed first */
+    if (matrix->frozen) {
+	offsets = matrix->offsets;
+    } else {
+	offsets = (uint64_t*)malloc(sizeof(uint64_t) * (matrix->Nrows + 2));
+	if (!offsets) return 1;
+	offsets[0] = offsets[1] = 0;
+	k = 0;
+	for (r = 1; r <= matrix->Nrows; ++r) {
+	    p = matrix->rows[r].cells;
+	    l = matrix->rows[r].length;
+	    for (i = 0; i < l && p[i].column > 0; i++)
+		k++;
+	    offsets[r+1] = k;
+	}
+    }
+
+    memset(&header, 0, sizeof(MappedHeader));
+    header.magic     = MATRIX_MAGIC;
+    header.version   = MATRIX_MAPPED_VERSION;
+    header.Nrows     = matrix->Nrows;
+    header.Ncolumns  = matrix->Ncolumns;
+    header.valuesize = sizeof(CellValue);
+    header.Ncells    = offsets[matrix->Nrows + 1];
+
+    pos = MAPPED_ALIGN;
+    header.offsets = pos;
+    pos += sizeof(uint64_t) * (matrix->Nrows + 2);
+    pos += (MAPPED_ALIGN - pos % MAPPED_ALIGN) % MAPPED_ALIGN;
+    header.columns = pos;
+    pos += sizeof(nat_uint32_t) * header.Ncells;
+    pos += (MAPPED_ALIGN - pos % MAPPED_ALIGN) % MAPPED_ALIGN;
+    header.values[MATRIX_1] = pos;
+    pos += sizeof(CellValue) * header.Ncells;
+    pos += (MAPPED_ALIGN - pos % MAPPED_ALIGN) % MAPPED_ALIGN;
+    header.values[MATRIX_2] = pos;
+
+    tmpname = g_strdup_printf("%s.tmp", filename);
+    fd = fopen(tmpname, "wb");
+    if (fd) {
+	error = WriteMappedSections(matrix, &header, offsets, fd);
+	if (fclose(fd)) error = 1;
+	if (!error && rename(tmpname, filename)) error = 1;
+	if (error) unlink(tmpname);
+    } else {
+	error = 1;
+    }
+
+    g_free(tmpname);
+    if (!matrix->frozen) free(offsets);
+    return error;
+}
+
+/**
+ * @brief Writes the matrix in the classic format to an open file
+ *
+ * @return 0 on success
+ */
+static int WriteClassicMatrix(Matrix *matrix, FILE *fd)
+{
+    nat_uint32_t r, i;
+
+    /*  
+     * FILE IS:
+     *
+     * MATRIX_NATIVE_MAGIC
+     * sizeof(CellValue)
+     * nrows
+     * ncolumns
+     * row1ncols col val1 val2 col val1 val2
+     * row2ncols col val1 val2 col val1 val2
+     */
+
+    if (WriteMatrixHeader(fd, matrix->Nrows, matrix->Ncolumns)) return 1;
+
+    if (matrix->frozen) return SaveFrozenRows(matrix, fd);
+
+    for (r = 1; r <= matrix->Nrows; ++r) {
+	i = matrix->rows[r].length;
+	if (fwrite(&i, sizeof(nat_uint32_t), 1, fd) != 1) return 1;
+	if (fwrite(matrix->rows[r].cells, sizeof(Cell), i, fd) != i) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Save the matrix to disk
+ *
+ * The file is written under a temporary name and renamed when
+ * complete, as the matrix may be mapped from the file replaced.
+ *
+ * @param matrix the matrix to be saved
+ * @param filename the filename of the file to be created
+ *
+ * @return 0 on success
+ */
+int SaveMatrix(Matrix *matrix, char *filename)
+{
+    char *tmpname;
+    FILE *fd;
+    int error;
+
+    tmpname = g_strdup_printf("%s.tmp", filename);
+    fd = fopen(tmpname, "wb");
+    if (fd) {
+	error = WriteClassicMatrix(matrix, fd);
+	if (fclose(fd)) error = 1;
+	if (!error && rename(tmpname, filename)) error = 1;
+	if (error) unlink(tmpname);
+    } else {
+	error = 1;
+    }
+
+    g_free(tmpname);
+    return error;
+}
+
+/**
+ * @brief Save an EM checkpoint: the matrix, with both copies, and the
+ * number of completed EM steps
+ *
+ * The checkpoint is a classic matrix file followed by a trailer
+ * (MATRIX_CHECKPOINT_MAGIC and the step number) that matrix loaders
+ * ignore. It is written under a temporary name, synced to disk and
+ * renamed, so an interrupted save leaves the previous checkpoint
+ * intact.
+ *
+ * @param matrix the matrix to be saved
+ * @param filename the checkpoint filename
+ * @param step number of completed EM steps
+ *
+ * @return 0 on success
+ */
+int SaveMatrixCheckpoint(Matrix *matrix, char *filename, nat_uint32_t step)
+{
+    nat_uint32_t trailer[2];
+    char *tmpname;
+    FILE *fd;
+    int error;
+
+    tmpname = g_strdup_printf("%s.tmp", filename);
+    fd = fopen(tmpname, "wb");
+    if (fd) {
+	error = WriteClassicMatrix(matrix, fd);
+	trailer[0] = MATRIX_CHECKPOINT_MAGIC;
+	trailer[1] = step;
+	if (!error && fwrite(trailer, sizeof(nat_uint32_t), 2, fd) != 2) error = 1;
+	if (fflush(fd) || fsync(fileno(fd))) error = 1;
+	if (fclose(fd)) error = 1;
+    } else {
+	error = 1;
+    }
+    if (!error && rename(tmpname, filename)) error = 1;
+    if (error) unlink(tmpname);
+
+    g_free(tmpname);
+    return error;
+}
+
+/**
+ * @brief Load an EM checkpoint saved by SaveMatrixCheckpoint
+ *
+ * @param filename the checkpoint filename
+ * @param frozen TRUE to load the matrix in the frozen layout
+ * @param step where to store the number of completed EM steps
+ *
+ * @return the matrix, or NULL if the file does not exist or is not a
+ * checkpoint
+ */
+Matrix *LoadMatrixCheckpoint(char *filename, nat_boolean_t frozen, nat_uint32_t *step)
+{
+    nat_uint32_t trailer[2];
+    FILE *fd;
+
+    fd = fopen(filename, "rb");
+    if (!fd) return NULL;
+    if (fseek(fd, -(long) sizeof(trailer), SEEK_END) ||
+	fread(trailer, sizeof(nat_uint32_t), 2, fd) != 2 ||
+	trailer[0] != MATRIX_CHECKPOINT_MAGIC) {
+	fclose(fd);
+	return NULL;
+    }
+    fclose(fd);
+
+    *step = trailer[1];
+    return frozen ? LoadFrozenMatrix(filename) : LoadMatrix(filename);
+}
+
+/**
+ * @brief Load a matrix from disk
+ *
+ * Files written before native cell values (in fixed point) are
+ * converted when loaded, as are files written with a different
+ * CellValue type.
+ *
+ * @param filename the filename of the file containing the matrix
+ * information
+ *
+ * @return the newly created Matrix structure
+ */
+Matrix *LoadMatrix(char *filename)
+{
+    Matrix *matrix;
+    FILE *fd;
+    nat_uint32_t r, i, valuesize;
+    char *raw = NULL;
+    size_t rawsize = 0;
     
     fd = fopen(filename, "rb"); 
     if (!fd) {
@@ -914,12 +2012,19 @@ Matrix *LoadMatrix(char *filename)
     /*  
      * FILE IS:
      *
+     * MATRIX_NATIVE_MAGIC   (not in fixed point files)
+     * sizeof(CellValue)     (not in fixed point files)
      * nrows
      * ncolumns
      * row1ncols col val1 val2 col val1 val2
      * row2ncols col val1 val2 col val1 val2
      */
 
+    if (IsMappedMatrix(fd)) {
+	fclose(fd);
+	return ThawMatrix(MapMatrix(filename));
+    }
+
     //matrix = g_new(Matrix, 1);
     matrix = (Matrix*)malloc(sizeof(Matrix));
     if (!matrix) {
@@ -927,12 +2032,10 @@ Matrix *LoadMatrix(char *filename)
 	return NULL;
     }
 
-    if (fread(&matrix->Nrows, sizeof(nat_uint32_t), 1, fd) != 1) {
-	report_error("matrix.c: error loading number of rows");
-	return NULL;
-    }
-    if (fread(&matrix->Ncolumns, sizeof(nat_uint32_t), 1, fd) != 1) {
-	report_error("matrix.c: error loading number of columns");
+    InitFrozenFields(matrix);
+
+    if (ReadMatrixHeader(fd, matrix, &valuesize)) {
+	report_error("matrix.c: error loading matrix dimensions");
 	return NULL;
     }
     //matrix->rows = g_new(Row, matrix->Nrows + 1);
@@ -960,15 +2063,363 @@ Matrix *LoadMatrix(char *filename)
 	    return NULL;
 	}
 
-	/* FIXME: CHECK MALLOC */
-	if (fread(matrix->rows[r].cells, sizeof(Cell), i, fd) != i) {
+	if (ReadMatrixRow(fd, valuesize, i, matrix->rows[r].cells, &raw, &rawsize)) {
 	    /* FIXME: free previous rows */
 	    free(matrix->rows);
 	    free(matrix);
+	    free(raw);
 	    return NULL;
 	}
     }
 
+    free(raw);
+    fclose(fd);
+    return matrix;
+}
+
+/**
+ * @brief Freezes a matrix in the compressed sparse row layout
+ *
+ * Converts the matrix in place. After this, no cells can be added to
+ * the matrix: increments to cells outside the pattern are dropped
+ * (and counted in the dropped field).
+ *
+ * @param matrix the matrix to be frozen
+ *
+ * @return 0 on success
+ */
+int FreezeMatrix(Matrix *matrix)
+{
+    nat_uint32_t r, i, l;
+    uint64_t k;
+    Cell *p;
+
+    if (matrix->frozen) return 0;
+
+    k = 0;
+    for (r = 1; r <= matrix->Nrows; ++r) {
+        p = matrix->rows[r].cells;
+        l = matrix->rows[r].length;
+        for (i = 0; i < l && p[i].column > 0; i++)
+            k++;
+    }
+
+    if (AllocFrozenArrays(matrix, k)) return 1;
+
+    k = 0;
+    for (r = 1; r <= matrix->Nrows; ++r) {
+        p = matrix->rows[r].cells;
+        l = matrix->rows[r].length;
+        for (i = 0; i < l && p[i].column > 0; i++) {
+            matrix->columns[k] = p[i].column;
+            matrix->values[MATRIX_1][k] = p[i].value1;
+            matrix->values[MATRIX_2][k] = p[i].value2;
+            k++;
+        }
+        matrix->offsets[r+1] = k;
+        free(matrix->rows[r].cells);
+    }
+    free(matrix->rows);
+    matrix->rows = NULL;
+
+    matrix->Ncells = k;
+    matrix->frozen = TRUE;
+    return 0;
+}
+
+/**
+ * @brief Load a matrix from disk, directly in the frozen layout
+ *
+ * Same as LoadMatrix followed by FreezeMatrix, but without keeping
+ * both layouts in memory at the same time.
+ *
+ * @param filename the filename of the file containing the matrix
+ * information
+ *
+ * @return the newly created Matrix structure
+ */
+Matrix *LoadFrozenMatrix(char *filename)
+{
+    Matrix *matrix;
+    FILE *fd;
+    Cell *cells = NULL;
+    nat_uint32_t r, i, l, size = 0, valuesize;
+    uint64_t k, bound;
+    char *raw = NULL;
+    size_t rawsize = 0;
+    long fsize;
+
+    fd = fopen(filename, "rb");
+    if (!fd) {
+	report_error("matrix.c: error opening file");
+	return NULL;
+    }
+
+    if (IsMappedMatrix(fd)) {
+	fclose(fd);
+	return MapMatrix(filename);
+    }
+
+    matrix = (Matrix*)malloc(sizeof(Matrix));
+    if (!matrix) {
+	report_error("matrix.c: error allocating matrix structure");
+	return NULL;
+    }
+    InitFrozenFields(matrix);
+    matrix->rows = NULL;
+
+    if (ReadMatrixHeader(fd, matrix, &valuesize)) {
+	report_error("matrix.c: error loading matrix dimensions");
+	return NULL;
+    }
+
+    /* the file size gives an upper bound for the number of cells */
+    k = ftell(fd);
+    fseek(fd, 0, SEEK_END);
+    fsize = ftell(fd);
+    fseek(fd, k, SEEK_SET);
+    bound = (fsize - k - (long)matrix->Nrows * sizeof(nat_uint32_t)) / FileCellSize(valuesize);
+
+    if (AllocFrozenArrays(matrix, bound)) {
+	report_error("matrix.c: error allocating frozen matrix");
+	return NULL;
+    }
+
+    k = 0;
+    for (r = 1; r <= matrix->Nrows; ++r) {
+	if (fread(&l, sizeof(nat_uint32_t), 1, fd) != 1) {
+	    report_error("matrix.c: error reading value");
+	    return NULL;
+	}
+        if (l > size) {
+            size = l;
+            cells = (Cell*)realloc(cells, sizeof(Cell) * size);
+            if (!cells) {
+                report_error("matrix.c: error allocating cells memory");
+                return NULL;
+            }
+        }
+	if (ReadMatrixRow(fd, valuesize, l, cells, &raw, &rawsize)) {
+	    report_error("matrix.c: error reading row");
+	    return NULL;
+	}
+        for (i = 0; i < l && cells[i].column > 0; i++) {
+            matrix->columns[k] = cells[i].column;
+            matrix->values[MATRIX_1][k] = cells[i].value1;
+            matrix->values[MATRIX_2][k] = cells[i].value2;
+            k++;
+        }
+        matrix->offsets[r+1] = k;
+    }
+    free(cells);
+    free(raw);
     fclose(fd);
+
+    /* give back the space reserved for padding cells */
+    if (k && k < bound) {
+        matrix->columns   = (nat_uint32_t*)realloc(matrix->columns, sizeof(nat_uint32_t) * k);
+        matrix->values[0] = (CellValue*)realloc(matrix->values[0], sizeof(CellValue) * k);
+        matrix->values[1] = (CellValue*)realloc(matrix->values[1], sizeof(CellValue) * k);
+    }
+
+    matrix->Ncells = k;
+    matrix->frozen = TRUE;
     return matrix;
 }
+
+/**
+ * @brief State of a MatrixWriter
+ */
+struct cMatrixWriter {
+    /** name of the file being written */
+    char          *filename;
+    /** name the file is written under, before being renamed */
+    char          *tmpname;
+    /** the file being written */
+    FILE          *fd;
+    /** true if writing the mappable format */
+    nat_boolean_t  mapped;
+    /** number of rows of the matrix */
+    nat_uint32_t   Nrows;
+    /** number of rows written so far */
+    nat_uint32_t   row;
+    /** mappable format: header, completed when closing */
+    MappedHeader   header;
+    /** mappable format: first cell of each row */
+    uint64_t      *offsets;
+    /** mappable format: values arrays, copied to the file when closing */
+    FILE          *values[2];
+    /** true after a write error */
+    nat_boolean_t  error;
+};
+
+/**
+ * @brief Creates a matrix file to be written row by row
+ *
+ * Only the rows being written are kept in memory. In the classic
+ * format, rows are written directly. In the mappable format, the
+ * columns are written directly, and the values go to temporary files
+ * (next to the matrix file) that are copied when the writer is
+ * closed. Offsets are kept in memory.
+ *
+ * @param filename the filename of the file to be created
+ * @param nrow number of rows
+ * @param ncolumn number of columns
+ * @param mapped TRUE to write the mappable format
+ *
+ * @return the new MatrixWriter, or NULL on error
+ */
+MatrixWriter *MatrixWriterNew(char *filename, nat_uint32_t nrow, nat_uint32_t ncolumn,
+                              nat_boolean_t mapped)
+{
+    MatrixWriter *writer;
+    uint64_t pos;
+
+    writer = (MatrixWriter*)malloc(sizeof(MatrixWriter));
+    if (!writer) return NULL;
+    writer->filename = g_strdup(filename);
+    writer->tmpname  = mapped ? g_strdup_printf("%s.tmp", filename) : g_strdup(filename);
+    writer->mapped   = mapped;
+    writer->Nrows    = nrow;
+    writer->row      = 0;
+    writer->offsets  = NULL;
+    writer->values[0] = writer->values[1] = NULL;
+    writer->error    = FALSE;
+
+    writer->fd = fopen(writer->tmpname, "wb");
+    if (!writer->fd) {
+	g_free(writer->filename);
+	g_free(writer->tmpname);
+	free(writer);
+	return NULL;
+    }
+
+    if (!mapped) {
+	if (WriteMatrixHeader(writer->fd, nrow, ncolumn))
+	    writer->error = TRUE;
+	return writer;
+    }
+
+    memset(&writer->header, 0, sizeof(MappedHeader));
+    writer->header.magic     = MATRIX_MAGIC;
+    writer->header.version   = MATRIX_MAPPED_VERSION;
+    writer->header.Nrows     = nrow;
+    writer->header.Ncolumns  = ncolumn;
+    writer->header.valuesize = sizeof(CellValue);
+    writer->header.offsets   = MAPPED_ALIGN;
+    pos = MAPPED_ALIGN + sizeof(uint64_t) * (nrow + 2);
+    pos += (MAPPED_ALIGN - pos % MAPPED_ALIGN) % MAPPED_ALIGN;
+    writer->header.columns   = pos;
+
+    writer->offsets = (uint64_t*)calloc(nrow + 2, sizeof(uint64_t));
+    writer->values[0] = temp_file_near(filename);
+    writer->values[1] = temp_file_near(filename);
+    if (!writer->offsets || !writer->values[0] || !writer->values[1] ||
+	fseek(writer->fd, pos, SEEK_SET))
+	writer->error = TRUE;
+    return writer;
+}
+
+/**
+ * @brief Writes the next row of a matrix file
+ *
+ * @param writer the matrix writer
+ * @param cells the row cells, in the dynamic matrix format (sorted by
+ * column), without free cells
+ * @param n the number of cells
+ *
+ * @return 0 on success
+ */
+int MatrixWriterAddRow(MatrixWriter *writer, Cell *cells, nat_uint32_t n)
+{
+    static const Cell empty[MEMBLOCK] = { { 0, 0, 0 } };
+    nat_uint32_t i, l, free_cells;
+
+    if (writer->error || writer->row == writer->Nrows) return 1;
+    writer->row++;
+
+    if (!writer->mapped) {
+	/* leave free cells at the end, as AllocMatrix does */
+	l = (n + MEMBLOCK) / MEMBLOCK * MEMBLOCK;
+	free_cells = l - n;
+	if (fwrite(&l, sizeof(nat_uint32_t), 1, writer->fd) != 1 ||
+	    fwrite(cells, sizeof(Cell), n, writer->fd) != n ||
+	    fwrite(empty, sizeof(Cell), free_cells, writer->fd) != free_cells)
+	    writer->error = TRUE;
+	return writer->error;
+    }
+
+    for (i = 0; i < n && !writer->error; i++) {
+	if (fwrite(&cells[i].column, sizeof(nat_uint32_t), 1, writer->fd) != 1 ||
+	    fwrite(&cells[i].value1, sizeof(CellValue), 1, writer->values[MATRIX_1]) != 1 ||
+	    fwrite(&cells[i].value2, sizeof(CellValue), 1, writer->values[MATRIX_2]) != 1)
+	    writer->error = TRUE;
+	writer->header.Ncells++;
+    }
+    writer->offsets[writer->row + 1] = writer->header.Ncells;
+    return writer->error;
+}
+
+/**
+ * @brief Appends a temporary values file to a mappable matrix file
+ */
+static int CopyMappedValues(FILE *from, FILE *to)
+{
+    char buffer[MAPPED_ALIGN * 16];
+    size_t n;
+
+    if (fflush(from) || fseek(from, 0, SEEK_SET)) return 1;
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0)
+	if (fwrite(buffer, 1, n, to) != n) return 1;
+    return ferror(from);
+}
+
+/**
+ * @brief Completes and closes a matrix file being written
+ *
+ * Rows not written are saved empty. The writer is freed.
+ *
+ * @return 0 on success
+ */
+int MatrixWriterClose(MatrixWriter *writer)
+{
+    MappedHeader *header = &writer->header;
+    nat_boolean_t error;
+    uint64_t pos;
+
+    while (!writer->error && writer->row < writer->Nrows)
+	MatrixWriterAddRow(writer, NULL, 0);
+
+    if (writer->mapped && !writer->error) {
+	pos = header->columns + sizeof(nat_uint32_t) * header->Ncells;
+	header->values[MATRIX_1] = AlignMappedFile(writer->fd, pos);
+	if (!header->values[MATRIX_1] ||
+	    CopyMappedValues(writer->values[MATRIX_1], writer->fd))
+	    writer->error = TRUE;
+	pos = header->values[MATRIX_1] + sizeof(CellValue) * header->Ncells;
+	header->values[MATRIX_2] = AlignMappedFile(writer->fd, pos);
+	if (!header->values[MATRIX_2] ||
+	    CopyMappedValues(writer->values[MATRIX_2], writer->fd) ||
+	    fseek(writer->fd, 0, SEEK_SET) ||
+	    fwrite(header, sizeof(MappedHeader), 1, writer->fd) != 1 ||
+	    fseek(writer->fd, header->offsets, SEEK_SET) ||
+	    fwrite(writer->offsets, sizeof(uint64_t), writer->Nrows + 2, writer->fd) != writer->Nrows + 2)
+	    writer->error = TRUE;
+    }
+
+    if (writer->values[0]) fclose(writer->values[0]);
+    if (writer->values[1]) fclose(writer->values[1]);
+    if (fclose(writer->fd)) writer->error = TRUE;
+    if (writer->mapped) {
+	if (!writer->error && rename(writer->tmpname, writer->filename))
+	    writer->error = TRUE;
+	if (writer->error) unlink(writer->tmpname);
+    }
+
+    error = writer->error;
+    free(writer->offsets);
+    g_free(writer->filename);
+    g_free(writer->tmpname);
+    free(writer);
+    return error;
+}
@@ -39,18 +39,68 @@
 #define MEMBLOCK 8 
 
 /**
- * @brief maximum value in one cell  (was 130)
+ * @brief maximum value in one fixed point cell  (was 130)
+ *
+ * Matrix files written before native cell values stored values in
+ * fixed point, with a second (double precision) cell for values
+ * over MAXVAL. They are converted when loaded.
  */
 #define MAXVAL 2000000
 
 /**
- * @brief number of significant decimals: 100 means 2  (was 500)
+ * @brief number of significant decimals of fixed point values: 100
+ * means 2  (was 500)
  */
 #define MAXDEC 1000  
 
+/**
+ * @brief first word of a matrix file in the mappable format ("NATM").
+ * Classic matrix files start with the number of rows instead.
+ */
+#define MATRIX_MAGIC 0x4d54414e
+
+/**
+ * @brief first word of a classic matrix file with native cell values
+ * ("NATV"). It is followed by the size of each value, and then the
+ * number of rows. Older files start with the number of rows.
+ */
+#define MATRIX_NATIVE_MAGIC 0x5654414e
+
+/**
+ * @brief first word of the trailer of an EM checkpoint ("NATK"),
+ * appended to a classic matrix file and followed by the number of
+ * completed EM steps.
+ */
+#define MATRIX_CHECKPOINT_MAGIC 0x4b54414e
 
+/**
+ * @brief version of the mappable matrix format
+ */
+#define MATRIX_MAPPED_VERSION 1
+
+/**
+ * @brief default number of pending updates in a MatrixBatch
+ */
+#define MATRIX_BATCH (1 << 20)
+
+
+#include <stddef.h>
+#include <stdint.h>
 #include "standard.h"
 
+/**
+ * @brief type of the matrix cell values. float unless defined at
+ * compile time (for instance, -DMATRIX_VALUE_TYPE=double).
+ */
+#ifndef MATRIX_VALUE_TYPE
+#define MATRIX_VALUE_TYPE float
+#endif
+
+/**
+ * @brief Matrix cell value
+ */
+typedef MATRIX_VALUE_TYPE CellValue;
+
 /**
  * @brief Macro to return the number of rows from a Matrix
  */
@@ -81,13 +131,13 @@ typedef struct cCell {
      *
      * @todo explain why value1 and value2
      */
-    nat_uint32_t   value1;
+    CellValue      value1;
     /** 
      * @brief value2
      *
      * @todo explain why value1 and value2
      */
-    nat_uint32_t   value2;
+    CellValue      value2;
 } __attribute__((packed)) Cell;
 
 /**
@@ -102,6 +152,16 @@ typedef struct cRow {
 
 /**
  * @brief Main sparse matrix structure
+ *
+ * A matrix can be in one of two layouts. The dynamic one (rows) is
+ * used while the matrix is being built, as cells can be added at any
+ * time. After nat-initmat the set of cells does not change, and the
+ * matrix can be frozen in a compressed sparse row (CSR) layout: the
+ * cells of row r are stored from offsets[r] to offsets[r+1]-1 of the
+ * columns and values arrays, sorted by column, without padding. A
+ * frozen matrix saved in the mappable format (SaveMappedMatrix) is
+ * loaded by mapping the file, and its arrays point straight into the
+ * mapping.
  */
 typedef struct cMatrix {
     /** number of rows in the matrix  */
@@ -110,8 +170,57 @@ typedef struct cMatrix {
     nat_uint32_t   Ncolumns;
     /** array with pointers for each row information  */
     Row      *rows;
+
+    /** true if the matrix is in the frozen (CSR) layout */
+    nat_boolean_t  frozen;
+    /** number of cells of the frozen matrix */
+    uint64_t       Ncells;
+    /** first cell of each row (Nrows + 2 entries, row 0 is unused) */
+    uint64_t      *offsets;
+    /** column of each cell */
+    nat_uint32_t  *columns;
+    /** cell values, indexed by MatrixVal */
+    CellValue     *values[2];
+    /** number of increments to cells outside the frozen pattern */
+    nat_uint32_t   dropped;
+    /** file mapping holding the frozen arrays, or NULL */
+    void          *map;
+    /** size of the file mapping */
+    size_t         mapsize;
 } Matrix;
 
+/**
+ * @brief Buffer of pending increments to a matrix
+ *
+ * Increments are kept until the buffer is full (or flushed), and
+ * then applied with MatrixAccumulateBatch. The result is the same as
+ * calling IncValue for each of them, in the same order.
+ */
+typedef struct cMatrixBatch {
+    /** the matrix to increment */
+    Matrix        *matrix;
+    /** the matrix copy to increment */
+    MatrixVal      Ma;
+    /** rows of the pending increments */
+    nat_uint32_t  *rows;
+    /** columns of the pending increments */
+    nat_uint32_t  *columns;
+    /** values of the pending increments */
+    float         *values;
+    /** number of pending increments */
+    nat_uint32_t   n;
+    /** maximum number of pending increments */
+    nat_uint32_t   size;
+} MatrixBatch;
+
+/**
+ * @brief Writer for matrix files that do not fit in memory
+ *
+ * Rows are given one at a time, in order, and written straight to
+ * the file (see MatrixWriterNew).
+ */
+typedef struct cMatrixWriter MatrixWriter;
+
 Matrix*            AllocMatrix           (nat_uint32_t       Nrow,
 					  nat_uint32_t       Ncolumn);
 
@@ -131,6 +240,26 @@ int                IncValue              (Matrix       *matrix,
 					  nat_uint32_t       r,
 					  nat_uint32_t       c);
 
+int                MatrixAccumulateBatch (Matrix       *matrix,
+					  MatrixVal     Ma,
+					  nat_uint32_t      *rows,
+					  nat_uint32_t      *columns,
+					  float        *values,
+					  nat_uint32_t       n);
+
+MatrixBatch*       MatrixBatchNew        (Matrix       *matrix,
+					  MatrixVal     Ma,
+					  nat_uint32_t       size);
+
+int                MatrixBatchInc        (MatrixBatch  *batch,
+					  float         incf,
+					  nat_uint32_t       r,
+					  nat_uint32_t       c);
+
+int                MatrixBatchFlush      (MatrixBatch  *batch);
+
+void               MatrixBatchFree       (MatrixBatch  *batch);
+
 float              GetValue              (Matrix       *matrix,
 					  MatrixVal     Ma, 
 					  nat_uint32_t       r,
@@ -138,9 +267,35 @@ float              GetValue              (Matrix       *matrix,
 
 Matrix*            LoadMatrix            (char         *filename);
 
+Matrix*            LoadFrozenMatrix      (char         *filename);
+
+int                FreezeMatrix          (Matrix       *matrix);
+
 int                SaveMatrix            (Matrix       *matrix,
 					  char         *filename);
 
+int                SaveMappedMatrix      (Matrix       *matrix,
+					  char         *filename);
+
+int                SaveMatrixCheckpoint  (Matrix       *matrix,
+					  char         *filename,
+					  nat_uint32_t       step);
+
+Matrix*            LoadMatrixCheckpoint  (char         *filename,
+					  nat_boolean_t      frozen,
+					  nat_uint32_t      *step);
+
+MatrixWriter*      MatrixWriterNew       (char         *filename,
+					  nat_uint32_t       Nrow,
+					  nat_uint32_t       Ncolumn,
+					  nat_boolean_t      mapped);
+
+int                MatrixWriterAddRow    (MatrixWriter *writer,
+					  Cell         *cells,
+					  nat_uint32_t       n);
+
+int                MatrixWriterClose     (MatrixWriter *writer);
+
 void               MatrixEntropy         (Matrix       *matrix,
 					  MatrixVal     Ma, 
 					  double       *h,
@@ -200,6 +355,12 @@ void               CopyMatrix            (Matrix       *matrix,
 
 float              CompareMatrices       (Matrix       *matrix);
 
+void               MatrixChange          (Matrix       *matrix,
+					  MatrixVal     Ma,
+					  double       *mean,
+					  double       *relative,
+					  uint64_t     *nonzero);
+
 /* Gives mean difference */
 float              MatrixTotal           (Matrix       *matrix,
 			     	          MatrixVal     Ma);
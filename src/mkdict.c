@@ -50,29 +50,40 @@ static nat_uint32_t put_string(wchar_t *str, wchar_t *orig,
     return ptr;
 }
 
-static nat_uint32_t tree_to_array(nat_uint32_t nrwords, wchar_t *str, 
-                                  NATCell *cells, WordLstNode *tree, nat_uint32_t ptr,
-                                  nat_uint32_t size, nat_uint32_t *cellptr, nat_uint32_t *tab) {
+static int cell_cmp(const void *a, const void *b)
+{
+    return wcscmp((*(WordLstNode**) a)->string, (*(WordLstNode**) b)->string);
+}
+
+static nat_uint32_t lexicon_to_array(Words *lex, wchar_t *str, 
+                                     NATCell *cells, nat_uint32_t ptr,
+                                     nat_uint32_t size, nat_uint32_t *cellptr, nat_uint32_t *tab) {
+    WordLstNode **sorted = g_new(WordLstNode*, lex->count + 1);
     nat_uint32_t offset = ptr;
-    if (tree->left)
-	offset = tree_to_array(nrwords, str, cells, tree->left, offset, size, cellptr, tab);
+    nat_uint32_t id, n = 0, i;
 
-    cells[*cellptr].offset = offset;
-    cells[*cellptr].count = tree->count;
-    cells[*cellptr].id = *cellptr;
+    /* NATDict lexicons are sorted */
+    for (id = 2; id < lex->idxsize; id++)
+	if (lex->idx[id]) sorted[n++] = lex->idx[id];
+    qsort(sorted, n, sizeof(WordLstNode*), cell_cmp);
+
+    for (i = 0; i < n; i++) {
+	cells[*cellptr].offset = offset;
+	cells[*cellptr].count = sorted[i]->count;
+	cells[*cellptr].id = *cellptr;
 
 #ifdef DEBUG
-    if (tree->id >= nrwords || *cellptr >= nrwords) 
-	g_message("*** Words/id/cellptr (%u,%u,%u) ***", nrwords, tree->id, *cellptr);
+	if (sorted[i]->id >= lex->count || *cellptr >= lex->count) 
+	    g_message("*** Words/id/cellptr (%u,%u,%u) ***", lex->count, sorted[i]->id, *cellptr);
 #endif
-    tab[tree->id] = *cellptr;
+	tab[sorted[i]->id] = *cellptr;
 
-    ++*cellptr;
+	++*cellptr;
 
-    offset = put_string(str, tree->string, offset, size);
+	offset = put_string(str, sorted[i]->string, offset, size);
+    }
 
-    if (tree->right)
-	offset = tree_to_array(nrwords, str, cells, tree->right, offset, size, cellptr, tab);
+    g_free(sorted);
     return offset;
 }
 
@@ -125,9 +136,7 @@ static int save(char *outfile,
     dictionary_remap(tab1, tab2, dic);
 
     g_message("\tSaving...");
-    gzwrite(out, &dic->size, sizeof(nat_uint32_t));
-    gzwrite(out, dic->pairs, sizeof(DicPair)*MAXENTRY*(dic->size+1));
-    gzwrite(out, dic->occurs, sizeof(nat_uint32_t)*(dic->size+1));
+    dictionary_save_fh(out, dic);
     dictionary_free(dic);
 
     // Load second dictionary
@@ -138,9 +147,7 @@ static int save(char *outfile,
     dictionary_remap(tab2, tab1, dic);
 
     g_message("\tSaving...");
-    gzwrite(out, &dic->size, sizeof(nat_uint32_t));
-    gzwrite(out, dic->pairs, sizeof(DicPair)*MAXENTRY*(dic->size+1));
-    gzwrite(out, dic->occurs, sizeof(nat_uint32_t)*(dic->size+1));
+    dictionary_save_fh(out, dic);
     dictionary_free(dic);
 
     // Close the file
@@ -183,7 +190,7 @@ static void go(char *lang1, char *lang2,
     if (!tab1) { fprintf(stderr, "Error allocating tab1\n"); exit(1); }
 
     tab1[0] = tab1[1] = lex1->count-1;
-    ptr1 = tree_to_array(lex1->count,string1, cells1, lex1->tree, ptr1, size1, &cellptr1, tab1);
+    ptr1 = lexicon_to_array(lex1, string1, cells1, ptr1, size1, &cellptr1, tab1);
     
     cells1[cellptr1].offset = ptr1;
     cells1[cellptr1].count = 0;
@@ -211,7 +218,7 @@ static void go(char *lang1, char *lang2,
     if (!tab2) report_error("Error allocating tab2\n");
 
     tab2[0] = tab2[1] = lex2->count-1;
-    ptr2 = tree_to_array(lex2->count,string2, cells2, lex2->tree, ptr2, size2, &cellptr2, tab2);
+    ptr2 = lexicon_to_array(lex2, string2, cells2, ptr2, size2, &cellptr2, tab2);
 
     cells2[cellptr2].offset = ptr2;
     cells2[cellptr2].count = 0;
@@ -25,6 +25,10 @@
 #include <zlib.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "natdict.h"
 
 
@@ -43,6 +47,36 @@
  */
 #define DEBUG 0
 
+/**
+ * @brief Header of a NATDict file in the mappable format
+ *
+ * Indexes 0 and 1 are for the source and target languages. Language
+ * names are null terminated, lexicon words and cells are stored as in
+ * memory, and dictionaries are in the mappable dictionary format.
+ * Each section starts at a DICTIONARY_MAPPED_ALIGN boundary, at the
+ * file position recorded here.
+ */
+typedef struct cNATDictMappedHeader {
+    /** NATDICT_MAPPED_STAMP */
+    char         stamp[8];
+    /** NATDICT_MAPPED_VERSION */
+    nat_uint32_t version;
+    /** size of a wide character, in bytes */
+    nat_uint32_t charsize;
+    /** size of the lexicon words, in characters */
+    nat_uint32_t words_limit[2];
+    /** number of lexicon cells */
+    nat_uint32_t count[2];
+    /** file positions of the language names */
+    uint64_t     language[2];
+    /** file positions of the lexicon words */
+    uint64_t     words[2];
+    /** file positions of the lexicon cells */
+    uint64_t     cells[2];
+    /** file positions of the dictionaries */
+    uint64_t     dictionary[2];
+} NATDictMappedHeader;
+
 
 
 static void print_quoted(wchar_t *str)
@@ -78,6 +112,24 @@ nat_uint32_t natdict_dictionary_get_id(NATDict *self, nat_boolean_t language,
 			     self->source_dictionary, wid, pos);
 }
 
+/**
+ * @brief Gets the number of possible translations of a word.
+ *
+ * @param self a reference to a NATDict object.
+ * @param language a bool identifying the language being used: 0 for 
+ *   the source language and 1 for the target language.
+ * @param wid the id identifier of the word being searched.
+ * @return the number of positions with translations for the word;
+ */
+nat_uint32_t natdict_dictionary_get_entries(NATDict *self, nat_boolean_t language,
+                                            nat_uint32_t wid)
+{
+    /* if (language) then 'target' else 'source' fi */
+    return dictionary_get_entries(language?
+				  self->target_dictionary:
+				  self->source_dictionary, wid);
+}
+
 /**
  * @brief Get the translation probability for a word
  *
@@ -177,6 +229,9 @@ NATDict *natdict_new(const char *source_language, const char *target_language)
     self->source_dictionary = NULL;
     self->target_dictionary = NULL;
 
+    self->map     = NULL;
+    self->mapsize = 0;
+
     self->source_language = g_strdup(source_language);
     self->target_language = g_strdup(target_language);
 
@@ -186,6 +241,9 @@ NATDict *natdict_new(const char *source_language, const char *target_language)
 /**
  * @brief Saves a NATDict object.
  *
+ * The file is written under a temporary name, and renamed when
+ * complete, as the object may be mapped from the file replaced.
+ *
  * @param self a reference to a NATDict object.
  * @param filename a reference to a string containing the name where
  *   to to save the dictionary.
@@ -194,22 +252,28 @@ NATDict *natdict_new(const char *source_language, const char *target_language)
 nat_int_t natdict_save(NATDict *self, const char *filename)
 {
     FILE    *fh;
-    nat_uint32_t  s;
-
-    fh = gzopen(filename, "wb");
-    if (!fh) return 0;
+    nat_int_t  s;
+    char    *tmpname;
+    int      ok;
+
+    tmpname = g_strdup_printf("%s.tmp", filename);
+    fh = gzopen(tmpname, "wb");
+    if (!fh) {
+	g_free(tmpname);
+	return 0;
+    }
     
     /* write NATools stamp */
     gzprintf(fh, "!NATDict");
 
     /* write source language name */
     s = strlen(self->source_language) + 1;
-    gzwrite(fh, &s, sizeof(nat_uint32_t));
+    gzwrite(fh, &s, sizeof(nat_int_t));
     gzwrite(fh, self->source_language, s);
 
     /* write target language name */
     s = strlen(self->target_language)+1;
-    gzwrite(fh, &s, sizeof(nat_uint32_t));
+    gzwrite(fh, &s, sizeof(nat_int_t));
     gzwrite(fh, self->target_language, s);
     
     /* source lexicon */
@@ -225,19 +289,210 @@ nat_int_t natdict_save(NATDict *self, const char *filename)
     gzwrite(fh, self->target_lexicon->cells, sizeof(NATCell)*self->target_lexicon->count);
 
     /* source->target dictionary */
-    dictionary_save_fh(fh, self->source_dictionary);
+    ok = dictionary_save_fh(fh, self->source_dictionary);
 
     /* target->source dictionary */
-    dictionary_save_fh(fh, self->target_dictionary);
+    ok = ok && dictionary_save_fh(fh, self->target_dictionary);
 
-    gzclose(fh);
+    if (gzclose(fh) != Z_OK) ok = 0;
+    if (ok && rename(tmpname, filename)) ok = 0;
+    if (!ok) unlink(tmpname);
 
+    g_free(tmpname);
+    return ok;
+}
+
+/**
+ * @brief Pads a file with zeros up to a DICTIONARY_MAPPED_ALIGN
+ * boundary
+ *
+ * @return 0 on error
+ */
+static int natdict_align(FILE *fd)
+{
+    static const char zeros[DICTIONARY_MAPPED_ALIGN];
+    long pos = ftell(fd);
+
+    if (pos < 0) return 0;
+    pos %= DICTIONARY_MAPPED_ALIGN;
+    if (pos && fwrite(zeros, DICTIONARY_MAPPED_ALIGN - pos, 1, fd) != 1) return 0;
     return 1;
 }
 
+/**
+ * @brief Saves a NATDict object in the mappable format.
+ *
+ * The file is not compressed, and is mapped in memory when opened
+ * by natdict_open. It is written under a temporary name, and renamed
+ * when complete.
+ *
+ * @param self a reference to the NATDict object to be saved.
+ * @param filename the name of the file to be created.
+ * @return 0 in case of error.
+ */
+nat_int_t natdict_save_mapped(NATDict *self, const char *filename)
+{
+    NATDictMappedHeader header;
+    NATLexicon *lexicon[2];
+    Dictionary *dictionary[2];
+    const char *language[2];
+    char *tmpname;
+    FILE *fd;
+    int i, ok;
+
+    language[0]   = self->source_language;
+    language[1]   = self->target_language;
+    lexicon[0]    = self->source_lexicon;
+    lexicon[1]    = self->target_lexicon;
+    dictionary[0] = self->source_dictionary;
+    dictionary[1] = self->target_dictionary;
+
+    memset(&header, 0, sizeof(NATDictMappedHeader));
+    memcpy(header.stamp, NATDICT_MAPPED_STAMP, 8);
+    header.version  = NATDICT_MAPPED_VERSION;
+    header.charsize = sizeof(wchar_t);
+
+    tmpname = g_strdup_printf("%s.tmp", filename);
+    fd = fopen(tmpname, "wb");
+    if (!fd) {
+	g_free(tmpname);
+	return 0;
+    }
+
+    /* the header is written again when positions are known */
+    ok = fwrite(&header, sizeof(NATDictMappedHeader), 1, fd) == 1 && natdict_align(fd);
+
+    for (i = 0; ok && i < 2; i++) {
+	header.language[i] = ftell(fd);
+	ok = fwrite(language[i], strlen(language[i]) + 1, 1, fd) == 1 && natdict_align(fd);
+    }
+
+    for (i = 0; ok && i < 2; i++) {
+	header.words_limit[i] = lexicon[i]->words_limit;
+	header.count[i]       = lexicon[i]->count;
+
+	header.words[i] = ftell(fd);
+	ok = (!header.words_limit[i] ||
+	      fwrite(lexicon[i]->words, sizeof(wchar_t), header.words_limit[i], fd) == header.words_limit[i]) &&
+	    natdict_align(fd);
+
+	header.cells[i] = ftell(fd);
+	ok = ok && (!header.count[i] ||
+		    fwrite(lexicon[i]->cells, sizeof(NATCell), header.count[i], fd) == header.count[i]) &&
+	    natdict_align(fd);
+    }
+
+    for (i = 0; ok && i < 2; i++) {
+	header.dictionary[i] = ftell(fd);
+	ok = dictionary_save_mapped_fh(fd, dictionary[i]);
+    }
+
+    ok = ok && !fseek(fd, 0, SEEK_SET) &&
+	fwrite(&header, sizeof(NATDictMappedHeader), 1, fd) == 1;
+
+    if (fclose(fd)) ok = 0;
+    if (ok && rename(tmpname, filename)) ok = 0;
+    if (!ok) unlink(tmpname);
+
+    g_free(tmpname);
+    return ok;
+}
+
+/**
+ * @brief Checks if a NATDict file is in the mappable format
+ */
+static nat_boolean_t natdict_is_mapped(const char *filename)
+{
+    char stamp[8];
+    nat_boolean_t mapped;
+    FILE *fd;
+
+    fd = fopen(filename, "rb");
+    if (!fd) return FALSE;
+    mapped = (fread(stamp, 8, 1, fd) == 1 && !strncmp(stamp, NATDICT_MAPPED_STAMP, 8));
+    fclose(fd);
+    return mapped;
+}
+
+/**
+ * @brief Maps a NATDict file in the mappable format
+ *
+ * Lexicons and dictionaries are used in place. The mapping is
+ * private, so they can be changed without touching the file.
+ *
+ * @return a reference to the NATDict object, or NULL on error.
+ */
+static NATDict *natdict_map(const char *filename)
+{
+    NATDictMappedHeader *header;
+    Dictionary *dictionary[2];
+    NATLexicon *lexicon[2];
+    NATDict *self;
+    struct stat st;
+    uint64_t size;
+    char *map;
+    int fd, i;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) || (size_t) st.st_size < sizeof(NATDictMappedHeader)) {
+	close(fd);
+	return NULL;
+    }
+    map = (char*)mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return NULL;
+
+    size = st.st_size;
+    header = (NATDictMappedHeader*)map;
+    if (header->version != NATDICT_MAPPED_VERSION || header->charsize != sizeof(wchar_t)) {
+	munmap(map, size);
+	return NULL;
+    }
+    for (i = 0; i < 2; i++)
+	if (header->language[i] >= size ||
+	    !memchr(map + header->language[i], 0, size - header->language[i]) ||
+	    header->words[i] + sizeof(wchar_t) * (uint64_t) header->words_limit[i] > size ||
+	    header->cells[i] + sizeof(NATCell) * (uint64_t) header->count[i] > size ||
+	    header->dictionary[i] >= size) {
+	    munmap(map, size);
+	    return NULL;
+	}
+
+    dictionary[0] = dictionary_map_image(map + header->dictionary[0], size - header->dictionary[0]);
+    dictionary[1] = dictionary_map_image(map + header->dictionary[1], size - header->dictionary[1]);
+    if (!dictionary[0] || !dictionary[1]) {
+	if (dictionary[0]) dictionary_free(dictionary[0]);
+	if (dictionary[1]) dictionary_free(dictionary[1]);
+	munmap(map, size);
+	return NULL;
+    }
+
+    for (i = 0; i < 2; i++) {
+	lexicon[i] = g_new(NATLexicon, 1);
+	lexicon[i]->words_limit = header->words_limit[i];
+	lexicon[i]->words       = (wchar_t*)(map + header->words[i]);
+	lexicon[i]->count       = header->count[i];
+	lexicon[i]->cells       = (NATCell*)(map + header->cells[i]);
+    }
+
+    self = natdict_new(map + header->language[0], map + header->language[1]);
+    self->source_lexicon    = lexicon[0];
+    self->target_lexicon    = lexicon[1];
+    self->source_dictionary = dictionary[0];
+    self->target_dictionary = dictionary[1];
+    self->map     = map;
+    self->mapsize = size;
+
+    return self;
+}
+
 /**
  * @brief Loads a NATDict object from a file.
  *
+ * Files in the mappable format (see natdict_save_mapped) are mapped
+ * in memory instead.
+ *
  * @param filename a reference to a string containing the name where
  *   the dictionary is saved.
  * @return a reference to the loaded NATDict object, or NULL
@@ -250,13 +505,17 @@ NATDict *natdict_open(const char *filename)
     nat_int_t s;
     NATDict *self;
 
+    if (natdict_is_mapped(filename)) return natdict_map(filename);
+
     fh = gzopen(filename, "rb");
     if (!fh) return NULL;
 
     /* Read stamp */
     gzread(fh, &tmp, 8 * sizeof(char));
-    if (strncmp(tmp, "!NATDict", 8))
+    if (strncmp(tmp, "!NATDict", 8)) {
+	gzclose(fh);
 	return NULL;
+    }
 
     /* Read Language names */
     gzread(fh, &s, sizeof(nat_int_t));
@@ -308,7 +567,7 @@ static void natdict_perldump_(NATLexicon *source,
 	printf(" => {\n");
 	printf("\t\tcount => %u,\n", natlexicon_count_from_id(source, id));
 	printf("\t\ttrans => {\n");
-	for (j=0; j<MAXENTRY; ++j) {
+	for (j=0; j<dictionary_get_entries(dic, id); ++j) {
 	    if (dictionary_get_val(dic, id, j) == 0.0000000) break;
 	    printf("\t\t\t");
 	    print_quoted(natlexicon_word_from_id(target, dictionary_get_id(dic, id, j)));
@@ -382,9 +641,7 @@ NATDict *natdict_add(NATDict *dic1, NATDict *dic2)
     NATLexicon *SLex, *TLex;
     NATDict *self;
 
-    self = g_new(NATDict, 1);
-    self->source_language = g_strdup(dic1->source_language);
-    self->target_language = g_strdup(dic1->target_language);
+    self = natdict_new(dic1->source_language, dic1->target_language);
     /* before start, should we see if the languages are the same? */
 
     g_message("Conciliating source dictionaries");
@@ -433,11 +690,18 @@ void natdict_free(NATDict *self)
     g_free(self->source_language);
     g_free(self->target_language);
 
-    natlexicon_free(self->source_lexicon);
-    natlexicon_free(self->target_lexicon);
+    if (self->map) {
+	g_free(self->source_lexicon);
+	g_free(self->target_lexicon);
+    } else {
+	natlexicon_free(self->source_lexicon);
+	natlexicon_free(self->target_lexicon);
+    }
 
     dictionary_free(self->source_dictionary);
     dictionary_free(self->target_dictionary);
 
+    if (self->map) munmap(self->map, self->mapsize);
+
     g_free(self);
 }
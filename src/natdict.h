@@ -31,6 +31,17 @@
  * @brief NATDict object API header file
  */
 
+/**
+ * @brief Stamp of NATDict files in the mappable format (NATDict files
+ * in the compressed format start with "!NATDict")
+ */
+#define NATDICT_MAPPED_STAMP "!NATDMap"
+
+/**
+ * @brief Version of the mappable NATDict format
+ */
+#define NATDICT_MAPPED_VERSION 1
+
 /**
  * @brief NATDict object structure
  */
@@ -49,11 +60,18 @@ typedef struct _NATDict {
     Dictionary *source_dictionary;
     /** Dictionary from the target to the source language */
     Dictionary *target_dictionary;
+
+    /** file mapping holding lexicons and dictionaries, or NULL */
+    char       *map;
+    /** size of the file mapping */
+    size_t      mapsize;
 } NATDict;
 
 
 nat_int_t    natdict_save(NATDict *self, const char *filename);
 NATDict*     natdict_open(const char *filename);
+nat_int_t    natdict_save_mapped(NATDict *self, const char *filename);
+void         natdict_free(NATDict *self);
 NATDict*     natdict_new(const char *source_language, const char *target_language);
 void         natdict_perldump(NATDict *self);
 NATDict*     natdict_add(NATDict *dic1, NATDict *dic2);
@@ -63,5 +81,6 @@ NATLexicon*  natdict_load_lexicon(FILE *fh);
 nat_uint32_t natdict_word_count(NATDict *self, nat_boolean_t language, nat_uint32_t id);
 float        natdict_dictionary_get_val(NATDict *self, nat_boolean_t language, nat_uint32_t wid, nat_uint32_t pos);
 nat_uint32_t natdict_dictionary_get_id(NATDict *self, nat_boolean_t language, nat_uint32_t wid, nat_uint32_t pos);
+nat_uint32_t natdict_dictionary_get_entries(NATDict *self, nat_boolean_t language, nat_uint32_t wid);
 
 #endif /* __NATDICT_H__ */
@@ -27,6 +27,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <wchar.h>
+#include <pthread.h>
 #include <NATools.h>
 
 #include "standard.h"
@@ -57,8 +58,127 @@
  */
 #define DEFAULT_INDEX_SIZE 150000
 
+/**
+ * @brief size, in characters, of the text chunks given to each
+ * tokenizer worker
+ */
+#define PRE_CHUNK 65536
+
+/**
+ * @brief maximum number of tokenizer threads
+ */
+#define PRE_MAXTHREADS 64
+
 static nat_boolean_t quiet;
 
+/**
+ * @brief A word of a tokenized sentence, ready to be encoded
+ */
+typedef struct cPreToken {
+    /** the word, lowercased if needed */
+    wchar_t       *word;
+    /** 1: lowercase; 2: Capital; 3: UPPERCASE */
+    int            flag;
+    /** true if the word is not added to the inverted index */
+    nat_boolean_t  ignore;
+    /** true if the word is too long, and is left untouched for the encoder */
+    nat_boolean_t  truncate;
+} PreToken;
+
+/**
+ * @brief A sentence of a tokenized chunk
+ */
+typedef struct cPreSentence {
+    /** number of words, as returned by NextTextSentence */
+    nat_uint32_t len;
+    /** position of the first word on the chunk tokens */
+    nat_uint32_t first;
+} PreSentence;
+
+/**
+ * @brief A chunk of whole sentences, and its tokens
+ *
+ * Tokens are only kept for sentences with at most MAXBUF words, as
+ * bigger ones are never encoded.
+ */
+typedef struct cPreChunk {
+    /** the chunk text (null terminated) */
+    wchar_t       *text;
+    /** allocated size of the text */
+    size_t         textsize;
+    /** true when the chunk was tokenized */
+    nat_boolean_t  done;
+    /** the chunk tokens */
+    PreToken      *tokens;
+    /** number of tokens */
+    nat_uint32_t   ntokens;
+    /** allocated tokens */
+    nat_uint32_t   tokenssize;
+    /** the chunk sentences */
+    PreSentence   *sentences;
+    /** number of sentences */
+    nat_uint32_t   nsentences;
+    /** allocated sentences */
+    nat_uint32_t   sentencessize;
+} PreChunk;
+
+/**
+ * @brief The chunks of one of the corpus texts
+ *
+ * Chunks are kept on a ring of @c window slots: chunk @c k uses slot
+ * <tt>k % window</tt>, and can only be read after the encoder
+ * consumed chunk <tt>k - window</tt>.
+ */
+typedef struct cPreStream {
+    /** the text file */
+    TextReader   *reader;
+    /** ring of chunks */
+    PreChunk     *chunks;
+    /** number of chunks read */
+    nat_uint32_t  read;
+    /** true when the last chunk was read */
+    nat_boolean_t ended;
+    /** number of chunks claimed by the tokenizers */
+    nat_uint32_t  claimed;
+    /** number of chunks consumed by the encoder */
+    nat_uint32_t  consumed;
+    /** chunk being consumed by the encoder, or NULL */
+    PreChunk     *current;
+    /** next sentence of the current chunk */
+    nat_uint32_t  sentence;
+} PreStream;
+
+/**
+ * @brief State shared by the reader, tokenizers and encoder of nat-pre
+ *
+ * The reader thread reads the corpus texts in chunks of whole
+ * sentences (TextReaderChunk), the tokenizer workers turn each chunk
+ * in token arrays, and the encoder (the main thread) assigns word
+ * identifiers consuming the sentences in the corpus order, so
+ * identifiers do not depend on the number of threads.  With one
+ * thread chunks are read and tokenized by the encoder itself.
+ */
+typedef struct cPrePipeline {
+    /** protects everything below */
+    pthread_mutex_t  lock;
+    /** signaled when a chunk is tokenized or consumed */
+    pthread_cond_t   changed;
+    /** the reader thread */
+    pthread_t        reader;
+    /** the tokenizer threads */
+    pthread_t       *threads;
+    /** number of tokenizer threads */
+    int              nthreads;
+    /** number of chunks on each stream ring */
+    nat_uint32_t     window;
+    /** the source and target texts */
+    PreStream        streams[2];
+    /** lowercase the words */
+    nat_boolean_t    ignore_case;
+    /** set by the encoder to stop the tokenizers */
+    nat_boolean_t    stop;
+} PrePipeline;
+
 static wchar_t *my_lowercase(wchar_t *sen, nat_boolean_t ignore_case) {
     if (ignore_case) {
         wchar_t *ptr = sen;
@@ -71,17 +191,289 @@ static wchar_t *my_lowercase(wchar_t *sen, nat_boolean_t ignore_case) {
 }
 
 void show_help(void) {
-    printf("Usage: nat-pre [-iq] cp1 cp2 lex1 lex2 crp1 crp2\n");
+    printf("Usage: nat-pre [-ipq] [-j n] cp1 cp2 lex1 lex2 crp1 crp2\n");
     printf("Supported options:\n"
            "  -h shows this help message and exits\n"
            "  -V shows "PACKAGE" version and exits\n"
            "  -v activates verbose mode (incompatible with quiet mode)\n"
            "  -i activates ignore case\n"
+           "  -p keeps word positions in the invertion indexes\n"
            "  -q activates quiet mode\n"
+           "  -j n uses n tokenizer threads (default 1)\n"
            "Check nat-pre manpage for details.\n");
 }
 
-static int AddSentence(wchar_t **sen, unsigned long len,
+/**
+ * @brief Computes the tokens of a sentence
+ *
+ * Words too long to be encoded are only marked, so that the encoder
+ * warns about them in the corpus order.
+ */
+static void TokenizeSentence(wchar_t **sen, nat_uint32_t len,
+                             PreToken *tokens, nat_boolean_t ignore_case)
+{
+    nat_uint32_t i;
+
+    for (i = 0; i < len; i++) {
+	tokens[i].word = sen[i];
+
+	if (isCapital(sen[i])) tokens[i].flag = 2;
+	else if (isUPPERCASE(sen[i])) tokens[i].flag = 3;
+	else tokens[i].flag = 1;
+
+	if (wcslen(sen[i]) >= MAXWORDLEN) {
+	    tokens[i].truncate = TRUE;
+	    tokens[i].ignore   = FALSE;
+	} else {
+	    tokens[i].truncate = FALSE;
+	    tokens[i].ignore   = wcsspn(my_lowercase(sen[i], ignore_case), IGNORE_WORDS) != 0;
+	}
+    }
+}
+
+/**
+ * @brief Splits a chunk in sentences and tokenizes them
+ */
+static void TokenizeChunk(PreChunk *chunk, nat_boolean_t ignore_case)
+{
+    wchar_t *sen[MAXBUF];
+    wchar_t *text = chunk->text;
+    nat_uint32_t len;
+
+    chunk->ntokens = 0;
+    chunk->nsentences = 0;
+    do {
+	len = NextTextSentence(sen, &text, MAXBUF, SOFTDELIMITER, HARDDELIMITER);
+
+	if (chunk->nsentences == chunk->sentencessize) {
+	    chunk->sentencessize = chunk->sentencessize ? 2 * chunk->sentencessize : 1024;
+	    chunk->sentences = g_realloc(chunk->sentences,
+					 sizeof(PreSentence) * chunk->sentencessize);
+	}
+	chunk->sentences[chunk->nsentences].len   = len;
+	chunk->sentences[chunk->nsentences].first = chunk->ntokens;
+	chunk->nsentences++;
+
+	if (len && len <= MAXBUF) {
+	    if (chunk->ntokens + len > chunk->tokenssize) {
+		while (chunk->ntokens + len > chunk->tokenssize)
+		    chunk->tokenssize = chunk->tokenssize ? 2 * chunk->tokenssize : 16384;
+		chunk->tokens = g_realloc(chunk->tokens,
+					  sizeof(PreToken) * chunk->tokenssize);
+	    }
+	    TokenizeSentence(sen, len, chunk->tokens + chunk->ntokens, ignore_case);
+	    chunk->ntokens += len;
+	}
+    } while (text != NULL);
+}
+
+/**
+ * @brief Reads the next chunk of a stream to its ring slot
+ *
+ * The slot is owned by the caller, so this is done without the lock.
+ */
+static PreChunk *ReadChunk(PrePipeline *pipe, PreStream *stream)
+{
+    PreChunk *chunk = stream->chunks + stream->read % pipe->window;
+
+    chunk->text = TextReaderChunk(stream->reader, &chunk->text, &chunk->textsize,
+				  PRE_CHUNK, SOFTDELIMITER, HARDDELIMITER);
+    chunk->done = FALSE;
+    return chunk;
+}
+
+/**
+ * @brief Reader thread: reads chunks while the rings have room
+ *
+ * The stream with less chunks ahead of the encoder is read first.
+ */
+static void *ReaderRun(void *data)
+{
+    PrePipeline *pipe = (PrePipeline*) data;
+    PreStream *stream;
+    int s;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->stop) {
+	stream = NULL;
+	for (s = 0; s < 2; s++) {
+	    PreStream *cand = pipe->streams + s;
+	    if (!cand->ended && cand->read < cand->consumed + pipe->window &&
+		(!stream || cand->read - cand->consumed < stream->read - stream->consumed))
+		stream = cand;
+	}
+	if (!stream) {
+	    if (pipe->streams[0].ended && pipe->streams[1].ended) break;
+	    pthread_cond_wait(&pipe->changed, &pipe->lock);
+	    continue;
+	}
+	pthread_mutex_unlock(&pipe->lock);
+
+	ReadChunk(pipe, stream);
+
+	pthread_mutex_lock(&pipe->lock);
+	stream->read++;
+	stream->ended = stream->reader->done;
+	pthread_cond_broadcast(&pipe->changed);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+/**
+ * @brief Tokenizer worker: tokenizes the chunks read, in order
+ *
+ * The stream with less chunks ready for the encoder is served first.
+ */
+static void *TokenizerRun(void *data)
+{
+    PrePipeline *pipe = (PrePipeline*) data;
+    PreStream *stream;
+    PreChunk *chunk;
+    int s;
+
+    pthread_mutex_lock(&pipe->lock);
+    while (!pipe->stop) {
+	stream = NULL;
+	for (s = 0; s < 2; s++) {
+	    PreStream *cand = pipe->streams + s;
+	    if (cand->claimed < cand->read &&
+		(!stream || cand->claimed - cand->consumed < stream->claimed - stream->consumed))
+		stream = cand;
+	}
+	if (!stream) {
+	    if (pipe->streams[0].ended && pipe->streams[1].ended &&
+		pipe->streams[0].claimed == pipe->streams[0].read &&
+		pipe->streams[1].claimed == pipe->streams[1].read) break;
+	    pthread_cond_wait(&pipe->changed, &pipe->lock);
+	    continue;
+	}
+
+	chunk = stream->chunks + stream->claimed % pipe->window;
+	stream->claimed++;
+	pthread_mutex_unlock(&pipe->lock);
+
+	TokenizeChunk(chunk, pipe->ignore_case);
+
+	pthread_mutex_lock(&pipe->lock);
+	chunk->done = TRUE;
+	pthread_cond_broadcast(&pipe->changed);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+    return NULL;
+}
+
+/**
+ * @brief Encoder side: gets the next sentence of a stream
+ *
+ * Waits for the tokenizers when needed, and releases the ring slot of
+ * each chunk fully consumed.
+ *
+ * @return the sentence, or NULL when the stream ended
+ */
+static PreSentence *NextSentence(PrePipeline *pipe, PreStream *stream)
+{
+    PreChunk *chunk = stream->current;
+
+    if (chunk && stream->sentence < chunk->nsentences)
+	return chunk->sentences + stream->sentence++;
+
+    pthread_mutex_lock(&pipe->lock);
+    if (chunk) {
+	stream->current = NULL;
+	stream->consumed++;
+	pthread_cond_broadcast(&pipe->changed);
+    }
+    for (;;) {
+	if (stream->consumed < stream->read) {
+	    chunk = stream->chunks + stream->consumed % pipe->window;
+	    if (chunk->done) break;
+	} else if (stream->ended) {
+	    pthread_mutex_unlock(&pipe->lock);
+	    return NULL;
+	} else if (pipe->nthreads == 1) {
+	    chunk = ReadChunk(pipe, stream);
+	    TokenizeChunk(chunk, pipe->ignore_case);
+	    chunk->done = TRUE;
+	    stream->read++;
+	    stream->claimed++;
+	    stream->ended = stream->reader->done;
+	    break;
+	}
+	pthread_cond_wait(&pipe->changed, &pipe->lock);
+    }
+    pthread_mutex_unlock(&pipe->lock);
+
+    stream->current  = chunk;
+    stream->sentence = 1;
+    return chunk->sentences;
+}
+
+static void PipelineInit(PrePipeline *pipe, TextReader *text1, TextReader *text2,
+			 int nthreads, nat_boolean_t ignore_case)
+{
+    int t;
+
+    pthread_mutex_init(&pipe->lock, NULL);
+    pthread_cond_init(&pipe->changed, NULL);
+    pipe->nthreads    = nthreads;
+    pipe->window      = 2 * nthreads;
+    pipe->ignore_case = ignore_case;
+    pipe->stop        = FALSE;
+
+    pipe->streams[0].reader = text1;
+    pipe->streams[1].reader = text2;
+    for (t = 0; t < 2; t++) {
+	pipe->streams[t].chunks   = g_new0(PreChunk, pipe->window);
+	pipe->streams[t].read     = 0;
+	pipe->streams[t].ended    = FALSE;
+	pipe->streams[t].claimed  = 0;
+	pipe->streams[t].consumed = 0;
+	pipe->streams[t].current  = NULL;
+	pipe->streams[t].sentence = 0;
+    }
+
+    pipe->threads = NULL;
+    if (nthreads > 1) {
+	if (pthread_create(&pipe->reader, NULL, ReaderRun, pipe))
+	    report_error("nat-pre: cannot create reader thread");
+	pipe->threads = g_new(pthread_t, nthreads);
+	for (t = 0; t < nthreads; t++)
+	    if (pthread_create(pipe->threads + t, NULL, TokenizerRun, pipe))
+		report_error("nat-pre: cannot create tokenizer thread");
+    }
+}
+
+static void PipelineFree(PrePipeline *pipe)
+{
+    nat_uint32_t i;
+    int t;
+
+    if (pipe->threads) {
+	pthread_mutex_lock(&pipe->lock);
+	pipe->stop = TRUE;
+	pthread_cond_broadcast(&pipe->changed);
+	pthread_mutex_unlock(&pipe->lock);
+
+	pthread_join(pipe->reader, NULL);
+	for (t = 0; t < pipe->nthreads; t++)
+	    pthread_join(pipe->threads[t], NULL);
+	g_free(pipe->threads);
+    }
+
+    for (t = 0; t < 2; t++) {
+	for (i = 0; i < pipe->window; i++) {
+	    g_free(pipe->streams[t].chunks[i].text);
+	    g_free(pipe->streams[t].chunks[i].tokens);
+	    g_free(pipe->streams[t].chunks[i].sentences);
+	}
+	g_free(pipe->streams[t].chunks);
+    }
+    pthread_cond_destroy(&pipe->changed);
+    pthread_mutex_destroy(&pipe->lock);
+}
+
+static int AddSentence(PreToken *sen, unsigned long len,
 		       Words* wl, Corpus *Corpus,
 		       InvIndex *Index, nat_uint32_t sentence_number,
 		       PartialCounts *partials, nat_boolean_t ignore_case)
@@ -90,26 +482,21 @@ static int AddSentence(wchar_t **sen, unsigned long len,
     
     /* Add each sentence word */
     for (i = 0; i < len; i++) {
-		int flag; 		/* 1: lowercase; 2: Capital; 3: UPPERCASE */
-
-		if (isCapital(*sen)) flag = 2;
-		else if (isUPPERCASE(*sen)) flag = 3;
-		else flag = 1;
-        
-		if (wcslen(*sen) >= MAXWORDLEN) {
-		    fprintf(stderr, "**WARNING** Truncating word '%ls'\n", *sen);
-	            (*sen)[MAXWORDLEN - 1] = L'\0';
+		if (sen->truncate) {
+		    fprintf(stderr, "**WARNING** Truncating word '%ls'\n", sen->word);
+	            sen->word[MAXWORDLEN - 1] = L'\0';
+		    sen->ignore = wcsspn(my_lowercase(sen->word, ignore_case), IGNORE_WORDS) != 0;
 		}
 
-        wid = words_add_word(wl, my_lowercase(*sen, ignore_case));
+        wid = words_add_word(wl, sen->word);
 
         if (wid) {
             partials = PartialCountsAdd(partials, wid);
 		
-            if (corpus_add_word(Corpus, wid, flag)) return 1;
+            if (corpus_add_word(Corpus, wid, sen->flag)) return 1;
 		
-            if (!wcsspn(*sen, IGNORE_WORDS)) {
-                Index = inv_index_add_occurrence(Index, wid, 0, sentence_number);
+            if (!sen->ignore) {
+                Index = inv_index_add_position(Index, wid, 0, sentence_number, i);
             }
         } else {
             fprintf(stderr, "pre.c: received an empty word id.\n");
@@ -130,24 +517,32 @@ static int AddSentence(wchar_t **sen, unsigned long len,
 }
 
 /* This function signature is PORNOGRAPHIC! */
-static int AnalyseCorpus(Corpus *C1, Words* wl1, InvIndex* Index1, wchar_t *text1, 
-			 Corpus *C2, Words* wl2, InvIndex* Index2, wchar_t *text2,
+static int AnalyseCorpus(Corpus *C1, Words* wl1, InvIndex* Index1, TextReader *text1, 
+			 Corpus *C2, Words* wl2, InvIndex* Index2, TextReader *text2,
 			 nat_uint32_t *Nw1, nat_uint32_t *Nw2, nat_uint32_t *Nsen,
 			 nat_uint32_t *TotNw1, nat_uint32_t *TotNw2, nat_uint32_t *TotNsen,
 			 PartialCounts *partials1, PartialCounts *partials2,
-                         nat_boolean_t ignore_case)
+                         nat_boolean_t ignore_case, int nthreads)
 {
     unsigned long len1, len2;
-    wchar_t *sen1[MAXBUF], *sen2[MAXBUF];
+    PrePipeline pipe;
+    PreSentence *sen1, *sen2;
+    int result = 0;
+
+    PipelineInit(&pipe, text1, text2, nthreads, ignore_case);
     
     if (!quiet) {
 		fprintf(stderr, "\n Sentences\tWords cp1\tWords cp2\n");
 		fprintf(stderr," ");
     }
-    do {
+    for (;;) {
 		/* get a sentence for each corpus (array of words) */
-		len1 = NextTextSentence(sen1, &text1, MAXBUF, SOFTDELIMITER, HARDDELIMITER);
-		len2 = NextTextSentence(sen2, &text2, MAXBUF, SOFTDELIMITER, HARDDELIMITER);
+		sen1 = NextSentence(&pipe, pipe.streams);
+		sen2 = NextSentence(&pipe, pipe.streams + 1);
+		if (!sen1 || !sen2) break;
+
+		len1 = sen1->len;
+		len2 = sen2->len;
 
 		if (len1 && len2) {
 		    (*TotNsen)++;
@@ -161,30 +556,31 @@ static int AnalyseCorpus(Corpus *C1, Words* wl1, InvIndex* Index1, wchar_t *text
 				(*Nsen)++;
 				(*Nw1) += len1;
 				(*Nw2) += len2;
-				if (AddSentence(sen1, len1, wl1, C1, Index1,
-		                                *Nsen, partials1, ignore_case))
-	                    return 1;
-				if (AddSentence(sen2, len2, wl2, C2, Index2,
-		                                *Nsen, partials2, ignore_case))
-	                    return 1;
+				if (AddSentence(pipe.streams[0].current->tokens + sen1->first,
+						len1, wl1, C1, Index1,
+		                                *Nsen, partials1, ignore_case) ||
+				    AddSentence(pipe.streams[1].current->tokens + sen2->first,
+						len2, wl2, C2, Index2,
+		                                *Nsen, partials2, ignore_case)) {
+				    result = 1;
+				    break;
+				}
 		    } else {
 				fprintf(stderr, "\n** WARNING: sentence too big: max(%ld,%ld)>%d\n",
 	                        len1, len2,MAXBUF);
-				/* 
-				   fprintf(stderr, "**          s1: %ls\n", *sen1);
-				   fprintf(stderr, "**          s2: %ls\n", *sen2);
-				*/
 		    }
 		}
-    } while (text1 != NULL && text2 != NULL);
+    }
+
+    PipelineFree(&pipe);
+    if (result) return result;
 
     if (!quiet)
 		fprintf(stderr, "\r  %7d\t %7d\t %7d\n\n", *TotNsen, *TotNw1, *TotNw2);
 
-    if (text1 != NULL || text2 != NULL) return 2;
+    if (sen1 != NULL || sen2 != NULL) return 2;
     else  return 0;
 }
-
  
 /**
  * The main program.
@@ -198,20 +594,22 @@ int main(int argc, char **argv)
     InvIndex *Index1, *Index2;
     char *indexfile;
 
-    wchar_t *text1, *text2;
+    TextReader *text1, *text2;
 
     nat_boolean_t verbose     = FALSE;
     nat_boolean_t ignore_case = FALSE;
+    nat_boolean_t positional  = FALSE;
 
     nat_uint32_t Nw1, Nw2, Nsen;
     nat_uint32_t TotNw1, TotNw2, TotNsen;
     nat_uint32_t UNw1, UNw2, UNsen;
     nat_uint32_t TotUNw1, TotUNw2;
     int result;
+    int nthreads = 1;
 
     PartialCounts partials1, partials2;
 
-    // extern char *optarg;
+    extern char *optarg;
     extern int optind;
     int c;
 
@@ -219,7 +617,7 @@ int main(int argc, char **argv)
 
     quiet = FALSE;
 
-    while ((c = getopt(argc, argv, "hvqiV")) != EOF) {
+    while ((c = getopt(argc, argv, "hvqipVj:")) != EOF) {
 	switch (c) {
         case 'h':
             show_help();
@@ -230,12 +628,20 @@ int main(int argc, char **argv)
         case 'i':
             ignore_case = TRUE;
             break;
+        case 'p':
+            positional = TRUE;
+            break;
 	case 'v':
 	    verbose = TRUE;
 	    break;
 	case 'q':
 	    quiet = TRUE;
 	    break;
+	case 'j':
+	    nthreads = atoi(optarg);
+	    if (nthreads < 1 || nthreads > PRE_MAXTHREADS)
+		report_error("Number of threads out of range (1-%d)", PRE_MAXTHREADS);
+	    break;
 	default:
             show_help();
             return 1;
@@ -288,8 +694,8 @@ int main(int argc, char **argv)
     /* 
      * INITIALIZE INVERTION INDEXES
      */
-    Index1 = inv_index_new(DEFAULT_INDEX_SIZE);
-    Index2 = inv_index_new(DEFAULT_INDEX_SIZE);
+    Index1 = inv_index_new(DEFAULT_INDEX_SIZE, positional);
+    Index2 = inv_index_new(DEFAULT_INDEX_SIZE, positional);
 
     /* 
      * INITIALIZE PARTIAL OCCURRENCES COUNT
@@ -314,13 +720,13 @@ int main(int argc, char **argv)
     TotNsen = 0; 
 
     if (verbose) printf("\nReading %s...\n", argv[optind]);
-    text1 = ReadText(argv[optind]);
+    text1 = TextReaderOpen(argv[optind]);
 
     if (verbose) printf("Reading %s...\n", argv[optind + 1]);
-    text2 = ReadText(argv[optind + 1]);
+    text2 = TextReaderOpen(argv[optind + 1]);
 
     if (text1 == NULL || text2 == NULL)
-	report_error("ReadText: %s %s", argv[optind], argv[optind+1]);
+	report_error("TextReaderOpen: %s %s", argv[optind], argv[optind+1]);
 
     Nw1 = 0; UNw1 = 0;
     Nw2 = 0; UNw2 = 0;
@@ -330,7 +736,7 @@ int main(int argc, char **argv)
     result = AnalyseCorpus(Corpus1, wordLst1, Index1, text1,
 			   Corpus2, wordLst2, Index2, text2,
 			   &UNw1, &UNw2, &UNsen, &Nw1, &Nw2, &Nsen,
-			   &partials1, &partials2, ignore_case);
+			   &partials1, &partials2, ignore_case, nthreads);
 
     TotUNw1 += UNw1;
     TotUNw2 += UNw2;
@@ -397,8 +803,8 @@ int main(int argc, char **argv)
     words_free(wordLst1);
     words_free(wordLst2);
 
-    free(text1);
-    free(text2);
+    TextReaderClose(text1);
+    TextReaderClose(text2);
 
     corpus_free(Corpus1);
     corpus_free(Corpus2);
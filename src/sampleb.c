@@ -26,15 +26,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <getopt.h>
+#include <unistd.h>
 
 #include "standard.h"
 #include <NATools/corpus.h>
 #include "matrix.h"
+#include "sampler.h"
+#include "emstats.h"
 
 
 /**
  * @file
- * @brief Implementation of the SampleA EM-Algorithm variant
+ * @brief Implementation of the SampleB EM-Algorithm variant
  */
 
 
@@ -55,16 +59,6 @@
  */
 #define SERR 0.01f
 
-/**
- * @brief handy random macro
- *
- * rand() uses a multiplicative congruential random-number gen- erator
- * with period 2^32 that returns successive pseudo- random numbers in
- * the range from 0 to RAND_MAX.  (see page 28, Hammersley and
- * Handscomb)
- */
-#define RANDOM(num) (double)(((double)rand()*(num))/(double)(RAND_MAX+1.0))
-
 
 
 #ifdef DEBUG
@@ -77,6 +71,42 @@ static void printSentence(nat_uint32_t *st, struct cWords *Words)
     printf("\b.\n");
 }
 
+static void printAlignment(SamplerWorkspace *ws, long Nsamples)
+{
+    nat_uint32_t r, c, i, j, lr = ws->lr, lc = ws->lc;
+    nat_uint32_t *st1 = ws->st1, *st2 = ws->st2;
+    double nij;
+
+    r = 0;
+    while (r < lr) {
+	c = 0;
+	while (c < lc) {
+	    nij = 0.0f;
+	    i = r;
+	    while (st1[i] == st1[r]) {
+		j = c;
+		while (st2[j] == st2[c]) {
+		    nij += (double) ws->e[i*lc + j] / (double) Nsamples;
+		    j++;
+		}
+		i++;
+	    }
+	    while (nij >= 0.5) {
+		if (st1[r] == 1) printf("([null], ");
+		else printf("(%s,", GiveString(&W1, st1[r]));
+		if (st2[c] == 1) printf("[null])");
+		else printf("%s)", GiveString(&W2, st2[c]));
+		if (nij < 0.5) printf("?\n");
+		else printf("\n");
+		nij--;
+	    }
+	    c = j;
+	}
+	r = i;
+    }
+    printf("\n");
+}
+
 #endif
 
 /* EM algorithm */
@@ -102,52 +132,57 @@ static nat_uint32_t SortMatrix(CorpusCell *s, nat_uint32_t *st)
     return lt;
 }
 
-static double MarginalProbs(double *p, double *pi, double *pj, nat_uint32_t lr, nat_uint32_t lc)
+/**
+ * @brief Sorts both sentences
+ */
+static nat_boolean_t Prepare(SamplerWorkspace *ws, CorpusCell *s1, CorpusCell *s2)
 {
-    double total, f;
-    nat_uint32_t r, c;
-    total = 0.0f;
-    for (c = 0; c < lc; c++) pj[c] = 0;
-    for (r = 0; r < lr; r++) {
-	pi[r] = 0;
-	for (c = 0; c < lc; c++) {
-	    f = p[r*MAXLEN + c];
-	    pj[c] += f;
-	    pi[r] += f;
-	}
-	total += pi[r];
-    }
-    return total;
+#ifdef DEBUG
+    static int k = 0;
+#endif
+
+    if (max(corpus_sentence_length(s1), corpus_sentence_length(s2)) > MAXLEN)
+	return FALSE;
+    ws->lr = SortMatrix(s1, ws->st1);
+    ws->lc = SortMatrix(s2, ws->st2);
+#ifdef DEBUG
+    printf("--- TEST %d: ---\n", ++k);
+    printSentence(ws->st1, &W1);
+    printSentence(ws->st2, &W2);
+    printf("---\n");
+#endif
+    return min(ws->lr, ws->lc) > 0;
 }
 
-static long MonteCarlo (nat_uint32_t *e, double *p, double *pi, 
-                        double pN, nat_uint32_t lr, unsigned lc)
+static long MonteCarlo (SamplerWorkspace *ws)
 {
+    nat_uint32_t lr = ws->lr, lc = ws->lc;
     nat_uint32_t r, c, i, j, ni[MAXLEN], nj[MAXLEN], nr, nc, n, l;
-    double d, mtse, rnd, s[MAXLEN][MAXLEN], si[MAXLEN], sN, dN;
+    nat_uint32_t *e = ws->e;
+    double *s = ws->s, *si = ws->si;
+    double d, mtse, rnd, sN, dN;
     long Nsamples, Ndum, Nwrong;
 
     l = 2 * max(lr,lc);
     Nsamples = Ndum = Nwrong = 0;
     do {
 	do {
-	    memcpy(si, pi, MAXLEN * sizeof(double));
-	    memcpy(&s[0][0], p, MAXLEN * MAXLEN * sizeof(double));
+	    sN = sampler_table_reset(ws);
 	    memset(ni, 0, lr * sizeof(*ni)); /* n=0: not connected, n>0: connected to column n-1 */
 	    memset(nj, 0, lc * sizeof(*nj)); /* n=0: not connected, n>0: connected to row n-1 */
-	    sN = pN;
 
 	    nr = nc = n = 0;
 	    while ((nr < lr || nc < lc) && sN > 0.01f && n < l) {
-		rnd = RANDOM(sN);                	/* n and l and deleting wrong alignments */
+		rnd = sampler_random(&ws->rng, sN);	/* n and l and deleting wrong alignments */
 		r = 0; c = 0;     			/* (see below) is dirty trick around     */
 		while (r < lr && rnd > si[r])		/* propable bug                          */
 		    rnd -= si[r++];
-		while (c < lc && rnd > s[r][c])
-		    rnd -= s[r][c++];
+		if (r < lr)
+		    while (c < lc && rnd > s[r*lc + c])
+			rnd -= s[r*lc + c++];
 		n++;
 		if (r < lr && c < lc) {
-		    e[r*MAXLEN + c] += 1;
+		    e[r*lc + c] += 1;
 		    dN = sN;
 		    if (ni[r] == 0) {
 			nr++;
@@ -155,42 +190,46 @@ static long MonteCarlo (nat_uint32_t *e, double *p, double *pi,
 			if (nj[c] == 0) {
 			    nc++;
 			    nj[c] = r+1;
+			    sampler_touch_row(ws, r);
+			    sampler_touch_column(ws, c);
 			    i = 0;
 			    while (i < lr || i < lc) {    /* both words not connected */
 				if (i < lr) {
 				    if (ni[i] > 0) {
-					sN -= s[i][c];
-					d = si[i] - s[i][c];
+					sN -= s[i*lc + c];
+					d = si[i] - s[i*lc + c];
 					si[i] = max(d, 0);
-					s[i][c] = 0.0f;
+					s[i*lc + c] = 0.0f;
 				    }
 				    else {
-					d = s[i][c] / dN;       /* penalty for multi-word expression */
-					sN -= s[i][c] - d;
-					si[i] -= s[i][c] - d;
-					s[i][c] = d;
+					d = s[i*lc + c] / dN;       /* penalty for multi-word expression */
+					sN -= s[i*lc + c] - d;
+					si[i] -= s[i*lc + c] - d;
+					s[i*lc + c] = d;
 				    }
 				}
 				if (i < lc) {
 				    if (nj[i] > 0) {
-					sN -= s[r][i];
-					d = si[r] - s[r][i];
+					sN -= s[r*lc + i];
+					d = si[r] - s[r*lc + i];
 					si[r] = max(d, 0);
-					s[r][i] = 0.0f;
+					s[r*lc + i] = 0.0f;
 				    }
 				    else {
-					d = s[r][i] / dN;
-					sN -= s[r][i] - d;
-					si[r] -= s[r][i] - d;
-					s[r][i] = d;
+					d = s[r*lc + i] / dN;
+					sN -= s[r*lc + i] - d;
+					si[r] -= s[r*lc + i] - d;
+					s[r*lc + i] = d;
 				    }
 				}
 				i++;
 			    }
 			}
 			else {
+			    sampler_touch_row(ws, r);
+			    sampler_touch_row(ws, nj[c] - 1);
 			    for (j = 0; j < lc; j++) {
-				s[r][j] = s[nj[c] - 1][j] = 0.0f;
+				s[r*lc + j] = s[(nj[c] - 1)*lc + j] = 0.0f;
 			    }
 			    sN -= si[r] + si[nj[c] - 1];
 			    si[r] = si[nj[c] - 1] = 0.0f;
@@ -199,11 +238,13 @@ static long MonteCarlo (nat_uint32_t *e, double *p, double *pi,
 		    else {                /* now nj[c] must be 0 */
 			nc++;
 			nj[c] = r+1;
+			sampler_touch_column(ws, c);
+			sampler_touch_column(ws, ni[r] - 1);
 			sN = 0.0f;
 			for (i = 0; i < lr; i++) {
-			    d = si[i] - (s[i][c] + s[i][ni[r] - 1]);
+			    d = si[i] - (s[i*lc + c] + s[i*lc + ni[r] - 1]);
 			    sN += (si[i] = max(d, 0) );
-			    s[i][c] = s[i][ni[r] - 1] = 0.0f;
+			    s[i*lc + c] = s[i*lc + ni[r] - 1] = 0.0f;
 			}
 		    }
 		}
@@ -215,14 +256,14 @@ static long MonteCarlo (nat_uint32_t *e, double *p, double *pi,
 		while (i < lr || i < lc) {
 		    if (i < lr && ni[i] > 0) {
 			j = ni[i] - 1;
-			if (e[i*MAXLEN + j] > 0) e[i*MAXLEN + j] -= 1;
+			if (e[i*lc + j] > 0) e[i*lc + j] -= 1;
 			else report_error("fatal\n");
 			ni[i] = 0;
 			if (nj[j] - 1 == i) nj[j] = 0;
 		    }
 		    if (i < lc && nj[i] > 0) {
 			j = nj[i] - 1;
-			if (e[j*MAXLEN + i]) e[j*MAXLEN + i] -= 1;
+			if (e[j*lc + i]) e[j*lc + i] -= 1;
 			else report_error("very fatal\n");
 			nj[i] = 0; 
 			if (ni[j] - 1 == i) ni[j] = 0;
@@ -239,36 +280,25 @@ static long MonteCarlo (nat_uint32_t *e, double *p, double *pi,
 	mtse = 0;           /* compute mean theortical standard error */
 	for (r = 0; r < lr; r++)
 	    for (c = 0; c < lc; c++) {
-		d = ((double) e[r*MAXLEN + c]) / (double) Nsamples;
+		d = ((double) e[r*lc + c]) / (double) Nsamples;
 		mtse += d * (1.0f - d);
 	    }
 	mtse /= lr * lc;
     } while (Nsamples < 65500 && sqrt(mtse / Nsamples) > SERR);
     /*     printf(", %f", mtse ); */
+#ifdef DEBUG
+    printAlignment(ws, Nsamples);
+#endif
     return Nsamples;
 }
 
 /* ... */
 
 static void EMalgorithm(struct cMatrix *M, struct cCorpus *C1, struct cCorpus *C2, 
-#ifdef DEBUG
-                        struct cWords *W1, struct cWords *W2,  
-#endif
-                        int step)
+                        int step, uint64_t seed, int nthreads)
 {
-    /* probabilities */
-    double p[MAXLEN][MAXLEN];
-    double pi[MAXLEN];
-    double pj[MAXLEN];
-    double pN;
-
-    long k, length, Nsamples;
-    CorpusCell *s1, *s2;
-    nat_uint32_t r, c, lr, lc;
-    nat_uint32_t st1[MAXLEN + 1];
-    nat_uint32_t st2[MAXLEN + 1];
-    nat_uint32_t e[MAXLEN][MAXLEN];          /* solution */
-    int M1, M2;
+    SamplerModel model = { Prepare, MonteCarlo };
+    MatrixVal M1, M2;
 
     if (step % 2) {
         M1 = MATRIX_1;
@@ -282,73 +312,7 @@ static void EMalgorithm(struct cMatrix *M, struct cCorpus *C1, struct cCorpus *C
     printf("\n\n");
 #endif
     ClearMatrix(M, M2);
-    k = 0;
-    length = corpus_sentences_nr(C1);
-    s1 = corpus_first_sentence(C1);
-    s2 = corpus_first_sentence(C2);
-
-    while (s1 != NULL && s2 != NULL) {
-#ifdef DEBUG
-	printf("--- TEST %d: ---\n", ++k);
-	printSentence(s1, W1);
-	printSentence(s2, W2);
-	printf("---\n");
-#else
-	fprintf(stderr, "\b\b\b\b\b%4.1f%%", (double) (k++) * 99.9f / (double) length);
-#endif
-	lr = SortMatrix(s1, st1);
-	lc = SortMatrix(s2, st2);
-	if (max(lr,lc) <= MAXLEN && min(lr,lc) > 0) {
-	    if (GetPartialMatrix(M, M1, st1, st2, &p[0][0], MAXLEN))
-		report_error("EMalgorithm: GetPartialMatrix");
-	    pN = MarginalProbs(&p[0][0], pi, pj, lr, lc);
-	    memset(&e[0][0], 0, MAXLEN*MAXLEN * sizeof(e[0][0]));
-	    Nsamples = MonteCarlo(&e[0][0], &p[0][0], pi, pN, lr, lc);
-/*      fprintf(stderr, ", %d", Nsamples); */
-#ifdef DEBUG
-	    {
-		nat_uint32_t i,j;
-		double nij;
-		r = 0;
-		while (r < lr) {
-		    c = 0;
-		    while (c < lc) {
-			nij = 0.0f;
-			i = r;
-			while (st1[i] == st1[r]) {
-			    j = c;
-			    while (st2[j] == st2[c]) {
-				nij += (double) e[i][j] / (double) Nsamples;
-				j++;
-			    }
-			    i++;
-			}
-			while (nij >= 0.5) {
-			    if (st1[r] == 1) printf("([null], ");
-			    else printf("(%s,", GiveString(W1, st1[r]));
-			    if (st2[c] == 1) printf("[null])");
-			    else printf("%s)", GiveString(W2, st2[c]));
-			    if (nij < 0.5) printf("?\n");
-			    else printf("\n");
-			    nij--;
-			}
-			c = j;       
-		    }
-		    r = i;
-		}
-		printf("\n");
-	    }
-#else
-	    for (r = 0; r < lr; r++)
-		for (c = 0; c < lc; c++) {
-		    if (IncValue(M, M2, (double) e[r][c] / (double) Nsamples, st1[r], st2[c]))
-			report_error("EMalgorithm: IncValue failed");
-		}
-#endif
-	}
-	s1 = corpus_next_sentence(C1);
-	s2 = corpus_next_sentence(C2);
-    }
+    sampler_estep(&model, M, M1, M2, C1, C2, step, seed, nthreads);
     fprintf(stderr, "\b\b\b\b\bdone \n");
 }
 
@@ -365,48 +329,135 @@ int main(int argc, char **argv)
     Matrix* Matrices;
     double t;
     int Nsteps, step;
-    if (argc != 6)
-	report_error("Usage: sampleB nsteps corpusfile1 corpusfile2 dictfilein dictfileout");
+    int nthreads = 1;
+    uint64_t seed = 1;
+    double threshold = 0.0, relative = 0.0;
+    char *metrics = NULL;
+    EMStats *stats;
+    nat_boolean_t converged;
+    int every = 0;
+    nat_boolean_t resume = FALSE;
+    nat_uint32_t done = 0;
+    char *checkpoint;
+    static struct option long_options[] = {
+        { "checkpoint", required_argument, NULL, 'c' },
+        { "resume",     no_argument,       NULL, 'R' },
+        { NULL, 0, NULL, 0 }
+    };
+    extern char *optarg;
+    extern int optind;
+    int opt;
+    nat_boolean_t frozen = FALSE;
+    nat_boolean_t mapped = FALSE;
+
+    while ((opt = getopt_long(argc, argv, "fmj:s:t:r:l:c:", long_options, NULL)) != EOF) {
+        switch (opt) {
+        case 'f':
+            frozen = TRUE;
+            break;
+        case 'm':
+            mapped = TRUE;
+            break;
+        case 'j':
+            nthreads = atoi(optarg);
+            if (nthreads < 1 || nthreads > SAMPLER_MAXTHREADS)
+                report_error("Number of threads out of range (1-%d)", SAMPLER_MAXTHREADS);
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            threshold = atof(optarg);
+            break;
+        case 'r':
+            relative = atof(optarg);
+            break;
+        case 'l':
+            metrics = optarg;
+            break;
+        case 'c':
+            every = atoi(optarg);
+            if (every < 1) report_error("Invalid checkpoint interval");
+            break;
+        case 'R':
+            resume = TRUE;
+            break;
+        default:
+            report_error("Usage: sampleB [-f] [-m] [-j threads] [-s seed] [-t diff] [-r change] [-l file] [-c steps] [--resume] nsteps corpusfile1 corpusfile2 dictfilein dictfileout\n(--resume implies -c 1 unless -c is given)");
+        }
+    }
+
+    if (argc != optind + 5)
+	report_error("Usage: sampleB [-f] [-m] [-j threads] [-s seed] [-t diff] [-r change] [-l file] [-c steps] [--resume] nsteps corpusfile1 corpusfile2 dictfilein dictfileout\n(--resume implies -c 1 unless -c is given)");
 
 #ifdef DEBUG
     LoadWords(&W1, "Lang1.lex");
     LoadWords(&W2, "Lang2.lex");
+    nthreads = 1;
 #endif
 
-    Nsteps = atoi(argv[1]);
+    Nsteps = atoi(argv[optind + 0]);
     if (Nsteps < 1 || Nsteps > 25)
 	report_error("Number of steps out of range");
 
     Corpus1 = corpus_new();
     Corpus2 = corpus_new();
-    if (corpus_load(Corpus1, argv[2])) report_error("LoadCorpus");
-    if (corpus_load(Corpus2, argv[3])) report_error("LoadCorpus");
-    if (!(Matrices = LoadMatrix(argv[4]))) report_error("LoadMatrix");
+    if (corpus_load(Corpus1, argv[optind + 1])) report_error("LoadCorpus");
+    if (corpus_load(Corpus2, argv[optind + 2])) report_error("LoadCorpus");
+    checkpoint = g_strdup_printf("%s.ckpt", argv[optind + 4]);
+    /* a resumed run keeps saving checkpoints, by default at every step */
+    if (resume && !every) every = 1;
+    Matrices = resume ? LoadMatrixCheckpoint(checkpoint, frozen, &done) : NULL;
+    if (Matrices)
+        fprintf(stderr, "Resuming after step %u\n", done);
+    else if (frozen)
+        Matrices = LoadFrozenMatrix(argv[optind + 3]);
+    else
+        Matrices = LoadMatrix(argv[optind + 3]);
+    if (!Matrices) report_error("LoadMatrix");
 
     fprintf(stderr, "EM-algorithm model B, Monte Carlo sampling\n");
 
-    fprintf(stderr, "Initial matrix total:%9.2f\n", MatrixTotal(Matrices, MATRIX_1));
+    fprintf(stderr, "Initial matrix total:%9.2f\n", MatrixTotal(Matrices, done % 2 ? MATRIX_2 : MATRIX_1));
     fprintf(stderr, "Initial memory used:%10.1f kb\n", (double) BytesInUse(Matrices) / 1024.0f);
-    step = 1;
+    stats = emstats_new(metrics, threshold, relative, done > 0);
+    if (!stats) report_error("Can't create metrics file %s", metrics);
+
+    step = done + 1;
     while (step <= Nsteps) {
-	EMalgorithm(Matrices, Corpus1, Corpus2, 
-#ifdef DEBUG
-		    &W1, &W2,   
-#endif
-		    step);
+	EMalgorithm(Matrices, Corpus1, Corpus2, step, seed, nthreads);
 	step++;
-	t = CompareMatrices(Matrices);
-	fprintf(stderr, "mean diff.: %15.6f\n", t);
+	converged = emstats_step(stats, Matrices, step % 2 ? MATRIX_1 : MATRIX_2, step - 1);
+	fprintf(stderr, "mean diff.: %15.6f\n", stats->mean_diff);
 	if (step % 2) t = MatrixTotal(Matrices, MATRIX_1);
 	else t = MatrixTotal(Matrices, MATRIX_2);
 	fprintf(stderr, "Matrix total:%9.2f\n", t);
-	fprintf(stderr, "Memory used:%9.1f kb\n", (double) BytesInUse(Matrices) / 1024.0f);
+	fprintf(stderr, "Memory used:%9.1f kb\n", (double) stats->bytes / 1024.0f);
+	if (converged) {
+	    fprintf(stderr, "Converged after %d steps\n", step - 1);
+	    break;
+	}
+	if (every && step <= Nsteps && (step - 1) % every == 0) {
+	    if (SaveMatrixCheckpoint(Matrices, checkpoint, step - 1))
+		report_error("Can't save checkpoint %s", checkpoint);
+	}
     }
+    Nsteps = step - 1;
+    emstats_free(stats);
 
+    if (Matrices->dropped)
+        fprintf(stderr, "** WARNING ** %u increments outside the frozen matrix were dropped\n",
+                Matrices->dropped);
     if (Nsteps % 2)
 	CopyMatrix(Matrices, MATRIX_1);
 
-    if (SaveMatrix(Matrices, argv[5])) report_error("SaveMatrix");
+    if (mapped) {
+	if (SaveMappedMatrix(Matrices, argv[optind + 4])) report_error("SaveMappedMatrix");
+    } else {
+	if (SaveMatrix(Matrices, argv[optind + 4])) report_error("SaveMatrix");
+    }
+    if (every) unlink(checkpoint);
+    g_free(checkpoint);
     corpus_free(Corpus1);
     corpus_free(Corpus2);
     FreeMatrix(Matrices);
@@ -0,0 +1,484 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "sampler.h"
+
+/**
+ * @file
+ * @brief Monte Carlo sampling engine used by the SampleA and SampleB
+ * EM-Algorithm variants
+ *
+ * Sentence pairs are read in rounds and sampled by a pool of
+ * threads. Each thread starts with a contiguous slice of the round
+ * and, when it is done, steals half of the sentences left to the
+ * busiest thread. Results are kept per sentence and merged into the
+ * matrix in corpus order, and each sentence pair draws from its own
+ * random stream, so the resulting matrix does not depend on the
+ * number of threads.
+ */
+
+/**
+ * @brief Number of sentence pairs given to each thread in each round
+ */
+#define ROUNDSIZE 2048
+
+/**
+ * @brief Sampling result for a sentence pair
+ */
+typedef struct cSamplerResult {
+    /** worker keeping the result */
+    nat_uint32_t  worker;
+    /** offset of the result in the worker arena */
+    size_t        offset;
+    /** number of rows (0 if the sentence pair was skipped) */
+    nat_uint32_t  lr;
+    /** number of columns */
+    nat_uint32_t  lc;
+    /** number of samples drawn */
+    long          Nsamples;
+} SamplerResult;
+
+struct cSamplerRound;
+
+/**
+ * @brief State of a sampling thread
+ */
+typedef struct cSamplerWorker {
+    /** the thread running this worker */
+    pthread_t             thread;
+    /** protects next and end */
+    pthread_mutex_t       lock;
+    /** next sentence pair to sample */
+    nat_uint32_t          next;
+    /** end of the sentence pairs left to this worker */
+    nat_uint32_t          end;
+    /** worker number */
+    nat_uint32_t          id;
+    /** per-sentence buffers, private to the worker */
+    SamplerWorkspace     *ws;
+    /** sampled words and counts, see SampleSentence */
+    nat_uint32_t         *arena;
+    /** number of arena entries used */
+    size_t                used;
+    /** number of arena entries allocated */
+    size_t                size;
+    /** the round being sampled */
+    struct cSamplerRound *round;
+} SamplerWorker;
+
+/**
+ * @brief A round of sentence pairs
+ */
+typedef struct cSamplerRound {
+    /** the model used to sample */
+    SamplerModel    *model;
+    /** the matrix being estimated (read only while workers run) */
+    Matrix          *M;
+    /** the matrix copy to read probabilities from */
+    MatrixVal        M1;
+    /** EM step */
+    int              step;
+    /** sampling seed */
+    uint64_t         seed;
+    /** number of the first sentence pair of the round */
+    nat_uint32_t     first;
+    /** source sentences */
+    CorpusCell     **s1;
+    /** target sentences */
+    CorpusCell     **s2;
+    /** per sentence pair results */
+    SamplerResult   *results;
+    /** the workers */
+    SamplerWorker   *workers;
+    /** number of workers */
+    int              nworkers;
+} SamplerRound;
+
+
+/**
+ * @brief Mixes the bits of a 64 bit integer (splitmix64 finalizer)
+ */
+static uint64_t Mix64(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Starts the random stream of a sentence pair
+ *
+ * @param rng the generator
+ * @param seed sampling seed
+ * @param step EM step
+ * @param sentence sentence pair number
+ */
+static void sampler_random_init(SamplerRandom *rng, uint64_t seed,
+                                int step, nat_uint32_t sentence)
+{
+    rng->key = Mix64(Mix64(seed) ^ (((uint64_t) step << 32) | sentence));
+    rng->counter = 0;
+}
+
+/**
+ * @brief Draws a random number
+ *
+ * @param rng the generator
+ * @param num upper limit
+ * @return a random number in [0, num[
+ */
+double sampler_random(SamplerRandom *rng, double num)
+{
+    uint64_t x = Mix64(rng->key + ++rng->counter * 0x9E3779B97F4A7C15ULL);
+    return (double) (x >> 11) * (1.0 / 9007199254740992.0) * num;
+}
+
+static SamplerWorkspace *SamplerWorkspaceNew(void)
+{
+    SamplerWorkspace *ws = g_new0(SamplerWorkspace, 1);
+    ws->st1     = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->st2     = g_new(nat_uint32_t, MAXLEN + 1);
+    ws->pi      = g_new(double, MAXLEN);
+    ws->pj      = g_new(double, MAXLEN);
+    ws->si      = g_new(double, MAXLEN);
+    ws->rows    = g_new(nat_uint32_t, MAXLEN);
+    ws->columns = g_new(nat_uint32_t, MAXLEN);
+    ws->changed = g_new0(char, 2 * MAXLEN);
+    return ws;
+}
+
+static void SamplerWorkspaceFree(SamplerWorkspace *ws)
+{
+    g_free(ws->st1);
+    g_free(ws->st2);
+    g_free(ws->p);
+    g_free(ws->pi);
+    g_free(ws->pj);
+    g_free(ws->s);
+    g_free(ws->si);
+    g_free(ws->e);
+    g_free(ws->rows);
+    g_free(ws->columns);
+    g_free(ws->changed);
+    g_free(ws);
+}
+
+/**
+ * @brief Forgets the changes to the sampling table
+ */
+static void ForgetChanges(SamplerWorkspace *ws)
+{
+    nat_uint32_t i;
+    for (i = 0; i < ws->nrows; i++)
+        ws->changed[ws->rows[i]] = 0;
+    for (i = 0; i < ws->ncolumns; i++)
+        ws->changed[MAXLEN + ws->columns[i]] = 0;
+    ws->nrows = ws->ncolumns = 0;
+}
+
+/**
+ * @brief Restores the sampling table from the probabilities
+ *
+ * Only the rows and columns touched since the last reset are copied,
+ * unless that is more work than copying the whole table.
+ *
+ * @param ws the workspace
+ * @return the total probability
+ */
+double sampler_table_reset(SamplerWorkspace *ws)
+{
+    nat_uint32_t i, r, c, lr = ws->lr, lc = ws->lc;
+
+    if (ws->fresh || ws->nrows * lc + ws->ncolumns * lr >= lr * lc) {
+        memcpy(ws->s, ws->p, lr * lc * sizeof(double));
+        ws->fresh = FALSE;
+    } else {
+        for (i = 0; i < ws->nrows; i++) {
+            r = ws->rows[i];
+            memcpy(ws->s + r * lc, ws->p + r * lc, lc * sizeof(double));
+        }
+        for (i = 0; i < ws->ncolumns; i++) {
+            c = ws->columns[i];
+            for (r = 0; r < lr; r++)
+                ws->s[r * lc + c] = ws->p[r * lc + c];
+        }
+    }
+    ForgetChanges(ws);
+    memcpy(ws->si, ws->pi, lr * sizeof(double));
+    return ws->pN;
+}
+
+static double MarginalProbs(SamplerWorkspace *ws)
+{
+    double total, f;
+    nat_uint32_t r, c;
+    total = 0.0f;
+    for (c = 0; c < ws->lc; c++) ws->pj[c] = 0;
+    for (r = 0; r < ws->lr; r++) {
+	ws->pi[r] = 0;
+	for (c = 0; c < ws->lc; c++) {
+	    f = ws->p[r * ws->lc + c];
+	    ws->pj[c] += f;
+	    ws->pi[r] += f;
+	}
+	total += ws->pi[r];
+    }
+    return total;
+}
+
+/**
+ * @brief Samples a sentence pair
+ *
+ * The sorted words and the counts are appended to the worker arena:
+ * lr source words, lc target words and lr x lc counts.
+ */
+static void SampleSentence(SamplerWorker *w, nat_uint32_t k)
+{
+    SamplerRound *round = w->round;
+    SamplerWorkspace *ws = w->ws;
+    SamplerResult *res = round->results + k;
+    nat_uint32_t cells;
+    size_t need;
+
+    res->lr = 0;
+    if (!round->model->prepare(ws, round->s1[k], round->s2[k]))
+        return;
+
+    cells = ws->lr * ws->lc;
+    if (cells > ws->size) {
+        ws->size = cells;
+        ws->p = g_renew(double, ws->p, cells);
+        ws->s = g_renew(double, ws->s, cells);
+        ws->e = g_renew(nat_uint32_t, ws->e, cells);
+    }
+
+    if (GetPartialMatrix(round->M, round->M1, ws->st1, ws->st2, ws->p, ws->lc))
+        report_error("EMalgorithm: GetPartialMatrix");
+    ws->pN = MarginalProbs(ws);
+    memset(ws->e, 0, cells * sizeof(*ws->e));
+    ForgetChanges(ws);
+    ws->fresh = TRUE;
+    sampler_random_init(&ws->rng, round->seed, round->step, round->first + k);
+
+    res->Nsamples = round->model->sample(ws);
+
+    need = ws->lr + ws->lc + cells;
+    if (w->used + need > w->size) {
+        w->size = max(2 * w->size, w->used + need);
+        w->arena = g_renew(nat_uint32_t, w->arena, w->size);
+    }
+    memcpy(w->arena + w->used, ws->st1, ws->lr * sizeof(nat_uint32_t));
+    memcpy(w->arena + w->used + ws->lr, ws->st2, ws->lc * sizeof(nat_uint32_t));
+    memcpy(w->arena + w->used + ws->lr + ws->lc, ws->e, cells * sizeof(nat_uint32_t));
+
+    res->worker = w->id;
+    res->offset = w->used;
+    res->lr     = ws->lr;
+    res->lc     = ws->lc;
+    w->used += need;
+}
+
+/**
+ * @brief Steals half of the sentence pairs left to the busiest worker
+ *
+ * @param w the idle worker
+ * @param k where to store the first stolen sentence pair
+ * @return FALSE if there is nothing left to steal
+ */
+static nat_boolean_t StealSentences(SamplerWorker *w, nat_uint32_t *k)
+{
+    SamplerRound *round = w->round;
+    SamplerWorker *victim;
+    nat_uint32_t left, best, from, to;
+    int t;
+
+    for (;;) {
+        victim = NULL;
+        best = 0;
+        for (t = 0; t < round->nworkers; t++) {
+            if (round->workers + t == w) continue;
+            pthread_mutex_lock(&round->workers[t].lock);
+            left = round->workers[t].end - round->workers[t].next;
+            pthread_mutex_unlock(&round->workers[t].lock);
+            if (left > best) {
+                best = left;
+                victim = round->workers + t;
+            }
+        }
+        if (!victim) return FALSE;
+
+        pthread_mutex_lock(&victim->lock);
+        left = victim->end - victim->next;
+        if (left == 0) {
+            /* finished meanwhile, look again */
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        to = victim->end;
+        from = to - (left + 1) / 2;
+        victim->end = from;
+        pthread_mutex_unlock(&victim->lock);
+
+        pthread_mutex_lock(&w->lock);
+        w->next = from + 1;
+        w->end = to;
+        pthread_mutex_unlock(&w->lock);
+        *k = from;
+        return TRUE;
+    }
+}
+
+/**
+ * @brief Body of a sampling thread
+ */
+static void *SamplerWorkerRun(void *data)
+{
+    SamplerWorker *w = (SamplerWorker*)data;
+    nat_boolean_t more;
+    nat_uint32_t k = 0;
+
+    w->used = 0;
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        more = w->next < w->end;
+        if (more) k = w->next++;
+        pthread_mutex_unlock(&w->lock);
+        if (!more && !StealSentences(w, &k))
+            break;
+        SampleSentence(w, k);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Runs the E-step of a sampling EM-Algorithm
+ *
+ * Counts are added to M2, that should be cleared beforehand.
+ *
+ * @param model the sampling model
+ * @param M the matrix being estimated
+ * @param M1 the matrix copy to read probabilities from
+ * @param M2 the matrix copy to store counts on
+ * @param C1 source corpus
+ * @param C2 target corpus
+ * @param step EM step, used to choose the random streams
+ * @param seed sampling seed
+ * @param nthreads number of sampling threads
+ */
+void sampler_estep(SamplerModel *model, Matrix *M, MatrixVal M1, MatrixVal M2,
+                   Corpus *C1, Corpus *C2, int step, uint64_t seed, int nthreads)
+{
+    SamplerRound round;
+    SamplerResult *res;
+    MatrixBatch *batch;
+    nat_uint32_t length, n, i, r, c, *ids, *e;
+    CorpusCell *s1, *s2;
+    int t;
+
+    round.model    = model;
+    round.M        = M;
+    round.M1       = M1;
+    round.step     = step;
+    round.seed     = seed;
+    round.first    = 0;
+    round.nworkers = nthreads;
+    round.s1       = g_new(CorpusCell*, nthreads * ROUNDSIZE);
+    round.s2       = g_new(CorpusCell*, nthreads * ROUNDSIZE);
+    round.results  = g_new(SamplerResult, nthreads * ROUNDSIZE);
+    round.workers  = g_new0(SamplerWorker, nthreads);
+    for (t = 0; t < nthreads; t++) {
+        round.workers[t].id    = t;
+        round.workers[t].ws    = SamplerWorkspaceNew();
+        round.workers[t].round = &round;
+        pthread_mutex_init(&round.workers[t].lock, NULL);
+    }
+
+    batch = MatrixBatchNew(M, M2, MATRIX_BATCH);
+    if (!batch) report_error("EMalgorithm: MatrixBatchNew failed");
+
+    length = corpus_sentences_nr(C1);
+    s1 = corpus_first_sentence(C1);
+    s2 = corpus_first_sentence(C2);
+    while (s1 != NULL && s2 != NULL) {
+#ifndef DEBUG
+	fprintf(stderr, "\b\b\b\b\b%4.1f%%", (double) round.first * 99.9f / (double) length);
+#endif
+
+        n = 0;
+        while (n < nthreads * ROUNDSIZE && s1 != NULL && s2 != NULL) {
+            round.s1[n] = s1;
+            round.s2[n] = s2;
+            n++;
+            s1 = corpus_next_sentence(C1);
+            s2 = corpus_next_sentence(C2);
+        }
+
+        for (t = 0; t < nthreads; t++) {
+            round.workers[t].next = (nat_uint32_t) (((double) n * t) / nthreads);
+            round.workers[t].end  = (nat_uint32_t) (((double) n * (t + 1)) / nthreads);
+        }
+        if (nthreads == 1)
+            SamplerWorkerRun(round.workers);
+        else {
+            for (t = 0; t < nthreads; t++)
+                if (pthread_create(&round.workers[t].thread, NULL,
+                                   SamplerWorkerRun, round.workers + t))
+                    report_error("EMalgorithm: cannot create worker thread");
+            for (t = 0; t < nthreads; t++)
+                pthread_join(round.workers[t].thread, NULL);
+        }
+
+        /* merge in corpus order */
+        for (i = 0; i < n; i++) {
+            res = round.results + i;
+            if (!res->lr) continue;
+            ids = round.workers[res->worker].arena + res->offset;
+            e = ids + res->lr + res->lc;
+            for (r = 0; r < res->lr; r++)
+                for (c = 0; c < res->lc; c++) {
+                    if (MatrixBatchInc(batch, (double) e[r * res->lc + c] / (double) res->Nsamples,
+                                       ids[r], ids[res->lr + c]))
+                        report_error("EMalgorithm: MatrixBatchInc failed");
+                }
+        }
+        round.first += n;
+    }
+
+    if (MatrixBatchFlush(batch))
+	report_error("EMalgorithm: MatrixBatchFlush failed");
+    MatrixBatchFree(batch);
+
+    for (t = 0; t < nthreads; t++) {
+        SamplerWorkspaceFree(round.workers[t].ws);
+        g_free(round.workers[t].arena);
+        pthread_mutex_destroy(&round.workers[t].lock);
+    }
+    g_free(round.workers);
+    g_free(round.results);
+    g_free(round.s1);
+    g_free(round.s2);
+}
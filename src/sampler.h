@@ -0,0 +1,169 @@
+/* -*- Mode: C; c-file-style: "stroustrup" -*- */
+
+/* NATools - Package with parallel corpora tools
+ * Copyright (C) 1998-2001  Djoerd Hiemstra
+ * Copyright (C) 2002-2012  Alberto Simes
+ *
+ * This package is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.	 See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+/**
+ * @file
+ * @brief Header file for the Monte Carlo sampling engine used by the
+ * SampleA and SampleB EM-Algorithm variants
+ */
+
+#include <stdint.h>
+
+#include "standard.h"
+#include <NATools/corpus.h>
+#include "matrix.h"
+
+/**
+ * @brief Maximum number of sampling threads
+ */
+#define SAMPLER_MAXTHREADS 64
+
+/**
+ * @brief Counter based random number generator
+ *
+ * Each sentence pair gets its own stream, given by the sampling seed,
+ * the EM step and the sentence number. The n-th number of a stream is
+ * a hash of its key and n, so the numbers drawn for a sentence do not
+ * depend on the thread sampling it.
+ */
+typedef struct cSamplerRandom {
+    /** stream key */
+    uint64_t key;
+    /** numbers drawn so far */
+    uint64_t counter;
+} SamplerRandom;
+
+/**
+ * @brief Per thread data used to sample a sentence pair
+ *
+ * Tables are lr x lc, with stride lc. The model prepare function
+ * fills st1, st2, lr and lc. The engine then fills the probabilities
+ * (p, pi, pj and pN) and clears the counts (e) before calling the
+ * model sample function.
+ */
+typedef struct cSamplerWorkspace {
+    /** sorted source words (0 terminated) */
+    nat_uint32_t  *st1;
+    /** sorted target words (0 terminated) */
+    nat_uint32_t  *st2;
+    /** number of rows of the tables */
+    nat_uint32_t   lr;
+    /** number of columns of the tables */
+    nat_uint32_t   lc;
+    /** number of cells allocated for each table */
+    nat_uint32_t   size;
+    /** alignment probabilities */
+    double        *p;
+    /** row marginals */
+    double        *pi;
+    /** column marginals */
+    double        *pj;
+    /** total probability */
+    double         pN;
+    /** sampling table, restored from p by sampler_table_reset */
+    double        *s;
+    /** sampling table row marginals, restored from pi */
+    double        *si;
+    /** alignment counts */
+    nat_uint32_t  *e;
+    /** random numbers for the sentence pair */
+    SamplerRandom  rng;
+
+    /** rows of s changed since the last reset */
+    nat_uint32_t  *rows;
+    /** columns of s changed since the last reset */
+    nat_uint32_t  *columns;
+    /** number of changed rows */
+    nat_uint32_t   nrows;
+    /** number of changed columns */
+    nat_uint32_t   ncolumns;
+    /** changed flags, for rows (first MAXLEN) and columns */
+    char          *changed;
+    /** true when s must be fully copied on the next reset */
+    nat_boolean_t  fresh;
+} SamplerWorkspace;
+
+/**
+ * @brief A sampling EM model
+ */
+typedef struct cSamplerModel {
+    /**
+     * @brief Fills st1, st2, lr and lc for a sentence pair
+     *
+     * @return FALSE if the sentence pair must be skipped
+     */
+    nat_boolean_t (*prepare)(SamplerWorkspace *ws, CorpusCell *s1, CorpusCell *s2);
+    /**
+     * @brief Draws alignments, counting them in e
+     *
+     * @return the number of samples drawn
+     */
+    long          (*sample)(SamplerWorkspace *ws);
+} SamplerModel;
+
+double     sampler_random        (SamplerRandom    *rng,
+                                  double            num);
+
+double     sampler_table_reset   (SamplerWorkspace *ws);
+
+/**
+ * @brief Marks row r of the sampling table as changed
+ *
+ * Must be used before changing the row, so that sampler_table_reset
+ * restores it.
+ */
+#define sampler_touch_row(ws, r)                                        \
+    do {                                                                \
+        if (!(ws)->changed[r]) {                                        \
+            (ws)->changed[r] = 1;                                       \
+            (ws)->rows[(ws)->nrows++] = (r);                            \
+        }                                                               \
+    } while (0)
+
+/**
+ * @brief Marks column c of the sampling table as changed
+ *
+ * Must be used before changing the column, so that
+ * sampler_table_reset restores it.
+ */
+#define sampler_touch_column(ws, c)                                     \
+    do {                                                                \
+        if (!(ws)->changed[MAXLEN + (c)]) {                             \
+            (ws)->changed[MAXLEN + (c)] = 1;                            \
+            (ws)->columns[(ws)->ncolumns++] = (c);                      \
+        }                                                               \
+    } while (0)
+
+void       sampler_estep         (SamplerModel     *model,
+                                  Matrix           *M,
+                                  MatrixVal         M1,
+                                  MatrixVal         M2,
+                                  Corpus           *C1,
+                                  Corpus           *C2,
+                                  int               step,
+                                  uint64_t          seed,
+                                  int               nthreads);
+
+#endif /* __SAMPLER_H__ */
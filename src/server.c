@@ -32,6 +32,10 @@
 /* #include <bits/signum.h> */
 #include <time.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 
 #include <NATools.h>
 #include "unicode.h"
@@ -41,24 +45,76 @@
 
 #define DEBUG 0
 
-int sockfd, fd;
+/** @brief default number of threads answering requests */
+#define SERVER_THREADS 4
+
+/** @brief maximum number of threads answering requests */
+#define SERVER_MAXTHREADS 64
+
+/** @brief maximum number of open connections */
+#define SERVER_MAXCONNS 1024
+
+/** @brief seconds a client has to send its request and get the answer */
+#define SERVER_TIMEOUT 50
+
+/** @brief maximum size of a request */
+#define SERVER_REQUEST_SIZE 1024
+
+/**
+ * @brief A client connection, and the request read so far
+ */
+typedef struct _ServerConn {
+    int fd;
+    /** when the connection is dropped */
+    time_t deadline;
+    size_t length;
+    char buf[SERVER_REQUEST_SIZE + 1];
+} ServerConn;
+
+/**
+ * @brief Queue of complete requests, waiting for a worker
+ */
+typedef struct _ServerQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t  ready;
+    ServerConn *jobs[SERVER_MAXCONNS];
+    int head, count;
+    /** open connections: being read, queued or being answered */
+    int nconns;
+} ServerQueue;
+
+/**
+ * @brief A worker thread, and the request it is answering
+ */
+typedef struct _ServerWorker {
+    pthread_t    thread;
+    ServerQueue *queue;
+    /** connection being answered, -1 if none (guarded by the queue lock) */
+    int          fd;
+    time_t       deadline;
+    char        *config;
+} ServerWorker;
+
+int sockfd;
 
 GHashTable *CORPORA;
 nat_int_t LAST_CORPORA = 0;
 
 void LOG(char* log, ...) {
     char stime[80];
+    char message[1024];
     time_t timep;
+    struct tm tm;
 
     va_list args;
     va_start(args, log);
 
     time(&timep);
-    strftime(stime, 80, "%F %T", localtime(&timep));
+    strftime(stime, 80, "%F %T", localtime_r(&timep, &tm));
 
-    fprintf(stderr, "[%s] ", stime);
-    vfprintf(stderr, log, args);
-    fprintf(stderr,"\n");
+    /* a single write, so that threads do not mix their lines */
+    vsnprintf(message, 1024, log, args);
+    fprintf(stderr, "[%s] %s\n", stime, message);
     va_end(args);
 }
 
@@ -156,7 +212,7 @@ void dump_dict_full(int fd, wchar_t *word, nat_uint32_t wid, nat_int_t dir, Corp
     snprintf(sbuf, 600, "%u\n", dictionary_get_occ(D, wid));
     write(fd, sbuf, strlen(sbuf));
 
-    for (j = 0; j < MAXENTRY; j++) {
+    for (j = 0; j < dictionary_get_entries(D, wid); j++) {
 	twid = 0;
 	prob = 0.0;
 	twid = dictionary_get_id(D, wid, j);
@@ -212,14 +268,8 @@ void handle_sigpipe(int x) {
     LOG("Connection abruptely closed");
 }
 
-void handle_sigalrm(int x) {
-    LOG("Timeout, dude!");
-    close(fd);
-}
-
 void handle_sigint(int x) {
     LOG("Quiting...");
-    close(fd);
     close(sockfd);
     exit(0);
 }
@@ -231,6 +281,80 @@ int* int_ptr(int x) {
     return y;
 }
 
+/**
+ * @brief Answers the requests of the queue
+ *
+ * Corpora are shared by all workers, read only.
+ */
+static void *ServerWorkerRun(void *data)
+{
+    ServerWorker *worker = (ServerWorker*) data;
+    ServerQueue *queue = worker->queue;
+    wchar_t wbuf[SERVER_REQUEST_SIZE + 1];
+    ServerConn *conn;
+
+    for (;;) {
+	pthread_mutex_lock(&queue->lock);
+	while (!queue->count)
+	    pthread_cond_wait(&queue->ready, &queue->lock);
+	conn = queue->jobs[queue->head];
+	queue->head = (queue->head + 1) % SERVER_MAXCONNS;
+	queue->count--;
+	worker->fd = conn->fd;
+	worker->deadline = conn->deadline;
+	pthread_mutex_unlock(&queue->lock);
+
+	if (time(NULL) < conn->deadline) {
+	    swprintf(wbuf, SERVER_REQUEST_SIZE + 1, L"%s", conn->buf);
+	    parse(conn->fd, wbuf, worker->config);
+	} else {
+	    LOG("Timeout, request waited too long");
+	}
+
+	/* the watchdog must not see the descriptor once closed */
+	pthread_mutex_lock(&queue->lock);
+	worker->fd = -1;
+	close(conn->fd);
+	queue->nconns--;
+	pthread_mutex_unlock(&queue->lock);
+	g_free(conn);
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads what a client sent
+ *
+ * @return 1 if the request is complete, -1 if the connection should
+ *     be dropped, 0 to wait for more
+ */
+static int ServerConnRead(ServerConn *conn)
+{
+    ssize_t n;
+    char *newline;
+
+    n = read(conn->fd, conn->buf + conn->length, SERVER_REQUEST_SIZE - conn->length);
+    if (n < 0)
+	return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    if (n == 0)
+	return conn->length ? 1 : -1;
+
+    conn->length += n;
+    conn->buf[conn->length] = '\0';
+
+    /* requests are a line, and the rest is ignored */
+    newline = memchr(conn->buf, '\n', conn->length);
+    if (newline) {
+	newline[1] = '\0';
+	return 1;
+    }
+    if (conn->length == SERVER_REQUEST_SIZE) {
+	ERROR(conn->fd);
+	return -1;
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     struct sockaddr_in serv;
     struct sockaddr_in client;
@@ -241,16 +365,41 @@ int main(int argc, char *argv[]) {
     //    char *host = "193.136.19.131";
 
     char buf[1024];
-    wchar_t wbuf[1024];
-    size_t n;
-    unsigned int size = sizeof(client);
+    socklen_t size = sizeof(client);
     int zbr = 1;
     FILE *f = NULL;
 
+    int nthreads = SERVER_THREADS;
+    ServerQueue queue;
+    ServerWorker *workers;
+    ServerConn *conns[SERVER_MAXCONNS];
+    struct pollfd fds[SERVER_MAXCONNS + 1];
+    struct timeval timeout;
+    int nreading = 0;
+    int t, i, fd, r;
+    time_t now;
+
+    extern char *optarg;
+    extern int optind;
+    int c;
+
     init_locale();
 
-    if (argc != 2) {
-	printf("Usage: nat-server <config-file>\n");
+    while ((c = getopt(argc, argv, "j:")) != EOF) {
+	switch (c) {
+	case 'j':
+	    nthreads = atoi(optarg);
+	    if (nthreads < 1 || nthreads > SERVER_MAXTHREADS)
+		report_error("Number of threads out of range (1-%d)", SERVER_MAXTHREADS);
+	    break;
+	default:
+	    printf("Usage: nat-server [-j threads] <config-file>\n");
+	    return 1;
+	}
+    }
+
+    if (argc != optind + 1) {
+	printf("Usage: nat-server [-j threads] <config-file>\n");
 	return 0;
     }
 
@@ -258,7 +407,7 @@ int main(int argc, char *argv[]) {
 
     /* CONFIGURATION FILE */
     LOG("Loading configuration file");
-    f = fopen(argv[1], "rb");
+    f = fopen(argv[optind], "rb");
     if (f) {
 	CorpusInfo *tmp_corpus;
 	while(!feof(f)) {
@@ -278,13 +427,12 @@ int main(int argc, char *argv[]) {
 	}
 	fclose(f);
     } else {
-	report_error("Can't find '%s'", argv[1]);
+	report_error("Can't find '%s'", argv[optind]);
     }
     
     /* SERVER CODE */
     /*-------------*/
 
-    signal(SIGALRM, handle_sigalrm);
     signal(SIGINT, handle_sigint);
     signal(SIGPIPE, handle_sigpipe);
 
@@ -311,38 +459,123 @@ int main(int argc, char *argv[]) {
     }
 
   
-    if (listen(sockfd,5) < 0 ) {
+    if (listen(sockfd, SOMAXCONN) < 0 ) {
 	LOG("couldn't listen");
 	return -1;
     } else{
 	LOG("listen done");
     }
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+
+    /* WORKERS */
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.ready, NULL);
+    queue.head = queue.count = queue.nconns = 0;
+
+    workers = g_new(ServerWorker, nthreads);
+    for (t = 0; t < nthreads; t++) {
+	workers[t].queue = &queue;
+	workers[t].fd = -1;
+	workers[t].config = argv[optind];
+	if (pthread_create(&workers[t].thread, NULL, ServerWorkerRun, workers + t))
+	    report_error("Can't create thread");
+    }
+    LOG("%d workers ready", nthreads);
 
+    /* Connections are read here, without blocking, until their
+       request is complete, and then queued for the workers. */
     for(;;) {
-	if ((fd = accept(sockfd, (struct sockaddr *) &client, &size)) < 0 ) {
-	    LOG("couln't accept connection!");
-	    return(-1);
-	} else {
+	pthread_mutex_lock(&queue.lock);
+	fds[0].fd = sockfd;
+	fds[0].events = queue.nconns < SERVER_MAXCONNS ? POLLIN : 0;
+	pthread_mutex_unlock(&queue.lock);
+	for (i = 0; i < nreading; i++) {
+	    fds[i + 1].fd = conns[i]->fd;
+	    fds[i + 1].events = POLLIN;
+	}
+
+	/* wake up every second to check deadlines */
+	if (poll(fds, nreading + 1, 1000) < 0 && errno != EINTR) {
+	    LOG("poll failed!");
+	    return -1;
+	}
+	now = time(NULL);
+
+	/* requests being read (from the end, as they are removed) */
+	for (i = nreading - 1; i >= 0; i--) {
+	    r = 0;
+	    if (fds[i + 1].revents)
+		r = ServerConnRead(conns[i]);
+	    if (!r && now >= conns[i]->deadline) {
+		LOG("Timeout, request not received");
+		r = -1;
+	    }
+
+	    if (r > 0) {
+		/* workers write blocking, until the deadline */
+		fcntl(conns[i]->fd, F_SETFL, fcntl(conns[i]->fd, F_GETFL) & ~O_NONBLOCK);
+		timeout.tv_sec = SERVER_TIMEOUT;
+		timeout.tv_usec = 0;
+		setsockopt(conns[i]->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+		pthread_mutex_lock(&queue.lock);
+		queue.jobs[(queue.head + queue.count) % SERVER_MAXCONNS] = conns[i];
+		queue.count++;
+		pthread_cond_signal(&queue.ready);
+		pthread_mutex_unlock(&queue.lock);
+	    } else if (r < 0) {
+		close(conns[i]->fd);
+		g_free(conns[i]);
+		pthread_mutex_lock(&queue.lock);
+		queue.nconns--;
+		pthread_mutex_unlock(&queue.lock);
+	    }
+	    if (r) conns[i] = conns[--nreading];
+	}
+
+	/* new connections */
+	if (fds[0].revents & POLLIN) {
+	    for (;;) {
+		pthread_mutex_lock(&queue.lock);
+		r = queue.nconns < SERVER_MAXCONNS;
+		pthread_mutex_unlock(&queue.lock);
+		if (!r) break;
+
+		if ((fd = accept(sockfd, (struct sockaddr *) &client, &size)) < 0) {
+		    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			LOG("couln't accept connection!");
+		    break;
+		}
 #if DEBUG	    
-	    LOG("accept connection (from: %s:%d) (fd: %d)",
-		inet_ntoa((struct in_addr)client.sin_addr),
-		ntohs(client.sin_port),
-		fd); 
+		LOG("accept connection (from: %s:%d) (fd: %d)",
+		    inet_ntoa((struct in_addr)client.sin_addr),
+		    ntohs(client.sin_port),
+		    fd); 
 #endif
-	    alarm(50);
-	    n = read(fd, buf, 1024);
-
-	    if ( n > 0 ) {
-                // buf to wchar_t ?
-                swprintf(wbuf, 1024, L"%s", buf);
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		conns[nreading] = g_new(ServerConn, 1);
+		conns[nreading]->fd = fd;
+		conns[nreading]->deadline = now + SERVER_TIMEOUT;
+		conns[nreading]->length = 0;
+		nreading++;
+
+		pthread_mutex_lock(&queue.lock);
+		queue.nconns++;
+		pthread_mutex_unlock(&queue.lock);
+	    }
+	}
 
-		parse(fd, wbuf, argv[1]);
-		wbuf[0] = L'\0';
-		n = 0;
+	/* answers past their deadline: the worker stops when it
+	   fails to write */
+	pthread_mutex_lock(&queue.lock);
+	for (t = 0; t < nthreads; t++) {
+	    if (workers[t].fd >= 0 && workers[t].deadline && now >= workers[t].deadline) {
+		LOG("Timeout, answer took too long");
+		shutdown(workers[t].fd, SHUT_RDWR);
+		workers[t].deadline = 0;
 	    }
-	    alarm(0);
-	    close(fd);  
 	}
+	pthread_mutex_unlock(&queue.lock);
     }
 }
 
@@ -86,7 +86,8 @@ TU* create_TU(CorpusInfo *corpus, double q,
               CorpusCell *source, CorpusCell *target) {
     TU *tu = g_new(TU, 1);			
     
-    tu->quality = (corpus->has_rank) ? q : -1.0;
+    /* q is negative if the corpus has no rank */
+    tu->quality = q;
     tu->source = convert_sentence(corpus->SourceLex, source);
     tu->target = convert_sentence(corpus->TargetLex, target);
 
@@ -190,6 +191,7 @@ GSList* dump_ngrams(int fd, CorpusInfo *corpus, int direction,
         data->list = NULL;
 
         /* Check if the ngrams files are already opened. If not, open them. */
+        pthread_mutex_lock(&corpus->lock);
         if (direction > 0 && !corpus->SourceGrams) {
             char* tmp = g_strdup_printf("%s/S.%%d.ngrams", corpus->filepath);
             corpus->SourceGrams = ngram_index_open_and_attach(tmp);
@@ -200,6 +202,7 @@ GSList* dump_ngrams(int fd, CorpusInfo *corpus, int direction,
             corpus->TargetGrams = ngram_index_open_and_attach(tmp);            
             g_free(tmp);
         }
+        pthread_mutex_unlock(&corpus->lock);
 
         if ((direction > 0 && !corpus->SourceGrams) ||
             (direction < 0 && !corpus->TargetGrams)) {
@@ -240,6 +243,42 @@ GSList* dump_ngrams(int fd, CorpusInfo *corpus, int direction,
 }
 
 
+/**
+ * @brief Adds a word to a concordance query
+ *
+ * Words without occurrences (like punctuation, which is not indexed)
+ * do not restrict the sentences searched, and are left to the exact
+ * match check.
+ *
+ * @param idx the index of the word language
+ * @param wid the word identifier
+ * @param iters the iterators intersected to find the sentences
+ * @param nterms number of iterators in <i>iters</i>
+ * @param phrase the iterator used to check the word position
+ * @return true if the word position can be checked from the index
+ */
+static nat_boolean_t add_query_word(CompactInvIndex *idx, nat_uint32_t wid,
+				    InvIndexIter *iters, nat_uint32_t *nterms,
+				    InvIndexIter *phrase)
+{
+    if (!inv_index_iter_init(idx, wid, phrase)) return FALSE;
+    iters[(*nterms)++] = *phrase;
+    return idx->positional;
+}
+
+/**
+ * @brief Number of words of a sentence, from the corpus offsets
+ */
+static nat_uint32_t sentence_length(CorpusInfo *corpus, nat_boolean_t source,
+				    nat_uchar_t chunk, nat_uint32_t sentence)
+{
+    nat_uint32_t *offsets = source ? corpus->chunks[chunk-1].source_offset
+                                   : corpus->chunks[chunk-1].target_offset;
+
+    /* each sentence ends with a zero */
+    return offsets[sentence+1] - offsets[sentence] - 1;
+}
+
 GSList* dump_conc(int fd, CorpusInfo *corpus, int direction,
 		  nat_boolean_t both, nat_boolean_t exact_match,
 		  wchar_t words[50][150], int i) {
@@ -249,9 +288,12 @@ GSList* dump_conc(int fd, CorpusInfo *corpus, int direction,
     int j = 2;
     nat_uint32_t wids[50];
     nat_uint32_t total = 20;
-    nat_uint32_t *occs = NULL, *occs1 = NULL, *occs2 = NULL;
-    nat_uint32_t wid;
-    nat_boolean_t need_free = FALSE;
+    InvIndexIter iters[50], phrase[50];
+    nat_uint32_t nterms = 0;
+    nat_uint32_t wid, occ;
+    nat_boolean_t stop = FALSE, failed = FALSE;
+    nat_boolean_t positional = TRUE, otherpositional = TRUE;
+    CompactInvIndex *idx;
     nat_uint32_t *otherwids = NULL;
     nat_uint32_t counter;
     TU* tu;
@@ -278,8 +320,9 @@ GSList* dump_conc(int fd, CorpusInfo *corpus, int direction,
 
     	    wids[j-2] = wid;
 
-    	    occs = inv_index_compact_get_occurrences( (direction > 0)?corpus->SourceIdx:corpus->TargetIdx, wid);
-
+    	    idx = (direction > 0)?corpus->SourceIdx:corpus->TargetIdx;
+    	    if (!add_query_word(idx, wid, iters, &nterms, &phrase[j-2]))
+    		positional = FALSE;
     	}
     	wids[j-1] = 0;
 
@@ -307,106 +350,98 @@ GSList* dump_conc(int fd, CorpusInfo *corpus, int direction,
     			wid = words_get_id( (direction > 0)?corpus->SourceLex:corpus->TargetLex, words[j]);
 			
     			if (!wid) {
-    			    if (need_free) g_free(occs);
     			    if (fd) DONE(fd);
     			    return NULL;
     			}
 
     			wids[j-2] = wid;
 		    
-    			occs1 = inv_index_compact_get_occurrences(
-                                (direction > 0)?corpus->SourceIdx:corpus->TargetIdx,
-                                wid);
-    			occs2 = intersect(occs, occs1);
-    			if (need_free) g_free(occs);
-    			occs = occs2;
-    			need_free = TRUE;
+    			idx = (direction > 0)?corpus->SourceIdx:corpus->TargetIdx;
+    			if (!add_query_word(idx, wid, iters, &nterms, &phrase[j-2])) {
+    			    if (otherwids) otherpositional = FALSE;
+    			    else positional = FALSE;
+    			}
     		    }
     		}
 	    }
 	    wids[j-2] = 0;
 	}
-	
-#if DEBUG      
-	LOG("Retrieving and processing %d unities", length(occs));
-#endif
-	
+
+	/* Occurrences are found and checked one at a time, so that the
+	   first units are sent without going through the whole lists */
+	inv_index_iter_sort(iters, nterms);
 	counter = 0;
-	
-	occs1 = occs;
-	
-	while(occs1 && *occs && counter < total) {
+
+	for (occ = inv_index_iter_intersect(iters, nterms);
+	     occ && counter < total && !stop && !failed;
+	     inv_index_iter_next(&iters[0]), occ = inv_index_iter_intersect(iters, nterms)) {
 	    nat_uchar_t  chunk;
 	    double q1 = -1, q2 = -1;
-	    nat_boolean_t has_kwalitee = FALSE;
-	    nat_uint32_t sentence = unpack(*occs, &chunk);
-	    CorpusCell *src, *trg;
-
-	    src = corpus_retrieve_sentence(corpus,  TRUE, chunk, sentence-1, &q1);
-	    trg = corpus_retrieve_sentence(corpus, FALSE, chunk, sentence-1, &q2);
-
-	    if (q1 >= 0 && q2 >= 0) has_kwalitee = TRUE;
-		
-	    if (exact_match && both) {
-    		if (corpus_strstr(src, wids) && corpus_strstr(trg, otherwids)) {
-    		    tu = create_TU(corpus, q1, src, trg);
-    		    if (fd) {
-                        if (send_TU(fd, tu)) break;
-                        destroy_TU(tu);
-    		    } else {
-                        results = g_slist_append(results, tu);
-    		    }
-    		    counter ++;
-    		}
-	    } else if (both) {
-    		tu = create_TU(corpus, q1, src, trg);
-    		if (fd) {
-    		    if (send_TU(fd,tu)) break;
-    		    destroy_TU(tu);
-    		} else {
-    		    results = g_slist_append(results, tu);
-    		}
-    		counter++;
-	    } else if (direction < 0) {
-    		if (!exact_match || (exact_match && corpus_strstr(trg, wids))) {
-    		    tu = create_TU(corpus, q1, src, trg);
-    		    if (fd) {
-    			    if (send_TU(fd,tu)) break;
-    			    destroy_TU(tu);
-    		    } else {
-    			    results = g_slist_append(results, tu);
-    		    }
-    		    counter++;
-    		}
-	    } else {
-    		if (!exact_match || (exact_match && corpus_strstr(src, wids))) {
-    		    tu = create_TU(corpus, q1, src, trg);
-    		    if (fd) {
-        			if (send_TU(fd,tu)) break;
-        			destroy_TU(tu);
-    		    } else {
-        			results = g_slist_append(results, tu);
-    		    }
-    		    counter++;
-    		}
+	    nat_uint32_t sentence = unpack(occ, &chunk);
+	    CorpusCell *src = NULL, *trg = NULL;
+	    nat_boolean_t match = TRUE;
+
+	    /* exact matches are checked before retrieving the other side,
+	       and from the positions if the index has them */
+	    if (exact_match && (both || direction > 0)) {
+		if (positional)
+		    match = inv_index_phrase_match(phrase, wids, occ,
+						   sentence_length(corpus, TRUE, chunk, sentence-1));
+		else {
+		    src = corpus_retrieve_sentence(corpus,  TRUE, chunk, sentence-1, &q1);
+		    failed = !src;
+		    match = src && corpus_strstr(src, wids);
+		}
+	    }
+	    if (match && exact_match && (both || direction < 0)) {
+		if (both ? otherpositional : positional)
+		    match = inv_index_phrase_match(both ? phrase + (otherwids - wids) : phrase,
+						   both ? otherwids : wids, occ,
+						   sentence_length(corpus, FALSE, chunk, sentence-1));
+		else {
+		    trg = corpus_retrieve_sentence(corpus, FALSE, chunk, sentence-1, &q2);
+		    failed = !trg;
+		    match = trg && corpus_strstr(trg, both ? otherwids : wids);
+		}
+	    }
+
+	    if (match) {
+		if (!src) src = corpus_retrieve_sentence(corpus,  TRUE, chunk, sentence-1, &q1);
+		if (!trg) trg = corpus_retrieve_sentence(corpus, FALSE, chunk, sentence-1, &q2);
+		failed = !src || !trg;
+	    }
+
+	    if (match && !failed) {
+		tu = create_TU(corpus, q1, src, trg);
+		if (fd) {
+		    stop = send_TU(fd, tu);
+		    destroy_TU(tu);
+		} else {
+		    results = g_slist_prepend(results, tu);
+		}
+		counter++;
 	    }
 
 	    g_free(src);
 	    g_free(trg);
-	    
-	    occs++;
 	}
 
 #if DEBUG
 	LOG("Sent %d units", counter); 
 #endif
+
+	/* a sentence could not be read: the request fails */
+	if (failed) {
+	    GSList *l;
+	    for (l = results; l; l = l->next) destroy_TU(l->data);
+	    g_slist_free(results);
+	    if (fd) ERROR(fd);
+	    return NULL;
+	}
 	if (fd) DONE(fd);
-	
-	if (need_free) g_free(occs1);
     } 
 
-
-    return results;
+    return g_slist_reverse(results);
 }
 
 CorpusCell *corpus_retrieve_sentence(CorpusInfo* corpus,
@@ -434,19 +469,27 @@ CorpusCell *corpus_retrieve_sentence(CorpusInfo* corpus,
         fh = corpus->chunks[chunk-1].target_crp;
     }
 
+    /* the rank cache may change while other threads use the corpus */
     rank_filename = g_strdup_printf("%s/rank.%03hhu.rnk", basedir, chunk);
+    pthread_mutex_lock(&corpus->lock);
     ranks = rank_load(corpus, rank_filename, size);
+    if (ranks) {
+	*kwalitee = ranks[sentence];
+    }
+    pthread_mutex_unlock(&corpus->lock);
+    g_free(rank_filename);
 
     begin = offsets[sentence];
     end = offsets[sentence+1];
     delta = end - begin;
 
+    /* pread does not move the shared file offset */
     buf = g_new0(CorpusCell, delta);
-    fseek(fh, begin*sizeof(CorpusCell) + CORPUS_HEADER_SIZE, 0);
-    fread( buf, sizeof(CorpusCell),delta,fh);
-
-    if (corpus->has_rank) {
-	*kwalitee = ranks[sentence];
+    if (pread(fileno(fh), buf, delta * sizeof(CorpusCell),
+              (off_t) begin * sizeof(CorpusCell) + CORPUS_HEADER_SIZE) !=
+	(ssize_t) (delta * sizeof(CorpusCell))) {
+	g_free(buf);
+	return NULL;
     }
 
     return buf;
@@ -56,6 +56,7 @@ GSList* dump_conc(int fd, CorpusInfo *corpus, int direction,
 		  wchar_t words[50][150], int i);
 GSList* dump_ngrams(int fd, CorpusInfo *corpus, int direction,
                     wchar_t words[50][150], int n);
+/* NULL if the sentence can not be read from the corpus file */
 CorpusCell *corpus_retrieve_sentence(CorpusInfo* corpus,
 				     nat_boolean_t source,
 				     const nat_uchar_t chunk,
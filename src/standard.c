@@ -21,6 +21,7 @@
 #include <glib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 #include <wchar.h>
 #include "standard.h"
 #include "unicode.h"
@@ -137,3 +138,30 @@ nat_boolean_t isUPPERCASE(const wchar_t* str)
     }
     return ok;
 }
+
+/**
+ * @brief Creates an anonymous temporary file
+ *
+ * The file is created in the same directory as another file (usually
+ * the output of the tool), as the default temporary directory might
+ * not have room for big intermediate files. It is removed from the
+ * directory at once, and disappears when closed.
+ *
+ * @param filename name of a file in the directory to use
+ * @return the temporary file, open for reading and writing, or NULL
+ */
+FILE *temp_file_near(const char *filename)
+{
+    char *name = g_strdup_printf("%s.XXXXXX", filename);
+    FILE *fd = NULL;
+    int fdn;
+
+    fdn = mkstemp(name);
+    if (fdn >= 0) {
+        unlink(name);
+        fd = fdopen(fdn, "w+b");
+        if (!fd) close(fdn);
+    }
+    g_free(name);
+    return fd;
+}
@@ -97,6 +97,8 @@ wchar_t* capital_dup(const wchar_t *str);
 nat_boolean_t isCapital(const wchar_t* str);
 nat_boolean_t isUPPERCASE(const wchar_t* str);
 
+FILE*    temp_file_near(const char *filename);
+
 /**
  * @mainpage NATools Documentation
  *
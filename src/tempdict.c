@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <EXTERN.h>
 #include <perl.h>
 #include "matrix.h"
@@ -132,137 +133,143 @@ int tempdict_dirtyputvalue2(struct cMat2 *Matrix, float f, nat_uint32_t r, nat_u
     }
 }
 
-static void tempdict_markdoubleitems(struct cMat2 *Matrix)
+/**
+ * @brief Number of items used by the cell starting at item i
+ *
+ * Values too big for a single item take two consecutive items of the
+ * same cell (see tempdict_dirtyputvalue2).
+ */
+static long tempdict_cellsize(struct cMat2 *Matrix, long i)
 {
-    long i;
-    struct cItem *I;
-    I = Matrix->items;
-    i = 0;
-    while (i < Matrix->p - 1) {
-	if (I[i].row == I[i+1].row && I[i].column == I[i+1].column)
-	    I[i].nextC = I+i+1;
-	else
-	    I[i].nextC = NULL;
-	i++;
-    }
+    struct cItem *I = Matrix->items;
+    if (i + 1 < Matrix->p && I[i].row == I[i+1].row && I[i].column == I[i+1].column)
+	return 2;
+    return 1;
 }
 
-
-static void tempdict_swapitems(struct cMat2 *Matrix, long i, long j)
+/**
+ * @brief Compares the cells starting at items i and j
+ *
+ * @return negative, zero or positive, as the cell i comes before, is
+ * the same or comes after cell j, by (row, column)
+ */
+static int tempdict_cellcmp(struct cMat2 *Matrix, long i, long j)
 {
-    long l;
-    struct cItem dummy, *I;
-    I = Matrix->items;
-    if (i>j) { l=i; i=j; j=l; }
-    dummy = I[i];
-    I[i] = I[j];
-    I[j] = dummy;
-    if (i < Matrix->p -1 && I[i].nextC == I+i+1) {
-	if (j < Matrix->p -1 && I[j].nextC == I+j+1) {
-	    dummy = I[i+1];
-	    I[i+1] = I[j+1];
-	    I[j+1] = dummy;
-	}
-	else {
-	    dummy = I[i+1];
-	    memmove(I+i+1, I+i+2, (j-i-1) * sizeof(struct cItem));
-	    I[j] = dummy;
-	}
-    }
-    else {
-	if (j < Matrix->p -1 && I[j].nextC == I+j+1) {
-	    dummy = I[j+1];
-	    memmove(I+i+2, I+i+1, (j-i) * sizeof(struct cItem));
-	    I[i+1] = dummy;
-	}
-    }  
+    struct cItem *I = Matrix->items;
+    if (I[i].row != I[j].row) return I[i].row < I[j].row ? -1 : 1;
+    if (I[i].column != I[j].column) return I[i].column < I[j].column ? -1 : 1;
+    return 0;
 }
 
-static void tempdict_removeitem(struct cMat2 *Matrix, long i)
+/**
+ * @brief Stable counting sort of cells (given by their first item)
+ * by row or by column
+ */
+static void tempdict_countingsort(struct cMat2 *Matrix, long *from, long *to,
+				  long n, nat_boolean_t byrow)
 {
-    struct cItem *I;
-    I = Matrix->items;
-    if (I[i].nextC == I+i+1) 
-	memmove(I+i, I+i+2, (Matrix->p -i -2) * sizeof(struct cItem));
-    else
-	memmove(I+i, I+i+1, (Matrix->p -i -1) * sizeof(struct cItem));
+    nat_uint32_t range = byrow ? Matrix->Nrows : Matrix->Ncolumns;
+    nat_uint32_t key;
+    long i, *count;
+
+    count = g_new0(long, range + 2);
+    for (i = 0; i < n; i++) {
+	key = byrow ? Matrix->items[from[i]].row : Matrix->items[from[i]].column;
+	count[key + 1]++;
+    }
+    for (key = 1; key <= range + 1; key++)
+	count[key] += count[key - 1];
+    for (i = 0; i < n; i++) {
+	key = byrow ? Matrix->items[from[i]].row : Matrix->items[from[i]].column;
+	to[count[key]++] = from[i];
+    }
+    g_free(count);
 }
 
-static void tempdict_bubblesortitems(struct cMat2 *Matrix)
+/**
+ * @brief Sorts the items by (row, column)
+ *
+ * Cells are sorted with two stable counting sort passes (by column,
+ * then by row), keeping the items of big values together. When a
+ * cell was given more than once (not in consecutive puts, that look
+ * like the two items of a big value), its last value is kept. Items
+ * already in order, as put by nat-mat2dic, are not moved.
+ *
+ * @return 0 on success
+ */
+static int tempdict_sortitems(struct cMat2 *Matrix)
 {
-    long i, j;
-    int done;
-    struct cItem *I;
-    I = Matrix->items;
-    i = 0;
-    done = 1;
-    do {
-	while (i < Matrix->p -1) {
-	    j = i+1;
-	    if (i < Matrix->p -2 && I[i].nextC == I+i+1) j++;
-	    if (I[i].row > I[j].row) {
-		tempdict_swapitems(Matrix, j, i);
-		done = 0;
-	    } 
-	    else {
-		if (I[i].row == I[j].row && I[i].column > I[j].column) {
-		    tempdict_swapitems(Matrix, j, i);
-		    done = 0;      
-		}
-		else {
-		    if (I[i].row == I[j].row && I[i].column == I[j].column)
-			tempdict_removeitem(Matrix, i);
-		}
-	    }
-	    i = j; 
-	}
-    } while (!done);
+    struct cItem *sorted;
+    long i, k, n, prev, *cells, *tmp;
+
+    /* check if cells are already in order */
+    prev = -1;
+    for (i = 0; i < Matrix->p; i += tempdict_cellsize(Matrix, i)) {
+	if (prev >= 0 && tempdict_cellcmp(Matrix, prev, i) >= 0)
+	    break;
+	prev = i;
+    }
+    if (i >= Matrix->p) return 0;
+
+    n = 0;
+    for (i = 0; i < Matrix->p; i += tempdict_cellsize(Matrix, i))
+	n++;
+    cells = g_new(long, n);
+    tmp   = g_new(long, n);
+    for (n = 0, i = 0; i < Matrix->p; i += tempdict_cellsize(Matrix, i))
+	cells[n++] = i;
+
+    tempdict_countingsort(Matrix, cells, tmp, n, FALSE);
+    tempdict_countingsort(Matrix, tmp, cells, n, TRUE);
+
+    sorted = (struct cItem *) malloc((Matrix->memory + 1) * sizeof(struct cItem));
+    if (sorted == NULL) {
+	g_free(cells);
+	g_free(tmp);
+	return 1;
+    }
+    for (k = 0, i = 0; i < n; i++) {
+	if (i + 1 < n && tempdict_cellcmp(Matrix, cells[i], cells[i+1]) == 0)
+	    continue;
+	sorted[k++] = Matrix->items[cells[i]];
+	if (tempdict_cellsize(Matrix, cells[i]) == 2)
+	    sorted[k++] = Matrix->items[cells[i] + 1];
+    }
+    free(Matrix->items);
+    Matrix->items = sorted;
+    Matrix->p = k;
+
+    g_free(cells);
+    g_free(tmp);
+    return 0;
 }
 
-static void tempdict_setrowpointers(struct cMat2 *Matrix)
+/**
+ * @brief Sets the row and column pointers, in a single pass
+ *
+ * firstR points to the first item of each row. The items of each
+ * column are chained by nextC, in item order, starting at firstC.
+ * Items must be sorted.
+ */
+static void tempdict_setpointers(struct cMat2 *Matrix)
 {
+    struct cItem *I = Matrix->items;
     long l;
-    nat_uint32_t i;
-    l=0;
-    for (i=1; i<= Matrix->Nrows; i++) {
-	while (l < Matrix->p && Matrix->items[l].row < i) l++;
-	if (Matrix->items[l].row == i)
-	    Matrix->firstR[i-1] = Matrix->items + l;
-	else
-	    Matrix->firstR[i-1] = NULL;
-    }
-}  
 
-static void tempdict_setcolumnpointers(struct cMat2 *Matrix)
-{
-    long l;
-    nat_uint32_t i;
-    struct cItem *I;
-    for (i=1; i <= Matrix->Ncolumns; i++)
-	Matrix->firstC[i-1] = NULL;
-    l=0;
-    while (l < Matrix->p) {
-	Matrix->items[l].nextC = NULL;
-	I = Matrix->firstC[Matrix->items[l].column - 1];
-	if (I == NULL) { 
-	    Matrix->firstC[Matrix->items[l].column - 1] = Matrix->items + l;
-	}
-	else {
-	    while (I->nextC != NULL) 
-		I = I->nextC;
-	    I->nextC = Matrix->items + l;
-	}
-	l++;
-    } 
+    memset(Matrix->firstR, 0, Matrix->Nrows * sizeof(struct cItem *));
+    memset(Matrix->firstC, 0, Matrix->Ncolumns * sizeof(struct cItem *));
+    for (l = Matrix->p - 1; l >= 0; l--) {
+	I[l].nextC = Matrix->firstC[I[l].column - 1];
+	Matrix->firstC[I[l].column - 1] = I + l;
+	Matrix->firstR[I[l].row - 1] = I + l;
+    }
 }
 
 static int tempdict_cleanmatrix2(struct cMat2 *Matrix)
 {
     if (Matrix->p <= 0) return 1;
-    tempdict_markdoubleitems(Matrix);
-    tempdict_bubblesortitems(Matrix);
-    tempdict_setrowpointers(Matrix);
-    tempdict_setcolumnpointers(Matrix);
+    if (tempdict_sortitems(Matrix)) return 1;
+    tempdict_setpointers(Matrix);
     Matrix->clean = 1;
     Matrix->items[Matrix->p].row = 0;  /* voor GetValue */ 
     return 0;
@@ -409,6 +416,227 @@ float tempdict_getcolumnmax2(struct cMat2 *Matrix, nat_uint32_t c, nat_uint32_t
     return total;
 }
 
+/**
+ * @brief Entry of the bounded heaps used by tempdict_topk
+ */
+typedef struct cTopEntry {
+    /** translation value */
+    float        value;
+    /** translation identifier */
+    nat_uint32_t id;
+} TopEntry;
+
+/**
+ * @brief Work of a tempdict_topk thread: rows [r0, r1) and columns
+ * [c0, c1)
+ */
+typedef struct cTopWorker {
+    /** the thread running this worker */
+    pthread_t      thread;
+    /** the temporary dictionary */
+    struct cMat2  *Matrix;
+    /** results */
+    TempDictTop   *rows, *columns;
+    /** words of this worker */
+    nat_uint32_t   r0, r1, c0, c1;
+} TopWorker;
+
+/*
+ * a is a worse translation than b: smaller value or, for the same
+ * value, found later (the order kept by tempdict_getrowmax2)
+ */
+#define TOP_WORSE(a, b) ((a).value < (b).value || ((a).value == (b).value && (a).id > (b).id))
+
+static void tempdict_topsift(TopEntry *heap, nat_uint32_t n, nat_uint32_t i)
+{
+    nat_uint32_t w, l;
+    TopEntry e = heap[i];
+
+    while ((l = 2 * i + 1) < n) {
+	w = l;
+	if (l + 1 < n && TOP_WORSE(heap[l + 1], heap[l])) w = l + 1;
+	if (!TOP_WORSE(heap[w], e)) break;
+	heap[i] = heap[w];
+	i = w;
+    }
+    heap[i] = e;
+}
+
+/**
+ * @brief Adds a translation to a heap keeping the k best ones, with
+ * the worst one on top
+ */
+static void tempdict_toppush(TopEntry *heap, nat_uint32_t *n, nat_uint32_t k,
+			     float value, nat_uint32_t id)
+{
+    nat_uint32_t i, parent;
+    TopEntry e;
+
+    e.value = value;
+    e.id = id;
+    if (*n < k) {
+	i = (*n)++;
+	while (i > 0) {
+	    parent = (i - 1) / 2;
+	    if (!TOP_WORSE(e, heap[parent])) break;
+	    heap[i] = heap[parent];
+	    i = parent;
+	}
+	heap[i] = e;
+    } else if (value > heap[0].value) {
+	heap[0] = e;
+	tempdict_topsift(heap, k, 0);
+    }
+}
+
+/**
+ * @brief Stores the translations of a heap for word w, best first
+ */
+static void tempdict_topstore(TempDictTop *top, nat_uint32_t w,
+			      TopEntry *heap, nat_uint32_t n, float total)
+{
+    nat_uint32_t *ids = top->ids + (size_t) w * top->k;
+    float *vals = top->vals + (size_t) w * top->k;
+
+    while (n > 0) {
+	n--;
+	ids[n] = heap[0].id;
+	vals[n] = heap[0].value;
+	heap[0] = heap[n];
+	tempdict_topsift(heap, n, 0);
+    }
+    top->totals[w] = total;
+}
+
+static void *tempdict_topworker(void *data)
+{
+    TopWorker *w = (TopWorker*)data;
+    struct cMat2 *Matrix = w->Matrix;
+    nat_uint32_t k = w->rows->k, n, r, c, i;
+    TopEntry *heap = g_new(TopEntry, k);
+    struct cItem *p;
+    float fm, total;
+
+    for (r = w->r0; r < w->r1; r++) {
+	n = 0;
+	total = 0.0f;
+	p = Matrix->firstR[r-1];
+	for (i = 0; p != NULL && p[i].row == r; i++) {
+	    fm = (float) (p[i].value) / (float) MAXDEC;
+	    if (p[i+1].row == r  && p[i].column == p[i+1].column) {
+		fm += (float) (p[i+1].value) * MAXVAL;
+		i++;
+	    }
+	    total += fm;
+	    tempdict_toppush(heap, &n, k, fm, p[i].column);
+	}
+	tempdict_topstore(w->rows, r, heap, n, total);
+    }
+
+    for (c = w->c0; c < w->c1; c++) {
+	n = 0;
+	total = 0.0f;
+	for (p = Matrix->firstC[c-1]; p != NULL; p = p->nextC) {
+	    fm = (float) (p[0].value) / (float) MAXDEC;
+	    if (p[1].column == c  && p[0].row == p[1].row) {
+		fm += (float) (p[1].value) * MAXVAL;
+		p++;
+	    }
+	    total += fm;
+	    tempdict_toppush(heap, &n, k, fm, p[0].row);
+	}
+	tempdict_topstore(w->columns, c, heap, n, total);
+    }
+
+    g_free(heap);
+    return NULL;
+}
+
+static void tempdict_newtop(TempDictTop *top, nat_uint32_t n, nat_uint32_t k)
+{
+    top->k      = k;
+    top->n      = n;
+    top->ids    = g_new0(nat_uint32_t, (size_t) (n + 1) * k);
+    top->vals   = g_new0(float, (size_t) (n + 1) * k);
+    top->totals = g_new0(float, n + 1);
+}
+
+/**
+ * @brief Finds the k best translations of every row and every column
+ *
+ * Gives the same translations, in the same order, and the same totals
+ * as tempdict_getrowmax2 and tempdict_getcolumnmax2, with a single
+ * pass over each row and column, keeping the best translations in
+ * bounded heaps. Rows are split among the threads by number of cells,
+ * columns by number.
+ *
+ * @param Matrix the temporary dictionary
+ * @param k number of translations per word
+ * @param nthreads number of threads to use
+ * @param rows where to place the translations of each row
+ * @param columns where to place the translations of each column
+ *
+ * @return 0 on success
+ */
+int tempdict_topk(struct cMat2 *Matrix, nat_uint32_t k, int nthreads,
+		  TempDictTop *rows, TempDictTop *columns)
+{
+    TopWorker *workers;
+    nat_uint32_t from;
+    int t, started, error = 0;
+
+    if (k < 1 || nthreads < 1) return 1;
+
+    tempdict_newtop(rows, Matrix->Nrows, k);
+    tempdict_newtop(columns, Matrix->Ncolumns, k);
+
+    /* an empty dictionary has no translations */
+    if (!Matrix->clean)
+	if (tempdict_cleanmatrix2(Matrix)) return 0;
+
+    workers = g_new0(TopWorker, nthreads);
+    for (t = 0; t < nthreads; t++) {
+	workers[t].Matrix  = Matrix;
+	workers[t].rows    = rows;
+	workers[t].columns = columns;
+
+	from = t ? Matrix->items[(long) ((double) Matrix->p * t / nthreads)].row : 1;
+	workers[t].r0 = t ? max(from, workers[t-1].r0) : 1;
+	if (t) workers[t-1].r1 = workers[t].r0;
+	workers[t].r1 = Matrix->Nrows + 1;
+
+	workers[t].c0 = 1 + (nat_uint32_t) ((double) Matrix->Ncolumns * t / nthreads);
+	workers[t].c1 = 1 + (nat_uint32_t) ((double) Matrix->Ncolumns * (t + 1) / nthreads);
+    }
+
+    if (nthreads == 1)
+	tempdict_topworker(workers);
+    else {
+	for (started = 0; started < nthreads; started++)
+	    if (pthread_create(&workers[started].thread, NULL, tempdict_topworker, workers + started)) {
+		error = 2;
+		break;
+	    }
+	/* on error, the threads already running still write to rows and columns */
+	for (t = 0; t < started; t++)
+	    pthread_join(workers[t].thread, NULL);
+    }
+
+    g_free(workers);
+    return error;
+}
+
+/**
+ * @brief Frees the translations found by tempdict_topk
+ */
+void tempdict_freetop(TempDictTop *top)
+{
+    g_free(top->ids);
+    g_free(top->vals);
+    g_free(top->totals);
+}
+
+
 /**
  * @brief Loads a cMat2 temporary matrix
  *
@@ -434,8 +662,7 @@ int tempdict_loadmatrix2(struct cMat2 *Matrix, const char *filename)
     if (Matrix->items == NULL || Matrix->firstR == NULL || Matrix->firstC == NULL) return 5;
     for(l=0; l<Matrix->memory; l++)
 	if (fread(&(Matrix->items[l].row), 3 * sizeof(nat_uint32_t), 1, fd) != 1) return 6;
-    tempdict_setrowpointers(Matrix);
-    tempdict_setcolumnpointers(Matrix);
+    tempdict_setpointers(Matrix);
     Matrix->clean = 1;
     Matrix->items[Matrix->p].row = 0;  /* voor GetValue */ 
     fclose(fd);
@@ -70,6 +70,26 @@ struct cMat2 {
     long          memory;      
 };
 
+/**
+ * @brief Best translations of each row (or column) of a temporary
+ * dictionary, as found by tempdict_topk
+ *
+ * Word w has k entries, starting at ids[w * k] and vals[w * k],
+ * sorted by decreasing value. Unused entries have a zero identifier.
+ */
+typedef struct cTempDictTop {
+    /** number of entries per word */
+    nat_uint32_t  k;
+    /** number of words */
+    nat_uint32_t  n;
+    /** translation identifiers, (n + 1) * k */
+    nat_uint32_t *ids;
+    /** translation values, (n + 1) * k */
+    float        *vals;
+    /** word totals, n + 1 */
+    float        *totals;
+} TempDictTop;
+
 int          tempdict_allocmatrix2(struct cMat2 *Matrix, nat_uint32_t Nrow, nat_uint32_t Ncolumn);
 void         tempdict_freematrix2(struct cMat2    *Matrix);
 int          tempdict_dirtyputvalue2(struct cMat2 *Matrix, float f,
@@ -80,5 +100,8 @@ float        tempdict_getcolumnmax2 (struct cMat2 *Matrix, nat_uint32_t c, nat_u
                                      float *f, nat_uint32_t max);
 int          tempdict_loadmatrix2(struct cMat2 *Matrix, const char *filename);
 int          tempdict_savematrix2(struct cMat2 *Matrix, const char *filename);
+int          tempdict_topk(struct cMat2 *Matrix, nat_uint32_t k, int nthreads,
+                           TempDictTop *rows, TempDictTop *columns);
+void         tempdict_freetop(TempDictTop *top);
 
 #endif
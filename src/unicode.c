@@ -20,7 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <wchar.h>
 
 #include <NATools.h>
@@ -155,50 +155,244 @@ unsigned short NextTextSentence(wchar_t **sen, wchar_t **text,
 }
 
 /**
- * @brief Reads all text from file to a text buffer
+ * @brief Finds where a chunk of whole sentences ends
+ *
+ * The chunk is cut after the first word starting with the soft
+ * delimiter found at least @c size characters after its beginning
+ * (and after the hard delimiter word that may follow it), exactly
+ * where NextTextSentence would end a sentence.
+ *
+ * @param chunk beginning of the chunk
+ * @param end end of the text available
+ * @param size minimum size of the chunk, in characters
+ * @param from position where the search for the delimiter starts
+ * @param final true if no more text will follow @c end
+ * @param cut where the chunk ends
+ * @param next beginning of the next chunk, or NULL if the text ends;
+ *        when more text is needed, where the search should resume
+ * @return true if the chunk end was found
+ */
+static nat_boolean_t ChunkEnd(wchar_t *chunk, wchar_t *end, size_t size,
+			      wchar_t *from, nat_boolean_t final,
+			      wchar_t sd, wchar_t hd,
+			      wchar_t **cut, wchar_t **next)
+{
+    wchar_t *ptr;
+
+    if ((size_t)(end - chunk) <= size) {
+	*cut  = end;
+	*next = final ? NULL : from;
+	return final;
+    }
+
+    /* any word starting with the soft delimiter ends a sentence */
+    ptr = from;
+    while (ptr < end && !(*ptr == sd && !InWord(ptr[-1]))) ptr++;
+    *next = ptr;
+    while (ptr < end && InWord(*ptr)) ptr++;
+    if (ptr == end) {
+	*cut = end;
+	if (final) *next = NULL;
+	return final;
+    }
+    *cut = ptr++;
+
+    /* skip a hard delimiter following the soft one */
+    while (ptr < end && !InWord(*ptr)) ptr++;
+    if (ptr < end && *ptr == hd)
+	while (ptr < end && InWord(*ptr)) ptr++;
+    if (ptr == end && !final) return FALSE;
+
+    *next = ptr < end ? ptr : NULL;
+    return TRUE;
+}
+
+/**
+ * @brief Decodes UTF-8 text
+ *
+ * Invalid sequences are replaced by U+FFFD, one byte at a time.
+ *
+ * @param bytes the UTF-8 bytes
+ * @param n number of bytes
+ * @param out where to write the characters (room for @c n of them)
+ * @param final true if an incomplete sequence at the end is invalid,
+ *        false if it is left to be decoded with the next bytes
+ * @param used number of bytes decoded
+ * @return number of characters decoded
+ */
+static size_t DecodeUTF8(const unsigned char *bytes, size_t n, wchar_t *out,
+			 nat_boolean_t final, size_t *used)
+{
+    static const wchar_t minimum[] = { 0, 0, 0x80, 0x800, 0x10000 };
+    size_t i = 0, o = 0, len, j;
+    wchar_t ch;
+
+    while (i < n) {
+	if (bytes[i] < 0x80) {
+	    out[o++] = bytes[i++];
+	    continue;
+	}
+
+	if      (bytes[i] >= 0xC2 && bytes[i] <= 0xDF) { len = 2; ch = bytes[i] & 0x1F; }
+	else if (bytes[i] >= 0xE0 && bytes[i] <= 0xEF) { len = 3; ch = bytes[i] & 0x0F; }
+	else if (bytes[i] >= 0xF0 && bytes[i] <= 0xF4) { len = 4; ch = bytes[i] & 0x07; }
+	else len = 0;
+
+	if (len && i + len > n && !final) {
+	    for (j = i + 1; j < n && (bytes[j] & 0xC0) == 0x80; j++)
+		;
+	    if (j == n) break;
+	}
+
+	for (j = 1; len && j < len; j++) {
+	    if (i + j >= n || (bytes[i + j] & 0xC0) != 0x80) len = 0;
+	    else ch = (ch << 6) | (bytes[i + j] & 0x3F);
+	}
+	if (len && (ch < minimum[len] || ch > 0x10FFFF ||
+		    (ch >= 0xD800 && ch <= 0xDFFF)))
+	    len = 0;
+
+	if (len) {
+	    out[o++] = ch;
+	    i += len;
+	} else {
+	    out[o++] = 0xFFFD;
+	    i++;
+	}
+    }
+
+    *used = i;
+    return o;
+}
+
+/**
+ * @brief Reads and decodes one more block of the text file
+ *
+ * @return the number of characters added to the reader text
+ */
+static size_t TextReaderFill(TextReader *reader)
+{
+    size_t got, used, added;
+
+    got = fread(reader->bytes + reader->nbytes, 1,
+		TEXT_READER_BLOCK - reader->nbytes, reader->fd);
+    if (got == 0) {
+	if (ferror(reader->fd))
+	    fprintf(stderr, "failed reading file\n");
+	reader->eof = TRUE;
+    }
+    reader->nbytes += got;
+
+    if (reader->length + reader->nbytes + 1 > reader->size) {
+	reader->size = 2 * (reader->length + reader->nbytes + 1);
+	reader->text = g_renew(wchar_t, reader->text, reader->size);
+    }
+
+    added = DecodeUTF8(reader->bytes, reader->nbytes, reader->text + reader->length,
+		       reader->eof, &used);
+    reader->length += added;
+    reader->nbytes -= used;
+    memmove(reader->bytes, reader->bytes + used, reader->nbytes);
+
+    return added;
+}
+
+/**
+ * @brief Opens a UTF-8 text file to be read in chunks
  *
  * @param filename Filename of the text file to be read
- * @return A big null-terminated buffer with the text file
+ * @return the reader, or NULL if the file can't be opened
  */
-wchar_t *ReadText(const char *filename)
+TextReader *TextReaderOpen(const char *filename)
 {
+    TextReader *reader;
     FILE *fd;
-    long len;
-    struct stat stat_buf;
-    wchar_t *result;
-    wchar_t *pos;
-    
+
     fd = fopen(filename, "r");
     if (fd == NULL) {
         fprintf(stderr, "failed opening file\n");
         return NULL;
     }
-    if (fstat(fileno(fd), &stat_buf) == -1) {
-        fprintf(stderr, "failed stating file\n");
-        return NULL;
-    }
 
-    len = stat_buf.st_size;
-    result = (wchar_t*)malloc(sizeof(wchar_t) * (len+1));
-    pos = result;
-    if (result == NULL) {
-        fprintf(stderr, "could not allocate buffer\n");
-        return NULL;
+    reader = g_new(TextReader, 1);
+    reader->fd     = fd;
+    reader->bytes  = g_new(unsigned char, TEXT_READER_BLOCK);
+    reader->nbytes = 0;
+    reader->size   = TEXT_READER_BLOCK + 1;
+    reader->text   = g_new(wchar_t, reader->size);
+    reader->length = 0;
+    reader->eof    = FALSE;
+    reader->done   = FALSE;
+
+    return reader;
+}
+
+/**
+ * @brief Reads the next chunk of whole sentences of a text
+ *
+ * The chunk has at least @c size characters (unless the text ends),
+ * and ends where NextTextSentence would end a sentence, so each
+ * chunk can be tokenized independently of the others.  Only the
+ * chunk and the text read after it are kept in memory.  The reader
+ * @c done field is set when the last chunk is returned; a text
+ * without words still gives one (empty) chunk.
+ *
+ * @param reader the text reader
+ * @param buffer pointer to the buffer where the null terminated chunk
+ *        is copied (reallocated if too small, may start as NULL)
+ * @param buffersize pointer to the size of the buffer, in characters
+ * @param size minimum size of the chunk, in characters
+ * @param sd SoftDelimiter
+ * @param hd HardDelimiter
+ * @return the chunk (@c *buffer), or NULL if the text ended
+ */
+wchar_t *TextReaderChunk(TextReader *reader, wchar_t **buffer, size_t *buffersize,
+			 size_t size, wchar_t sd, wchar_t hd)
+{
+    wchar_t *cut, *next;
+    size_t from = size > 0 ? size : 1;
+    size_t len;
+
+    if (reader->done) return NULL;
+
+    while (!ChunkEnd(reader->text, reader->text + reader->length, size,
+		     reader->text + from, reader->eof, sd, hd, &cut, &next)) {
+	from = next - reader->text;
+	TextReaderFill(reader);
     }
 
-    while (!feof(fd)) {
-        wchar_t c = fgetwc(fd);
-        if (!feof(fd)) *pos = c;
-        pos++;
+    len = cut - reader->text;
+    if (len + 1 > *buffersize) {
+	*buffersize = len + 1;
+	*buffer = g_renew(wchar_t, *buffer, *buffersize);
     }
+    wmemcpy(*buffer, reader->text, len);
+    (*buffer)[len] = L'\0';
 
-    if (fclose(fd)) {
-        fprintf(stderr, "problem closing filehandle\n");
-        return NULL;
+    if (next == NULL) {
+	reader->done = TRUE;
+	reader->length = 0;
+    } else {
+	reader->length -= next - reader->text;
+	wmemmove(reader->text, next, reader->length);
     }
-    *pos = '\0';
 
-    return result;
+    return *buffer;
+}
+
+/**
+ * @brief Closes a text reader
+ *
+ * @param reader the text reader
+ */
+void TextReaderClose(TextReader *reader)
+{
+    if (reader) {
+	fclose(reader->fd);
+	g_free(reader->bytes);
+	g_free(reader->text);
+	g_free(reader);
+    }
 }
 
 /* Nat_string */
@@ -21,6 +21,8 @@
 #ifndef __UNICODE_H__
 #define __UNICODE_H__ 1
 
+#include <stdio.h>
+
 /**
  * @file
  * @brief Header file for unicode-aware methods
@@ -43,9 +45,38 @@ nat_string_t*  nat_string_new();
 nat_string_t*  nat_string_append(nat_string_t *str, const wchar_t *format, ...);
 void           nat_string_free(nat_string_t *str);
 
-//
+/* ------ Text files ------- */
+
+/** @brief number of bytes read from the text file at a time */
+#define TEXT_READER_BLOCK 65536
+
+/**
+ * @brief A UTF-8 text file being read in chunks of whole sentences
+ */
+typedef struct cTextReader {
+    /** the text file */
+    FILE          *fd;
+    /** bytes read and not yet decoded (an incomplete sequence) */
+    unsigned char *bytes;
+    /** number of bytes on the bytes buffer */
+    size_t         nbytes;
+    /** text decoded and not yet returned in a chunk */
+    wchar_t       *text;
+    /** number of characters on the text buffer */
+    size_t         length;
+    /** allocated size of the text buffer */
+    size_t         size;
+    /** true when the whole file was read */
+    nat_boolean_t  eof;
+    /** true when the last chunk was returned */
+    nat_boolean_t  done;
+} TextReader;
+
+TextReader*    TextReaderOpen(const char *filename);
+wchar_t*       TextReaderChunk(TextReader *reader, wchar_t **buffer, size_t *buffersize,
+                               size_t size, wchar_t sd, wchar_t hd);
+void           TextReaderClose(TextReader *reader);
 
-wchar_t*       ReadText(const char *filename);
 unsigned short NextTextSentence(wchar_t **sen, wchar_t **text,
                                 unsigned short maxLen,
                                 wchar_t sd, wchar_t hd);
@@ -37,16 +37,117 @@
  * @brief Auxiliary data structure functions to collect words
  */
 
-static int strcmpx(const wchar_t *s1,const wchar_t *s2)
+/**
+ * @brief Allocates memory from the arena of a word list
+ *
+ * The memory lives until the word list is freed.
+ */
+static void *words_alloc(Words *list, size_t bytes)
+{
+    WordsBlock *block = list->blocks;
+    void *ptr;
+
+    bytes = (bytes + 7) & ~(size_t) 7;
+    if (!block || block->used + bytes > block->size) {
+	size_t size = bytes > WORDS_BLOCK ? bytes : WORDS_BLOCK;
+	block = g_malloc(sizeof(WordsBlock) + size);
+	block->next = list->blocks;
+	block->used = 0;
+	block->size = size;
+	list->blocks = block;
+    }
+    ptr = (char*) (block + 1) + block->used;
+    block->used += bytes;
+    return ptr;
+}
+
+/**
+ * @brief Makes room in the idx array for an identifier
+ */
+static void words_grow_idx(Words *list, nat_uint32_t id)
+{
+    nat_uint32_t size = list->idxsize;
+
+    if (id < size) return;
+    while (size <= id) size *= 2;
+    list->idx = g_renew(WordLstNode*, list->idx, size);
+    memset(list->idx + list->idxsize, 0, sizeof(WordLstNode*) * (size - list->idxsize));
+    list->idxsize = size;
+}
+
+/**
+ * @brief Hash of a word (FNV-1a over its characters)
+ */
+static nat_uint32_t words_hash(const wchar_t *string)
+{
+    nat_uint32_t h = 2166136261u;
+    while (*string) {
+	h ^= (nat_uint32_t) *string++;
+	h *= 16777619u;
+    }
+    return h;
+}
+
+/**
+ * @brief Finds the hash table slot of a word
+ *
+ * @return the slot holding the word identifier, or the empty slot
+ * where it should be stored
+ */
+static nat_uint32_t *words_slot(Words *list, const wchar_t *string)
+{
+    nat_uint32_t mask = list->hashsize - 1;
+    nat_uint32_t h = words_hash(string) & mask;
+
+    while (list->hash[h] && wcscmp(list->idx[list->hash[h]]->string, string))
+	h = (h + 1) & mask;
+    return list->hash + h;
+}
+
+/**
+ * @brief Keeps the hash table at most half full, for one more word
+ */
+static void words_reserve(Words *list)
+{
+    nat_uint32_t id;
+
+    if (2 * (list->count + 1) <= list->hashsize) return;
+
+    g_free(list->hash);
+    while (2 * (list->count + 1) > list->hashsize) list->hashsize *= 2;
+    list->hash = g_new0(nat_uint32_t, list->hashsize);
+    for (id = 2; id < list->idxsize; id++)
+	if (list->idx[id])
+	    *words_slot(list, list->idx[id]->string) = id;
+}
+
+/**
+ * @brief Creates the cell of a word
+ *
+ * @param list the word list object
+ * @param id the word identifier
+ * @param count the word occurrence count
+ * @param string the word
+ * @param copy true to copy the string to the arena
+ * @return the new cell
+ */
+static WordLstNode *words_cell(Words *list, nat_uint32_t id, nat_uint32_t count,
+			       wchar_t *string, nat_boolean_t copy)
 {
-    int result;
-    do
-        result = (*s1++) - (*s2++);
-    while (!result && *s1 && *s2);
-    if (*(s1-1) == L'*' || *(s2-1) == L'*') result = 0;
-    if (!result && *s1) return 1;
-    if (!result && *s2) return -1;
-    else return result;
+    WordLstNode *cell = words_alloc(list, sizeof(WordLstNode));
+
+    if (copy) {
+	size_t len = wcslen(string) + 1;
+	cell->string = words_alloc(list, sizeof(wchar_t) * len);
+	wmemcpy(cell->string, string, len);
+    } else
+	cell->string = string;
+    cell->id = id;
+    cell->count = count;
+
+    words_grow_idx(list, id);
+    list->idx[id] = cell;
+    return cell;
 }
 
 /**
@@ -56,71 +157,52 @@ static int strcmpx(const wchar_t *s1,const wchar_t *s2)
  */
 Words* words_new()
 {
+    static wchar_t none[] = L"(none)";
     Words *ws = g_new( Words, 1 );
     ws->count = 1; 		/* FIRST IS THE NULL */
     ws->occurrences = 0;
-    ws->tree = NULL;
-    ws->idx = NULL;
+    ws->idxsize = 1024;
+    ws->idx = g_new0(WordLstNode*, ws->idxsize);
+    ws->hashsize = 1024;
+    ws->hash = g_new0(nat_uint32_t, ws->hashsize);
+    ws->blocks = NULL;
+    ws->file = NULL;
+    ws->filesize = 0;
+
+    words_cell(ws, 1, 0, none, FALSE);
     return ws;
 }
 
+/**
+ * @brief Size of a word record in a lexicon file: identifier,
+ * count, length (with the null character) and the word
+ */
+#define RECORD_SIZE(len) (2 * sizeof(nat_uint32_t) + sizeof(int) + sizeof(wchar_t) * (len))
 
-static WordLstNode* words_add_word_(WordLstNode* list, wchar_t *string, nat_uint32_t* rn)
+/**
+ * @brief Goes to the next word record of a loaded lexicon file
+ *
+ * @param list the loaded lexicon
+ * @param p the current record, or NULL to get the first one
+ * @return the next record, or NULL at the end of the file (or of its
+ *   valid records)
+ */
+static char *words_next_record(Words *list, char *p)
 {
-    int cmp;
-    if (!list) {
-        WordLstNode *cell = g_new(WordLstNode, 1);
-        if (!cell) { *rn = 0; return list; }
-
-        cell->string = string;
-        cell->count = 1;        /* I would put 1... but original uses 2 */
-        cell->left = NULL;
-        cell->right = NULL;
-        cell->id = *rn;
-        return cell;
-    } else {
-        cmp = strcmpx(string, list->string);
-        if (cmp < 0) {
-            list->left = words_add_word_(list->left, string, rn);
-        } else if (cmp > 0) {
-            list->right = words_add_word_(list->right, string, rn);
-        } else {
-            *rn = list->id;
-            list->count++;
-        }
-	return list;
-    }
-}
-
-
+    char *end = list->file + list->filesize;
+    int len;
 
-static WordLstNode* words_add_word_and_index_(Words *w, WordLstNode* list,
-                                              wchar_t *string, nat_uint32_t* rn)
-{
-    int cmp;
-    if (!list) {
-        WordLstNode *cell = g_new(WordLstNode, 1);
-        if (!cell) { *rn = 0; return list; }
-
-        cell->string = string;
-        cell->count = 1;        /* I would put 1... but original uses 2 */
-        cell->left = NULL;
-        cell->right = NULL;
-        cell->id = *rn;
-	w->idx[cell->id] = cell;
-        return cell;
-    } else {
-        cmp = strcmpx(string, list->string);
-        if (cmp < 0) {
-            list->left = words_add_word_(list->left, string, rn);
-        } else if (cmp > 0) {
-            list->right = words_add_word_(list->right, string, rn);
-        } else {
-            *rn = list->id;
-            list->count++;
-        }
-	return list;
-    }
+    if (!p)
+	p = list->file + 2 * sizeof(nat_uint32_t);
+    else
+	p += RECORD_SIZE(((int*)p)[2]);
+
+    if (p + RECORD_SIZE(0) > end) return NULL;
+    len = ((int*)p)[2];
+    if (len < 1 || (size_t) len > (size_t) (end - p) / sizeof(wchar_t) ||
+	p + RECORD_SIZE(len) > end)
+	return NULL;
+    return p;
 }
 
 /**
@@ -129,7 +211,7 @@ static WordLstNode* words_add_word_and_index_(Words *w, WordLstNode* list,
  * This function takes a word list object and a word. If the word does
  * not exist, a new cell is created and the new identifier
  * returned. If it already exists, the respective identifier is
- * returned.
+ * returned. New words are copied, so the string can be reused.
  *
  * @param list the word list object
  * @param string the word being added
@@ -137,27 +219,34 @@ static WordLstNode* words_add_word_and_index_(Words *w, WordLstNode* list,
  */
 nat_uint32_t words_add_word(Words* list, wchar_t *string)
 {
-    nat_uint32_t register_number = list->count + 1;
-    
-    list->tree = words_add_word_(list->tree, string, &register_number);
-    if (register_number == list->count+1) list->count++;
+    nat_uint32_t *slot;
+
+    words_reserve(list);
+    slot = words_slot(list, string);
+    if (*slot)
+	list->idx[*slot]->count++;
+    else {
+	*slot = ++list->count;
+	words_cell(list, list->count, 1, string, TRUE);
+    }
     list->occurrences++;
 
-    return register_number;
+    return *slot;
 }
 
 /**
- * @brief FIXME
+ * @brief Adds a word to the word list object
+ *
+ * The same as words_add_word: words are always reachable by
+ * identifier.
+ *
+ * @param list the word list object
+ * @param string the word being added
+ * @return the identifier for that word
  */
 nat_uint32_t words_add_word_and_index(Words* list, wchar_t *string)
 {
-    nat_uint32_t register_number = list->count + 1;
-    
-    list->tree = words_add_word_and_index_(list, list->tree, string, &register_number);
-    if (register_number == list->count+1) list->count++;
-    list->occurrences++;
-
-    return register_number;
+    return words_add_word(list, string);
 }
 
 
@@ -195,38 +284,32 @@ nat_uint32_t words_occurrences(Words* list)
 }
 
 /**
- * @brief FIXME
+ * @brief Makes room for more words in the idx array
+ *
+ * Not needed to add words, as the array grows when needed, but avoids
+ * growing it several times.
  */
 Words* words_enlarge(Words* list, nat_uint32_t extracells)
 {
-    list->idx = g_realloc(list->idx, (extracells + list->count) * sizeof(WordLstNode*));
+    words_grow_idx(list, list->count + extracells);
     return list;
 }
 
-static void word_save_(WordLstNode* tree, FILE *fd)
-{
-    if (tree) {
-        int len;
-        fwrite(&tree->id, sizeof(tree->id), 1, fd);
-        fwrite(&tree->count, sizeof(tree->count), 1, fd);
-        len = wcslen(tree->string)+1;
-        fwrite(&len, sizeof(int), 1, fd);
-        fwrite(tree->string, sizeof(wchar_t) * len, 1, fd);
-        word_save_(tree->left, fd);
-        word_save_(tree->right, fd);
-    }
-}
-
 /**
  * @brief Saves a wordlist on a file
  *
+ * Words are saved by identifier order.
+ *
  * @param list the word list object to be saved
  * @param filename a string with the name of the file being created
  * @return true unless the save process failed. In this case, false is returned.
  */
 nat_boolean_t words_save(Words* list, char* filename)
 {
+    WordLstNode *cell;
+    nat_uint32_t id;
     FILE *fd;
+    int len;
 
     fd = fopen(filename, "w");
     if (fd == NULL)
@@ -234,137 +317,127 @@ nat_boolean_t words_save(Words* list, char* filename)
     else {
         fwrite(&list->count,       sizeof(nat_uint32_t), 1, fd);
         fwrite(&list->occurrences, sizeof(nat_uint32_t), 1, fd);
-        word_save_(list->tree, fd);
+        for (id = 2; id < list->idxsize; id++) {
+            cell = list->idx[id];
+            if (!cell) continue;
+            fwrite(&cell->id, sizeof(cell->id), 1, fd);
+            fwrite(&cell->count, sizeof(cell->count), 1, fd);
+            len = wcslen(cell->string)+1;
+            fwrite(&len, sizeof(int), 1, fd);
+            fwrite(cell->string, sizeof(wchar_t) * len, 1, fd);
+        }
     }
     fclose(fd);
     return TRUE;
 }
 
-
-static WordLstNode* words_add_full_(Words *w, WordLstNode* tree, nat_uint32_t id,
-                                    nat_uint32_t count, wchar_t* string) {
-    int cmp;
-    if (!tree) {
-        WordLstNode *cell = g_new(WordLstNode, 1);
-        if (!cell) return tree;
-
-        if (w->idx) w->idx[id] = cell;
-
-        cell->string = string;
-        cell->count = count;
-        cell->left = NULL;
-        cell->right = NULL;
-        cell->id = id;
-        
-        return cell;
-
-    } else {
-        cmp = strcmpx(string, tree->string);
-
-        if (cmp < 0)
-            tree->left = words_add_full_(w, tree->left, id, count, string);
-        else if (cmp > 0)
-            tree->right = words_add_full_(w, tree->right, id, count, string);
-
-        return tree;
-    }
-}
-
 /** 
- * @brief Adds a word in the tree maintaining a direct access array
+ * @brief Adds a word with a known identifier and count
+ *
+ * Words with an identifier or string already in the list are not
+ * added (but are counted).
  *
  * @param list the word list object
  * @param id the identifier for that word
  * @param count the occurrence count for that word
  * @param string the word
- * @param ptr a pointer to the direct access array
  * @return the word list object
  */
 Words* words_add_full(Words* list, nat_uint32_t id,
                       nat_uint32_t count, const wchar_t* string)
 {
-    wchar_t *str = wcs_dup(string);
-    list->tree = words_add_full_(list, list->tree, id, count, str);
+    nat_uint32_t *slot;
+
+    words_reserve(list);
     list->count++;              /* we hope this is not called for two equal strings */
     list->occurrences+=count;
-    return list;
-}
-
-
-
-Words* words_real_load_(const char *filename, nat_boolean_t quick)
-{
-    FILE *fd;
-    nat_uint32_t count;
-    nat_uint32_t id, wc, tk;
-    wchar_t buffer[MAXWORDLEN+1];
-    Words *tree;    
 
-    fd = fopen(filename, "r");
-    
-    if (fd == NULL) return NULL;
-
-    if (!fread(&wc, sizeof(wc), 1, fd)) return NULL;
-    if (!fread(&tk, sizeof(tk), 1, fd)) return NULL;
-
-    tree = words_new();
-
-    if (!quick) {
-        if (tree->idx) g_free(tree->idx);
-        tree->idx = g_new0(WordLstNode*, wc+1);
-        if (!tree->idx) return NULL;
-    }
-
-    while(!feof(fd)) {
-        fread(&id, sizeof(id), 1, fd);
-        if (!feof(fd)) {
-            int len;
-            fread(&count, sizeof(count),         1, fd);
-            fread(&len,   sizeof(int),           1, fd);
-            fread(buffer, sizeof(wchar_t) * len, 1, fd);
-            words_add_full(tree, id, count, buffer);
-        }
-    }
-    fclose(fd);
-
-    if (!quick) {
-        WordLstNode *cell = g_new(WordLstNode, 1);
-        cell->string = wcs_dup(L"(none)"); 
-        tree->idx[1] = cell;       // FIXME: e o 0 ?
-    }
-    
-    return tree;
+    if (id < 2 || (id < list->idxsize && list->idx[id])) return list;
+    slot = words_slot(list, string);
+    if (*slot) return list;
+    *slot = id;
+    words_cell(list, id, count, (wchar_t*) string, TRUE);
+    return list;
 }
 
 
+/**
+ * @brief Loads a word list object
+ *
+ * The same as words_load.
+ *
+ * @param filename filename of the word-list object
+ * @return the loaded word-list object
+ */
 Words* words_quick_load(const char *filename) {
-    return words_real_load_(filename, 1);
+    return words_load(filename);
 }
 
 
 /**
  * @brief Loads a word list object
  *
- * This function simply loads the file and returns the word
- * tree.
+ * The file is read at once, and its words are used in place. More
+ * words can be added later.
  *
  * @param filename filename of the word-list object
  * @return the loaded word-list object
  */
 Words* words_load(const char *filename) {
-    return words_real_load_(filename, 0);
-}
+    nat_uint32_t wc, id, *slot;
+    Words *list;
+    wchar_t *string;
+    char *file, *p;
+    long size;
+    FILE *fd;
 
+    fd = fopen(filename, "r");
+    if (fd == NULL) return NULL;
 
-static void print_words_(WordLstNode *Words)
-{
-    if (Words) {
-        print_words_(Words->left);
-        printf(" '%ls'\n", Words->string);
-        print_words_(Words->right);
+    if (fseek(fd, 0, SEEK_END) || (size = ftell(fd)) < (long) (2 * sizeof(nat_uint32_t)) ||
+	fseek(fd, 0, SEEK_SET)) {
+	fclose(fd);
+	return NULL;
+    }
+    file = g_new(char, size);
+    if (fread(file, size, 1, fd) != 1) {
+	fclose(fd);
+	g_free(file);
+	return NULL;
+    }
+    fclose(fd);
+
+    wc = ((nat_uint32_t*)file)[0];
+    if (wc < 1) wc = 1;
+
+    list = words_new();
+    list->file = file;
+    list->filesize = size;
+    words_grow_idx(list, wc);
+    while (list->hashsize < 2 * (wc + 1)) list->hashsize <<= 1;
+    g_free(list->hash);
+    list->hash = g_new0(nat_uint32_t, list->hashsize);
+
+    for (p = words_next_record(list, NULL); p; p = words_next_record(list, p)) {
+	id = ((nat_uint32_t*)p)[0];
+	string = (wchar_t*)(p + RECORD_SIZE(0));
+	string[((int*)p)[2] - 1] = L'\0';
+
+	words_reserve(list);
+	list->count++;
+	list->occurrences += ((nat_uint32_t*)p)[1];
+	if (id < 2 || id > wc || list->idx[id]) continue;
+
+	slot = words_slot(list, string);
+	if (*slot) continue;      /* the first of equal words is kept */
+	*slot = id;
+	words_cell(list, id, ((nat_uint32_t*)p)[1], string, FALSE);
     }
+
+    return list;
 }
 
+
 /**
  * @brief prints the dictionary words to stdout
  *
@@ -376,32 +449,36 @@ static void print_words_(WordLstNode *Words)
  */
 void words_print(wchar_t* title, Words *lst)
 {
-    printf("== %ls ==\n", title);
-    print_words_(lst->tree);
-}
+    nat_uint32_t id;
 
-static void words_free_(WordLstNode *l) {
-    if (l) {
-        words_free_(l->left);
-        words_free_(l->right);
-        g_free(l);
-    }
+    printf("== %ls ==\n", title);
+    for (id = 2; id < lst->idxsize; id++)
+        if (lst->idx[id])
+            printf(" '%ls'\n", lst->idx[id]->string);
 }
 
 /**
  * @brief Frees the word list structure
  *
- * @param lst pointer to the tree to be freed.
+ * @param lst pointer to the word list to be freed.
  */
 void words_free(Words *lst)
 {
-    if (lst->idx) g_free(lst->idx);
-    words_free_(lst->tree);
+    WordsBlock *block;
+
+    while (lst->blocks) {
+        block = lst->blocks;
+        lst->blocks = block->next;
+        g_free(block);
+    }
+    g_free(lst->idx);
+    g_free(lst->hash);
+    g_free(lst->file);
     g_free(lst);
 }
 
 /**
- * @brief Returns the word in the tree given the word identifier
+ * @brief Returns the word in the list given the word identifier
  *
  * @param words obj
  * @param index word identifier (and index in the array of cells)
@@ -409,10 +486,8 @@ void words_free(Words *lst)
  */
 wchar_t* words_get_by_id(Words *words, nat_uint32_t index)
 {
-    WordLstNode *cell;
-    if (!words->idx) report_error("Words get by id called with NULL idx\n");
+    WordLstNode *cell = words_get_full_by_id(words, index);
 
-    cell = words->idx[index];
     if (cell)
         return cell->string;
     else
@@ -420,40 +495,32 @@ wchar_t* words_get_by_id(Words *words, nat_uint32_t index)
 }
 
 /**
- * @brief Returns the full word cell in the tree given the word identifier
+ * @brief Returns the full word cell given the word identifier
  *
- * @param ptr auxiliary array of cell indexes
+ * @param w the word list object
  * @param index word identifier (and index in the array of cells)
- * @return the cell of that word in the tree.
+ * @return the cell of that word.
  */
 WordLstNode *words_get_full_by_id(Words *w, nat_uint32_t index)
 {
-    WordLstNode *cell;
-
-    if (!w->idx) return NULL;
-
-    cell = w->idx[index];
-    if (cell)
-        return cell;
-    else
-        return NULL;
+    if (index >= w->idxsize) return NULL;
+    return w->idx[index];
 }
 
 /**
  * @brief Returns the number of occurrences from a word
  *
- * @param ptr auxiliary array of cell indexes
+ * @param w the word list object
  * @param wid word identifier (and index in the array of cells)
  * @return the occurrence number for that word.
  */
 nat_uint32_t words_get_count_by_id(Words *w, nat_uint32_t wid)
 {
     WordLstNode *cell;
-    /* FIXME: Check if wid is smaller to the size of the array */
 
     if (!w) return 0;
 
-    cell = w->idx[wid];
+    cell = words_get_full_by_id(w, wid);
     if (cell)
 	return cell->count;
     else
@@ -464,18 +531,14 @@ nat_uint32_t words_get_count_by_id(Words *w, nat_uint32_t wid)
  * @brief Sets the number of occurrences for a word
  *
  * @param list the word list
- * @param ptr auxiliary array of cell indexes
  * @param wid word identifier (and index in the array of cells)
  * @return 0 on error.
  */
 nat_int_t words_set_count_by_id(Words *list, nat_uint32_t wid, nat_uint32_t count)
 {
     WordLstNode *cell;
-    /* FIXME: Check if wid is smaller to the size of the array */
 
-    if (!list->idx) return 0;
-
-    cell = list->idx[wid];
+    cell = words_get_full_by_id(list, wid);
     if (cell) {
 	nat_uint32_t ocount = cell->count;
         cell->count = count;
@@ -485,21 +548,6 @@ nat_int_t words_set_count_by_id(Words *list, nat_uint32_t wid, nat_uint32_t coun
     return 1;
 }
 
-static nat_uint32_t get_id_(WordLstNode *tree, const wchar_t *string) {
-    if (tree) {
-        int cmp = strcmpx(string, tree->string);
-        if (cmp<0) {
-            return get_id_(tree->left, string);
-        } else if (cmp>0) {
-            return get_id_(tree->right, string);
-        } else {
-            return tree->id;
-        }
-    } else {
-        return 0;
-    }
-}
-
 /**
  * @brief Returns the id for a specific word
  *
@@ -509,7 +557,5 @@ static nat_uint32_t get_id_(WordLstNode *tree, const wchar_t *string) {
  */
 nat_uint32_t words_get_id(Words* list, const wchar_t *string)
 {
-    return  get_id_(list->tree, string);
+    return *words_slot(list, string);
 }
-
-
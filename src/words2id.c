@@ -55,7 +55,7 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    lst = words_quick_load(argv[1]);
+    lst = words_load(argv[1]);
     if (!lst) return 1;
     
     fd = fopen(argv[2], "r");
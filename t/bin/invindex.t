@@ -0,0 +1,23 @@
+#!/usr/bin/perl
+
+use warnings;
+use strict;
+
+our $CTESTS = 6;
+our $PERLTESTS = 1;
+our $NTESTS = $CTESTS + $PERLTESTS;
+
+print "1..$NTESTS\n";
+
+if (system("./t/bin/invindex")) {
+    nok();
+} else {
+    ok();
+}
+
+unlink "t/bin/invindex.output"       if -f "t/bin/invindex.output";
+unlink "t/bin/invindex.plain.output" if -f "t/bin/invindex.plain.output";
+unlink "t/bin/invindex.old.output"   if -f "t/bin/invindex.old.output";
+
+sub nok { print "n",ok() }
+sub ok  { print "ok ",++$CTESTS,"\n" }
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#include <NATools/corpus.h>
+#include <invindex.h>
+
+#define SENTENCES 3000
+#define LENGTH    12
+#define WORDS     300
+
+/* sentences are numbered from 1, and end with a zero word */
+CorpusCell corpus[SENTENCES + 1][LENGTH + 1];
+nat_uint32_t seed = 1;
+
+nat_uint32_t next_random(nat_uint32_t max) {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % max;
+}
+
+/* small identifiers are frequent: their lists have several blocks */
+nat_uint32_t random_word(void) {
+    nat_uint32_t a = next_random(WORDS - 2);
+    nat_uint32_t b = next_random(WORDS - 2);
+    return 2 + a * b / (WORDS - 2);
+}
+
+int occurs(nat_uint32_t wid, nat_uint32_t sentence) {
+    int i;
+    for (i = 0; corpus[sentence][i].word; i++)
+	if (corpus[sentence][i].word == wid) return 1;
+    return 0;
+}
+
+int length(nat_uint32_t sentence) {
+    int i = 0;
+    while (corpus[sentence][i].word) i++;
+    return i;
+}
+
+/* first sentence, from a given one, where the word occurs */
+nat_uint32_t naive_seek(nat_uint32_t wid, nat_uint32_t sentence) {
+    for (; sentence <= SENTENCES; sentence++)
+	if (occurs(wid, sentence)) return pack(sentence, 1);
+    return 0;
+}
+
+int check_lists(CompactInvIndex *cii) {
+    nat_uint32_t wid, n, occ, *occs;
+    nat_uchar_t chunk;
+
+    for (wid = 0; wid < WORDS; wid++) {
+	occs = inv_index_compact_get_occurrences(cii, wid);
+	n = 0;
+	for (occ = naive_seek(wid, 1); occ; occ = naive_seek(wid, unpack(occ, &chunk) + 1)) {
+	    if (!occs || occs[n] != occ) return 1;
+	    n++;
+	}
+	if ((occs && occs[n]) || inv_index_compact_count(cii, wid) != n) return 1;
+	g_free(occs);
+    }
+    return 0;
+}
+
+int check_seek(CompactInvIndex *cii) {
+    InvIndexIter iter;
+    nat_uint32_t wid, sentence;
+
+    for (wid = 2; wid < WORDS; wid++) {
+	inv_index_iter_init(cii, wid, &iter);
+	for (sentence = 1; sentence <= SENTENCES + 1; sentence += 1 + next_random(400))
+	    if (inv_index_iter_seek(&iter, pack(sentence, 1)) != naive_seek(wid, sentence))
+		return 1;
+    }
+    return 0;
+}
+
+int check_intersection(CompactInvIndex *cii) {
+    InvIndexIter iters[3];
+    nat_uint32_t wids[3], *occs, sentence, i, j, n, t;
+
+    for (t = 0; t < 500; t++) {
+	n = 2 + t % 2;
+	for (i = 0; i < n; i++) {
+	    wids[i] = t < 100 ? 2 + next_random(8) : random_word();
+	    inv_index_iter_init(cii, wids[i], &iters[i]);
+	}
+	occs = inv_index_intersect(iters, n);
+
+	/* naive merge */
+	j = 0;
+	for (sentence = 1; sentence <= SENTENCES; sentence++) {
+	    for (i = 0; i < n && occurs(wids[i], sentence); i++)
+		;
+	    if (i == n && occs[j++] != pack(sentence, 1)) return 1;
+	}
+	if (occs[j]) return 1;
+	g_free(occs);
+    }
+    return 0;
+}
+
+int check_phrases(CompactInvIndex *cii) {
+    InvIndexIter iters[LENGTH];
+    nat_uint32_t phrase[LENGTH + 1];
+    nat_uint32_t sentence, size, start, i, t;
+
+    for (t = 0; t < 300; t++) {
+	/* a piece of a sentence, or random words, with some wildcards */
+	sentence = 1 + next_random(SENTENCES);
+	size = 1 + next_random(length(sentence));
+	start = next_random(length(sentence) - size + 1);
+	for (i = 0; i < size; i++) {
+	    phrase[i] = t % 3 ? corpus[sentence][start + i].word : random_word();
+	    if (!next_random(4)) phrase[i] = 1;
+	    if (phrase[i] != 1) inv_index_iter_init(cii, phrase[i], &iters[i]);
+	}
+	phrase[size] = 0;
+
+	for (sentence = 1; sentence <= SENTENCES; sentence++)
+	    if (inv_index_phrase_match(iters, phrase, pack(sentence, 1), length(sentence)) !=
+		corpus_strstr(corpus[sentence], phrase))
+		return 1;
+    }
+    return 0;
+}
+
+int main(void) {
+    InvIndex *index, *plain;
+    CompactInvIndex *cii, *plaincii, *oldcii;
+    nat_uint32_t sentence, wid, nrentries, n, i, offsets[WORDS];
+    FILE *output;
+
+    index = inv_index_new(10, TRUE);
+    plain = inv_index_new(10, FALSE);
+    for (sentence = 1; sentence <= SENTENCES; sentence++) {
+	n = 1 + next_random(LENGTH);
+	for (i = 0; i < n; i++) {
+	    corpus[sentence][i].word = random_word();
+	    inv_index_add_position(index, corpus[sentence][i].word, 1, sentence, i);
+	    inv_index_add_occurrence(plain, corpus[sentence][i].word, 1, sentence);
+	}
+	corpus[sentence][n].word = 0;
+    }
+
+    if (inv_index_save_hash(index, "t/bin/invindex.output", TRUE) ||
+	inv_index_save_hash(plain, "t/bin/invindex.plain.output", TRUE))
+	return 1;
+    inv_index_free(index);
+    inv_index_free(plain);
+
+    cii = inv_index_compact_load("t/bin/invindex.output");
+    plaincii = inv_index_compact_load("t/bin/invindex.plain.output");
+    if (!cii || !plaincii || !cii->positional || plaincii->positional) return 1;
+    printf("ok 1\n");
+
+    if (check_lists(cii) || check_lists(plaincii)) return 1;
+    printf("ok 2\n");
+
+    /* old format: number of words, number of occurrences, the zero
+       terminated occurrences of each word, unsorted, and their offsets */
+    output = fopen("t/bin/invindex.old.output", "wb");
+    if (!output) return 1;
+    nrentries = plaincii->nrentries;
+    n = WORDS;
+    fwrite(&n, sizeof(nat_uint32_t), 1, output);
+    fwrite(&nrentries, sizeof(nat_uint32_t), 1, output);
+    for (wid = 0, n = 0; wid < WORDS; wid++) {
+	offsets[wid] = n;
+	for (sentence = SENTENCES; sentence > 0; sentence--)
+	    if (occurs(wid, sentence)) {
+		i = pack(sentence, 1);
+		fwrite(&i, sizeof(nat_uint32_t), 1, output);
+		n++;
+	    }
+	i = 0;
+	fwrite(&i, sizeof(nat_uint32_t), 1, output);
+	n++;
+    }
+    fwrite(offsets, sizeof(nat_uint32_t), WORDS, output);
+    fclose(output);
+
+    oldcii = inv_index_compact_load("t/bin/invindex.old.output");
+    if (!oldcii || oldcii->positional || check_lists(oldcii)) return 1;
+    inv_index_compact_free(oldcii);
+    printf("ok 3\n");
+
+    if (check_seek(cii) || check_seek(plaincii)) return 1;
+    printf("ok 4\n");
+
+    if (check_intersection(cii) || check_intersection(plaincii)) return 1;
+    printf("ok 5\n");
+
+    if (check_phrases(cii)) return 1;
+    printf("ok 6\n");
+
+    inv_index_compact_free(cii);
+    inv_index_compact_free(plaincii);
+    return 0;
+}
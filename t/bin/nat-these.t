@@ -5,6 +5,7 @@ use warnings;
 use strict;
 use Test::More;
 use IPC::Open2;
+use File::Compare;
 
 print STDERR "Warning: some of these tests can take about 1 minute on slow machines\n";
 
@@ -76,6 +77,20 @@ for (@initmatfiles) {
   ok(-f, "Checking if file $_ exists");
 }
 
+my @initmatmfiles = qw!t/PT-EN.ext.mat t/PT-EN.ext.dic t/PT-EN.int.dic
+                        t/PT-EN.ext.bin t/EN-PT.ext.bin t/PT-EN.int.bin t/EN-PT.int.bin!;
+`_build/apps/nat-initmat -q --mem-limit=1 t/PT.crp t/EN.crp t/PT-EN.ext.mat 2>/dev/null`;
+ok(!$?, "nat-initmat runs in external memory");
+`_build/apps/nat-mat2dic t/PT-EN.ext.mat t/PT-EN.ext.dic 2>/dev/null`;
+`_build/apps/nat-mat2dic t/PT-EN.mat t/PT-EN.int.dic 2>/dev/null`;
+for (qw!ext int!) {
+  `_build/apps/nat-postbin t/PT-EN.$_.dic t/PT.crp.partials t/EN.crp.partials t/PT.lex t/EN.lex t/PT-EN.$_.bin t/EN-PT.$_.bin`;
+}
+# values are summed in another order, and can differ in the last digits
+ok(same_dictionaries("t/PT-EN.int.bin", "t/PT-EN.ext.bin") &&
+   same_dictionaries("t/EN-PT.int.bin", "t/EN-PT.ext.bin"),
+   "nat-initmat builds the same matrix in external memory");
+
 ###
 ### nat-ipfp
 ###
@@ -89,6 +104,49 @@ for (@ipfpfiles) {
   ok(-f, "Checking if file $_ exists");
 }
 
+my @ipfpjfiles = qw!t/PT-EN.ipfp.j2a.mat t/PT-EN.ipfp.j2b.mat!;
+for (@ipfpjfiles) {
+  `_build/apps/nat-ipfp -q -j 2 3 t/PT.crp t/EN.crp t/PT-EN.mat $_ 2>/dev/null`;
+  ok(-f, "Checking if file $_ exists");
+}
+is(compare(@ipfpjfiles), 0, "Parallel nat-ipfp output is reproducible");
+
+my @ipfpffiles = qw!t/PT-EN.ipfp.f.mat!;
+`_build/apps/nat-ipfp -q -f 3 t/PT.crp t/EN.crp t/PT-EN.mat t/PT-EN.ipfp.f.mat 2>/dev/null`;
+ok(!$?, "nat-ipfp runs with a frozen matrix");
+ok(-f $ipfpffiles[0], "Checking if file $ipfpffiles[0] exists");
+
+my @ipfplfiles = qw!t/PT-EN.ipfp.l.mat t/PT-EN.ipfp.metrics!;
+`_build/apps/nat-ipfp -q -l t/PT-EN.ipfp.metrics 3 t/PT.crp t/EN.crp t/PT-EN.mat t/PT-EN.ipfp.l.mat 2>/dev/null`;
+is(compare("t/PT-EN.ipfp.mat", "t/PT-EN.ipfp.l.mat"), 0, "Metrics do not change nat-ipfp output");
+{
+  open my $fh, "<", "t/PT-EN.ipfp.metrics" or die;
+  my @lines = grep { !/^#/ } <$fh>;
+  close $fh;
+  is(scalar(@lines), 3, "nat-ipfp writes one metrics line per step");
+  like($lines[0], qr/^1\t[\d.]+\t[\d.]+\t\S+\t\S+\t\d+\t\d+$/, "Metrics line format");
+}
+
+my @ipfpcfiles = qw!t/PT-EN.ipfp.c.mat t/PT-EN.ipfp.c.mat.ckpt!;
+`_build/apps/nat-ipfp -q -c 1 3 t/PT.crp t/EN.crp t/PT-EN.mat t/PT-EN.ipfp.c.mat 2>/dev/null`;
+is(compare("t/PT-EN.ipfp.mat", "t/PT-EN.ipfp.c.mat"), 0, "Checkpoints do not change nat-ipfp output");
+ok(!-f "t/PT-EN.ipfp.c.mat.ckpt", "nat-ipfp removes its checkpoint when done");
+`_build/apps/nat-ipfp -q --resume 3 t/PT.crp t/EN.crp t/PT-EN.mat t/PT-EN.ipfp.c.mat 2>/dev/null`;
+is(compare("t/PT-EN.ipfp.mat", "t/PT-EN.ipfp.c.mat"), 0, "nat-ipfp --resume without a checkpoint starts over");
+
+###
+### nat-samplea / nat-sampleb
+
+my @samplefiles = qw!t/PT-EN.sa.j1.mat t/PT-EN.sa.j2.mat t/PT-EN.sb.j1.mat t/PT-EN.sb.j2.mat!;
+for my $model (qw!a b!) {
+  for my $j (1, 2) {
+    `_build/apps/nat-sample$model -j $j 1 t/PT.crp t/EN.crp t/PT-EN.mat t/PT-EN.s$model.j$j.mat >/dev/null 2>&1`;
+    ok(-f "t/PT-EN.s$model.j$j.mat", "Checking if file t/PT-EN.s$model.j$j.mat exists");
+  }
+  is(compare("t/PT-EN.s$model.j1.mat", "t/PT-EN.s$model.j2.mat"), 0,
+     "nat-sample$model output does not depend on the number of threads");
+}
+
 ###
 ### nat-mat2dic   (ipfp.mat ipfp.dic)
 ###
@@ -102,6 +160,16 @@ for (@mat2dicfiles) {
   ok(-f, "Checking if file $_ exists");
 }
 
+###
+### nat-matconv (ipfp.mat ipfp.map.mat)
+###
+my @matconvfiles = qw{t/PT-EN.ipfp.map.mat t/PT-EN.ipfp.map.dic};
+`_build/apps/nat-matconv t/PT-EN.ipfp.mat t/PT-EN.ipfp.map.mat`;
+ok(!$?, "nat-matconv converts to the mappable format");
+`_build/apps/nat-mat2dic t/PT-EN.ipfp.map.mat t/PT-EN.ipfp.map.dic 2>/dev/null`;
+is(compare("t/PT-EN.ipfp.dic", "t/PT-EN.ipfp.map.dic"), 0,
+   "nat-mat2dic gives the same dictionary from a mappable matrix");
+
 ###
 ### nat-postbin (PT-EN.ipfp.dic PT.lex EN.lex PT-EN.pl EN-PT.pl)
 ###
@@ -115,6 +183,51 @@ for (@postfiles) {
   ok -f, "Checking if file $_ exists";
 }
 
+###
+### nat-dicconv
+###
+my @dicconvfiles = qw{t/PT-EN.map.bin t/PT-EN.gz.bin};
+unlink @dicconvfiles;
+`_build/apps/nat-dicconv t/PT-EN.bin t/PT-EN.map.bin`;
+ok(!$?, "nat-dicconv converts to the mappable format");
+`_build/apps/nat-dicconv -c t/PT-EN.map.bin t/PT-EN.gz.bin`;
+is(compare("t/PT-EN.bin", "t/PT-EN.gz.bin"), 0, "nat-dicconv reads mappable dictionaries");
+
+###
+### nat-align (initmat, ipfp, mat2dic and postbin in one process)
+###
+my @alignfiles = qw{t/PT-EN.align.bin t/EN-PT.align.bin t/PT-EN.align.mat};
+unlink @alignfiles;
+`_build/apps/nat-align -q -n 3 --save-init t/PT-EN.align.mat t/PT.crp t/EN.crp t/PT.crp.partials t/EN.crp.partials t/PT.lex t/EN.lex t/PT-EN.align.bin t/EN-PT.align.bin 2>/dev/null`;
+ok(!$?, "nat-align runs");
+is(compare("t/PT-EN.mat", "t/PT-EN.align.mat"), 0, "nat-align saves the same initial matrix");
+is(compare("t/PT-EN.bin", "t/PT-EN.align.bin"), 0, "nat-align gives the same dictionary as the separate tools");
+is(compare("t/EN-PT.bin", "t/EN-PT.align.bin"), 0, "nat-align gives the same inverse dictionary");
+
+###
+### Dictionaries with a fixed number of translations per word
+###
+my @olddicfiles = qw{t/PT-EN.old.bin t/PT-EN.new.bin};
+{
+  require Lingua::NATools::Dict;
+  my $dic = Lingua::NATools::Dict::open("t/PT-EN.bin");
+  open my $fh, ">:raw", "t/PT-EN.old.bin" or die "Can't create t/PT-EN.old.bin";
+  print $fh pack("L", $dic->size);
+  for my $w (0 .. $dic->size) {
+    my @vals = @{$dic->vals($w)};
+    push @vals, 0, 0 while @vals < 16;
+    print $fh pack("(Lf)8", @vals);
+  }
+  print $fh pack("L", $dic->occ($_)) for 0 .. $dic->size;
+  close $fh;
+  $dic->close;
+
+  $dic = Lingua::NATools::Dict::open("t/PT-EN.old.bin");
+  ok($dic && $dic->save("t/PT-EN.new.bin"), "Old dictionary files are read");
+  $dic->close if $dic;
+  is(compare("t/PT-EN.bin", "t/PT-EN.new.bin"), 0, "Old dictionary files are saved with variable length lists");
+}
+
 ###
 ### nat-dumpDict
 ###
@@ -158,10 +271,30 @@ ok(defined($DIC2));
 
 }
 
-unlink(@prefiles,@initmatfiles,@ipfpfiles,@mat2dicfiles,@postfiles);
+unlink(@prefiles,@initmatfiles,@initmatmfiles,@ipfpfiles,@ipfpjfiles,@ipfpffiles,@ipfplfiles,@ipfpcfiles,@samplefiles,@mat2dicfiles,@matconvfiles,@postfiles,@dicconvfiles,@alignfiles,@olddicfiles);
 
 done_testing;
 
+## True if two dictionaries have the same translations for each word,
+## the same occurrence counts, and probabilities within 1e-4
+sub same_dictionaries {
+    my ($file1, $file2) = @_;
+    require Lingua::NATools::Dict;
+    my $dic1 = Lingua::NATools::Dict::open($file1) or return 0;
+    my $dic2 = Lingua::NATools::Dict::open($file2) or return 0;
+    my $same = $dic1->size == $dic2->size;
+    for my $w (0 .. $dic1->size) {
+        last unless $same;
+        my %vals1 = @{$dic1->vals($w)};
+        my %vals2 = @{$dic2->vals($w)};
+        $same = $dic1->occ($w) == $dic2->occ($w) && keys %vals1 == keys %vals2 &&
+          !grep { !exists $vals2{$_} || abs($vals1{$_} - $vals2{$_}) > 1e-4 } keys %vals1;
+    }
+    $dic1->close;
+    $dic2->close;
+    return $same;
+}
+
 sub read_lines {
     my $handler = shift;
     my $ready = <$handler>;
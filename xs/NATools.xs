@@ -246,7 +246,7 @@ dicgetvals(id, word)
 	     U32 wid;
 	     float val;
 	     array = newAV();
-	     for (i=0;i<MAXENTRY;i++) {
+	     for (i=0;i<dictionary_get_entries(dics[id],word);i++) {
 		 wid = dictionary_get_id(dics[id],word,i);
 		 val = dictionary_get_val(dics[id],word,i);
 		 if (val == 0.0) break;
@@ -476,7 +476,7 @@ wladdword(id, word)
          if (id > MAXDICS || id < 0 || !wls[id]) {
 	     wid = 0;
          } else {
-	     wid = words_add_word_and_index(wls[id], wcs_dup(word));
+	     wid = words_add_word_and_index(wls[id], word);
 	 }
          RETVAL = wid;
    OUTPUT:
@@ -717,7 +717,7 @@ nat_dict_getvals(id, lang, word)
 	     U32 wid;
 	     float val;
 	     array = newAV();
-	     for (i=0;i<MAXENTRY;i++) {
+	     for (i=0;i<natdict_dictionary_get_entries(natdics[id],lang,word);i++) {
 		 wid = natdict_dictionary_get_id(natdics[id],lang,word,i);
 		 val = natdict_dictionary_get_val(natdics[id],lang,word,i);
 		 if (val == 0.0) break;
@@ -926,7 +926,7 @@ corpus_info_ptd_by_word(dir, word)
         array = newAV();
         av_push(array, newSVuv(dictionary_get_occ(D, wid)));
 
-        for (j = 0; j < MAXENTRY; j++) {
+        for (j = 0; j < dictionary_get_entries(D, wid); j++) {
 	    twid = 0;
 	    prob = 0.0;
 	    twid = dictionary_get_id(D, wid, j);